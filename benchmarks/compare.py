@@ -0,0 +1,67 @@
+#!/usr/bin/env python3
+"""Compares two result files of the bench target.
+
+Every query, optimization level, target and thread count present in both files is compared by the median
+time of each phase. A phase that got slower than the threshold is reported
+as a regression and makes the script exit with status 1.
+
+usage: compare.py baseline.json candidate.json [--threshold 0.05]
+       [--phases execute_ms,codegen_ms] [--min-ms 1.0]
+"""
+
+import argparse
+import json
+import sys
+
+PHASES = ["irgen_ms", "optimize_ms", "codegen_ms", "execute_ms"]
+
+
+def load(path):
+    with open(path) as f:
+        results = json.load(f)["results"]
+    return {(r["query"], r.get("opt", "fast"), r.get("target", "host"),
+             r["threads"], r.get("streaming", 0)): r
+            for r in results if "median" in r}
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("baseline")
+    parser.add_argument("candidate")
+    parser.add_argument("--threshold", type=float, default=0.05,
+                        help="relative slowdown tolerated as noise")
+    parser.add_argument("--phases", default=",".join(PHASES))
+    parser.add_argument("--min-ms", type=float, default=1.0,
+                        help="ignore phases faster than this in the baseline")
+    args = parser.parse_args()
+
+    baseline = load(args.baseline)
+    candidate = load(args.candidate)
+    phases = args.phases.split(",")
+    regressions = 0
+    print(f"{'query':<6} {'opt':<10} {'target':<7} {'threads':>7} {'stream':>6} {'phase':<12} "
+          f"{'baseline':>10} {'candidate':>10} {'change':>8}")
+    for key in sorted(baseline.keys() & candidate.keys()):
+        for phase in phases:
+            old = baseline[key]["median"][phase]
+            new = candidate[key]["median"][phase]
+            if old < args.min_ms:
+                continue
+            change = new / old - 1
+            flag = ""
+            if change > args.threshold:
+                flag = "  REGRESSION"
+                regressions += 1
+            elif change < -args.threshold:
+                flag = "  improvement"
+            print(f"{key[0]:<6} {key[1]:<10} {key[2]:<7} {key[3]:>7} {key[4]:>6} "
+                  f"{phase:<12} {old:>10.2f} {new:>10.2f} {change:>+8.1%}"
+                  f"{flag}")
+    for key in sorted(baseline.keys() ^ candidate.keys()):
+        print(f"{key[0]} at {key[1]} for {key[2]} with {key[3]} threads and "
+              f"streaming {key[4]} is only in one file")
+    return 1 if regressions else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,86 @@
+#include "internal/Tpch.h"
+#include "runtime/Hyperloglog.h"
+#include "runtime/Murmur.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+/// Compares the sketch estimates with the true number of distinct build keys
+/// of the TPC-H joins. Each build side is split across threads the same way
+/// combineSketches merges the thread local sketches.
+
+using namespace p2cllvm;
+
+namespace {
+constexpr size_t threads = 8;
+
+template <typename T> uint64_t hashValue(const T &val) {
+  return murmurHash(reinterpret_cast<const char *>(&val), sizeof(T));
+}
+
+/// mirrors MurmurHasher::createCombineHash
+uint64_t combine(uint64_t h1, uint64_t h2) {
+  return h2 ^ ((h2 << 6) + (h2 >> 2) + 0x517cc1b727220a95ul + h1);
+}
+
+template <unsigned P> uint64_t estimate(const std::vector<uint64_t> &hashes) {
+  std::vector<BasicSketch<P>> sketches(threads);
+  for (size_t i = 0; i < hashes.size(); ++i)
+    sketches[i * threads / hashes.size()].add(hashes[i]);
+  for (size_t i = 1; i < threads; ++i)
+    sketches.front().merge(sketches[i]);
+  return sketches.front().estimate();
+}
+
+template <unsigned P>
+void report(const std::vector<uint64_t> &hashes, size_t actual) {
+  auto est = estimate<P>(hashes);
+  double err = (static_cast<double>(est) - actual) / actual;
+  std::printf("  %2u %12lu %+9.4f%%\n", P, est, err * 100);
+}
+
+void run(const char *name, const std::vector<uint64_t> &hashes) {
+  size_t actual = std::unordered_set<uint64_t>(hashes.begin(), hashes.end())
+                      .size();
+  std::printf("%s: %lu tuples, %lu distinct\n", name, hashes.size(), actual);
+  report<8>(hashes, actual);
+  report<10>(hashes, actual);
+  report<12>(hashes, actual);
+  report<14>(hashes, actual);
+  report<16>(hashes, actual);
+}
+
+template <typename C> std::vector<uint64_t> hashColumn(const C &col) {
+  std::vector<uint64_t> hashes(col.size);
+  for (size_t i = 0; i < col.size; ++i)
+    hashes[i] = hashValue(col.data[i]);
+  return hashes;
+}
+} // namespace
+
+int main(int argc, char *argv[]) {
+  const char *env = std::getenv("tpchpath");
+  std::string dir = argc > 1 ? argv[1] : env ? env : "../data-generator/output";
+  InMemoryTPCH db{dir};
+
+  run("region.r_regionkey", hashColumn(db.region.r_regionkey));
+  run("nation.n_nationkey", hashColumn(db.nation.n_nationkey));
+  run("supplier.s_suppkey", hashColumn(db.supplier.s_suppkey));
+  run("customer.c_custkey", hashColumn(db.customer.c_custkey));
+  run("part.p_partkey", hashColumn(db.part.p_partkey));
+  run("orders.o_orderkey", hashColumn(db.orders.o_orderkey));
+  run("orders.o_custkey", hashColumn(db.orders.o_custkey));
+  run("lineitem.l_orderkey", hashColumn(db.lineitem.l_orderkey));
+
+  std::vector<uint64_t> ps(db.partsupp.tuple_count);
+  for (size_t i = 0; i < ps.size(); ++i)
+    ps[i] = combine(hashValue(db.partsupp.ps_partkey.data[i]),
+                    hashValue(db.partsupp.ps_suppkey.data[i]));
+  run("partsupp.(ps_partkey, ps_suppkey)", ps);
+  return 0;
+}
@@ -0,0 +1,220 @@
+#include "internal/BaseTypes.h"
+#include "runtime/Hashtables.h"
+#include "runtime/Hyperloglog.h"
+#include "runtime/Murmur.h"
+#include "runtime/Runtime.h"
+#include "runtime/ThreadLocal.h"
+#include "runtime/Tuplebuffer.h"
+
+#include <benchmark/benchmark.h>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// Throughput of the runtime primitives called from generated code. Sizes
+/// go from cache resident to DRAM bound, the threaded benchmarks share one
+/// data structure between all threads.
+
+using namespace p2cllvm;
+
+namespace {
+std::vector<uint64_t> randomHashes(size_t n, uint64_t seed = 42) {
+  std::mt19937_64 rng(seed);
+  std::vector<uint64_t> hashes(n);
+  for (auto &hash : hashes)
+    hash = rng();
+  return hashes;
+}
+
+/// hash table entries with an 8 byte payload
+struct Entries {
+  static constexpr size_t entrySize = 2;
+  std::vector<uint64_t> mem;
+
+  explicit Entries(size_t n) : mem(n * entrySize) {}
+  HashTableEntry *operator[](size_t i) {
+    return reinterpret_cast<HashTableEntry *>(&mem[i * entrySize]);
+  }
+};
+
+void BM_HashTableInsert(benchmark::State &state) {
+  size_t n = state.range(0);
+  auto hashes = randomHashes(n);
+  Entries entries(n);
+  HashTable ht(n);
+  for (auto _ : state) {
+    /// includes clearing the slots, about one store per insert
+    ht.flush();
+    for (size_t i = 0; i < n; ++i)
+      ht.insert(entries[i], hashes[i]);
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_HashTableInsert)->RangeMultiplier(16)->Range(1 << 10, 1 << 22);
+
+HashTable *sharedTable;
+Entries *sharedEntries;
+std::vector<uint64_t> sharedHashes;
+
+void BM_HashTableInsertWithTagThreaded(benchmark::State &state) {
+  size_t n = state.range(0);
+  if (state.thread_index() == 0) {
+    sharedTable = new HashTable(n);
+    sharedEntries = new Entries(n);
+    sharedHashes = randomHashes(n);
+  }
+  size_t begin = n * state.thread_index() / state.threads();
+  size_t end = n * (state.thread_index() + 1) / state.threads();
+  for (auto _ : state) {
+    /// entries are inserted again every iteration, chains are never walked
+    for (size_t i = begin; i < end; ++i)
+      sharedTable->insertWithTagThreaded((*sharedEntries)[i], sharedHashes[i]);
+  }
+  state.SetItemsProcessed(state.iterations() * (end - begin));
+  if (state.thread_index() == 0) {
+    delete sharedTable;
+    delete sharedEntries;
+  }
+}
+BENCHMARK(BM_HashTableInsertWithTagThreaded)
+    ->RangeMultiplier(16)
+    ->Range(1 << 10, 1 << 22)
+    ->ThreadRange(1, 16)
+    ->UseRealTime();
+
+void BM_TupleBufferAlloc(benchmark::State &state) {
+  size_t elemSize = state.range(0);
+  size_t n = state.range(1);
+  for (auto _ : state) {
+    TupleBuffer tb;
+    for (size_t i = 0; i < n; ++i)
+      *tb.alloc(elemSize) = 1;
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+  state.SetBytesProcessed(state.iterations() * n * elemSize);
+}
+BENCHMARK(BM_TupleBufferAlloc)
+    ->ArgsProduct({{8, 32, 128}, {1 << 10, 1 << 16, 1 << 20}});
+
+void BM_SketchAdd(benchmark::State &state) {
+  size_t n = state.range(0);
+  auto hashes = randomHashes(n);
+  for (auto _ : state) {
+    /// small sizes stay in the sparse representation
+    Sketch sketch;
+    for (auto hash : hashes)
+      sketch.add(hash);
+    benchmark::DoNotOptimize(sketch);
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_SketchAdd)->RangeMultiplier(8)->Range(1 << 6, 1 << 21);
+
+void BM_SketchMerge(benchmark::State &state) {
+  size_t n = state.range(0);
+  Sketch lhs, rhs;
+  for (auto hash : randomHashes(n, 1))
+    lhs.add(hash);
+  for (auto hash : randomHashes(n, 2))
+    rhs.add(hash);
+  for (auto _ : state) {
+    Sketch merged = lhs;
+    merged.merge(rhs);
+    benchmark::DoNotOptimize(merged);
+  }
+}
+BENCHMARK(BM_SketchMerge)->RangeMultiplier(8)->Range(1 << 6, 1 << 21);
+
+void BM_MurmurHash(benchmark::State &state) {
+  std::string key(state.range(0), 'x');
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(key.data());
+    benchmark::DoNotOptimize(murmurHash(key.data(), key.size()));
+  }
+  state.SetBytesProcessed(state.iterations() * key.size());
+}
+BENCHMARK(BM_MurmurHash)->RangeMultiplier(4)->Range(4, 1024);
+
+struct LocalState {
+  uint64_t value = 0;
+};
+
+ThreadLocalStorage<LocalState> *sharedStorage;
+
+void BM_ThreadLocalGetOrInsert(benchmark::State &state) {
+  if (state.thread_index() == 0)
+    sharedStorage = new ThreadLocalStorage<LocalState>(state.threads());
+  auto id = std::this_thread::get_id();
+  for (auto _ : state)
+    benchmark::DoNotOptimize(sharedStorage->getOrInsert(id));
+  state.SetItemsProcessed(state.iterations());
+  if (state.thread_index() == 0)
+    delete sharedStorage;
+}
+BENCHMARK(BM_ThreadLocalGetOrInsert)->ThreadRange(1, 16)->UseRealTime();
+
+/// strings of the benchmarked length that do not contain the pattern
+struct Strings {
+  std::vector<std::string> storage;
+  std::vector<StringView> views;
+
+  Strings(size_t length, size_t n = 1024) {
+    std::mt19937 rng(7);
+    storage.reserve(n);
+    for (size_t i = 0; i < n; ++i) {
+      std::string s(length, 'a');
+      for (auto &c : s)
+        c = 'a' + rng() % 20;
+      storage.push_back(std::move(s));
+    }
+    for (auto &s : storage)
+      views.push_back({s.data(), s.size()});
+  }
+};
+
+template <bool (*Fn)(StringView *, char *, size_t)>
+void BM_Like(benchmark::State &state) {
+  Strings strings(state.range(0));
+  std::string pattern = "xyz";
+  for (auto _ : state) {
+    for (auto &view : strings.views)
+      benchmark::DoNotOptimize(Fn(&view, pattern.data(), pattern.size()));
+  }
+  state.SetItemsProcessed(state.iterations() * strings.views.size());
+}
+BENCHMARK(BM_Like<like>)->RangeMultiplier(4)->Range(16, 1024);
+BENCHMARK(BM_Like<like_prefix>)->RangeMultiplier(4)->Range(16, 1024);
+BENCHMARK(BM_Like<like_suffix>)->RangeMultiplier(4)->Range(16, 1024);
+
+void BM_StringEq(benchmark::State &state) {
+  Strings strings(state.range(0));
+  /// equal strings compare every byte
+  Strings copies(state.range(0));
+  for (auto _ : state) {
+    for (size_t i = 0; i < strings.views.size(); ++i)
+      benchmark::DoNotOptimize(
+          string_eq(&strings.views[i], &copies.views[i]));
+  }
+  state.SetItemsProcessed(state.iterations() * strings.views.size());
+}
+BENCHMARK(BM_StringEq)->RangeMultiplier(4)->Range(4, 1024);
+
+void BM_StringLt(benchmark::State &state) {
+  Strings strings(state.range(0));
+  size_t n = strings.views.size();
+  for (auto _ : state) {
+    for (size_t i = 0; i < n; ++i)
+      benchmark::DoNotOptimize(
+          string_lt(&strings.views[i], &strings.views[(i + 1) % n]));
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_StringLt)->RangeMultiplier(4)->Range(4, 1024);
+} // namespace
+
+BENCHMARK_MAIN();
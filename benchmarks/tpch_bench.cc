@@ -0,0 +1,703 @@
+#include "IR/Builder.h"
+#include "IR/Pipeline.h"
+#include "internal/Catalog.h"
+#include "internal/Compiler.h"
+#include "internal/QueryScheduler.h"
+#include "internal/Statistics.h"
+#include "internal/WorkloadScheduler.h"
+#include "operators/Driver.h"
+#include "operators/JoinOrder.h"
+#include "operators/MemoryEstimate.h"
+#include "runtime/Test.h"
+#include "tpch_queries.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <numeric>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <llvm/ADT/STLFunctionalExtras.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/TargetParser/Host.h>
+#include <llvm/Support/raw_ostream.h>
+
+/// Benchmarks the TPC-H queries and writes their times as JSON. Every mode
+/// parses its own options after its name, without a name the sweep runs.
+///
+/// usage: bench [sweep] [options] [--streaming 0,2] [--expected dir]
+///        bench startup [options] [--modes eager,none,populate]
+///        bench concurrent [options] [--instances 4]
+///        bench workload [options] [--policies fair,priority]
+///              [--priority q06:1] [--memorylimit 4G]
+/// options: [--queries q01,q05] [--opt fast,aggressive]
+///          [--target host,avx2] [--threads 1,8] [--runs 3]
+///          [--joinorder plan|cost] [--output file.json]
+///
+/// sweep runs the queries over the optimization levels, code generation
+/// targets, thread counts and buffered morsels per worker of streaming scans,
+/// 0 scans the mappings, and writes the time of IR generation,
+/// optimization, code generation and execution of every run. Results are
+/// checked against <expected>/<query>.tbl if the file exists.
+/// startup opens the database again for every run with the given prefault
+/// modes, or maps all columns up front with eager, and runs the query once.
+/// concurrent starts that many instances of a query at once, each with a
+/// share of the threads, first with separate and then with shared scans, and
+/// reports the wall time.
+/// workload submits all queries at once to one WorkloadScheduler with each
+/// of the given policies and reports the queue and run time of every query.
+/// --priority sets the priority of queries, 0 by default, and
+/// --memorylimit the estimated memory of the queries running at once.
+/// The modes besides the sweep run with the first optimization level and
+/// target and the last thread count. --joinorder cost reorders the joins of
+/// every plan by estimated cardinalities before the runs.
+/// The database is read from the tpchpath environment variable.
+
+using namespace p2cllvm;
+
+namespace {
+struct Times {
+  double irgen = 0;
+  double optimize = 0;
+  double codegen = 0;
+  double execute = 0;
+};
+
+/// a code generation target of the --target sweep
+struct Target {
+  std::string name;
+  TargetOptions options;
+  /// host feature the generated code needs
+  std::string required;
+};
+
+/// x86-64-v2 is the baseline of the runtime, without the vectorizers of the
+/// higher optimization levels its code is scalar
+const std::vector<Target> targets = {
+    {"host", {}, ""},
+    {"sse4.2", {"x86-64-v2", ""}, "sse4.2"},
+    {"avx2", {"x86-64-v3", ""}, "avx2"},
+    {"avx512", {"x86-64-v4", ""}, "avx512f"},
+};
+
+/// one point of the sweep
+struct Config {
+  OptLevel level;
+  const Target &target;
+  size_t threads;
+  size_t streaming = 0;
+  SharedScans *sharedScans = nullptr;
+};
+
+/// the options every mode takes
+struct CommonOptions {
+  std::vector<std::string> queries;
+  std::vector<OptLevel> levels;
+  std::vector<Target> targets;
+  std::vector<size_t> threads;
+  uint32_t runs = 3;
+  bool costJoinOrder = false;
+  std::string output;
+
+  /// the configuration of the modes without a sweep
+  Config single() const {
+    return {levels.front(), targets.front(), threads.back()};
+  }
+};
+
+struct WorkloadOptions {
+  std::vector<SchedulingPolicy> policies;
+  llvm::StringMap<int> priority;
+  size_t memoryLimit = MemoryBudget::unlimited;
+};
+
+using MakePlan = tpch::Plan (*)();
+
+double msSince(std::chrono::steady_clock::time_point &start) {
+  auto now = std::chrono::steady_clock::now();
+  double ms = std::chrono::duration<double, std::milli>(now - start).count();
+  start = now;
+  return ms;
+}
+
+/// generates and compiles the query, each phase is timed around its own
+/// work; setting up the JIT counts as code generation
+void compileQuery(Builder &builder, QueryCompiler &compiler, tpch::Plan &plan,
+                  Sink &sink, const Config &config, Times &times) {
+  auto start = std::chrono::steady_clock::now();
+  sink.produce(plan.op, plan.outputs, plan.names, builder);
+  times.irgen = msSince(start);
+
+  compiler.createJIT(config.target.options);
+  compiler.setOptLevel(config.level);
+  times.codegen = msSince(start);
+
+  compiler.optimize(builder.query);
+  times.optimize = msSince(start);
+
+  compiler.addModule(std::move(builder.query), builder.query.context);
+  compiler.addSymbols(builder.query.symbolManager);
+  compiler.materialize(builder.query);
+  times.codegen += msSince(start);
+}
+
+/// validate runs after execution, while the operator contexts are alive
+Times runQuery(Catalog &db, tpch::Plan &plan, Sink &sink, const Config &config,
+               llvm::function_ref<void()> validate = [] {}) {
+  Times times;
+  Query query(db);
+  auto builder = Builder(query);
+  QueryCompiler compiler;
+  /// the workers are started before any phase is timed
+  MultiThreadedScheduler scheduler{10000, db, config.threads};
+  scheduler.setStreaming(config.streaming);
+  scheduler.setSharedScans(config.sharedScans);
+  compileQuery(builder, compiler, plan, sink, config, times);
+
+  auto start = std::chrono::steady_clock::now();
+  for (const auto &pipeline : builder.query.pipelines)
+    scheduler.execPipeline(*pipeline, compiler);
+  times.execute = msSince(start);
+  validate();
+  return times;
+}
+
+/// the values of an expected result file in row major order
+std::optional<std::vector<std::string>> readExpected(const std::string &dir,
+                                                     std::string_view query) {
+  if (dir.empty())
+    return std::nullopt;
+  std::ifstream in(dir + "/" + std::string(query) + ".tbl");
+  if (!in) {
+    llvm::errs() << query << " is not validated, " << dir
+                 << " has no expected results for it\n";
+    return std::nullopt;
+  }
+  std::vector<std::string> values;
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line.empty())
+      continue;
+    llvm::SmallVector<llvm::StringRef, 16> fields;
+    llvm::StringRef(line).split(fields, '|');
+    for (auto field : fields)
+      values.push_back(field.str());
+  }
+  return values;
+}
+
+template <typename T>
+std::vector<T> splitList(std::string_view list, auto &&convert) {
+  llvm::SmallVector<llvm::StringRef, 16> items;
+  llvm::StringRef(list).split(items, ',', -1, false);
+  std::vector<T> result;
+  for (auto item : items)
+    result.push_back(convert(item));
+  return result;
+}
+
+std::vector<size_t> splitSizes(std::string_view list) {
+  return splitList<size_t>(list, [](llvm::StringRef s) {
+    return static_cast<size_t>(std::stoul(s.str()));
+  });
+}
+
+/// nullptr for unknown queries
+MakePlan findQuery(std::string_view name) {
+  auto it = std::find_if(tpch::queries.begin(), tpch::queries.end(),
+                         [&](auto &q) { return q.first == name; });
+  return it == tpch::queries.end() ? nullptr : it->second;
+}
+
+/// parses the options of every mode and passes the others to parseMode,
+/// which returns false for options the mode does not take
+void parseOptions(
+    int argc, char *argv[], CommonOptions &options,
+    llvm::function_ref<bool(std::string_view, std::string_view)> parseMode) {
+  for (auto &[name, plan] : tpch::queries)
+    options.queries.emplace_back(name);
+  options.levels = {OptLevel::Fast};
+  options.targets = {targets.front()};
+  options.threads = {1, std::thread::hardware_concurrency()};
+  for (int i = 1; i + 1 < argc; i += 2) {
+    std::string_view arg = argv[i];
+    std::string_view value = argv[i + 1];
+    if (arg == "--queries") {
+      options.queries = splitList<std::string>(
+          value, [](llvm::StringRef s) { return s.str(); });
+    } else if (arg == "--opt") {
+      options.levels = splitList<OptLevel>(value, [](llvm::StringRef s) {
+        auto level = parseOptLevel(s);
+        if (!level) {
+          llvm::errs() << "unknown optimization level " << s << "\n";
+          std::exit(EXIT_FAILURE);
+        }
+        return *level;
+      });
+    } else if (arg == "--target") {
+      options.targets = splitList<Target>(value, [](llvm::StringRef s) {
+        auto it = std::find_if(targets.begin(), targets.end(),
+                               [&](auto &target) { return target.name == s; });
+        if (it == targets.end()) {
+          llvm::errs() << "unknown target " << s << "\n";
+          std::exit(EXIT_FAILURE);
+        }
+        return *it;
+      });
+    } else if (arg == "--threads") {
+      options.threads = splitSizes(value);
+    } else if (arg == "--runs") {
+      options.runs = std::stoul(std::string(value));
+    } else if (arg == "--joinorder") {
+      if (value != "plan" && value != "cost") {
+        llvm::errs() << "unknown join order " << value << "\n";
+        std::exit(EXIT_FAILURE);
+      }
+      options.costJoinOrder = value == "cost";
+    } else if (arg == "--output") {
+      options.output = value;
+    } else if (!parseMode(arg, value)) {
+      llvm::errs() << "unknown option " << arg << "\n";
+      std::exit(EXIT_FAILURE);
+    }
+  }
+  for (auto &name : options.queries) {
+    if (!findQuery(name)) {
+      llvm::errs() << "unknown query " << name << "\n";
+      std::exit(EXIT_FAILURE);
+    }
+  }
+}
+
+bool hostSupports(const Target &target) {
+  if (target.required.empty())
+    return true;
+  llvm::StringMap<bool> features;
+  return llvm::sys::getHostCPUFeatures(features) &&
+         features.lookup(target.required);
+}
+
+double median(std::vector<double> values) {
+  std::sort(values.begin(), values.end());
+  size_t mid = values.size() / 2;
+  return values.size() % 2 ? values[mid] : (values[mid - 1] + values[mid]) / 2;
+}
+
+void writeTimes(llvm::json::OStream &json, const Times &times) {
+  json.attribute("irgen_ms", times.irgen);
+  json.attribute("optimize_ms", times.optimize);
+  json.attribute("codegen_ms", times.codegen);
+  json.attribute("execute_ms", times.execute);
+}
+
+/// runs the query and writes its times as one result object
+void benchmarkQuery(llvm::json::OStream &json, Catalog &db,
+                    llvm::StringRef name, tpch::Plan &plan,
+                    const std::optional<std::vector<std::string>> &expected,
+                    const Config &config, uint32_t runCount) {
+  std::vector<Times> runs;
+  uint64_t rows = 0;
+  for (uint32_t run = 0; run < runCount; ++run) {
+    if (expected) {
+      /// compareFromString exits on the first wrong value
+      AssertSink sink(*expected);
+      runs.push_back(runQuery(db, plan, sink, config, [&]() {
+        compareLength(expected->size(), sink.getContext());
+      }));
+    } else {
+      CountSink sink;
+      runs.push_back(runQuery(db, plan, sink, config));
+      rows = sink.getRows();
+    }
+  }
+  json.object([&]() {
+    json.attribute("query", name);
+    json.attribute("opt", getName(config.level));
+    json.attribute("target", config.target.name);
+    json.attribute("threads", static_cast<int64_t>(config.threads));
+    json.attribute("streaming", static_cast<int64_t>(config.streaming));
+    json.attribute("validated", expected.has_value());
+    if (!expected)
+      json.attribute("rows", static_cast<int64_t>(rows));
+    json.attributeArray("runs", [&]() {
+      for (auto &times : runs)
+        json.object([&]() { writeTimes(json, times); });
+    });
+    auto medianOf = [&](double Times::*phase) {
+      std::vector<double> values;
+      for (auto &times : runs)
+        values.push_back(times.*phase);
+      return median(values);
+    };
+    if (!runs.empty()) {
+      Times med{medianOf(&Times::irgen), medianOf(&Times::optimize),
+                medianOf(&Times::codegen), medianOf(&Times::execute)};
+      json.attributeObject("median", [&]() { writeTimes(json, med); });
+    }
+  });
+  llvm::errs() << name << " opt=" << getName(config.level)
+               << " target=" << config.target.name
+               << " threads=" << config.threads
+               << " streaming=" << config.streaming << " done\n";
+}
+
+/// the time to open the database is part of the first query
+void benchmarkStartup(llvm::json::OStream &json, llvm::StringRef name,
+                      tpch::Plan &plan, llvm::StringRef mode,
+                      const Config &config, uint32_t runCount) {
+  json.object([&]() {
+    json.attribute("query", name);
+    json.attribute("startup", mode);
+    json.attribute("threads", static_cast<int64_t>(config.threads));
+    std::vector<double> totals;
+    json.attributeArray("runs", [&]() {
+      for (uint32_t run = 0; run < runCount; ++run) {
+        auto start = std::chrono::steady_clock::now();
+        Catalog db(Catalog::defaultPath());
+        if (mode == "eager") {
+          /// the mapping before columns were mapped on demand
+          auto &schema = db.getSchema();
+          for (size_t table = 0; table < schema.size(); ++table) {
+            auto &info = schema.getTable(table);
+            std::vector<uint32_t> columns(info.columns.size());
+            std::iota(columns.begin(), columns.end(), 0);
+            db.mapColumns(table, columns);
+          }
+        } else {
+          db.setPrefault(*parsePrefault(mode));
+        }
+        double open = msSince(start);
+        CountSink sink;
+        Times times = runQuery(db, plan, sink, config);
+        totals.push_back(open + times.irgen + times.optimize + times.codegen +
+                         times.execute);
+        json.object([&]() {
+          json.attribute("open_ms", open);
+          writeTimes(json, times);
+          json.attribute("mapped_columns",
+                         static_cast<int64_t>(db.getMappedColumns()));
+        });
+      }
+    });
+    if (!totals.empty())
+      json.attribute("median_total_ms", median(totals));
+  });
+  llvm::errs() << name << " startup=" << mode << " done\n";
+}
+
+/// instances of a query running at once, with and without shared scans
+void benchmarkConcurrent(llvm::json::OStream &json, Catalog &db,
+                         llvm::StringRef name, tpch::Plan (*makePlan)(),
+                         Statistics *stats, size_t instances,
+                         const Config &config, uint32_t runCount) {
+  for (bool shared : {false, true}) {
+    json.object([&]() {
+      json.attribute("query", name);
+      json.attribute("concurrent", static_cast<int64_t>(instances));
+      json.attribute("shared", shared);
+      json.attribute("threads", static_cast<int64_t>(config.threads));
+      std::vector<double> walls;
+      json.attributeArray("runs", [&]() {
+        for (uint32_t run = 0; run < runCount; ++run) {
+          SharedScans scans;
+          Config instance = config;
+          instance.threads = std::max<size_t>(config.threads / instances, 1);
+          instance.sharedScans = shared ? &scans : nullptr;
+          /// operators keep per query state, every instance builds its plan
+          std::vector<tpch::Plan> plans;
+          for (size_t i = 0; i < instances; ++i) {
+            plans.push_back(makePlan());
+            if (stats)
+              optimizeJoinOrder(plans.back().op, *stats);
+          }
+          auto start = std::chrono::steady_clock::now();
+          std::vector<std::thread> threads;
+          for (auto &plan : plans)
+            threads.emplace_back([&]() {
+              CountSink sink;
+              runQuery(db, plan, sink, instance);
+            });
+          for (auto &thread : threads)
+            thread.join();
+          walls.push_back(msSince(start));
+          json.object([&]() {
+            json.attribute("wall_ms", walls.back());
+            json.attribute("shared_morsels",
+                           static_cast<int64_t>(scans.getSharedMorsels()));
+          });
+        }
+      });
+      if (!walls.empty())
+        json.attribute("median_wall_ms", median(walls));
+    });
+  }
+  llvm::errs() << name << " concurrent=" << instances << " done\n";
+}
+/// all queries submitted at once to a WorkloadScheduler, their memory is
+/// estimated from the statistics
+void benchmarkWorkload(llvm::json::OStream &json, Catalog &db,
+                       Statistics &stats, const CommonOptions &options,
+                       const WorkloadOptions &workload,
+                       SchedulingPolicy policy, const Config &config) {
+  std::vector<std::pair<std::string, MakePlan>> queries;
+  for (auto &name : options.queries)
+    queries.emplace_back(name, findQuery(name));
+  json.object([&]() {
+    json.attribute("policy", getName(policy));
+    json.attribute("threads", static_cast<int64_t>(config.threads));
+    if (workload.memoryLimit != MemoryBudget::unlimited)
+      json.attribute("memory_limit",
+                     static_cast<int64_t>(workload.memoryLimit));
+    std::vector<double> walls;
+    json.attributeArray("runs", [&]() {
+      for (uint32_t run = 0; run < options.runs; ++run) {
+        WorkloadScheduler::Options schedulerOptions;
+        schedulerOptions.threads = config.threads;
+        schedulerOptions.policy = policy;
+        schedulerOptions.memoryLimit = workload.memoryLimit;
+        WorkloadScheduler scheduler(db, schedulerOptions);
+        struct Result {
+          size_t memory;
+          double queue;
+          double run;
+        };
+        std::vector<Result> results(queries.size());
+        std::vector<tpch::Plan> plans;
+        for (auto &[name, makePlan] : queries) {
+          plans.push_back(makePlan());
+          if (options.costJoinOrder)
+            optimizeJoinOrder(plans.back().op, stats);
+        }
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> threads;
+        std::mutex statsMutex;
+        for (size_t i = 0; i < queries.size(); ++i)
+          threads.emplace_back([&, i]() {
+            size_t memory;
+            {
+              std::lock_guard lock(statsMutex);
+              memory = estimateMemory(*plans[i].op, stats, config.threads);
+            }
+            Times times;
+            Query query(db);
+            auto builder = Builder(query);
+            QueryCompiler compiler;
+            CountSink sink;
+            compileQuery(builder, compiler, plans[i], sink, config, times);
+            auto ticket = scheduler.submit(
+                builder.query, compiler, memory,
+                workload.priority.lookup(queries[i].first));
+            ticket.wait();
+            results[i] = {memory, ticket.queueTime().count() / 1e6,
+                          ticket.runTime().count() / 1e6};
+          });
+        for (auto &thread : threads)
+          thread.join();
+        walls.push_back(msSince(start));
+        json.object([&]() {
+          json.attribute("wall_ms", walls.back());
+          json.attributeArray("queries", [&]() {
+            for (size_t i = 0; i < queries.size(); ++i)
+              json.object([&]() {
+                json.attribute("query", queries[i].first);
+                json.attribute(
+                    "priority",
+                    static_cast<int64_t>(
+                        workload.priority.lookup(queries[i].first)));
+                json.attribute("estimated_bytes",
+                               static_cast<int64_t>(results[i].memory));
+                json.attribute("queue_ms", results[i].queue);
+                json.attribute("run_ms", results[i].run);
+              });
+          });
+        });
+      }
+    });
+    if (!walls.empty())
+      json.attribute("median_wall_ms", median(walls));
+  });
+  llvm::errs() << "workload policy=" << getName(policy) << " done\n";
+}
+
+/// writes the header and the entries write adds to the section of the mode
+int writeResults(const CommonOptions &options, const std::string &path,
+                 const char *section,
+                 llvm::function_ref<void(llvm::json::OStream &)> write) {
+  std::error_code ec;
+  std::optional<llvm::raw_fd_ostream> file;
+  if (!options.output.empty()) {
+    file.emplace(options.output, ec);
+    if (ec) {
+      llvm::errs() << options.output << ": " << ec.message() << "\n";
+      return EXIT_FAILURE;
+    }
+  }
+  llvm::json::OStream json(file ? *file : llvm::outs(), 2);
+  json.object([&]() {
+    json.attribute("tpchpath", path);
+    json.attribute("runs", static_cast<int64_t>(options.runs));
+    json.attribute("joinorder", options.costJoinOrder ? "cost" : "plan");
+    json.attributeArray(section, [&]() { write(json); });
+  });
+  (file ? static_cast<llvm::raw_ostream &>(*file) : llvm::outs()) << "\n";
+  return EXIT_SUCCESS;
+}
+
+int runSweep(int argc, char *argv[]) {
+  CommonOptions options;
+  std::vector<size_t> streaming = {0};
+  std::string expectedDir;
+  parseOptions(argc, argv, options,
+               [&](std::string_view arg, std::string_view value) {
+                 if (arg == "--streaming")
+                   streaming = splitSizes(value);
+                 else if (arg == "--expected")
+                   expectedDir = value;
+                 else
+                   return false;
+                 return true;
+               });
+  Catalog db(Catalog::defaultPath());
+  Statistics stats(db);
+  return writeResults(options, db.getPath(), "results", [&](auto &json) {
+    for (auto &name : options.queries) {
+      auto plan = findQuery(name)();
+      if (options.costJoinOrder)
+        optimizeJoinOrder(plan.op, stats);
+      auto expected = readExpected(expectedDir, name);
+      for (OptLevel level : options.levels) {
+        for (auto &target : options.targets) {
+          if (!hostSupports(target)) {
+            llvm::errs() << "skipping " << target.name
+                         << ", the host lacks " << target.required << "\n";
+            continue;
+          }
+          for (size_t threads : options.threads) {
+            for (size_t slots : streaming) {
+              Config config{level, target, threads, slots};
+              benchmarkQuery(json, db, name, plan, expected, config,
+                             options.runs);
+            }
+          }
+        }
+      }
+    }
+  });
+}
+
+int runStartup(int argc, char *argv[]) {
+  CommonOptions options;
+  std::vector<std::string> modes = {"eager", "none"};
+  parseOptions(argc, argv, options,
+               [&](std::string_view arg, std::string_view value) {
+                 if (arg != "--modes")
+                   return false;
+                 modes = splitList<std::string>(value, [](llvm::StringRef s) {
+                   if (s != "eager" && !parsePrefault(s)) {
+                     llvm::errs() << "unknown startup mode " << s << "\n";
+                     std::exit(EXIT_FAILURE);
+                   }
+                   return s.str();
+                 });
+                 return true;
+               });
+  /// the statistics for --joinorder, every run opens the database again
+  Catalog db(Catalog::defaultPath());
+  Statistics stats(db);
+  return writeResults(options, db.getPath(), "startup", [&](auto &json) {
+    for (auto &name : options.queries) {
+      auto plan = findQuery(name)();
+      if (options.costJoinOrder)
+        optimizeJoinOrder(plan.op, stats);
+      for (auto &mode : modes)
+        benchmarkStartup(json, name, plan, mode, options.single(),
+                         options.runs);
+    }
+  });
+}
+
+int runConcurrent(int argc, char *argv[]) {
+  CommonOptions options;
+  size_t instances = 4;
+  parseOptions(argc, argv, options,
+               [&](std::string_view arg, std::string_view value) {
+                 if (arg != "--instances")
+                   return false;
+                 instances = std::stoul(std::string(value));
+                 return true;
+               });
+  Catalog db(Catalog::defaultPath());
+  Statistics stats(db);
+  return writeResults(options, db.getPath(), "concurrent", [&](auto &json) {
+    for (auto &name : options.queries)
+      benchmarkConcurrent(json, db, name, findQuery(name),
+                          options.costJoinOrder ? &stats : nullptr, instances,
+                          options.single(), options.runs);
+  });
+}
+
+int runWorkload(int argc, char *argv[]) {
+  CommonOptions options;
+  WorkloadOptions workload;
+  workload.policies = {SchedulingPolicy::FairShare};
+  parseOptions(
+      argc, argv, options, [&](std::string_view arg, std::string_view value) {
+        if (arg == "--policies") {
+          workload.policies =
+              splitList<SchedulingPolicy>(value, [](llvm::StringRef s) {
+                auto policy = parseSchedulingPolicy(s);
+                if (!policy) {
+                  llvm::errs() << "unknown scheduling policy " << s << "\n";
+                  std::exit(EXIT_FAILURE);
+                }
+                return *policy;
+              });
+        } else if (arg == "--priority") {
+          for (auto [query, priority] :
+               splitList<std::pair<llvm::StringRef, int>>(
+                   value, [](llvm::StringRef s) {
+                     auto [query, priority] = s.split(':');
+                     return std::make_pair(query, std::stoi(priority.str()));
+                   }))
+            workload.priority[query] = priority;
+        } else if (arg == "--memorylimit") {
+          workload.memoryLimit = MemoryBudget::parse(std::string(value).c_str());
+        } else {
+          return false;
+        }
+        return true;
+      });
+  Catalog db(Catalog::defaultPath());
+  Statistics stats(db);
+  return writeResults(options, db.getPath(), "workload", [&](auto &json) {
+    for (SchedulingPolicy policy : workload.policies)
+      benchmarkWorkload(json, db, stats, options, workload, policy,
+                        options.single());
+  });
+}
+} // namespace
+
+int main(int argc, char *argv[]) {
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+  /// the options of a mode follow its name
+  std::string_view mode = argc > 1 ? argv[1] : "";
+  if (mode == "sweep")
+    return runSweep(argc - 1, argv + 1);
+  if (mode == "startup")
+    return runStartup(argc - 1, argv + 1);
+  if (mode == "concurrent")
+    return runConcurrent(argc - 1, argv + 1);
+  if (mode == "workload")
+    return runWorkload(argc - 1, argv + 1);
+  return runSweep(argc, argv);
+}
@@ -0,0 +1,672 @@
+#pragma once
+
+#include "IR/Expression.h"
+#include "internal/BaseTypes.h"
+#include "operators/Aggregation.h"
+#include "operators/InnerJoin.h"
+#include "operators/Iu.h"
+#include "operators/Map.h"
+#include "operators/Operations.h"
+#include "operators/Operator.h"
+#include "operators/Scan.h"
+#include "operators/Selection.h"
+#include "operators/Sort.h"
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/// The TPC-H queries the operators support, with the default substitution
+/// parameters. Dates are julian day numbers.
+
+namespace p2cllvm::tpch {
+struct Plan {
+  std::unique_ptr<Operator> op;
+  std::vector<IU *> outputs;
+  std::vector<std::string> names;
+};
+
+namespace exp {
+inline std::unique_ptr<Exp> col(IU *iu) { return std::make_unique<IUExp>(iu); }
+
+template <typename T> std::unique_ptr<Exp> val(T value) {
+  return std::make_unique<ConstExp<T>>(value);
+}
+
+inline std::unique_ptr<Exp> str(std::string_view value) {
+  return std::make_unique<ConstExp<StringView>>(value);
+}
+
+inline std::unique_ptr<Exp> call(std::string_view fn, std::unique_ptr<Exp> lhs,
+                                 std::unique_ptr<Exp> rhs) {
+  return makeCallExp(fn, std::move(lhs), std::move(rhs));
+}
+
+inline std::unique_ptr<Exp> eq(IU *iu, std::string_view value) {
+  return call("std::equal_to()", col(iu), str(value));
+}
+
+template <typename... Exps>
+std::unique_ptr<Exp> allOf(std::unique_ptr<Exp> first, Exps... rest) {
+  if constexpr (sizeof...(rest) == 0)
+    return first;
+  else
+    return call("std::logical_and()", std::move(first),
+                allOf(std::move(rest)...));
+}
+
+template <typename... Exps>
+std::unique_ptr<Exp> anyOf(std::unique_ptr<Exp> first, Exps... rest) {
+  if constexpr (sizeof...(rest) == 0)
+    return first;
+  else
+    return call("std::logical_or()", std::move(first),
+                anyOf(std::move(rest)...));
+}
+
+template <typename... Values>
+std::unique_ptr<Exp> in(IU *iu, std::string_view first, Values... rest) {
+  if constexpr (sizeof...(rest) == 0)
+    return eq(iu, first);
+  else
+    return anyOf(eq(iu, first), in(iu, rest...));
+}
+
+/// lo <= iu <= hi
+template <typename T> std::unique_ptr<Exp> between(IU *iu, T lo, T hi) {
+  return allOf(call("std::greater_equal()", col(iu), val(lo)),
+               call("std::less_equal()", col(iu), val(hi)));
+}
+
+/// lo <= iu < hi
+template <typename T> std::unique_ptr<Exp> range(IU *iu, T lo, T hi) {
+  return allOf(call("std::greater_equal()", col(iu), val(lo)),
+               call("std::less()", col(iu), val(hi)));
+}
+
+/// price * (1 - discount)
+inline std::unique_ptr<Exp> discounted(IU *price, IU *discount) {
+  return call("std::multiplies()", col(price),
+              call("std::minus()", val(1.0), col(discount)));
+}
+
+inline std::unique_ptr<Exp> caseWhen(std::unique_ptr<Exp> cond,
+                                     std::unique_ptr<Exp> then,
+                                     std::unique_ptr<Exp> otherwise,
+                                     TypeEnum type) {
+  return std::make_unique<CaseExp<1>>(
+      std::array<std::unique_ptr<Exp>, 1>{std::move(cond)},
+      std::array<std::unique_ptr<Exp>, 1>{std::move(then)},
+      std::move(otherwise), type);
+}
+} // namespace exp
+
+inline Plan q01() {
+  using namespace exp;
+  auto l = std::make_unique<Scan>("lineitem");
+  IU *l_returnflag = l->getIU("l_returnflag");
+  IU *l_linestatus = l->getIU("l_linestatus");
+  IU *l_quantity = l->getIU("l_quantity");
+  IU *l_extendedprice = l->getIU("l_extendedprice");
+  IU *l_discount = l->getIU("l_discount");
+  IU *l_tax = l->getIU("l_tax");
+  IU *l_shipdate = l->getIU("l_shipdate");
+  auto sel = std::make_unique<Selection>(
+      std::move(l),
+      call("std::less_equal()", col(l_shipdate), val<int32_t>(2451059)));
+  auto discPrice = std::make_unique<Map>(
+      std::move(sel), discounted(l_extendedprice, l_discount), "disc_price",
+      TypeEnum::Double);
+  IU *disc_price = discPrice->getIU("disc_price");
+  auto charge = std::make_unique<Map>(
+      std::move(discPrice),
+      call("std::multiplies()", col(disc_price),
+           call("std::plus()", val(1.0), col(l_tax))),
+      "charge", TypeEnum::Double);
+  IU *charge_iu = charge->getIU("charge");
+
+  auto gb = std::make_unique<Aggregation>(std::move(charge),
+                                          IUSet({l_returnflag, l_linestatus}));
+  gb->addAggregate(std::make_unique<SumAggregate>("sum_qty", l_quantity));
+  gb->addAggregate(
+      std::make_unique<SumAggregate>("sum_base_price", l_extendedprice));
+  gb->addAggregate(std::make_unique<SumAggregate>("sum_disc_price", disc_price));
+  gb->addAggregate(std::make_unique<SumAggregate>("sum_charge", charge_iu));
+  gb->addAggregate(std::make_unique<SumAggregate>("sum_disc", l_discount));
+  gb->addAggregate(std::make_unique<CountAggregate>("count_order"));
+  IU *sum_qty = gb->getIU("sum_qty");
+  IU *sum_base_price = gb->getIU("sum_base_price");
+  IU *sum_disc_price = gb->getIU("sum_disc_price");
+  IU *sum_charge = gb->getIU("sum_charge");
+  IU *sum_disc = gb->getIU("sum_disc");
+  IU *count_order = gb->getIU("count_order");
+
+  std::unique_ptr<Operator> op = std::move(gb);
+  std::vector<IU *> avgs;
+  for (auto [name, sum] : {std::pair{"avg_qty", sum_qty},
+                           std::pair{"avg_price", sum_base_price},
+                           std::pair{"avg_disc", sum_disc}}) {
+    auto avg = std::make_unique<Map>(
+        std::move(op), call("std::divides()", col(sum), col(count_order)),
+        name, TypeEnum::Double);
+    avgs.push_back(avg->getIU(name));
+    op = std::move(avg);
+  }
+  auto sort = std::make_unique<Sort>(std::move(op),
+                                     std::vector<IU *>{l_returnflag, l_linestatus},
+                                     std::vector<bool>{false, false});
+  return {std::move(sort),
+          {l_returnflag, l_linestatus, sum_qty, sum_base_price, sum_disc_price,
+           sum_charge, avgs[0], avgs[1], avgs[2], count_order},
+          {"l_returnflag", "l_linestatus", "sum_qty", "sum_base_price",
+           "sum_disc_price", "sum_charge", "avg_qty", "avg_price", "avg_disc",
+           "count_order"}};
+}
+
+inline Plan q05() {
+  using namespace exp;
+  auto r = std::make_unique<Scan>("region");
+  IU *r_regionkey = r->getIU("r_regionkey");
+  IU *r_name = r->getIU("r_name");
+  auto r_sel = std::make_unique<Selection>(std::move(r), eq(r_name, "ASIA"));
+
+  auto n = std::make_unique<Scan>("nation");
+  IU *n_nationkey = n->getIU("n_nationkey");
+  IU *n_regionkey = n->getIU("n_regionkey");
+  IU *n_name = n->getIU("n_name");
+  auto join1 = std::make_unique<InnerJoin>(
+      std::move(r_sel), std::move(n), std::vector<IU *>{r_regionkey},
+      std::vector<IU *>{n_regionkey}, nullptr);
+
+  auto c = std::make_unique<Scan>("customer");
+  IU *c_custkey = c->getIU("c_custkey");
+  IU *c_nationkey = c->getIU("c_nationkey");
+  auto join2 = std::make_unique<InnerJoin>(
+      std::move(join1), std::move(c), std::vector<IU *>{n_nationkey},
+      std::vector<IU *>{c_nationkey}, nullptr);
+
+  auto o = std::make_unique<Scan>("orders");
+  IU *o_orderkey = o->getIU("o_orderkey");
+  IU *o_custkey = o->getIU("o_custkey");
+  IU *o_orderdate = o->getIU("o_orderdate");
+  auto o_sel = std::make_unique<Selection>(
+      std::move(o), range<int32_t>(o_orderdate, 2449354, 2449719));
+  auto join3 = std::make_unique<InnerJoin>(
+      std::move(join2), std::move(o_sel), std::vector<IU *>{c_custkey},
+      std::vector<IU *>{o_custkey}, nullptr);
+
+  auto l = std::make_unique<Scan>("lineitem");
+  IU *l_orderkey = l->getIU("l_orderkey");
+  IU *l_suppkey = l->getIU("l_suppkey");
+  IU *l_extendedprice = l->getIU("l_extendedprice");
+  IU *l_discount = l->getIU("l_discount");
+  auto join4 = std::make_unique<InnerJoin>(
+      std::move(join3), std::move(l), std::vector<IU *>{o_orderkey},
+      std::vector<IU *>{l_orderkey}, nullptr);
+
+  auto s = std::make_unique<Scan>("supplier");
+  IU *s_suppkey = s->getIU("s_suppkey");
+  IU *s_nationkey = s->getIU("s_nationkey");
+  auto join5 = std::make_unique<InnerJoin>(
+      std::move(s), std::move(join4),
+      std::vector<IU *>{s_suppkey, s_nationkey},
+      std::vector<IU *>{l_suppkey, n_nationkey}, nullptr);
+
+  auto map = std::make_unique<Map>(std::move(join5),
+                                   discounted(l_extendedprice, l_discount),
+                                   "volume", TypeEnum::Double);
+  IU *volume = map->getIU("volume");
+  auto gb = std::make_unique<Aggregation>(std::move(map), IUSet({n_name}));
+  gb->addAggregate(std::make_unique<SumAggregate>("revenue", volume));
+  IU *revenue = gb->getIU("revenue");
+  auto sort = std::make_unique<Sort>(std::move(gb), std::vector<IU *>{revenue},
+                                     std::vector<bool>{true});
+  return {std::move(sort), {n_name, revenue}, {"n_name", "revenue"}};
+}
+
+inline Plan q06() {
+  using namespace exp;
+  auto l = std::make_unique<Scan>("lineitem");
+  IU *l_quantity = l->getIU("l_quantity");
+  IU *l_extendedprice = l->getIU("l_extendedprice");
+  IU *l_discount = l->getIU("l_discount");
+  IU *l_shipdate = l->getIU("l_shipdate");
+  auto sel = std::make_unique<Selection>(
+      std::move(l),
+      allOf(range<int32_t>(l_shipdate, 2449354, 2449719),
+            between(l_discount, 0.0499, 0.0701),
+            call("std::less()", col(l_quantity), val(24.0))));
+  auto map = std::make_unique<Map>(
+      std::move(sel),
+      call("std::multiplies()", col(l_extendedprice), col(l_discount)),
+      "volume", TypeEnum::Double);
+  IU *volume = map->getIU("volume");
+  auto gb = std::make_unique<Aggregation>(std::move(map), IUSet());
+  gb->addAggregate(std::make_unique<SumAggregate>("revenue", volume));
+  IU *revenue = gb->getIU("revenue");
+  return {std::move(gb), {revenue}, {"revenue"}};
+}
+
+inline Plan q07() {
+  using namespace exp;
+  auto n1 = std::make_unique<Scan>("nation");
+  IU *n1_nationkey = n1->getIU("n_nationkey");
+  IU *n1_name = n1->getIU("n_name");
+  auto n1_sel = std::make_unique<Selection>(std::move(n1),
+                                            in(n1_name, "FRANCE", "GERMANY"));
+  auto s = std::make_unique<Scan>("supplier");
+  IU *s_suppkey = s->getIU("s_suppkey");
+  IU *s_nationkey = s->getIU("s_nationkey");
+  auto suppliers = std::make_unique<InnerJoin>(
+      std::move(n1_sel), std::move(s), std::vector<IU *>{n1_nationkey},
+      std::vector<IU *>{s_nationkey}, nullptr);
+
+  auto n2 = std::make_unique<Scan>("nation");
+  IU *n2_nationkey = n2->getIU("n_nationkey");
+  IU *n2_name = n2->getIU("n_name");
+  auto n2_sel = std::make_unique<Selection>(std::move(n2),
+                                            in(n2_name, "FRANCE", "GERMANY"));
+  auto c = std::make_unique<Scan>("customer");
+  IU *c_custkey = c->getIU("c_custkey");
+  IU *c_nationkey = c->getIU("c_nationkey");
+  auto customers = std::make_unique<InnerJoin>(
+      std::move(n2_sel), std::move(c), std::vector<IU *>{n2_nationkey},
+      std::vector<IU *>{c_nationkey}, nullptr);
+
+  auto o = std::make_unique<Scan>("orders");
+  IU *o_orderkey = o->getIU("o_orderkey");
+  IU *o_custkey = o->getIU("o_custkey");
+  auto orders = std::make_unique<InnerJoin>(
+      std::move(customers), std::move(o), std::vector<IU *>{c_custkey},
+      std::vector<IU *>{o_custkey}, nullptr);
+
+  auto l = std::make_unique<Scan>("lineitem");
+  IU *l_orderkey = l->getIU("l_orderkey");
+  IU *l_suppkey = l->getIU("l_suppkey");
+  IU *l_extendedprice = l->getIU("l_extendedprice");
+  IU *l_discount = l->getIU("l_discount");
+  IU *l_shipdate = l->getIU("l_shipdate");
+  auto l_sel = std::make_unique<Selection>(
+      std::move(l), between<int32_t>(l_shipdate, 2449719, 2450449));
+  auto lineitems = std::make_unique<InnerJoin>(
+      std::move(orders), std::move(l_sel), std::vector<IU *>{o_orderkey},
+      std::vector<IU *>{l_orderkey}, nullptr);
+
+  auto join = std::make_unique<InnerJoin>(
+      std::move(suppliers), std::move(lineitems),
+      std::vector<IU *>{s_suppkey}, std::vector<IU *>{l_suppkey},
+      anyOf(allOf(eq(n1_name, "FRANCE"), eq(n2_name, "GERMANY")),
+            allOf(eq(n1_name, "GERMANY"), eq(n2_name, "FRANCE"))));
+  auto year = std::make_unique<Map>(
+      std::move(join), makeCallExp("date::extractYear", col(l_shipdate)),
+      "l_year", TypeEnum::Integer);
+  IU *l_year = year->getIU("l_year");
+  auto map = std::make_unique<Map>(std::move(year),
+                                   discounted(l_extendedprice, l_discount),
+                                   "volume", TypeEnum::Double);
+  IU *volume = map->getIU("volume");
+  auto gb = std::make_unique<Aggregation>(std::move(map),
+                                          IUSet({n1_name, n2_name, l_year}));
+  gb->addAggregate(std::make_unique<SumAggregate>("revenue", volume));
+  IU *revenue = gb->getIU("revenue");
+  auto sort = std::make_unique<Sort>(
+      std::move(gb), std::vector<IU *>{n1_name, n2_name, l_year},
+      std::vector<bool>{false, false, false});
+  return {std::move(sort),
+          {n1_name, n2_name, l_year, revenue},
+          {"supp_nation", "cust_nation", "l_year", "revenue"}};
+}
+
+inline Plan q08() {
+  using namespace exp;
+  auto r = std::make_unique<Scan>("region");
+  IU *r_regionkey = r->getIU("r_regionkey");
+  IU *r_name = r->getIU("r_name");
+  auto r_sel = std::make_unique<Selection>(std::move(r), eq(r_name, "AMERICA"));
+  auto n1 = std::make_unique<Scan>("nation");
+  IU *n1_nationkey = n1->getIU("n_nationkey");
+  IU *n1_regionkey = n1->getIU("n_regionkey");
+  auto nations = std::make_unique<InnerJoin>(
+      std::move(r_sel), std::move(n1), std::vector<IU *>{r_regionkey},
+      std::vector<IU *>{n1_regionkey}, nullptr);
+  auto c = std::make_unique<Scan>("customer");
+  IU *c_custkey = c->getIU("c_custkey");
+  IU *c_nationkey = c->getIU("c_nationkey");
+  auto customers = std::make_unique<InnerJoin>(
+      std::move(nations), std::move(c), std::vector<IU *>{n1_nationkey},
+      std::vector<IU *>{c_nationkey}, nullptr);
+  auto o = std::make_unique<Scan>("orders");
+  IU *o_orderkey = o->getIU("o_orderkey");
+  IU *o_custkey = o->getIU("o_custkey");
+  IU *o_orderdate = o->getIU("o_orderdate");
+  auto o_sel = std::make_unique<Selection>(
+      std::move(o), between<int32_t>(o_orderdate, 2449719, 2450449));
+  auto orders = std::make_unique<InnerJoin>(
+      std::move(customers), std::move(o_sel), std::vector<IU *>{c_custkey},
+      std::vector<IU *>{o_custkey}, nullptr);
+
+  auto p = std::make_unique<Scan>("part");
+  IU *p_partkey = p->getIU("p_partkey");
+  IU *p_type = p->getIU("p_type");
+  auto p_sel = std::make_unique<Selection>(
+      std::move(p), eq(p_type, "ECONOMY ANODIZED STEEL"));
+  auto l = std::make_unique<Scan>("lineitem");
+  IU *l_orderkey = l->getIU("l_orderkey");
+  IU *l_partkey = l->getIU("l_partkey");
+  IU *l_suppkey = l->getIU("l_suppkey");
+  IU *l_extendedprice = l->getIU("l_extendedprice");
+  IU *l_discount = l->getIU("l_discount");
+  auto lineitems = std::make_unique<InnerJoin>(
+      std::move(p_sel), std::move(l), std::vector<IU *>{p_partkey},
+      std::vector<IU *>{l_partkey}, nullptr);
+  auto join = std::make_unique<InnerJoin>(
+      std::move(orders), std::move(lineitems), std::vector<IU *>{o_orderkey},
+      std::vector<IU *>{l_orderkey}, nullptr);
+
+  auto n2 = std::make_unique<Scan>("nation");
+  IU *n2_nationkey = n2->getIU("n_nationkey");
+  IU *n2_name = n2->getIU("n_name");
+  auto s = std::make_unique<Scan>("supplier");
+  IU *s_suppkey = s->getIU("s_suppkey");
+  IU *s_nationkey = s->getIU("s_nationkey");
+  auto suppliers = std::make_unique<InnerJoin>(
+      std::move(n2), std::move(s), std::vector<IU *>{n2_nationkey},
+      std::vector<IU *>{s_nationkey}, nullptr);
+  auto all = std::make_unique<InnerJoin>(
+      std::move(suppliers), std::move(join), std::vector<IU *>{s_suppkey},
+      std::vector<IU *>{l_suppkey}, nullptr);
+
+  auto year = std::make_unique<Map>(
+      std::move(all), makeCallExp("date::extractYear", col(o_orderdate)),
+      "o_year", TypeEnum::Integer);
+  IU *o_year = year->getIU("o_year");
+  auto volumeMap = std::make_unique<Map>(
+      std::move(year), discounted(l_extendedprice, l_discount), "volume",
+      TypeEnum::Double);
+  IU *volume = volumeMap->getIU("volume");
+  auto brazilMap = std::make_unique<Map>(
+      std::move(volumeMap),
+      caseWhen(eq(n2_name, "BRAZIL"), col(volume), val(0.0), TypeEnum::Double),
+      "brazil_volume", TypeEnum::Double);
+  IU *brazil_volume = brazilMap->getIU("brazil_volume");
+  auto gb = std::make_unique<Aggregation>(std::move(brazilMap),
+                                          IUSet({o_year}));
+  gb->addAggregate(std::make_unique<SumAggregate>("brazil", brazil_volume));
+  gb->addAggregate(std::make_unique<SumAggregate>("total", volume));
+  IU *brazil = gb->getIU("brazil");
+  IU *total = gb->getIU("total");
+  auto share = std::make_unique<Map>(
+      std::move(gb), call("std::divides()", col(brazil), col(total)),
+      "mkt_share", TypeEnum::Double);
+  IU *mkt_share = share->getIU("mkt_share");
+  auto sort = std::make_unique<Sort>(std::move(share),
+                                     std::vector<IU *>{o_year},
+                                     std::vector<bool>{false});
+  return {std::move(sort), {o_year, mkt_share}, {"o_year", "mkt_share"}};
+}
+
+inline Plan q09() {
+  using namespace exp;
+  auto p = std::make_unique<Scan>("part");
+  IU *p_partkey = p->getIU("p_partkey");
+  IU *p_name = p->getIU("p_name");
+  auto p_sel = std::make_unique<Selection>(
+      std::move(p), std::make_unique<LikeExp>(col(p_name), "%green%"));
+  auto ps = std::make_unique<Scan>("partsupp");
+  IU *ps_partkey = ps->getIU("ps_partkey");
+  IU *ps_suppkey = ps->getIU("ps_suppkey");
+  IU *ps_supplycost = ps->getIU("ps_supplycost");
+  auto partsupps = std::make_unique<InnerJoin>(
+      std::move(p_sel), std::move(ps), std::vector<IU *>{p_partkey},
+      std::vector<IU *>{ps_partkey}, nullptr);
+
+  auto l = std::make_unique<Scan>("lineitem");
+  IU *l_orderkey = l->getIU("l_orderkey");
+  IU *l_partkey = l->getIU("l_partkey");
+  IU *l_suppkey = l->getIU("l_suppkey");
+  IU *l_quantity = l->getIU("l_quantity");
+  IU *l_extendedprice = l->getIU("l_extendedprice");
+  IU *l_discount = l->getIU("l_discount");
+  auto lineitems = std::make_unique<InnerJoin>(
+      std::move(partsupps), std::move(l),
+      std::vector<IU *>{ps_partkey, ps_suppkey},
+      std::vector<IU *>{l_partkey, l_suppkey}, nullptr);
+
+  auto n = std::make_unique<Scan>("nation");
+  IU *n_nationkey = n->getIU("n_nationkey");
+  IU *n_name = n->getIU("n_name");
+  auto s = std::make_unique<Scan>("supplier");
+  IU *s_suppkey = s->getIU("s_suppkey");
+  IU *s_nationkey = s->getIU("s_nationkey");
+  auto suppliers = std::make_unique<InnerJoin>(
+      std::move(n), std::move(s), std::vector<IU *>{n_nationkey},
+      std::vector<IU *>{s_nationkey}, nullptr);
+  auto withNation = std::make_unique<InnerJoin>(
+      std::move(suppliers), std::move(lineitems),
+      std::vector<IU *>{s_suppkey}, std::vector<IU *>{l_suppkey}, nullptr);
+
+  auto o = std::make_unique<Scan>("orders");
+  IU *o_orderkey = o->getIU("o_orderkey");
+  IU *o_orderdate = o->getIU("o_orderdate");
+  auto join = std::make_unique<InnerJoin>(
+      std::move(withNation), std::move(o), std::vector<IU *>{l_orderkey},
+      std::vector<IU *>{o_orderkey}, nullptr);
+
+  auto year = std::make_unique<Map>(
+      std::move(join), makeCallExp("date::extractYear", col(o_orderdate)),
+      "o_year", TypeEnum::Integer);
+  IU *o_year = year->getIU("o_year");
+  auto amountMap = std::make_unique<Map>(
+      std::move(year),
+      call("std::minus()", discounted(l_extendedprice, l_discount),
+           call("std::multiplies()", col(ps_supplycost), col(l_quantity))),
+      "amount", TypeEnum::Double);
+  IU *amount = amountMap->getIU("amount");
+  auto gb = std::make_unique<Aggregation>(std::move(amountMap),
+                                          IUSet({n_name, o_year}));
+  gb->addAggregate(std::make_unique<SumAggregate>("sum_profit", amount));
+  IU *sum_profit = gb->getIU("sum_profit");
+  auto sort = std::make_unique<Sort>(std::move(gb),
+                                     std::vector<IU *>{n_name, o_year},
+                                     std::vector<bool>{false, true});
+  return {std::move(sort),
+          {n_name, o_year, sum_profit},
+          {"nation", "o_year", "sum_profit"}};
+}
+
+inline Plan q12() {
+  using namespace exp;
+  auto l = std::make_unique<Scan>("lineitem");
+  IU *l_orderkey = l->getIU("l_orderkey");
+  IU *l_shipmode = l->getIU("l_shipmode");
+  IU *l_shipdate = l->getIU("l_shipdate");
+  IU *l_commitdate = l->getIU("l_commitdate");
+  IU *l_receiptdate = l->getIU("l_receiptdate");
+  auto l_sel = std::make_unique<Selection>(
+      std::move(l),
+      allOf(range<int32_t>(l_receiptdate, 2449354, 2449719),
+            in(l_shipmode, "MAIL", "SHIP"),
+            call("std::less()", col(l_commitdate), col(l_receiptdate)),
+            call("std::less()", col(l_shipdate), col(l_commitdate))));
+  auto o = std::make_unique<Scan>("orders");
+  IU *o_orderkey = o->getIU("o_orderkey");
+  IU *o_orderpriority = o->getIU("o_orderpriority");
+  auto join = std::make_unique<InnerJoin>(
+      std::move(l_sel), std::move(o), std::vector<IU *>{l_orderkey},
+      std::vector<IU *>{o_orderkey}, nullptr);
+  auto highMap = std::make_unique<Map>(
+      std::move(join),
+      caseWhen(in(o_orderpriority, "1-URGENT", "2-HIGH"), val<int64_t>(1),
+               val<int64_t>(0), TypeEnum::BigInt),
+      "high", TypeEnum::BigInt);
+  IU *high = highMap->getIU("high");
+  auto lowMap = std::make_unique<Map>(
+      std::move(highMap), call("std::minus()", val<int64_t>(1), col(high)),
+      "low", TypeEnum::BigInt);
+  IU *low = lowMap->getIU("low");
+  auto gb = std::make_unique<Aggregation>(std::move(lowMap),
+                                          IUSet({l_shipmode}));
+  gb->addAggregate(std::make_unique<SumAggregate>("high_line_count", high));
+  gb->addAggregate(std::make_unique<SumAggregate>("low_line_count", low));
+  IU *high_line_count = gb->getIU("high_line_count");
+  IU *low_line_count = gb->getIU("low_line_count");
+  auto sort = std::make_unique<Sort>(std::move(gb),
+                                     std::vector<IU *>{l_shipmode},
+                                     std::vector<bool>{false});
+  return {std::move(sort),
+          {l_shipmode, high_line_count, low_line_count},
+          {"l_shipmode", "high_line_count", "low_line_count"}};
+}
+
+inline Plan q14() {
+  using namespace exp;
+  auto l = std::make_unique<Scan>("lineitem");
+  IU *l_partkey = l->getIU("l_partkey");
+  IU *l_extendedprice = l->getIU("l_extendedprice");
+  IU *l_discount = l->getIU("l_discount");
+  IU *l_shipdate = l->getIU("l_shipdate");
+  auto l_sel = std::make_unique<Selection>(
+      std::move(l), range<int32_t>(l_shipdate, 2449962, 2449992));
+  auto p = std::make_unique<Scan>("part");
+  IU *p_partkey = p->getIU("p_partkey");
+  IU *p_type = p->getIU("p_type");
+  auto join = std::make_unique<InnerJoin>(
+      std::move(l_sel), std::move(p), std::vector<IU *>{l_partkey},
+      std::vector<IU *>{p_partkey}, nullptr);
+  auto volumeMap = std::make_unique<Map>(
+      std::move(join), discounted(l_extendedprice, l_discount), "volume",
+      TypeEnum::Double);
+  IU *volume = volumeMap->getIU("volume");
+  auto promoMap = std::make_unique<Map>(
+      std::move(volumeMap),
+      caseWhen(std::make_unique<LikeExp>(col(p_type), "PROMO%"), col(volume),
+               val(0.0), TypeEnum::Double),
+      "promo_volume", TypeEnum::Double);
+  IU *promo_volume = promoMap->getIU("promo_volume");
+  auto gb = std::make_unique<Aggregation>(std::move(promoMap), IUSet());
+  gb->addAggregate(std::make_unique<SumAggregate>("promo", promo_volume));
+  gb->addAggregate(std::make_unique<SumAggregate>("total", volume));
+  IU *promo = gb->getIU("promo");
+  IU *total = gb->getIU("total");
+  auto revenue = std::make_unique<Map>(
+      std::move(gb),
+      call("std::divides()",
+           call("std::multiplies()", val(100.0), col(promo)), col(total)),
+      "promo_revenue", TypeEnum::Double);
+  IU *promo_revenue = revenue->getIU("promo_revenue");
+  return {std::move(revenue), {promo_revenue}, {"promo_revenue"}};
+}
+
+inline Plan q17() {
+  using namespace exp;
+  /// the correlated subquery is decorrelated into an aggregation per part
+  auto p1 = std::make_unique<Scan>("part");
+  IU *p1_partkey = p1->getIU("p_partkey");
+  IU *p1_brand = p1->getIU("p_brand");
+  IU *p1_container = p1->getIU("p_container");
+  auto p1_sel = std::make_unique<Selection>(
+      std::move(p1), allOf(eq(p1_brand, "Brand#23"),
+                           eq(p1_container, "MED BOX")));
+  auto l1 = std::make_unique<Scan>("lineitem");
+  IU *l1_partkey = l1->getIU("l_partkey");
+  IU *l1_quantity = l1->getIU("l_quantity");
+  auto join1 = std::make_unique<InnerJoin>(
+      std::move(p1_sel), std::move(l1), std::vector<IU *>{p1_partkey},
+      std::vector<IU *>{l1_partkey}, nullptr);
+  auto perPart = std::make_unique<Aggregation>(std::move(join1),
+                                               IUSet({p1_partkey}));
+  perPart->addAggregate(std::make_unique<SumAggregate>("sum_qty", l1_quantity));
+  perPart->addAggregate(std::make_unique<CountAggregate>("cnt"));
+  IU *sum_qty = perPart->getIU("sum_qty");
+  IU *cnt = perPart->getIU("cnt");
+  auto limitMap = std::make_unique<Map>(
+      std::move(perPart),
+      call("std::divides()",
+           call("std::multiplies()", val(0.2), col(sum_qty)), col(cnt)),
+      "limit", TypeEnum::Double);
+  IU *limit = limitMap->getIU("limit");
+
+  auto p2 = std::make_unique<Scan>("part");
+  IU *p2_partkey = p2->getIU("p_partkey");
+  IU *p2_brand = p2->getIU("p_brand");
+  IU *p2_container = p2->getIU("p_container");
+  auto p2_sel = std::make_unique<Selection>(
+      std::move(p2), allOf(eq(p2_brand, "Brand#23"),
+                           eq(p2_container, "MED BOX")));
+  auto l2 = std::make_unique<Scan>("lineitem");
+  IU *l2_partkey = l2->getIU("l_partkey");
+  IU *l2_quantity = l2->getIU("l_quantity");
+  IU *l2_extendedprice = l2->getIU("l_extendedprice");
+  auto join2 = std::make_unique<InnerJoin>(
+      std::move(p2_sel), std::move(l2), std::vector<IU *>{p2_partkey},
+      std::vector<IU *>{l2_partkey}, nullptr);
+  auto join = std::make_unique<InnerJoin>(
+      std::move(limitMap), std::move(join2), std::vector<IU *>{p1_partkey},
+      std::vector<IU *>{p2_partkey},
+      call("std::less()", col(l2_quantity), col(limit)));
+  auto gb = std::make_unique<Aggregation>(std::move(join), IUSet());
+  gb->addAggregate(std::make_unique<SumAggregate>("sum_price", l2_extendedprice));
+  IU *sum_price = gb->getIU("sum_price");
+  auto yearly = std::make_unique<Map>(
+      std::move(gb), call("std::divides()", col(sum_price), val(7.0)),
+      "avg_yearly", TypeEnum::Double);
+  IU *avg_yearly = yearly->getIU("avg_yearly");
+  return {std::move(yearly), {avg_yearly}, {"avg_yearly"}};
+}
+
+inline Plan q19() {
+  using namespace exp;
+  auto p = std::make_unique<Scan>("part");
+  IU *p_partkey = p->getIU("p_partkey");
+  IU *p_brand = p->getIU("p_brand");
+  IU *p_container = p->getIU("p_container");
+  IU *p_size = p->getIU("p_size");
+  /// the disjunction is checked on join, prefilter both sides with its hull
+  auto p_sel = std::make_unique<Selection>(
+      std::move(p), allOf(in(p_brand, "Brand#12", "Brand#23", "Brand#34"),
+                          between<int32_t>(p_size, 1, 15)));
+  auto l = std::make_unique<Scan>("lineitem");
+  IU *l_partkey = l->getIU("l_partkey");
+  IU *l_quantity = l->getIU("l_quantity");
+  IU *l_extendedprice = l->getIU("l_extendedprice");
+  IU *l_discount = l->getIU("l_discount");
+  IU *l_shipinstruct = l->getIU("l_shipinstruct");
+  IU *l_shipmode = l->getIU("l_shipmode");
+  auto l_sel = std::make_unique<Selection>(
+      std::move(l), allOf(in(l_shipmode, "AIR", "AIR REG"),
+                          eq(l_shipinstruct, "DELIVER IN PERSON"),
+                          between(l_quantity, 1.0, 30.0)));
+  auto join = std::make_unique<InnerJoin>(
+      std::move(p_sel), std::move(l_sel), std::vector<IU *>{p_partkey},
+      std::vector<IU *>{l_partkey},
+      anyOf(allOf(eq(p_brand, "Brand#12"),
+                  in(p_container, "SM CASE", "SM BOX", "SM PACK", "SM PKG"),
+                  between(l_quantity, 1.0, 11.0),
+                  between<int32_t>(p_size, 1, 5)),
+            allOf(eq(p_brand, "Brand#23"),
+                  in(p_container, "MED BAG", "MED BOX", "MED PKG", "MED PACK"),
+                  between(l_quantity, 10.0, 20.0),
+                  between<int32_t>(p_size, 1, 10)),
+            allOf(eq(p_brand, "Brand#34"),
+                  in(p_container, "LG CASE", "LG BOX", "LG PACK", "LG PKG"),
+                  between(l_quantity, 20.0, 30.0),
+                  between<int32_t>(p_size, 1, 15))));
+  auto map = std::make_unique<Map>(std::move(join),
+                                   discounted(l_extendedprice, l_discount),
+                                   "volume", TypeEnum::Double);
+  IU *volume = map->getIU("volume");
+  auto gb = std::make_unique<Aggregation>(std::move(map), IUSet());
+  gb->addAggregate(std::make_unique<SumAggregate>("revenue", volume));
+  IU *revenue = gb->getIU("revenue");
+  return {std::move(gb), {revenue}, {"revenue"}};
+}
+
+inline const std::vector<std::pair<std::string_view, Plan (*)()>> queries = {
+    {"q01", &q01}, {"q05", &q05}, {"q06", &q06}, {"q07", &q07},
+    {"q08", &q08}, {"q09", &q09}, {"q12", &q12}, {"q14", &q14},
+    {"q17", &q17}, {"q19", &q19}};
+} // namespace p2cllvm::tpch
@@ -1,8 +1,11 @@
 // Maximilian Kuschewski, 2023
 #include <array>
 #include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <string>
 #include <string_view>
+#include <thread>
 
 #include "csv.hpp"
 #include "table-reader.hpp"
@@ -11,58 +14,33 @@
 using namespace p2c;
 namespace fs = std::filesystem;
 
+// converts <iprefix>/<name>.tbl into output/<name>/ with all threads
+template<typename Table, size_t N>
+void convert(const fs::path &iprefix, const char *name, const std::array<const char *, N> &colnames,
+             unsigned threads, std::ostream &schema) {
+   std::string output = "output/" + std::string(name) + "/";
+   std::string input = (iprefix / (std::string(name) + ".tbl")).string();
+   typename Table::parallel_reader reader(output, input.c_str(), colnames.data(), threads);
+   auto rows = reader.read();
+   std::cout << "read " << rows << " rows for " << name << std::endl;
+   Table::reader::write_schema(schema, name, colnames.data());
+}
+
 int main(int argc, char *argv[]) {
-   // takes one argument: the directory containing all database tables
-   assert(argc == 2);
+   // takes the directory containing all database tables and optionally the
+   // number of threads
+   assert(argc == 2 || argc == 3);
    fs::path iprefix(argv[1]);
-   // orders
-   {
-      orders::reader reader("output/orders/", (iprefix / "orders.tbl").c_str(), orders_c.data());
-      auto rows = reader.read();
-      std::cout << "read " << rows << " rows for orders" << std::endl;
-   }
-   // nation
-   {
-      nation::reader reader("output/nation/", (iprefix / "nation.tbl").c_str(), nation_c.data());
-      auto rows = reader.read();
-      std::cout << "read " << rows << " rows for nation" << std::endl;
-   }
-   // customer
-   {
-      customer::reader reader("output/customer/", (iprefix / "customer.tbl").c_str(), customer_c.data());
-      auto rows = reader.read();
-      std::cout << "read " << rows << " rows for customer" << std::endl;
-   }
-   // lineitem
-   {
-      lineitem::reader reader("output/lineitem/", (iprefix / "lineitem.tbl").c_str(), lineitem_c.data());
-      auto rows = reader.read();
-      std::cout << "read " << rows << " rows for lineitem" << std::endl;
-   }
-   // part
-   {
-      part::reader reader("output/part/", (iprefix / "part.tbl").c_str(), part_c.data());
-      auto rows = reader.read();
-      std::cout << "read " << rows << " rows for part" << std::endl;
-   }
-   // partsupp
-   {
-      partsupp::reader reader("output/partsupp/", (iprefix / "partsupp.tbl").c_str(), partsupp_c.data());
-      auto rows = reader.read();
-      std::cout << "read " << rows << " rows for partsupp" << std::endl;
-   }
-   // region
-   {
-      region::reader reader("output/region/", (iprefix / "region.tbl").c_str(), region_c.data());
-      auto rows = reader.read();
-      std::cout << "read " << rows << " rows for region" << std::endl;
-   }
-   // supplier
-   {
-      supplier::reader reader("output/supplier/", (iprefix / "supplier.tbl").c_str(), supplier_c.data());
-      auto rows = reader.read();
-      std::cout << "read " << rows << " rows for supplier" << std::endl;
-   }
-   // io::csv::read_file<'|', '\n', decltype(consume_cell)>(cfg.input.c_str(), nation_cols, consume_cell);
+   unsigned threads = argc == 3 ? std::stoul(argv[2]) : std::thread::hardware_concurrency();
+   fs::create_directories("output");
+   std::ofstream schema("output/schema");
+   convert<orders>(iprefix, "orders", orders_c, threads, schema);
+   convert<nation>(iprefix, "nation", nation_c, threads, schema);
+   convert<customer>(iprefix, "customer", customer_c, threads, schema);
+   convert<lineitem>(iprefix, "lineitem", lineitem_c, threads, schema);
+   convert<part>(iprefix, "part", part_c, threads, schema);
+   convert<partsupp>(iprefix, "partsupp", partsupp_c, threads, schema);
+   convert<region>(iprefix, "region", region_c, threads, schema);
+   convert<supplier>(iprefix, "supplier", supplier_c, threads, schema);
    return 0;
 }
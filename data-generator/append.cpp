@@ -0,0 +1,98 @@
+// Appends rows to converted tables and compacts the appended deltas
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <array>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include "delta-segments.hpp"
+#include "tpch.hpp"
+
+using namespace p2c;
+namespace fs = std::filesystem;
+
+// an append leaving more deltas than this starts a merge in the background
+constexpr size_t MAX_DELTAS = 8;
+
+// calls fn.template operator()<Table>(colnames) for the table called name
+template<typename F>
+bool with_table(std::string_view name, const F &fn) {
+   if (name == "orders") {
+      fn.template operator()<orders>(orders_c);
+   } else if (name == "nation") {
+      fn.template operator()<nation>(nation_c);
+   } else if (name == "customer") {
+      fn.template operator()<customer>(customer_c);
+   } else if (name == "lineitem") {
+      fn.template operator()<lineitem>(lineitem_c);
+   } else if (name == "part") {
+      fn.template operator()<part>(part_c);
+   } else if (name == "partsupp") {
+      fn.template operator()<partsupp>(partsupp_c);
+   } else if (name == "region") {
+      fn.template operator()<region>(region_c);
+   } else if (name == "supplier") {
+      fn.template operator()<supplier>(supplier_c);
+   } else {
+      return false;
+   }
+   return true;
+}
+
+template<typename Table, size_t N>
+void merge(const fs::path &table_dir, const std::array<const char *, N> &colnames, unsigned threads) {
+   auto merged = [&]<typename... Ts>(std::tuple<Ts...> *) {
+      return merge_segments<Ts...>(table_dir, colnames.data(), threads);
+   }(static_cast<typename Table::columns *>(nullptr));
+   std::cout << "merged " << merged << " segments of " << table_dir.string() << std::endl;
+}
+
+int usage(const char *name) {
+   std::cerr << "usage: " << name << " <output-dir> <table> <file.tbl> [threads]\n"
+             << "       " << name << " --merge <output-dir> <table> [threads]" << std::endl;
+   return 1;
+}
+
+int main(int argc, char *argv[]) {
+   // both forms take three arguments and optionally the number of threads
+   if (argc != 4 && argc != 5) {
+      return usage(argv[0]);
+   }
+   bool merging = std::string_view(argv[1]) == "--merge";
+   char **arg = argv + 1 + merging;
+   fs::path table_dir = fs::path(arg[0]) / arg[1];
+   unsigned threads = argc == 5 ? std::stoul(argv[4]) : std::thread::hardware_concurrency();
+   bool known = with_table(arg[1], [&]<typename Table, size_t N>(const std::array<const char *, N> &colnames) {
+      if (merging) {
+         merge<Table>(table_dir, colnames, threads);
+         return;
+      }
+      auto rows = [&]<typename... Ts>(std::tuple<Ts...> *) {
+         return append_segment<Ts...>(table_dir, arg[2], colnames.data(), threads);
+      }(static_cast<typename Table::columns *>(nullptr));
+      std::cout << "appended " << rows << " rows to " << table_dir.string() << std::endl;
+      // the first segment of the list is the main segment
+      if (TableSegments(table_dir).read().size() - 1 <= MAX_DELTAS) {
+         return;
+      }
+      // queries keep reading the segments they listed, the merge can run
+      // after the append has returned
+      if (::fork() == 0) {
+         ::setsid();
+         if (::fork() == 0) {
+            merge<Table>(table_dir, colnames, threads);
+         }
+         ::_exit(0);
+      }
+      ::wait(nullptr);
+   });
+   if (!known) {
+      std::cerr << "unknown table " << arg[1] << std::endl;
+      return 1;
+   }
+   return 0;
+}
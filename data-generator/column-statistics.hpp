@@ -0,0 +1,186 @@
+#pragma once
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "../types.hpp"
+
+namespace p2c {
+/// Statistics of one column, written as `<column>.stats` next to its `.bin`
+/// file. The format is one `key value...` pair per line; numeric values of
+/// dates are their day number and chars their code.
+/// The statistics are collected in one pass in storage order: the distinct
+/// count from a HyperLogLog, the histogram from a uniform sample of the
+/// values, so memory does not grow with the column.
+template<typename T>
+struct ColumnStatistics {
+   static constexpr unsigned HISTOGRAM_BUCKETS = 64;
+   /// values kept for the histogram
+   static constexpr size_t SAMPLE_SIZE = 1u << 14;
+   static constexpr bool IS_NUMERIC = !std::is_same_v<T, std::string_view>;
+
+   uint64_t rows = 0;
+   /// the binary format has no nulls, the field keeps the format stable
+   uint64_t nulls = 0;
+   uint64_t distinct = 0;
+   double min = 0;
+   double max = 0;
+   /// values never decrease in storage order
+   bool sorted = true;
+   /// fraction of neighbouring values in non decreasing order
+   double clustering = 1.0;
+   /// bounds of equi-depth buckets, the first is min and the last max
+   std::vector<double> histogram;
+
+   ColumnStatistics() : registers(HLL_REGISTERS) {}
+
+   // items is a std::vector or a DataColumn page
+   template<typename Items>
+   explicit ColumnStatistics(const Items &items) : ColumnStatistics() {
+      for (size_t i = 0; i != items.size(); ++i) {
+         add(items[i]);
+      }
+      finish();
+   }
+
+   /// adds the next value in storage order, string values must stay valid
+   /// until the next call
+   void add(const T &val) {
+      add_hash(hash(val));
+      if (rows != 0) {
+         ascending += !(val < last);
+      }
+      last = val;
+      if constexpr (IS_NUMERIC) {
+         auto value = to_double(val);
+         min = rows == 0 ? value : std::min(min, value);
+         max = rows == 0 ? value : std::max(max, value);
+         // reservoir sampling, every value is kept with the same probability
+         if (sample.size() < SAMPLE_SIZE) {
+            sample.push_back(value);
+         } else if (auto slot = next_random() % (rows + 1); slot < SAMPLE_SIZE) {
+            sample[slot] = value;
+         }
+      }
+      ++rows;
+   }
+
+   /// computes the statistics of the added values
+   void finish() {
+      distinct = std::min(estimate_distinct(), rows);
+      if (rows > 1) {
+         sorted = ascending == rows - 1;
+         clustering = static_cast<double>(ascending) / (rows - 1);
+      }
+      if constexpr (IS_NUMERIC) {
+         if (rows == 0) {
+            return;
+         }
+         std::sort(sample.begin(), sample.end());
+         auto buckets = std::min<uint64_t>(HISTOGRAM_BUCKETS, sample.size());
+         histogram.clear();
+         for (uint64_t i = 0; i <= buckets; ++i) {
+            histogram.push_back(sample[std::min(i * sample.size() / buckets, sample.size() - 1)]);
+         }
+         // the sample may miss the extremes
+         histogram.front() = min;
+         histogram.back() = max;
+      }
+   }
+
+   void write(const std::string &filename) const {
+      std::ofstream out(filename);
+      out.precision(17);
+      out << "rows " << rows << "\n";
+      out << "nulls " << nulls << "\n";
+      out << "distinct " << distinct << "\n";
+      out << "sorted " << sorted << "\n";
+      out << "clustering " << clustering << "\n";
+      if constexpr (IS_NUMERIC) {
+         out << "min " << min << "\n";
+         out << "max " << max << "\n";
+         out << "histogram " << histogram.size();
+         for (auto bound : histogram) {
+            out << " " << bound;
+         }
+         out << "\n";
+      }
+   }
+
+  private:
+   static double to_double(const T &val) {
+      if constexpr (std::is_same_v<T, date>) {
+         return val.value;
+      } else {
+         return static_cast<double>(val);
+      }
+   }
+
+   static uint64_t hash(const T &val) {
+      uint64_t h = 0;
+      if constexpr (std::is_same_v<T, std::string_view>) {
+         // FNV-1a
+         h = 0xcbf29ce484222325ull;
+         for (char c : val) {
+            h = (h ^ static_cast<uint8_t>(c)) * 0x100000001b3ull;
+         }
+      } else {
+         std::memcpy(&h, &val, sizeof(T));
+      }
+      // murmur3 finalizer
+      h ^= h >> 33;
+      h *= 0xff51afd7ed558ccdull;
+      h ^= h >> 33;
+      h *= 0xc4ceb9fe1a85ec53ull;
+      h ^= h >> 33;
+      return h;
+   }
+
+   /// HyperLogLog with 2^14 registers and linear counting for small sets
+   static constexpr unsigned HLL_BITS = 14;
+   static constexpr uint64_t HLL_REGISTERS = 1ull << HLL_BITS;
+
+   void add_hash(uint64_t h) {
+      auto rest = h << HLL_BITS;
+      uint8_t rank = rest == 0 ? 64 - HLL_BITS + 1 : std::countl_zero(rest) + 1;
+      auto &reg = registers[h >> (64 - HLL_BITS)];
+      reg = std::max(reg, rank);
+   }
+
+   uint64_t estimate_distinct() const {
+      constexpr uint64_t m = HLL_REGISTERS;
+      double sum = 0;
+      uint64_t zeros = 0;
+      for (auto reg : registers) {
+         sum += std::ldexp(1.0, -reg);
+         zeros += reg == 0;
+      }
+      double alpha = 0.7213 / (1 + 1.079 / m);
+      double estimate = alpha * m * m / sum;
+      if (estimate <= 2.5 * m && zeros) {
+         estimate = m * std::log(static_cast<double>(m) / zeros);
+      }
+      return std::llround(estimate);
+   }
+
+   /// splitmix64, a fixed seed keeps the statistics reproducible
+   uint64_t next_random() {
+      uint64_t z = (random_state += 0x9e3779b97f4a7c15ull);
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+      return z ^ (z >> 31);
+   }
+
+   std::vector<uint8_t> registers;
+   std::vector<double> sample;
+   uint64_t ascending = 0;
+   T last{};
+   uint64_t random_state = 0;
+};
+}  // namespace p2c
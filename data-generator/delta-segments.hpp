@@ -0,0 +1,263 @@
+#pragma once
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "../io.hpp"
+#include "column-statistics.hpp"
+#include "parallel-reader.hpp"
+
+namespace p2c {
+namespace fs = std::filesystem;
+
+/// The segments of a table directory. The `segments` file lists the
+/// directories of the segments relative to the table directory, the main
+/// segment first; without it the table directory itself is the only
+/// segment. Appends write a `delta.<n>` segment, merges a new `main.<n>`
+/// one. The file is replaced atomically under an exclusive lock, readers
+/// see the old or the new list.
+class TableSegments {
+  public:
+   static constexpr const char *MANIFEST = "segments";
+   /// segments replaced by a merge, removed by a later one. Readers lock the
+   /// directories of the segments they list shared, under a shared lock of
+   /// the table; a locked segment stays until no reader holds it
+   static constexpr const char *OBSOLETE = "obsolete";
+
+   /// locks the table until destruction
+   explicit TableSegments(fs::path table_dir) : table_dir(std::move(table_dir)) {
+      lock_fd = ::open((this->table_dir / ".lock").c_str(), O_CREAT | O_RDWR, 0644);
+      if (lock_fd < 0 || ::flock(lock_fd, LOCK_EX) != 0) {
+         throw std::logic_error("Could not lock " + this->table_dir.string() + ": " + strerror(errno));
+      }
+   }
+   TableSegments(const TableSegments &) = delete;
+   ~TableSegments() { ::close(lock_fd); }
+
+   std::vector<std::string> read() const { return read_list(MANIFEST, {"."}); }
+   void write(const std::vector<std::string> &segments) const { write_list(MANIFEST, segments); }
+
+   std::vector<std::string> read_obsolete() const { return read_list(OBSOLETE, {}); }
+   void write_obsolete(const std::vector<std::string> &segments) const { write_list(OBSOLETE, segments); }
+
+   /// unused directory name kind.<n>, numbers grow across deltas and merges
+   std::string next_name(std::string_view kind) const {
+      uint64_t last = 0;
+      for (auto &entry : fs::directory_iterator(table_dir)) {
+         auto name = entry.path().filename().string();
+         for (auto prefix : {"delta.", "main.", ".main."}) {
+            auto len = std::strlen(prefix);
+            if (name.starts_with(prefix) && name.size() > len &&
+                name.find_first_not_of("0123456789", len) == std::string::npos) {
+               last = std::max<uint64_t>(last, std::stoull(name.substr(len)));
+            }
+         }
+      }
+      return std::string(kind) + "." + std::to_string(last + 1);
+   }
+
+   fs::path path_of(const std::string &segment) const { return segment == "." ? table_dir : table_dir / segment; }
+
+   /// deletes the column files of a segment unless a reader locked its
+   /// directory, the table directory itself keeps its subdirectories.
+   /// Returns false if the segment is still in use.
+   bool remove(const std::string &segment) const {
+      int dir_fd = ::open(path_of(segment).c_str(), O_RDONLY | O_DIRECTORY);
+      if (dir_fd >= 0 && ::flock(dir_fd, LOCK_EX | LOCK_NB) != 0) {
+         ::close(dir_fd);
+         return false;
+      }
+      if (segment != ".") {
+         fs::remove_all(table_dir / segment);
+      } else {
+         for (auto &entry : fs::directory_iterator(table_dir)) {
+            auto ext = entry.path().extension();
+            if (entry.is_regular_file() && (ext == ".bin" || ext == ".stats")) {
+               fs::remove(entry.path());
+            }
+         }
+      }
+      if (dir_fd >= 0) {
+         ::close(dir_fd);
+      }
+      return true;
+   }
+
+  private:
+   std::vector<std::string> read_list(const char *file, std::vector<std::string> fallback) const {
+      std::ifstream in(table_dir / file);
+      std::vector<std::string> segments;
+      for (std::string line; std::getline(in, line);) {
+         if (!line.empty()) {
+            segments.push_back(line);
+         }
+      }
+      return segments.empty() ? fallback : segments;
+   }
+
+   void write_list(const char *file, const std::vector<std::string> &segments) const {
+      auto tmp = table_dir / (std::string(file) + ".tmp");
+      {
+         std::ofstream out(tmp);
+         for (auto &segment : segments) {
+            out << segment << "\n";
+         }
+         out.flush();
+         if (!out) {
+            throw std::logic_error("Could not write " + tmp.string());
+         }
+      }
+      fs::rename(tmp, table_dir / file);
+   }
+
+   fs::path table_dir;
+   int lock_fd;
+};
+
+/// Appends the rows of a .tbl file to a table as a new delta segment. The
+/// work is proportional to the appended rows, the main segment is not
+/// touched. Returns the number of appended rows.
+template<typename... Ts>
+uint64_t append_segment(const fs::path &table_dir, const char *input, char const *const *colnames,
+                        unsigned threads) {
+   // written under a private name, published by the rename
+   auto staging = table_dir / (".append." + std::to_string(::getpid()));
+   fs::remove_all(staging);
+   auto rows = ParallelTableReader<Ts...>(staging.string() + "/", input, colnames, threads).read();
+   if (rows == 0) {
+      fs::remove_all(staging);
+      return 0;
+   }
+   TableSegments segments(table_dir);
+   auto list = segments.read();
+   auto name = segments.next_name("delta");
+   fs::rename(staging, table_dir / name);
+   list.push_back(name);
+   segments.write(list);
+   return rows;
+}
+
+/// concatenates a column of the segments in dirs into a column of output,
+/// the statistics are collected while the values are copied
+template<typename T>
+void merge_column(const std::vector<fs::path> &dirs, const std::string &name, const fs::path &output) {
+   using page_t = DataColumn<T>;
+   ColumnStatistics<T> statistics;
+   std::vector<page_t> inputs;
+   uint64_t rows = 0;
+   for (auto &dir : dirs) {
+      inputs.emplace_back((dir / (name + ".bin")).string());
+      rows += inputs.back().size();
+   }
+   auto filename = (output / (name + ".bin")).string();
+   if constexpr (page_t::size_tag::IS_VARIABLE) {
+      uint64_t string_bytes = 0;
+      for (auto &input : inputs) {
+         for (size_t i = 0; i != input.size(); ++i) {
+            string_bytes += input.slot_at(i).size;
+         }
+      }
+      auto size = page_t::GLOBAL_OVERHEAD + rows * page_t::PER_ITEM_OVERHEAD + string_bytes;
+      page_t page(filename.c_str(), O_CREAT | O_RDWR, size);
+      page.data()->count = rows;
+      // strings are written backwards from the end of the file
+      uint64_t offset = size;
+      uint64_t row = 0;
+      for (auto &input : inputs) {
+         for (size_t i = 0; i != input.size(); ++i) {
+            auto value = input[i];
+            offset -= value.size();
+            std::memcpy(reinterpret_cast<char *>(page.data()) + offset, value.data(), value.size());
+            page.slot_at(row++) = {value.size(), offset};
+            statistics.add(value);
+         }
+      }
+      page.flush();
+   } else {
+      page_t page(filename.c_str(), O_CREAT | O_RDWR, rows * sizeof(T));
+      T *out = page.data();
+      for (auto &input : inputs) {
+         for (auto &value : input) {
+            *out++ = value;
+            statistics.add(value);
+         }
+      }
+      page.flush();
+   }
+   statistics.finish();
+   statistics.write((output / (name + ".stats")).string());
+}
+
+/// Compacts the main segment and all deltas of a table into a new main
+/// segment. The columns are copied without locking, appends running in the
+/// meantime stay deltas of the new main segment. Returns the number of
+/// segments merged, 0 if there was nothing to merge or another merge of the
+/// table is running.
+template<typename... Ts>
+size_t merge_segments(const fs::path &table_dir, char const *const *colnames, unsigned threads) {
+   // one merge per table at a time
+   int merge_fd = ::open((table_dir / ".merge").c_str(), O_CREAT | O_RDWR, 0644);
+   if (merge_fd < 0) {
+      throw std::logic_error("Could not open " + (table_dir / ".merge").string() + ": " + strerror(errno));
+   }
+   if (::flock(merge_fd, LOCK_EX | LOCK_NB) != 0) {
+      ::close(merge_fd);
+      return 0;
+   }
+   std::vector<std::string> merged;
+   std::vector<fs::path> dirs;
+   fs::path output;
+   std::string name;
+   {
+      TableSegments segments(table_dir);
+      merged = segments.read();
+      if (merged.size() < 2) {
+         ::close(merge_fd);
+         return 0;
+      }
+      for (auto &segment : merged) {
+         dirs.push_back(segments.path_of(segment));
+      }
+      name = segments.next_name("main");
+      output = table_dir / ("." + name);
+   }
+   fs::remove_all(output);
+   fs::create_directories(output);
+   run_parallel(threads, sizeof...(Ts), [&](size_t col) {
+      [&]<size_t... I>(std::index_sequence<I...>) {
+         ((col == I ? merge_column<std::tuple_element_t<I, std::tuple<Ts...>>>(dirs, colnames[I], output) : void()),
+          ...);
+      }(std::make_index_sequence<sizeof...(Ts)>());
+   });
+   {
+      TableSegments segments(table_dir);
+      // segments still read by a catalog are removed by a later merge
+      std::vector<std::string> obsolete;
+      for (auto &segment : segments.read_obsolete()) {
+         if (!segments.remove(segment)) {
+            obsolete.push_back(segment);
+         }
+      }
+      fs::rename(output, table_dir / name);
+      // deltas appended during the merge follow the merged ones
+      auto list = segments.read();
+      std::vector<std::string> next{name};
+      next.insert(next.end(), list.begin() + merged.size(), list.end());
+      segments.write(next);
+      obsolete.insert(obsolete.end(), merged.begin(), merged.end());
+      segments.write_obsolete(obsolete);
+   }
+   ::close(merge_fd);
+   return merged.size();
+}
+
+}  // namespace p2c
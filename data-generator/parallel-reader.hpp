@@ -0,0 +1,220 @@
+#pragma once
+#include <fcntl.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "../io.hpp"
+#include "column-statistics.hpp"
+#include "csv.hpp"
+#include "table-reader.hpp"
+
+namespace p2c {
+/// calls fn(idx) for every idx below tasks on up to thread_count threads
+template<typename F>
+void run_parallel(unsigned thread_count, size_t tasks, const F &fn) {
+   std::atomic<size_t> next{0};
+   auto threads = std::min<size_t>(thread_count, tasks);
+   std::vector<std::thread> workers;
+   for (size_t t = 0; t < threads; ++t) {
+      workers.emplace_back([&]() {
+         for (size_t idx; (idx = next.fetch_add(1)) < tasks;) {
+            fn(idx);
+         }
+      });
+   }
+   for (auto &worker : workers) {
+      worker.join();
+   }
+}
+
+/// Converts a table with all threads. The inputs are split into chunks at
+/// line boundaries. A first pass counts the rows and string bytes of every
+/// chunk, which fixes where each chunk's values go in the output files; the
+/// second pass parses the chunks again and writes the values directly into
+/// the mapped output columns, so no column is buffered in memory.
+template<typename... Ts>
+struct ParallelTableReader {
+   static constexpr unsigned COLUMNS = sizeof...(Ts);
+   /// chunks per thread, evens out chunks with longer lines
+   static constexpr unsigned CHUNKS_PER_THREAD = 8;
+
+   using pages_t = std::tuple<DataColumn<Ts>...>;
+
+   struct Chunk {
+      csv::CharIter range;
+      /// filled by the first pass
+      uint64_t rows = 0;
+      std::array<uint64_t, COLUMNS> string_bytes{};
+      /// filled from the counts, first row and the end of the chunk's string
+      /// data per column
+      uint64_t first_row = 0;
+      std::array<uint64_t, COLUMNS> string_end{};
+   };
+
+   std::vector<FileMapping<char>> inputs;
+   std::array<std::string, COLUMNS> output_files;
+   std::array<std::string, COLUMNS> statistics_files;
+   unsigned thread_count;
+
+   ParallelTableReader(const std::string &output_prefix, const char *filename, char const *const *colnames,
+                       unsigned thread_count = std::thread::hardware_concurrency())
+       : inputs(TableImport<Ts...>::open(filename)), thread_count(std::max(thread_count, 1u)) {
+      std::filesystem::create_directories(output_prefix);
+      for (auto i = 0u; i != COLUMNS; ++i) {
+         output_files[i] = output_prefix + colnames[i] + ".bin";
+         statistics_files[i] = output_prefix + colnames[i] + ".stats";
+      }
+   }
+
+   uint64_t read() {
+      auto chunks = split();
+      run_parallel(chunks.size(), [&](size_t idx) { count(chunks[idx]); });
+      uint64_t rows = 0;
+      std::array<uint64_t, COLUMNS> string_bytes{};
+      for (auto &chunk : chunks) {
+         chunk.first_row = rows;
+         rows += chunk.rows;
+         for (auto i = 0u; i != COLUMNS; ++i) {
+            // string data is written backwards from the end of the file
+            chunk.string_end[i] = string_bytes[i];
+            string_bytes[i] += chunk.string_bytes[i];
+         }
+      }
+      auto pages = create_pages(rows, string_bytes, chunks);
+      run_parallel(chunks.size(), [&](size_t idx) { parse(chunks[idx], pages); });
+      // statistics and flushing are per column
+      run_parallel(COLUMNS, [&](size_t col) {
+         for_column(col, [&]<size_t I>() {
+            auto &page = std::get<I>(pages);
+            ColumnStatistics<std::tuple_element_t<I, std::tuple<Ts...>>>(page).write(statistics_files[I]);
+            page.flush();
+         });
+      });
+      return rows;
+   }
+   uint64_t operator()() { return read(); }
+
+  private:
+   template<typename F>
+   void run_parallel(size_t tasks, const F &fn) {
+      p2c::run_parallel(thread_count, tasks, fn);
+   }
+
+   /// calls fn.template operator()<I>() for the runtime column index col
+   template<typename F, size_t I = 0>
+   static void for_column(size_t col, const F &fn) {
+      if constexpr (I < COLUMNS) {
+         if (col == I) {
+            fn.template operator()<I>();
+         } else {
+            for_column<F, I + 1>(col, fn);
+         }
+      }
+   }
+
+   std::vector<Chunk> split() {
+      std::vector<Chunk> chunks;
+      for (auto &input : inputs) {
+         const char *begin = input.begin();
+         const char *end = input.end();
+         size_t size = end - begin;
+         size_t parts = std::max<size_t>(1, std::min<size_t>(thread_count * CHUNKS_PER_THREAD, size / 4096));
+         const char *start = begin;
+         for (size_t part = 1; part <= parts && start != end; ++part) {
+            const char *stop = end;
+            if (part != parts) {
+               csv::CharIter pos{std::max(start, begin + size * part / parts), end};
+               csv::find<'\n'>(pos);
+               stop = pos.iter + (pos.iter != end);
+            }
+            if (stop != start) {
+               chunks.push_back(Chunk{csv::CharIter{start, stop}});
+            }
+            start = stop;
+         }
+      }
+      return chunks;
+   }
+
+   static const std::vector<unsigned> &all_columns() {
+      static const std::vector<unsigned> columns = [] {
+         std::vector<unsigned> columns(COLUMNS);
+         for (auto i = 0u; i != COLUMNS; ++i) {
+            columns[i] = i;
+         }
+         return columns;
+      }();
+      return columns;
+   }
+
+   static void count(Chunk &chunk) {
+      auto pos = chunk.range;
+      while (csv::read_line<delim>(pos, all_columns(), [&](unsigned col, csv::CharIter &pos) {
+         auto start = pos.iter;
+         csv::find_either<delim, '\n'>(pos);
+         for_column(col, [&]<size_t I>() {
+            if constexpr (std::is_same_v<std::tuple_element_t<I, std::tuple<Ts...>>, std::string_view>) {
+               chunk.string_bytes[I] += pos.iter - start;
+            }
+         });
+      })) {
+         ++chunk.rows;
+      }
+   }
+
+   pages_t create_pages(uint64_t rows, const std::array<uint64_t, COLUMNS> &string_bytes, std::vector<Chunk> &chunks) {
+      return [&]<size_t... I>(std::index_sequence<I...>) {
+         return pages_t{create_page<I>(rows, string_bytes[I], chunks)...};
+      }(std::make_index_sequence<COLUMNS>());
+   }
+
+   template<size_t I>
+   auto create_page(uint64_t rows, uint64_t string_bytes, std::vector<Chunk> &chunks) {
+      using page_t = DataColumn<std::tuple_element_t<I, std::tuple<Ts...>>>;
+      if constexpr (page_t::size_tag::IS_VARIABLE) {
+         auto size = page_t::GLOBAL_OVERHEAD + rows * page_t::PER_ITEM_OVERHEAD + string_bytes;
+         page_t page(output_files[I].c_str(), O_CREAT | O_RDWR, size);
+         page.data()->count = rows;
+         for (auto &chunk : chunks) {
+            chunk.string_end[I] = size - chunk.string_end[I];
+         }
+         return page;
+      } else {
+         return page_t(output_files[I].c_str(), O_CREAT | O_RDWR, rows * sizeof(typename page_t::value_type));
+      }
+   }
+
+   static void parse(Chunk &chunk, pages_t &pages) {
+      auto pos = chunk.range;
+      auto row = chunk.first_row;
+      auto string_end = chunk.string_end;
+      while (csv::read_line<delim>(pos, all_columns(), [&](unsigned col, csv::CharIter &pos) {
+         for_column(col, [&]<size_t I>() {
+            using value_t = std::tuple_element_t<I, std::tuple<Ts...>>;
+            auto &page = std::get<I>(pages);
+            csv::Parser<value_t> parser;
+            auto value = parser.template parse_value<delim>(pos);
+            if constexpr (std::is_same_v<value_t, std::string_view>) {
+               auto &offset = string_end[I];
+               offset -= value.size();
+               std::memcpy(reinterpret_cast<char *>(page.data()) + offset, value.data(), value.size());
+               page.slot_at(row) = {value.size(), offset};
+            } else {
+               page.data()[row] = value;
+            }
+         });
+      })) {
+         ++row;
+      }
+   }
+};
+}  // namespace p2c
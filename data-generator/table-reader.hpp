@@ -3,10 +3,12 @@
 #include <fcntl.h>
 
 #include <filesystem>
+#include <ostream>
 #include <string>
 #include <vector>
 
 #include "../io.hpp"
+#include "column-statistics.hpp"
 #include "csv.hpp"
 
 namespace p2c {
@@ -54,6 +56,8 @@ struct ColumnOutput {
       }
       return page;
    }
+
+   void write_statistics(const char *filename) const { ColumnStatistics<T>(items).write(filename); }
 };
 
 template<typename... Ts>
@@ -133,6 +137,7 @@ template<typename... Ts>
 struct TableReader : TableImport<Ts...> {
    using super_t = TableImport<Ts...>;
    std::array<std::string, sizeof...(Ts)> output_files;
+   std::array<std::string, sizeof...(Ts)> statistics_files;
 
    TableReader(const std::string &output_prefix, const char *filename, char const *const *colnames)
        : super_t(filename) {
@@ -140,15 +145,37 @@ struct TableReader : TableImport<Ts...> {
       std::filesystem::create_directories(output_prefix);
       this->fold_outputs(0, [&](const auto &output, unsigned idx, unsigned num, unsigned v) {
          output_files[idx] = output_prefix + colnames[idx] + ".bin";
+         statistics_files[idx] = output_prefix + colnames[idx] + ".stats";
          return 0;
       });
    }
 
+   // type names of the engine's TypeEnum
+   template<typename T>
+   static constexpr char const *schema_type() {
+      constexpr char const *type_names[] = {"Integer", "Double", "Char", "String", "BigInt", "Bool", "Date"};
+      // int64_t shares the Integer tag
+      if constexpr (std::is_same_v<T, int64_t>) {
+         return "BigInt";
+      } else {
+         return type_names[tindex(type_tag<T>::tag)];
+      }
+   }
+
+   // one line of the schema manifest the engine reads
+   static void write_schema(std::ostream &out, const char *table, char const *const *colnames) {
+      unsigned idx = 0;
+      out << table;
+      ((out << ' ' << colnames[idx++] << ':' << schema_type<Ts>()), ...);
+      out << '\n';
+   }
+
    ~TableReader() {
       // write to files
       this->fold_outputs(0, [&](const auto &output, unsigned idx, unsigned num, unsigned v) {
          auto page = output.make_page(output_files[idx].c_str());
          page.flush();
+         output.write_statistics(statistics_files[idx].c_str());
          // for (auto item : page) {
          //   std::cout << "idx " << idx << " item " << item << std::endl;
          // }
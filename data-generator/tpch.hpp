@@ -5,6 +5,7 @@
 
 #include "../types.hpp"
 #include "csv.hpp"
+#include "parallel-reader.hpp"
 #include "table-reader.hpp"
 
 namespace p2c {
@@ -32,6 +33,7 @@ template<typename... Ts>
 struct TableDef {
    using import = TableImport<Ts...>;
    using reader = TableReader<Ts...>;
+   using parallel_reader = ParallelTableReader<Ts...>;
    using columns = typename import::tuple_type;
 
    template<template<typename> class Container>
@@ -10,6 +10,7 @@
 #include "runtime/Hashtables.h"
 #include "runtime/Tuplebuffer.h"
 
+#include <atomic>
 #include <concepts>
 #include <cstdint>
 #include <llvm/ADT/ArrayRef.h>
@@ -62,6 +63,10 @@ public:
 
   ValueRef<llvm::Function> createCmpFunction();
 
+  /// count a tuple in a pipeline local counter that is added to counter
+  /// once per pipeline invocation, i.e. once per morsel in scan pipelines
+  void createCounterIncrement(std::atomic<uint64_t> *counter);
+
   ///-------------------------------------------------------------------------------
   /// Memory Accesses
   /// ------------------------------------------------------------------------------
@@ -41,6 +41,10 @@ struct Exp {
   /// check Semantics before compiling(might add new nodes to fix issues)
   virtual Type &checkSemantics() = 0;
   virtual Type &getType() = 0;
+
+  /// true if evaluating the expression may trap, like an integer division
+  /// by zero, so it must not run ahead of the conditions guarding it
+  virtual bool canTrap() { return false; }
 };
 
 struct CastExp : public Exp {
@@ -60,6 +64,8 @@ struct CastExp : public Exp {
   Type &getType() override { return to; }
 
   IUSet getIUs() override { return child->getIUs(); }
+
+  bool canTrap() override { return child->canTrap(); }
 };
 
 template <typename T> struct ConstExp : public Exp {
@@ -164,6 +170,8 @@ struct LikeExp : public Exp {
   Type &getType() override { return type; }
   IUSet getIUs() override { return value->getIUs(); }
 
+  bool canTrap() override { return value->canTrap(); }
+
   ~LikeExp() override = default;
 };
 
@@ -230,6 +238,13 @@ template <size_t N> struct CaseExp : public Exp {
     return conds[0]->getIUs() | trueExps[0]->getIUs() | falseExp->getIUs();
   }
 
+  bool canTrap() override {
+    for (size_t i = 0; i < N; ++i)
+      if (conds[i]->canTrap() || trueExps[i]->canTrap())
+        return true;
+    return falseExp->canTrap();
+  }
+
   ~CaseExp() override = default;
 };
 
@@ -245,6 +260,7 @@ struct UnaryExp : public Exp {
   Type &checkSemantics() override { return exp->checkSemantics(); }
   Type& getType() override {return exp->getType(); }
   IUSet getIUs() override { return exp->getIUs(); }
+  bool canTrap() override { return exp->canTrap(); }
   ~UnaryExp() override = default;
 };
 
@@ -277,6 +293,13 @@ struct BinOpExp : public Exp {
   Type &getType() override { return lhs->getType(); }
 
   IUSet getIUs() override { return lhs->getIUs() | rhs->getIUs(); }
+
+  /// integer divisions trap on a zero divisor
+  bool canTrap() override {
+    if (op == BinOp::Div && lhs->getType().typeEnum != TypeEnum::Double)
+      return true;
+    return lhs->canTrap() || rhs->canTrap();
+  }
   ~BinOpExp() override = default;
 };
 
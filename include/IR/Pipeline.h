@@ -1,14 +1,19 @@
 #pragma once
 #include "IR/Defs.h"
 #include "operators/OperatorContext.h"
+#include "runtime/Cancellation.h"
+#include "runtime/PerfCounters.h"
+#include "runtime/Spill.h"
 #include "SymbolManager.h"
 
 #include <cassert>
+#include <chrono>
 #include <concepts>
 #include <cstdint>
 #include <memory>
 #include <string_view>
 #include <utility>
+#include <vector>
 #include <llvm/ADT/SmallVector.h>
 #include <llvm/IR/DerivedTypes.h>
 #include <llvm/IR/Function.h>
@@ -20,11 +25,15 @@
 namespace p2cllvm {
 
 enum class PipelineType { Scan, Default, Continuation};
-struct TPCH;
+class Catalog;
 struct Pipeline {
   PipelineType type;
   std::string name;
   llvm::SmallVector<void *, 8> args;
+  /// wall time of the last execution if the scheduler measures it
+  std::chrono::nanoseconds time{0};
+  /// hardware events of the last execution, summed over all workers
+  PerfSample counters;
   Pipeline(PipelineType ptype, ValueRef<llvm::Function> pipeline, std::string_view name)
       : type(ptype), name(name) {}
 
@@ -42,6 +51,8 @@ struct ScanPipeline : public Pipeline {
                  std::string_view name, size_t tableIndex)
         : Pipeline(PipelineType::Scan, pipeline, name), tableIndex(tableIndex) {}
     size_t tableIndex;
+    /// columns of the table the pipeline reads
+    std::vector<uint32_t> columns;
     ~ScanPipeline() override = default;
 };
 
@@ -52,13 +63,18 @@ struct Query {
   SymbolManager symbolManager;
   std::unique_ptr<llvm::LLVMContext> context;
   std::unique_ptr<llvm::Module> module;
-  TPCH& dbref;
-
-  uint64_t getLineItemCount() const;
+  Catalog& dbref;
+  /// shared by all operators that materialize tuples
+  MemoryBudget budget{MemoryBudget::fromEnv()};
+  /// stops the query between morsels, see QueryScheduler::execQuery
+  CancellationToken cancellation;
+  /// reorder the conjuncts of selections by their sampled selectivity and
+  /// cost, the driver sets it from the adaptive environment variable
+  bool adaptive = false;
 
   unsigned pipelineIndex = 0;
 
-  Query(TPCH& db, std::string_view name = "query")
+  Query(Catalog& db, std::string_view name = "query")
       : dbref(db), context(std::make_unique<llvm::LLVMContext>()), module(std::make_unique<llvm::Module>(name, *context)) {}
 
   template <PipelineType ptype>
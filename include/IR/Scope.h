@@ -4,6 +4,8 @@
 #include "operators/Iu.h"
 
 #include <algorithm>
+#include <atomic>
+#include <cstdint>
 #include <llvm/ADT/DenseMap.h>
 #include <llvm/ADT/SmallVector.h>
 #include <llvm/IR/BasicBlock.h>
@@ -19,6 +21,11 @@ struct Scope {
   llvm::DenseMap<IU *, ValueRef<>> iuValues;
   llvm::DenseMap<IU *, ValueRef<>> iuPtrs;
   llvm::SmallVector<LoopInfo, 4> loopInfo;
+  /// pipeline local tuple counters and the shared counters they are added to
+  /// when the pipeline returns
+  llvm::SmallVector<std::pair<ValueRef<llvm::AllocaInst>, ValueRef<>>, 4>
+      counters;
+  llvm::SmallVector<std::atomic<uint64_t> *, 4> counterTargets;
 
   inline ValueRef<> updatePtr(IU *iu, ValueRef<>ptr) { iuPtrs[iu] = ptr; 
     return ptr;
@@ -0,0 +1,498 @@
+#pragma once
+
+#include "IR/ColTypes.h"
+#include "IR/Defs.h"
+#include "IR/Types.h"
+#include "internal/BaseTypes.h"
+#include "internal/File.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <fcntl.h>
+#include <fstream>
+#include <istream>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Type.h>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+namespace p2cllvm {
+struct ColumnInfo {
+  std::string name;
+  TypeEnum type;
+};
+
+struct TableInfo {
+  std::string name;
+  std::vector<ColumnInfo> columns;
+
+  /// position of the column in the table struct
+  std::optional<uint32_t> find(std::string_view column) const {
+    for (uint32_t i = 0; i < columns.size(); ++i)
+      if (columns[i].name == column)
+        return i;
+    return std::nullopt;
+  }
+
+  uint32_t getIndex(std::string_view column) const {
+    if (auto idx = find(column))
+      return *idx;
+    throw std::runtime_error("Unknown column " + std::string(column) +
+                             " in table " + name);
+  }
+};
+
+/// Tables and columns of a data directory, read from its `schema` manifest.
+/// Every line names a table followed by its columns as name:Type, with the
+/// type names of TypeEnum, e.g.
+///   region r_regionkey:Integer r_name:String r_comment:String
+/// Directories without a manifest hold TPC-H.
+class Schema {
+public:
+  static constexpr std::string_view manifest = "schema";
+
+  static Schema parse(std::istream &in, const std::string &source) {
+    Schema schema;
+    std::string line;
+    while (std::getline(in, line)) {
+      std::istringstream words(line);
+      TableInfo table;
+      if (!(words >> table.name) || table.name.front() == '#')
+        continue;
+      std::string column;
+      while (words >> column) {
+        auto colon = column.find(':');
+        if (colon == std::string::npos)
+          throw std::runtime_error("Missing type of " + column + " in " +
+                                   source);
+        table.columns.push_back(
+            {column.substr(0, colon), parseType(column.substr(colon + 1))});
+      }
+      if (table.columns.empty())
+        throw std::runtime_error("Table " + table.name + " in " + source +
+                                 " has no columns");
+      schema.tables.push_back(std::move(table));
+    }
+    return schema;
+  }
+
+  static Schema load(const std::string &dir) {
+    std::string filePath = dir + "/" + std::string(manifest);
+    std::ifstream in(filePath);
+    if (in)
+      return parse(in, filePath);
+    return tpch();
+  }
+
+  /// the built-in TPC-H schema, which the TPC-H plans are written against
+  static const Schema &tpch() {
+    static const Schema schema = []() {
+      std::istringstream in{std::string(tpchManifest)};
+      return parse(in, "TPC-H");
+    }();
+    return schema;
+  }
+
+  std::optional<size_t> find(std::string_view table) const {
+    for (size_t i = 0; i < tables.size(); ++i)
+      if (tables[i].name == table)
+        return i;
+    return std::nullopt;
+  }
+
+  size_t getTableIndex(std::string_view table) const {
+    if (auto idx = find(table))
+      return *idx;
+    throw std::runtime_error("Unknown table " + std::string(table));
+  }
+
+  const TableInfo &getTable(size_t idx) const { return tables.at(idx); }
+  const TableInfo &getTable(std::string_view table) const {
+    return tables[getTableIndex(table)];
+  }
+
+  size_t size() const { return tables.size(); }
+
+private:
+  static TypeEnum parseType(std::string_view name) {
+    for (size_t i = 0; i < typeNames.size(); ++i)
+      if (typeNames[i] == name && i != static_cast<size_t>(TypeEnum::Undefined))
+        return static_cast<TypeEnum>(i);
+    throw std::runtime_error("Unknown column type " + std::string(name));
+  }
+
+  static constexpr std::string_view tpchManifest =
+      "part p_partkey:Integer p_name:String p_mfgr:String p_brand:String "
+      "p_type:String p_size:Integer p_container:String p_retailprice:Double "
+      "p_comment:String\n"
+      "supplier s_suppkey:Integer s_name:String s_address:String "
+      "s_nationkey:Integer s_phone:String s_acctbal:Double s_comment:String\n"
+      "partsupp ps_partkey:Integer ps_suppkey:Integer ps_availqty:Integer "
+      "ps_supplycost:Double ps_comment:String\n"
+      "customer c_custkey:Integer c_name:String c_address:String "
+      "c_nationkey:Integer c_phone:String c_acctbal:Double "
+      "c_mktsegment:String c_comment:String\n"
+      "orders o_orderkey:BigInt o_custkey:Integer o_orderstatus:Char "
+      "o_totalprice:Double o_orderdate:Date o_orderpriority:String "
+      "o_clerk:String o_shippriority:Integer o_comment:String\n"
+      "lineitem l_orderkey:BigInt l_partkey:Integer l_suppkey:Integer "
+      "l_linenumber:Integer l_quantity:Double l_extendedprice:Double "
+      "l_discount:Double l_tax:Double l_returnflag:Char l_linestatus:Char "
+      "l_shipdate:Date l_commitdate:Date l_receiptdate:Date "
+      "l_shipinstruct:String l_shipmode:String l_comment:String\n"
+      "nation n_nationkey:Integer n_name:String n_regionkey:Integer "
+      "n_comment:String\n"
+      "region r_regionkey:Integer r_name:String r_comment:String\n";
+
+  std::vector<TableInfo> tables;
+};
+
+/// How the pages of a column are loaded when it is mapped. Populate maps
+/// with MAP_POPULATE, the columns of one scan in parallel; WillNeed starts
+/// readahead with madvise and returns.
+enum class Prefault { None, Populate, WillNeed };
+
+inline std::optional<Prefault> parsePrefault(std::string_view name) {
+  if (name == "none")
+    return Prefault::None;
+  if (name == "populate")
+    return Prefault::Populate;
+  if (name == "willneed")
+    return Prefault::WillNeed;
+  return std::nullopt;
+}
+
+/// The tables of a data directory and its schema. Opening reads the schema
+/// and maps nothing, a Scan looks up its table in the Catalog of the query
+/// and maps the columns it reads while its code is generated.
+///
+/// A table is a list of segments with the same columns. Appended rows go
+/// into delta segments until a merge compacts them into a new main
+/// segment. The `segments` file of a table directory lists the directories
+/// of its segments relative to the table, main first; without it the table
+/// directory itself is the only segment. The list is read once per Catalog,
+/// when the table is first used, and the directory of every listed segment
+/// is locked shared until the Catalog is destroyed. A merge deletes the
+/// segments replaced by the merge before it unless a Catalog still holds
+/// such a lock, so the column files can be opened when they are first used.
+class Catalog {
+public:
+  static constexpr std::string_view segmentManifest = "segments";
+
+  explicit Catalog(std::string_view path)
+      : path(path), schema(Schema::load(this->path)) {
+    tables.resize(schema.size());
+  }
+
+  Catalog(const Catalog &) = delete;
+  Catalog &operator=(const Catalog &) = delete;
+
+  ~Catalog() {
+    for (auto &table : tables)
+      for (auto &segment : table.segments)
+        for (size_t i = 0; i < segment.columns.size(); ++i) {
+          if (segment.columns[i].data)
+            ::munmap(segment.columns[i].data, segment.bytes[i]);
+          if (segment.files[i] != -1)
+            ::close(segment.files[i]);
+        }
+    for (auto &table : tables)
+      for (auto &segment : table.segments)
+        if (segment.dirFile != -1)
+          ::close(segment.dirFile);
+  }
+
+  static std::string defaultPath() {
+    const char *path = std::getenv("tpchpath");
+    return path ? path : "../data-generator/output";
+  }
+
+  const Schema &getSchema() const { return schema; }
+
+  /// segment directories of a table relative to its directory, main first
+  static std::vector<std::string> readSegments(const std::string &tableDir) {
+    std::ifstream in(tableDir + "/" + std::string(segmentManifest));
+    std::vector<std::string> segments;
+    std::string line;
+    while (std::getline(in, line))
+      if (!line.empty())
+        segments.push_back(line);
+    if (segments.empty())
+      segments.emplace_back(".");
+    return segments;
+  }
+
+  const std::string &getPath() const { return path; }
+
+  /// directory of the main segment, which holds the column statistics
+  std::string getMainPath(size_t idx) {
+    std::lock_guard lock(m);
+    return getMappedTable(idx).segments.front().dir;
+  }
+
+  /// directories of all segments in the order of getSegments
+  std::vector<std::string> getSegmentPaths(size_t idx) {
+    std::lock_guard lock(m);
+    std::vector<std::string> paths;
+    for (auto &segment : getMappedTable(idx).segments)
+      paths.push_back(segment.dir);
+    return paths;
+  }
+
+  /// the file of a column in every segment in the order of getSegments,
+  /// opened on first use and owned by the Catalog
+  std::vector<int> getColumnFiles(size_t idx, uint32_t column) {
+    std::lock_guard lock(m);
+    auto &name = schema.getTable(idx).columns.at(column).name;
+    std::vector<int> files;
+    for (auto &segment : getMappedTable(idx).segments)
+      files.push_back(columnFile(segment, column, name));
+    return files;
+  }
+
+  void setPrefault(Prefault mode) { prefault = mode; }
+  Prefault getPrefault() const { return prefault; }
+
+  /// maps the given columns of every segment of a table unless they already
+  /// are
+  void mapColumns(size_t idx, const std::vector<uint32_t> &columns) {
+    std::lock_guard lock(m);
+    auto &info = schema.getTable(idx);
+    auto &table = getMappedTable(idx);
+    std::vector<std::pair<Segment *, uint32_t>> missing;
+    for (auto &segment : table.segments)
+      for (uint32_t column : columns) {
+        std::pair<Segment *, uint32_t> entry{&segment, column};
+        if (!segment.columns.at(column).data &&
+            std::find(missing.begin(), missing.end(), entry) == missing.end())
+          missing.push_back(entry);
+      }
+    if (prefault != Prefault::Populate || missing.size() < 2) {
+      for (auto [segment, column] : missing)
+        map(info, *segment, column);
+      return;
+    }
+    /// populating reads the whole column, overlap the reads
+    std::vector<std::exception_ptr> errors(missing.size());
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < missing.size(); ++i)
+      threads.emplace_back([&, i]() {
+        try {
+          map(info, *missing[i].first, missing[i].second);
+        } catch (...) {
+          errors[i] = std::current_exception();
+        }
+      });
+    for (auto &thread : threads)
+      thread.join();
+    for (auto &error : errors)
+      if (error)
+        std::rethrow_exception(error);
+  }
+
+  /// struct of ColumnMappings and tuple count of every segment of the table,
+  /// main first, only the columns passed to mapColumns are mapped
+  std::vector<std::pair<void *, size_t>> getSegments(size_t idx) {
+    std::lock_guard lock(m);
+    auto &info = schema.getTable(idx);
+    std::vector<std::pair<void *, size_t>> result;
+    for (auto &segment : getMappedTable(idx).segments) {
+      if (!segment.tupleCount)
+        segment.tupleCount = countTuples(info, segment);
+      result.emplace_back(segment.columns.data(), *segment.tupleCount);
+    }
+    return result;
+  }
+
+  /// tuple count over all segments
+  size_t getTupleCount(size_t idx) {
+    size_t count = 0;
+    for (auto [ptr, segmentCount] : getSegments(idx))
+      count += segmentCount;
+    return count;
+  }
+
+  /// number of mapped columns over all segments of all tables
+  size_t getMappedColumns() {
+    std::lock_guard lock(m);
+    size_t mapped = 0;
+    for (auto &table : tables)
+      for (auto &segment : table.segments)
+        for (auto &column : segment.columns)
+          mapped += column.data != nullptr;
+    return mapped;
+  }
+
+  /// bytes per value of a fixed size type, 0 for strings
+  static size_t fixedWidth(TypeEnum type) {
+    switch (type) {
+    case TypeEnum::Integer:
+    case TypeEnum::Date:
+      return sizeof(int32_t);
+    case TypeEnum::BigInt:
+      return sizeof(int64_t);
+    case TypeEnum::Double:
+      return sizeof(double);
+    case TypeEnum::Char:
+    case TypeEnum::Bool:
+      return sizeof(char);
+    default:
+      return 0;
+    }
+  }
+
+  /// the layout of a segment, one ColumnMapping per column
+  TypeRef<llvm::StructType> createTableType(llvm::LLVMContext &context,
+                                            size_t idx) const {
+    auto &table = schema.getTable(idx);
+    return getOrCreateType(context, table.name, [&]() {
+      std::vector<llvm::Type *> types;
+      for (auto &column : table.columns)
+        types.push_back(createColumnType(context, column.type));
+      return llvm::StructType::create(context, types, table.name);
+    });
+  }
+
+private:
+  /// untyped ColumnMapping, the generated code only reads data
+  struct MappedColumn {
+    void *data = nullptr;
+    uint64_t size = 0;
+  };
+  static_assert(sizeof(MappedColumn) == sizeof(ColumnMapping<int32_t>));
+
+  struct Segment {
+    std::string dir;
+    std::vector<MappedColumn> columns;
+    /// the directory, locked shared such that no merge deletes it
+    int dirFile = -1;
+    /// column files, -1 until first used
+    std::vector<int> files;
+    /// length of each mapping
+    std::vector<size_t> bytes;
+    std::optional<uint64_t> tupleCount;
+  };
+
+  struct MappedTable {
+    /// empty until the table is first used
+    std::vector<Segment> segments;
+  };
+
+  MappedTable &getMappedTable(size_t idx) {
+    auto &table = tables.at(idx);
+    if (table.segments.empty()) {
+      auto &info = schema.getTable(idx);
+      std::string tableDir = path + "/" + info.name;
+      /// appends and merges lock the table exclusively, so no merge deletes
+      /// a listed segment before its directory is locked
+      int lock = ::open((tableDir + "/.lock").c_str(), O_RDONLY);
+      if (lock != -1)
+        ::flock(lock, LOCK_SH);
+      for (auto &dir : readSegments(tableDir)) {
+        auto &segment = table.segments.emplace_back();
+        segment.dir = dir == "." ? tableDir : tableDir + "/" + dir;
+        segment.columns.resize(info.columns.size());
+        segment.bytes.resize(info.columns.size());
+        segment.files.resize(info.columns.size(), -1);
+        segment.dirFile = ::open(segment.dir.c_str(), O_RDONLY | O_DIRECTORY);
+        if (segment.dirFile != -1)
+          ::flock(segment.dirFile, LOCK_SH);
+      }
+      if (lock != -1)
+        ::close(lock);
+    }
+    return table;
+  }
+
+  /// opens the file of a column on first use, safe to call for different
+  /// columns or segments at the same time
+  int columnFile(Segment &segment, uint32_t idx,
+                 const std::string &name) const {
+    if (segment.files[idx] == -1)
+      segment.files[idx] =
+          ::open((segment.dir + "/" + name + ".bin").c_str(), O_RDONLY);
+    if (segment.files[idx] == -1)
+      throw std::runtime_error("Failed to open file: " + segment.dir + "/" +
+                               name + ".bin");
+    return segment.files[idx];
+  }
+
+  /// safe to call for different columns or segments at the same time
+  void map(const TableInfo &info, Segment &segment, uint32_t idx) {
+    int flags = prefault == Prefault::Populate ? MAP_POPULATE : 0;
+    auto &column = segment.columns[idx];
+    auto &name = info.columns[idx].name;
+    int fd = columnFile(segment, idx, name);
+    switch (info.columns[idx].type) {
+    case TypeEnum::Integer:
+    case TypeEnum::Date:
+      std::tie(column.data, column.size) =
+          ColumnMapping<int32_t>::load_columns(fd, flags);
+      segment.bytes[idx] = column.size * sizeof(int32_t);
+      break;
+    case TypeEnum::BigInt:
+      std::tie(column.data, column.size) =
+          ColumnMapping<int64_t>::load_columns(fd, flags);
+      segment.bytes[idx] = column.size * sizeof(int64_t);
+      break;
+    case TypeEnum::Double:
+      std::tie(column.data, column.size) =
+          ColumnMapping<double>::load_columns(fd, flags);
+      segment.bytes[idx] = column.size * sizeof(double);
+      break;
+    case TypeEnum::Char:
+    case TypeEnum::Bool:
+      std::tie(column.data, column.size) =
+          ColumnMapping<char>::load_columns(fd, flags);
+      segment.bytes[idx] = column.size;
+      break;
+    case TypeEnum::String:
+      std::tie(column.data, column.size) =
+          ColumnMapping<StringView>::load_columns(fd, flags);
+      segment.bytes[idx] = column.size;
+      break;
+    default:
+      throw std::runtime_error("Unsupported type of column " + name);
+    }
+    if (prefault == Prefault::WillNeed)
+      ::madvise(column.data, segment.bytes[idx], MADV_WILLNEED);
+  }
+
+  /// the file size of a fixed size column, a string column has to be mapped
+  uint64_t countTuples(const TableInfo &info, Segment &segment) {
+    for (uint32_t i = 0; i < info.columns.size(); ++i) {
+      size_t width = fixedWidth(info.columns[i].type);
+      if (segment.columns[i].data && width)
+        return segment.columns[i].size;
+      if (!width)
+        continue;
+      struct stat st;
+      ::fstat(columnFile(segment, i, info.columns[i].name), &st);
+      return st.st_size / width;
+    }
+    if (!segment.columns.front().data)
+      map(info, segment, 0);
+    return static_cast<String *>(segment.columns.front().data)->count;
+  }
+
+  std::string path;
+  Schema schema;
+  Prefault prefault = Prefault::None;
+  std::vector<MappedTable> tables;
+  std::mutex m;
+};
+} // namespace p2cllvm
@@ -5,16 +5,27 @@
 #include "IR/SymbolManager.h"
 
 #include <cassert>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
 #include <cstdint>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
 #include <string_view>
+#include <unistd.h>
+#include <vector>
 #include <llvm/ADT/STLExtras.h>
 #include <llvm/ADT/iterator_range.h>
 #include <llvm/Analysis/CGSCCPassManager.h>
 #include <llvm/Analysis/LoopAnalysisManager.h>
 #include <llvm/ExecutionEngine/JITEventListener.h>
 #include <llvm/ExecutionEngine/JITSymbol.h>
+#include <llvm/ExecutionEngine/Orc/CompileUtils.h>
 #include <llvm/ExecutionEngine/Orc/Core.h>
+#include <llvm/ExecutionEngine/Orc/IRCompileLayer.h>
 #include <llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h>
 #include <llvm/ExecutionEngine/Orc/LLJIT.h>
 #include <llvm/ExecutionEngine/Orc/Mangling.h>
@@ -24,6 +35,8 @@
 #include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
 #include <llvm/ExecutionEngine/SectionMemoryManager.h>
 #include <llvm/IR/BasicBlock.h>
+#include <llvm/Object/ObjectFile.h>
+#include <llvm/Object/SymbolSize.h>
 #include <llvm/IR/Dominators.h>
 #include <llvm/IR/Function.h>
 #include <llvm/IR/IRBuilder.h>
@@ -32,13 +45,17 @@
 #include <llvm/IR/Instructions.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Module.h>
+#include <llvm/IR/PassInstrumentation.h>
 #include <llvm/IR/PassManager.h>
 #include <llvm/IR/Verifier.h>
 #include <llvm/Passes/PassBuilder.h>
 #include <llvm/Support/Casting.h>
 #include <llvm/Support/Error.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/MemoryBuffer.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Target/TargetMachine.h>
+#include <llvm/TargetParser/SubtargetFeature.h>
 #include <llvm/Transforms/InstCombine/InstCombine.h>
 #include <llvm/Transforms/Scalar/GVN.h>
 #include <llvm/Transforms/Scalar/Reassociate.h>
@@ -90,11 +107,127 @@ public:
   static bool isRequired() { return true; }
 };
 
+/// Where the compile time of a query goes and how much code each function
+/// became. Filled by QueryCompiler if reporting is enabled.
+struct CompilationReport {
+  struct Pass {
+    std::string name;
+    /// analyses run inside the passes requesting them, their time overlaps
+    bool analysis;
+    size_t runs = 0;
+    std::chrono::nanoseconds time{0};
+  };
+  struct Function {
+    std::string name;
+    size_t instructionsBefore = 0;
+    size_t instructionsAfter = 0;
+    uint64_t codeSize = 0;
+  };
+
+  std::chrono::nanoseconds optimization{0};
+  std::chrono::nanoseconds codegen{0};
+  std::chrono::nanoseconds link{0};
+  std::vector<Pass> passes;
+  std::vector<Function> functions;
+
+  void addPass(llvm::StringRef name, bool analysis,
+               std::chrono::nanoseconds time) {
+    auto it = llvm::find_if(passes, [&](const Pass &pass) {
+      return pass.name == name && pass.analysis == analysis;
+    });
+    if (it == passes.end())
+      it = passes.insert(passes.end(), Pass{name.str(), analysis});
+    ++it->runs;
+    it->time += time;
+  }
+
+  Function &getFunction(llvm::StringRef name) {
+    auto it = llvm::find_if(
+        functions, [&](const Function &fn) { return fn.name == name; });
+    if (it == functions.end())
+      it = functions.insert(functions.end(), Function{name.str()});
+    return *it;
+  }
+
+  void toJSON(llvm::json::OStream &json) const {
+    auto ms = [](std::chrono::nanoseconds time) { return time.count() / 1e6; };
+    json.object([&]() {
+      json.attribute("optimize_ms", ms(optimization));
+      json.attribute("codegen_ms", ms(codegen));
+      json.attribute("link_ms", ms(link));
+      json.attributeArray("passes", [&]() {
+        for (auto &pass : passes) {
+          json.object([&]() {
+            json.attribute(pass.analysis ? "analysis" : "pass", pass.name);
+            json.attribute("runs", static_cast<int64_t>(pass.runs));
+            json.attribute("ms", ms(pass.time));
+          });
+        }
+      });
+      json.attributeArray("functions", [&]() {
+        for (auto &fn : functions) {
+          json.object([&]() {
+            json.attribute("function", fn.name);
+            json.attribute("instructions_before",
+                           static_cast<int64_t>(fn.instructionsBefore));
+            json.attribute("instructions_after",
+                           static_cast<int64_t>(fn.instructionsAfter));
+            json.attribute("code_bytes", static_cast<int64_t>(fn.codeSize));
+          });
+        }
+      });
+    });
+  }
+};
+
+/// fast: the hand picked function passes, cheapest to compile
+/// default: the PassBuilder O2 pipeline with loop passes and vectorizers
+/// aggressive: the PassBuilder O3 pipeline
+enum class OptLevel { Fast, Default, Aggressive };
+
+inline std::optional<OptLevel> parseOptLevel(std::string_view name) {
+  if (name == "fast")
+    return OptLevel::Fast;
+  if (name == "default")
+    return OptLevel::Default;
+  if (name == "aggressive")
+    return OptLevel::Aggressive;
+  return std::nullopt;
+}
+
+inline llvm::StringRef getName(OptLevel level) {
+  switch (level) {
+  case OptLevel::Fast:
+    return "fast";
+  case OptLevel::Default:
+    return "default";
+  case OptLevel::Aggressive:
+    return "aggressive";
+  }
+  llvm_unreachable("unknown optimization level");
+}
+
+/// overrides of the host CPU the JIT generates code for, features are given
+/// like "+avx2,-avx512f"
+struct TargetOptions {
+  /// empty keeps the host CPU, otherwise the host features are dropped
+  std::string cpu;
+  /// added to the features of the CPU
+  std::string features;
+};
+
 class Optimizer {
 public:
-  void run(llvm::Module &module) {
+  void run(llvm::Module &module, CompilationReport *report = nullptr) {
     /// apparently we need all
-    llvm::PassBuilder pb;
+    llvm::PassInstrumentationCallbacks pic;
+    if (report)
+      instrument(pic, *report);
+    llvm::PipelineTuningOptions tuning;
+    tuning.LoopVectorization = level != OptLevel::Fast;
+    tuning.SLPVectorization = level != OptLevel::Fast;
+    /// the target machine provides the cost models of the vectorizers
+    llvm::PassBuilder pb(targetMachine, tuning, std::nullopt, &pic);
     llvm::FunctionAnalysisManager fam;
     llvm::LoopAnalysisManager lam;
     llvm::CGSCCAnalysisManager cam;
@@ -105,11 +238,24 @@ public:
     pb.registerModuleAnalyses(mam);
     pb.crossRegisterProxies(lam, fam, cam, mam);
 
-    for (auto &fn : module) {
-      if (fn.isDeclaration())
-        continue;
-      fpm.run(fn, fam);
+    if (level == OptLevel::Fast) {
+      for (auto &fn : module) {
+        if (fn.isDeclaration())
+          continue;
+        fpm.run(fn, fam);
+      }
+      return;
     }
+    /// sink the column loads first, LICM hoists the invariant ones later
+    pb.registerPipelineStartEPCallback(
+        [](llvm::ModulePassManager &mpm, llvm::OptimizationLevel) {
+          mpm.addPass(llvm::createModuleToFunctionPassAdaptor(
+              LateMaterializationPass()));
+        });
+    auto mpm = pb.buildPerModuleDefaultPipeline(
+        level == OptLevel::Aggressive ? llvm::OptimizationLevel::O3
+                                      : llvm::OptimizationLevel::O2);
+    mpm.run(module, mam);
   }
   Optimizer() {
     /// adapted from LingoDB
@@ -120,24 +266,234 @@ public:
     fpm.addPass(LateMaterializationPass());
   }
 
+  void setLevel(OptLevel optLevel) { level = optLevel; }
+  OptLevel getLevel() const { return level; }
+  void setTargetMachine(llvm::TargetMachine *tm) { targetMachine = tm; }
+
 private:
+  /// times every pass and analysis, nested ones are included in the parent
+  void instrument(llvm::PassInstrumentationCallbacks &pic,
+                  CompilationReport &report) {
+    using clock = std::chrono::steady_clock;
+    auto starts = std::make_shared<std::vector<clock::time_point>>();
+    auto begin = [starts](llvm::StringRef, llvm::Any) {
+      starts->push_back(clock::now());
+    };
+    auto end = [starts, &report](llvm::StringRef name, bool analysis) {
+      report.addPass(name, analysis, clock::now() - starts->back());
+      starts->pop_back();
+    };
+    pic.registerBeforeNonSkippedPassCallback(begin);
+    pic.registerAfterPassCallback(
+        [end](llvm::StringRef name, llvm::Any, const llvm::PreservedAnalyses &) {
+          end(name, false);
+        });
+    pic.registerAfterPassInvalidatedCallback(
+        [end](llvm::StringRef name, const llvm::PreservedAnalyses &) {
+          end(name, false);
+        });
+    pic.registerBeforeAnalysisCallback(begin);
+    pic.registerAfterAnalysisCallback(
+        [end](llvm::StringRef name, llvm::Any) { end(name, true); });
+  }
+
   llvm::FunctionPassManager fpm;
+  OptLevel level = OptLevel::Fast;
+  llvm::TargetMachine *targetMachine = nullptr;
+};
+
+/// Compiles modules like the default compiler of LLJIT, adding the time and
+/// the size of every function in the object file to the report
+class ReportingCompiler : public llvm::orc::IRCompileLayer::IRCompiler {
+public:
+  ReportingCompiler(std::unique_ptr<llvm::orc::IRCompileLayer::IRCompiler> inner,
+                    CompilationReport *&report)
+      : IRCompiler(inner->getManglingOptions()), inner(std::move(inner)),
+        report(report) {}
+
+  llvm::Expected<std::unique_ptr<llvm::MemoryBuffer>>
+  operator()(llvm::Module &module) override {
+    auto start = std::chrono::steady_clock::now();
+    auto obj = (*inner)(module);
+    if (!report || !obj)
+      return obj;
+    report->codegen += std::chrono::steady_clock::now() - start;
+    auto file =
+        llvm::object::ObjectFile::createObjectFile((*obj)->getMemBufferRef());
+    if (!file) {
+      llvm::consumeError(file.takeError());
+      return obj;
+    }
+    for (auto &[symbol, size] : llvm::object::computeSymbolSizes(**file)) {
+      auto type = symbol.getType();
+      auto name = symbol.getName();
+      if (type && *type == llvm::object::SymbolRef::ST_Function && name)
+        report->getFunction(*name).codeSize = size;
+      llvm::consumeError(type.takeError());
+      llvm::consumeError(name.takeError());
+    }
+    return obj;
+  }
+
+private:
+  std::unique_ptr<llvm::orc::IRCompileLayer::IRCompiler> inner;
+  /// owned by the QueryCompiler, null while reporting is disabled
+  CompilationReport *&report;
+};
+
+/// Appends the address range and name of every JIT'd function to
+/// /tmp/perf-<pid>.map, which perf reads to symbolize anonymous code
+class PerfMapListener : public llvm::JITEventListener {
+public:
+  static PerfMapListener &get() {
+    static PerfMapListener listener;
+    return listener;
+  }
+
+  void notifyObjectLoaded(ObjectKey key, const llvm::object::ObjectFile &obj,
+                          const llvm::RuntimeDyld::LoadedObjectInfo &info) override {
+    (void)key;
+    /// the debug object has the sections at their load addresses
+    auto debugObj = info.getObjectForDebug(obj);
+    const auto &loaded = debugObj.getBinary() ? *debugObj.getBinary() : obj;
+    std::lock_guard lock(m);
+    if (!file)
+      return;
+    for (auto &[symbol, size] : llvm::object::computeSymbolSizes(loaded)) {
+      auto type = symbol.getType();
+      auto name = symbol.getName();
+      auto addr = symbol.getAddress();
+      if (type && *type == llvm::object::SymbolRef::ST_Function && name &&
+          addr && size > 0)
+        std::fprintf(file, "%" PRIx64 " %" PRIx64 " %s\n", *addr, size,
+                     name->str().c_str());
+      llvm::consumeError(type.takeError());
+      llvm::consumeError(name.takeError());
+      llvm::consumeError(addr.takeError());
+    }
+    std::fflush(file);
+  }
+
+private:
+  PerfMapListener() {
+    std::string path = "/tmp/perf-" + std::to_string(::getpid()) + ".map";
+    file = std::fopen(path.c_str(), "w");
+  }
+  ~PerfMapListener() override {
+    if (file)
+      std::fclose(file);
+  }
+
+  std::mutex m;
+  std::FILE *file;
 };
 
 class QueryCompiler {
 public:
-  void createJIT() {
+  /// debug registers the generated code with gdb and perf, which only see
+  /// the symbols of the functions
+  void createJIT(const TargetOptions &target = {}, bool debug = false) {
     /// adapted from https://github.com/llvm/llvm-project/blob/main/llvm/examples/OrcV2Examples/LLJITWithGDBRegistrationListener/LLJITWithGDBRegistrationListener.cpp  
     llvm::ExitOnError ExitOnErr;
-    auto res = ExitOnErr(
-        llvm::orc::LLJITBuilder().create());
-    jit = std::move(res);
+    llvm::orc::LLJITBuilder jitBuilder;
+    auto jtmb = ExitOnErr(llvm::orc::JITTargetMachineBuilder::detectHost());
+    if (!target.cpu.empty()) {
+      jtmb.setCPU(target.cpu);
+      jtmb.getFeatures() = llvm::SubtargetFeatures();
+    }
+    if (!target.features.empty())
+      jtmb.addFeatures(llvm::SubtargetFeatures(target.features).getFeatures());
+    targetMachine = ExitOnErr(jtmb.createTargetMachine());
+    optimizer.setTargetMachine(targetMachine.get());
+    jitBuilder.setJITTargetMachineBuilder(std::move(jtmb));
+    /// event listeners need the RuntimeDyld linker, only use it on request
+    if (debug) {
+      jitBuilder.setObjectLinkingLayerCreator(
+          [](llvm::orc::ExecutionSession &es, auto &&...) {
+            auto layer = std::make_unique<llvm::orc::RTDyldObjectLinkingLayer>(
+                es, [](auto &&...) {
+                  return std::make_unique<llvm::SectionMemoryManager>();
+                });
+            layer->registerJITEventListener(
+                *llvm::JITEventListener::createGDBRegistrationListener());
+            /// nullptr if LLVM was built without perf support
+            if (auto *perf = llvm::JITEventListener::createPerfJITEventListener())
+              layer->registerJITEventListener(*perf);
+            layer->registerJITEventListener(PerfMapListener::get());
+            return llvm::Expected<std::unique_ptr<llvm::orc::ObjectLayer>>(
+                std::move(layer));
+          });
+    }
+    jitBuilder.setCompileFunctionCreator(
+        [this](llvm::orc::JITTargetMachineBuilder jtmb)
+            -> llvm::Expected<
+                std::unique_ptr<llvm::orc::IRCompileLayer::IRCompiler>> {
+          return std::make_unique<ReportingCompiler>(
+              std::make_unique<llvm::orc::ConcurrentIRCompiler>(
+                  std::move(jtmb)),
+              activeReport);
+        });
+    jit = ExitOnErr(jitBuilder.create());
   }
 
   void addQuery(Query &&query, std::unique_ptr<llvm::LLVMContext> &context) {
+    optimize(query);
+    addModule(std::move(query), context);
+  }
+
+  /// runs the IR optimizations, separate from addModule to time them
+  void optimize(Query &query) {
     query.module->setDataLayout(jit->getDataLayout());
     query.module->setTargetTriple(jit->getTargetTriple());
-    optimizer.run(*query.getModule());
+    /// lets the vectorizers use the host's vector width, codegen uses the
+    /// same target machine
+    for (auto &fn : *query.getModule()) {
+      if (fn.isDeclaration())
+        continue;
+      fn.addFnAttr("target-cpu", targetMachine->getTargetCPU());
+      fn.addFnAttr("target-features", targetMachine->getTargetFeatureString());
+    }
+    if (!activeReport) {
+      optimizer.run(*query.getModule());
+      return;
+    }
+    countInstructions(*query.getModule(),
+                      &CompilationReport::Function::instructionsBefore);
+    auto start = std::chrono::steady_clock::now();
+    optimizer.run(*query.getModule(), activeReport);
+    activeReport->optimization += std::chrono::steady_clock::now() - start;
+    countInstructions(*query.getModule(),
+                      &CompilationReport::Function::instructionsAfter);
+  }
+
+  /// generates and links the code of all pipelines, otherwise this happens
+  /// on the first execution
+  void materialize(Query &query) {
+    auto start = std::chrono::steady_clock::now();
+    auto codegen = activeReport ? activeReport->codegen
+                                : std::chrono::nanoseconds{0};
+    for (const auto &pipeline : query.pipelines) {
+      auto fn = getPipelineFunction(pipeline->name);
+      if (!fn)
+        llvm::report_fatal_error(fn.takeError());
+    }
+    if (activeReport)
+      activeReport->link += std::chrono::steady_clock::now() - start -
+                            (activeReport->codegen - codegen);
+  }
+
+  const llvm::TargetMachine &getTargetMachine() const { return *targetMachine; }
+
+  /// optimization level of the queries added from now on
+  void setOptLevel(OptLevel level) { optimizer.setLevel(level); }
+  OptLevel getOptLevel() const { return optimizer.getLevel(); }
+
+  /// collect a CompilationReport for the queries added from now on
+  void setReporting(bool enable) { activeReport = enable ? &report : nullptr; }
+  const CompilationReport &getReport() const { return report; }
+
+  /// hands the module to the JIT, code is generated on the first lookup
+  void addModule(Query &&query, std::unique_ptr<llvm::LLVMContext> &context) {
 #ifndef NDEBUG
     llvm::errs() << *query.module << "\n";
     llvm::verifyModule(*query.module, &llvm::errs());
@@ -180,9 +536,21 @@ private:
       llvm::report_fatal_error(std::move(ret));
     }
   }
+  void countInstructions(llvm::Module &module,
+                         size_t CompilationReport::Function::*count) {
+    for (auto &fn : module) {
+      if (!fn.isDeclaration())
+        activeReport->getFunction(fn.getName()).*count =
+            fn.getInstructionCount();
+    }
+  }
+
   llvm::orc::LLJITBuilder builder;
   std::unique_ptr<llvm::orc::LLJIT> jit;
+  std::unique_ptr<llvm::TargetMachine> targetMachine;
   Optimizer optimizer;
+  CompilationReport report;
+  CompilationReport *activeReport = nullptr;
 };
 
 } // namespace p2cllvm
@@ -34,24 +34,32 @@ template <typename T> struct ColumnMapping {
       std::tie(data, size) = load_columns(dirPath, colName);
   }
 
+  /// flags are added to the mmap flags, e.g. MAP_POPULATE
   static std::pair<mapping_type, size_t> load_columns(std::string_view dirPath,
-                            std::string_view colName) {
+                            std::string_view colName, int flags = 0) {
     std::string filePath = std::string(dirPath) + "/" + std::string(colName) + ".bin";
     int fd = open(filePath.c_str(), O_RDONLY);
     if (fd == -1)
       throw std::runtime_error("Failed to open file: " + filePath);
+    try {
+      auto mapping = load_columns(fd, flags);
+      close(fd);
+      return mapping;
+    } catch (...) {
+      close(fd);
+      throw;
+    }
+  }
 
+  /// maps an open column file, the caller closes fd
+  static std::pair<mapping_type, size_t> load_columns(int fd, int flags = 0) {
     /// Find the size of the file
-    lseek(fd, 0, SEEK_END);
-    size_t size = lseek(fd, 0, SEEK_CUR);
-    auto *data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    size_t size = lseek(fd, 0, SEEK_END);
+    auto *data = mmap(nullptr, size, PROT_READ, MAP_SHARED | flags, fd, 0);
     if(data == MAP_FAILED){
-        auto err = errno;
-        close(fd);
         throw std::logic_error("Could not map file: " +
-                                std::string(strerror(err)));
+                                std::string(strerror(errno)));
     }
-    close(fd);
     if (size > 1024 * 1024) {
       madvise(data, size, MADV_HUGEPAGE);
     }
@@ -1,9 +1,19 @@
 #pragma once
 #include "IR/Pipeline.h"
 #include "internal/Compiler.h"
-#include "internal/Tpch.h"
+#include "internal/Catalog.h"
+#include "internal/SharedScan.h"
+#include "internal/StreamingScan.h"
+#include "runtime/Cancellation.h"
+#include "runtime/PerfCounters.h"
+#include <chrono>
+#include <condition_variable>
 #include <cstdint>
+#include <functional>
 #include <llvm/Support/Error.h>
+#include <llvm/Support/raw_ostream.h>
+#include <mutex>
+#include <thread>
 #include <tuple>
 #include <vector>
 
@@ -11,9 +21,11 @@ namespace p2cllvm {
 template <typename I> class QueryScheduler {
 public:
   virtual ~QueryScheduler() = default;
-  QueryScheduler(TPCH &db) : db(db) {}
+  QueryScheduler(Catalog &db) : db(db) {}
 
   void execPipeline(Pipeline &pipeline, QueryCompiler &qc) {
+    pipeline.counters = {};
+    auto start = std::chrono::steady_clock::now();
     switch (pipeline.type) {
     case PipelineType::Default:
       static_cast<I &>(*this).execPipelineImpl(pipeline, qc);
@@ -26,15 +38,64 @@ public:
       static_cast<I &>(*this).execContinuationPipelineImpl(pipeline, qc);
       break;
     }
+    if (timing)
+      pipeline.time = std::chrono::steady_clock::now() - start;
   }
 
+  /// Runs the pipelines of the query in order. Once its cancellation token
+  /// stopped, the workers finish their morsels and the query releases the
+  /// memory of its operators; false then.
+  bool execQuery(Query &query, QueryCompiler &qc) {
+    cancellation = &query.cancellation;
+    bool finished = true;
+    for (const auto &pipeline : query.pipelines) {
+      execPipeline(*pipeline, qc);
+#ifndef NDEBUG
+      llvm::errs() << "executed: " << pipeline->name << "\n";
+#endif
+      if (query.cancellation.stopped()) {
+        query.operatorContext.clear();
+        finished = false;
+        break;
+      }
+    }
+    cancellation = nullptr;
+    return finished;
+  }
+
+  /// measure the wall time of each pipeline for query profiles
+  void setTiming(bool enable) { timing = enable; }
+  /// count hardware events of each thread executing a pipeline
+  void setCounting(bool enable) { counting = enable; }
+
 protected:
-  TPCH &db;
+  /// runs fn on the calling thread and adds its events to the pipeline
+  template <typename Fn> void counted(Pipeline &pipeline, Fn &&fn) {
+    if (!counting) {
+      fn();
+      return;
+    }
+    auto &counters = PerfCounters::local();
+    counters.start();
+    fn();
+    auto sample = counters.stop();
+    std::lock_guard lock(countersMutex);
+    pipeline.counters += sample;
+  }
+
+  /// checked between morsels
+  bool stopped() const { return cancellation && cancellation->stopped(); }
+
+  Catalog &db;
+  const CancellationToken *cancellation = nullptr;
+  bool timing = false;
+  bool counting = false;
+  std::mutex countersMutex;
 };
 
 class SimpleQueryScheduler : public QueryScheduler<SimpleQueryScheduler> {
 public:
-  SimpleQueryScheduler(TPCH &db) : QueryScheduler(db) {};
+  SimpleQueryScheduler(Catalog &db) : QueryScheduler(db) {};
   ~SimpleQueryScheduler() = default;
 
   void execPipelineImpl(Pipeline &pipeline, QueryCompiler &qc) {
@@ -42,18 +103,20 @@ public:
     if (!fn)
       llvm::report_fatal_error(fn.takeError());
     auto *fptr = (*fn).toPtr<void (*)(void **)>();
-    fptr(pipeline.args.data());
+    counted(pipeline, [&]() { fptr(pipeline.args.data()); });
   }
 
   void execScanPipelineImpl(ScanPipeline &pipeline, QueryCompiler &qc) {
     auto fn = qc.getPipelineFunction(pipeline.name);
     if (!fn)
       llvm::report_fatal_error(fn.takeError());
-    auto tableIdx = pipeline.tableIndex;
-    auto [ptr, size] = db.getTable(tableIdx);
+    auto segments = db.getSegments(pipeline.tableIndex);
     auto *fptr =
         (*fn).toPtr<void (*)(void *, uint64_t, uint64_t, uint64_t, void **)>();
-    fptr(ptr, 0, size, 0, pipeline.args.data());
+    counted(pipeline, [&]() {
+      for (auto [ptr, size] : segments)
+        fptr(ptr, 0, size, 0, pipeline.args.data());
+    });
   }
 
   void execContinuationPipelineImpl(Pipeline &pipeline, QueryCompiler &qc) {
@@ -63,62 +126,173 @@ public:
 
 class MultiThreadedScheduler : public QueryScheduler<MultiThreadedScheduler> {
 public:
-  MultiThreadedScheduler(size_t chunkSize, TPCH &db,
+  MultiThreadedScheduler(size_t chunkSize, Catalog &db,
                          size_t nthreads = std::thread::hardware_concurrency())
-      : QueryScheduler(db), nthreads(nthreads), chunkSize(chunkSize) {}
-  ~MultiThreadedScheduler() = default;
+      : QueryScheduler(db), nthreads(nthreads), chunkSize(chunkSize),
+        workers(nthreads) {
+    for (auto &t : workers)
+      t = std::thread([this]() { work(); });
+  }
+  ~MultiThreadedScheduler() {
+    {
+      std::lock_guard lock(m);
+      stop = true;
+    }
+    cv.notify_all();
+    for (auto &t : workers)
+      t.join();
+  }
 
   void execPipelineImpl(Pipeline &pipeline, QueryCompiler &qc) {
     auto fn = qc.getPipelineFunction(pipeline.name);
     if (!fn)
       llvm::report_fatal_error(fn.takeError());
     auto *fptr = (*fn).toPtr<void (*)(void **)>();
-    fptr(pipeline.args.data());
+    counted(pipeline, [&]() { fptr(pipeline.args.data()); });
   }
+  /// Read the fixed size columns of scans into buffers ahead of the workers
+  /// instead of faulting in their mapping, for data larger than memory.
+  /// slotsPerWorker morsels per worker are buffered, 0 disables streaming.
+  void setStreaming(size_t slotsPerWorker, size_t ioThreads = 2) {
+    streamSlots = slotsPerWorker;
+    streamThreads = ioThreads;
+  }
+
+  /// Scans attach to the scans of other queries sharing scans, which read
+  /// the same morsels close in time. nullptr scans alone.
+  void setSharedScans(SharedScans *scans) { sharedScans = scans; }
+
   void execScanPipelineImpl(ScanPipeline &pipeline, QueryCompiler &qc) {
-    std::vector<std::thread> threads(nthreads);
-    auto tableIdx = pipeline.tableIndex;
-    auto [ptr, size] = db.getTable(tableIdx);
     auto fn = qc.getPipelineFunction(pipeline.name);
     if (!fn)
       llvm::report_fatal_error(fn.takeError());
     auto *fptr =
         (*fn).toPtr<void (*)(void *, uint64_t, uint64_t, uint64_t, void **)>();
-    std::atomic<size_t> chunk = 0;
-    for (auto &t : threads) {
-      t = std::thread([&]() {
-        size_t start;
-        while ((start = chunk.fetch_add(chunkSize)) < size) {
-          fptr(ptr, start, std::min(start + chunkSize, size), nthreads,
-               pipeline.args.data());
+    if (streamSlots &&
+        MorselStream::streams(db, pipeline.tableIndex, pipeline.columns)) {
+      execStreamingScan(pipeline, fptr);
+      return;
+    }
+    if (sharedScans) {
+      execSharedScan(pipeline, fptr);
+      return;
+    }
+    auto segments = db.getSegments(pipeline.tableIndex);
+    /// morsels never span segments, workers move on to the next segment once
+    /// the current one is handed out
+    std::vector<std::atomic<size_t>> chunks(segments.size());
+    runOnWorkers([&]() {
+      counted(pipeline, [&]() {
+        for (size_t i = 0; i < segments.size(); ++i) {
+          auto [ptr, size] = segments[i];
+          size_t start;
+          while (!stopped() &&
+                 (start = chunks[i].fetch_add(chunkSize)) < size) {
+            fptr(ptr, start, std::min(start + chunkSize, size), nthreads,
+                 pipeline.args.data());
+          }
         }
       });
-    }
-    for (auto &t : threads)
-      t.join();
+    });
   }
 
   void execContinuationPipelineImpl(Pipeline& pipeline, QueryCompiler& qc){
-    std::vector<std::thread> threads(nthreads);
     auto fn = qc.getPipelineFunction(pipeline.name);
     if (!fn)
       llvm::report_fatal_error(fn.takeError());
     auto *fptr =
         (*fn).toPtr<void (*)(void **)>();
-    for(auto& t: threads)
-        t = std::thread(fptr, pipeline.args.data());
-    
-    for(auto& t: threads)
-        t.join();
+    /// each call takes one thread local entry or spilled partition
+    runOnWorkers([&]() {
+      if (!stopped())
+        counted(pipeline, [&]() { fptr(pipeline.args.data()); });
+    });
   }
 private:
+  using ScanFn = void (*)(void *, uint64_t, uint64_t, uint64_t, void **);
+
+  void execStreamingScan(ScanPipeline &pipeline, ScanFn fptr) {
+    MorselStream stream(db, pipeline.tableIndex, pipeline.columns, chunkSize,
+                        nthreads * streamSlots, streamThreads);
+    runOnWorkers([&]() {
+      counted(pipeline, [&]() {
+        try {
+          while (!stopped()) {
+            auto morsel = stream.acquire();
+            if (!morsel)
+              break;
+            fptr(morsel->table, morsel->begin, morsel->end, nthreads,
+                 pipeline.args.data());
+            stream.release(*morsel);
+          }
+        } catch (const std::exception &e) {
+          llvm::report_fatal_error(e.what());
+        }
+      });
+    });
+  }
+
+  void execSharedScan(ScanPipeline &pipeline, ScanFn fptr) {
+    auto cursor = sharedScans->attach(
+        pipeline.tableIndex, db.getSegments(pipeline.tableIndex), chunkSize);
+    runOnWorkers([&]() {
+      counted(pipeline, [&]() {
+        while (!stopped()) {
+          auto morsel = cursor->next();
+          if (!morsel)
+            break;
+          fptr(morsel->table, morsel->begin, morsel->end, nthreads,
+               pipeline.args.data());
+        }
+      });
+    });
+  }
+
+  /// The same workers run every pipeline of the query, so an operator fed by
+  /// several pipelines finds its thread local state again.
+  void runOnWorkers(std::function<void()> fn) {
+    std::unique_lock lock(m);
+    job = std::move(fn);
+    running = workers.size();
+    ++generation;
+    cv.notify_all();
+    done.wait(lock, [&]() { return running == 0; });
+    job = nullptr;
+  }
+
+  void work() {
+    size_t seen = 0;
+    std::unique_lock lock(m);
+    while (true) {
+      cv.wait(lock, [&]() { return stop || generation != seen; });
+      if (stop)
+        return;
+      seen = generation;
+      lock.unlock();
+      job();
+      lock.lock();
+      if (--running == 0)
+        done.notify_one();
+    }
+  }
+
   size_t nthreads;
   size_t chunkSize;
+  size_t streamSlots = 0;
+  size_t streamThreads = 2;
+  SharedScans *sharedScans = nullptr;
+  std::vector<std::thread> workers;
+  std::mutex m;
+  std::condition_variable cv, done;
+  std::function<void()> job;
+  size_t running = 0;
+  size_t generation = 0;
+  bool stop = false;
 };
 
 class CompilationTimeScheduler : public QueryScheduler<CompilationTimeScheduler>{
 public:
- CompilationTimeScheduler(TPCH &db) : QueryScheduler(db) {};
+ CompilationTimeScheduler(Catalog &db) : QueryScheduler(db) {};
   ~CompilationTimeScheduler() = default;
 
   void execPipelineImpl(Pipeline &pipeline, QueryCompiler &qc) {
@@ -132,8 +306,7 @@ public:
     auto fn = qc.getPipelineFunction(pipeline.name);
     if (!fn)
       llvm::report_fatal_error(fn.takeError());
-    auto tableIdx = pipeline.tableIndex;
-    std::ignore = db.getTable(tableIdx);
+    std::ignore = db.getSegments(pipeline.tableIndex);
     std::ignore =
         (*fn).toPtr<void (*)(void *, uint64_t, uint64_t, uint64_t, void **)>();
   }
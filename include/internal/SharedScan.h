@@ -0,0 +1,156 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace p2cllvm {
+/// Circular scans shared by the concurrent queries of a Catalog. A scan
+/// pipeline attaches to the running scan of its table and starts at the
+/// morsel the scan is at, wrapping around to the morsels it missed. Every
+/// attached scan reads the same morsels close in time: none may claim a
+/// morsel more than `window` morsels ahead of the slowest one, so the
+/// followers find the columns in the cache the leader loaded them into.
+class SharedScans {
+public:
+  struct Morsel {
+    /// struct of ColumnMappings of the morsel's segment
+    void *table;
+    uint64_t begin;
+    uint64_t end;
+  };
+
+private:
+  struct Participant {
+    /// absolute positions, the morsel of position p is p % morsels
+    uint64_t next;
+    uint64_t end;
+  };
+
+  struct TableScan {
+    std::vector<Morsel> morsels;
+    std::list<Participant> participants;
+    /// position after the furthest claimed morsel, new scans start here
+    uint64_t head = 0;
+    std::condition_variable cv;
+  };
+  /// by table and its first segment, a Catalog maps a table once; dropped
+  /// when the last scan detaches
+  using TableMap = std::map<std::pair<size_t, void *>, TableScan>;
+
+public:
+  /// the scan of one pipeline, detaches on destruction
+  class Cursor {
+  public:
+    Cursor(const Cursor &) = delete;
+    Cursor &operator=(const Cursor &) = delete;
+    ~Cursor() { scans.detach(scan, participant); }
+
+    /// next morsel of the pipeline, waits while it is ahead of the window;
+    /// std::nullopt once the pipeline saw every morsel
+    std::optional<Morsel> next() {
+      return scans.next(scan->second, *participant);
+    }
+
+  private:
+    friend class SharedScans;
+    Cursor(SharedScans &scans, TableMap::iterator scan,
+           std::list<Participant>::iterator participant)
+        : scans(scans), scan(scan), participant(participant) {}
+
+    SharedScans &scans;
+    TableMap::iterator scan;
+    std::list<Participant>::iterator participant;
+  };
+
+  explicit SharedScans(uint64_t window = 32)
+      : window(std::max<uint64_t>(window, 1)) {}
+
+  /// attaches a scan over segments, the struct and tuple count of each
+  /// segment as Catalog::getSegments returns them
+  std::unique_ptr<Cursor>
+  attach(size_t tableIdx, const std::vector<std::pair<void *, size_t>> &segments,
+         uint64_t morselSize) {
+    std::lock_guard lock(m);
+    void *first = segments.empty() ? nullptr : segments.front().first;
+    auto it = tables.try_emplace({tableIdx, first}).first;
+    auto &scan = it->second;
+    if (scan.morsels.empty())
+      for (auto [table, count] : segments)
+        for (uint64_t begin = 0; begin < count; begin += morselSize)
+          scan.morsels.push_back(
+              {table, begin, std::min(begin + morselSize, count)});
+    uint64_t start = scan.head;
+    auto participant = scan.participants.insert(
+        scan.participants.end(), {start, start + scan.morsels.size()});
+    if (scan.participants.size() > 1)
+      ++attachedToRunning;
+    return std::unique_ptr<Cursor>(new Cursor(*this, it, participant));
+  }
+
+  /// morsels claimed while another scan of the table was claiming, within
+  /// the window of each other
+  uint64_t getSharedMorsels() {
+    std::lock_guard lock(m);
+    return shared;
+  }
+
+  /// scans that attached while another scan of their table was running
+  uint64_t getAttachedToRunning() {
+    std::lock_guard lock(m);
+    return attachedToRunning;
+  }
+
+private:
+  std::optional<Morsel> next(TableScan &scan, Participant &participant) {
+    std::unique_lock lock(m);
+    scan.cv.wait(lock, [&]() {
+      return participant.next >= participant.end ||
+             participant.next < slowest(scan) + window;
+    });
+    if (participant.next >= participant.end)
+      return std::nullopt;
+    uint64_t pos = participant.next++;
+    scan.head = std::max(scan.head, participant.next);
+    for (auto &other : scan.participants)
+      if (&other != &participant && other.next < other.end) {
+        ++shared;
+        break;
+      }
+    scan.cv.notify_all();
+    return scan.morsels[pos % scan.morsels.size()];
+  }
+
+  /// position of the slowest scan still claiming morsels
+  static uint64_t slowest(const TableScan &scan) {
+    uint64_t min = UINT64_MAX;
+    for (auto &participant : scan.participants)
+      if (participant.next < participant.end)
+        min = std::min(min, participant.next);
+    return min;
+  }
+
+  void detach(TableMap::iterator scan,
+              std::list<Participant>::iterator participant) {
+    std::lock_guard lock(m);
+    scan->second.participants.erase(participant);
+    if (scan->second.participants.empty())
+      tables.erase(scan);
+    else
+      scan->second.cv.notify_all();
+  }
+
+  uint64_t window;
+  std::mutex m;
+  TableMap tables;
+  uint64_t shared = 0;
+  uint64_t attachedToRunning = 0;
+};
+} // namespace p2cllvm
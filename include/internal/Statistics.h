@@ -0,0 +1,246 @@
+#pragma once
+
+#include "internal/BaseTypes.h"
+#include "internal/File.h"
+#include "internal/Catalog.h"
+#include "runtime/Hyperloglog.h"
+#include "runtime/Murmur.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace p2cllvm {
+struct ColumnStatistics {
+  static constexpr unsigned histogramBuckets = 64;
+  uint64_t rows = 0;
+  uint64_t nulls = 0;
+  /// HyperLogLog estimate
+  uint64_t distinct = 0;
+  /// values never decrease in storage order
+  bool sorted = false;
+  /// fraction of neighbouring values in non decreasing order
+  double clustering = 0;
+  /// only set for numeric columns, dates are their day number
+  bool numeric = false;
+  double min = 0;
+  double max = 0;
+  /// bounds of equi-depth buckets, the first is min and the last max
+  std::vector<double> histogram;
+
+  /// Estimated fraction of the values below value, interpolated within the
+  /// histogram bucket or between min and max without a histogram.
+  double fractionBelow(double value) const {
+    if (!numeric || value <= min)
+      return 0.0;
+    if (value > max)
+      return 1.0;
+    if (histogram.size() < 2)
+      return max > min ? (value - min) / (max - min) : 0.5;
+    size_t buckets = histogram.size() - 1;
+    auto it = std::lower_bound(histogram.begin(), histogram.end(), value);
+    size_t bucket = std::max<size_t>(it - histogram.begin(), 1) - 1;
+    double lo = histogram[bucket];
+    double hi = histogram[bucket + 1];
+    double within =
+        hi > lo ? std::clamp((value - lo) / (hi - lo), 0.0, 1.0) : 0.0;
+    return (bucket + within) / buckets;
+  }
+
+  /// Reads the statistics the data generator writes next to the column
+  static std::optional<ColumnStatistics> load(const std::string &filePath) {
+    std::ifstream in(filePath);
+    if (!in)
+      return std::nullopt;
+    ColumnStatistics stats;
+    std::string key;
+    while (in >> key) {
+      if (key == "rows")
+        in >> stats.rows;
+      else if (key == "nulls")
+        in >> stats.nulls;
+      else if (key == "distinct")
+        in >> stats.distinct;
+      else if (key == "sorted")
+        in >> stats.sorted;
+      else if (key == "clustering")
+        in >> stats.clustering;
+      else if (key == "min")
+        in >> stats.min, stats.numeric = true;
+      else if (key == "max")
+        in >> stats.max;
+      else if (key == "histogram") {
+        size_t n = 0;
+        in >> n;
+        stats.histogram.resize(n);
+        for (auto &bound : stats.histogram)
+          in >> bound;
+      } else
+        in.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+      if (!in)
+        throw std::runtime_error("Malformed statistics: " + filePath);
+    }
+    return stats;
+  }
+};
+
+/// Table cardinalities and per column statistics of a Catalog, used for cost
+/// estimates before code generation. Column statistics are read from the
+/// `.stats` files the data generator writes; without one they are computed
+/// from the column on first use, in one pass with a sampled histogram.
+class Statistics {
+public:
+  explicit Statistics(Catalog &db) : db(db) {}
+
+  uint64_t getCardinality(std::string_view table) {
+    return db.getTupleCount(db.getSchema().getTableIndex(table));
+  }
+
+  const ColumnStatistics &getColumn(std::string_view table,
+                                    std::string_view column) {
+    std::lock_guard lock(m);
+    auto key = std::make_pair(std::string(table), std::string(column));
+    auto it = columns.find(key);
+    if (it == columns.end())
+      it = columns.emplace(key, loadOrCompute(table, column)).first;
+    return it->second;
+  }
+
+private:
+  ColumnStatistics loadOrCompute(std::string_view table,
+                                 std::string_view column) {
+    /// the .stats files describe the main segment, rows appended since the
+    /// last merge are only part of statistics computed from the data
+    size_t tableIdx = db.getSchema().getTableIndex(table);
+    std::string filePath =
+        db.getMainPath(tableIdx) + "/" + std::string(column) + ".stats";
+    if (auto stats = ColumnStatistics::load(filePath))
+      return *stats;
+    return compute(table, column);
+  }
+
+  ColumnStatistics compute(std::string_view table, std::string_view column) {
+    auto &schema = db.getSchema();
+    size_t tableIdx = schema.getTableIndex(table);
+    auto &info = schema.getTable(tableIdx);
+    uint32_t idx = info.getIndex(column);
+    TypeEnum type = info.columns[idx].type;
+    db.mapColumns(tableIdx, {idx});
+    /// the column of every segment with its tuple count; segments are
+    /// structs of ColumnMappings, which all have the same layout
+    std::vector<std::pair<void *, uint64_t>> parts;
+    uint64_t count = 0;
+    for (auto [tablePtr, segmentCount] : db.getSegments(tableIdx)) {
+      auto *mapping =
+          reinterpret_cast<ColumnMapping<int32_t> *>(tablePtr) + idx;
+      parts.emplace_back(mapping->data, segmentCount);
+      count += segmentCount;
+    }
+    switch (type) {
+    case TypeEnum::Integer:
+    case TypeEnum::Date:
+      return computeNumeric<int32_t>(parts, count);
+    case TypeEnum::BigInt:
+      return computeNumeric<int64_t>(parts, count);
+    case TypeEnum::Double:
+      return computeNumeric<double>(parts, count);
+    case TypeEnum::Char:
+      return computeNumeric<char>(parts, count);
+    case TypeEnum::String: {
+      Sketch sketch;
+      for (auto [data, partCount] : parts) {
+        auto *strings = static_cast<String *>(data);
+        for (uint64_t i = 0; i < partCount; ++i) {
+          auto &slot = strings->slot[i];
+          sketch.add(murmurHash(
+              reinterpret_cast<char *>(strings) + slot.offset, slot.length));
+        }
+      }
+      ColumnStatistics stats;
+      stats.rows = count;
+      stats.distinct = sketch.estimate();
+      return stats;
+    }
+    default: {
+      ColumnStatistics stats;
+      stats.rows = stats.distinct = count;
+      return stats;
+    }
+    }
+  }
+
+  /// values kept for the histogram of a column without a .stats file
+  static constexpr size_t sampleSize = 1ull << 14;
+
+  /// One pass over the column: min, max and the order are exact, the
+  /// histogram comes from a reservoir sample of sampleSize values
+  template <typename T>
+  static ColumnStatistics
+  computeNumeric(const std::vector<std::pair<void *, uint64_t>> &parts,
+                 uint64_t count) {
+    ColumnStatistics stats;
+    stats.rows = count;
+    stats.numeric = true;
+    if (count == 0)
+      return stats;
+    Sketch sketch;
+    uint64_t ascending = 0, seen = 0;
+    double min = std::numeric_limits<double>::infinity(), max = -min, last = 0;
+    std::vector<double> sample;
+    sample.reserve(std::min<uint64_t>(sampleSize, count));
+    /// splitmix64, a fixed seed keeps the statistics reproducible
+    uint64_t random = 0;
+    auto nextRandom = [&random]() {
+      uint64_t z = (random += 0x9e3779b97f4a7c15ull);
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+      return z ^ (z >> 31);
+    };
+    for (auto [data, partCount] : parts) {
+      auto *values = static_cast<const T *>(data);
+      for (uint64_t i = 0; i < partCount; ++i, ++seen) {
+        sketch.add(murmurHash(reinterpret_cast<const char *>(values + i),
+                              sizeof(T)));
+        double value = values[i];
+        /// in storage order across segments
+        ascending += seen > 0 && !(value < last);
+        last = value;
+        min = std::min(min, value);
+        max = std::max(max, value);
+        if (sample.size() < sampleSize)
+          sample.push_back(value);
+        else if (auto slot = nextRandom() % (seen + 1); slot < sampleSize)
+          sample[slot] = value;
+      }
+    }
+    stats.distinct = sketch.estimate();
+    stats.sorted = ascending + 1 == count;
+    stats.clustering =
+        count > 1 ? static_cast<double>(ascending) / (count - 1) : 1.0;
+    stats.min = min;
+    stats.max = max;
+    std::sort(sample.begin(), sample.end());
+    uint64_t n = sample.size();
+    uint64_t buckets = std::min<uint64_t>(ColumnStatistics::histogramBuckets, n);
+    for (uint64_t i = 0; i <= buckets; ++i)
+      stats.histogram.push_back(sample[std::min(i * n / buckets, n - 1)]);
+    /// the sample may miss the extremes
+    stats.histogram.front() = min;
+    stats.histogram.back() = max;
+    return stats;
+  }
+
+  Catalog &db;
+  std::mutex m;
+  std::map<std::pair<std::string, std::string>, ColumnStatistics> columns;
+};
+} // namespace p2cllvm
@@ -0,0 +1,249 @@
+#pragma once
+
+#include "internal/Catalog.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fcntl.h>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace p2cllvm {
+/// Streams the fixed size columns of a scan through a ring of buffers for
+/// data larger than memory. I/O threads read the upcoming morsels with
+/// pread ahead of the workers, which run the scan pipeline on a copy of the
+/// segment's table struct whose streamed columns point into the buffers.
+/// The pipeline keeps the row numbers of the segment, a streamed column
+/// points to where row 0 would be. String columns stay mapped: the values
+/// point into the column and may be kept after the morsel, e.g. in a hash
+/// table.
+class MorselStream {
+public:
+  struct Morsel {
+    /// struct of ColumnMappings for the pipeline
+    void *table;
+    uint64_t begin;
+    uint64_t end;
+    size_t index;
+  };
+
+  /// slots is the number of morsels buffered or in flight
+  MorselStream(Catalog &db, size_t tableIdx,
+               const std::vector<uint32_t> &columns, uint64_t morselSize,
+               size_t slots, size_t ioThreads)
+      : slots(std::max<size_t>(slots, 1)) {
+    auto &info = db.getSchema().getTable(tableIdx);
+    for (uint32_t column : columns)
+      if (size_t width = Catalog::fixedWidth(info.columns[column].type))
+        streamed.push_back({column, width, pageAligned(morselSize * width)});
+    auto segments = db.getSegments(tableIdx);
+    size_t width = info.columns.size();
+    files.resize(segments.size());
+    /// the files of the Catalog, which stay readable after a merge
+    for (auto &column : streamed) {
+      auto fds = db.getColumnFiles(tableIdx, column.idx);
+      for (size_t s = 0; s < segments.size(); ++s) {
+        ::posix_fadvise(fds[s], 0, 0, POSIX_FADV_SEQUENTIAL);
+        files[s].push_back(fds[s]);
+      }
+    }
+    for (size_t s = 0; s < segments.size(); ++s) {
+      auto [ptr, count] = segments[s];
+      auto *mappings = static_cast<ColumnEntry *>(ptr);
+      tables.emplace_back(mappings, mappings + width);
+      for (uint64_t begin = 0; begin < count; begin += morselSize)
+        morsels.push_back({s, begin, std::min(begin + morselSize, count)});
+    }
+    ring.resize(this->slots);
+    for (auto &slot : ring)
+      for (auto &column : streamed)
+        slot.buffers.push_back(allocate(column.bytes));
+    ioThreads = std::min(std::max<size_t>(ioThreads, 1), morsels.size());
+    for (size_t i = 0; i < ioThreads; ++i)
+      readers.emplace_back([this]() { read(); });
+  }
+
+  MorselStream(const MorselStream &) = delete;
+  MorselStream &operator=(const MorselStream &) = delete;
+
+  ~MorselStream() {
+    {
+      std::lock_guard lock(m);
+      stop = true;
+    }
+    freed.notify_all();
+    for (auto &reader : readers)
+      reader.join();
+    for (auto &slot : ring)
+      for (size_t i = 0; i < slot.buffers.size(); ++i) {
+        ::munlock(slot.buffers[i], streamed[i].bytes);
+        std::free(slot.buffers[i]);
+      }
+  }
+
+  /// true if the scan reads a column the stream can buffer
+  static bool streams(const Catalog &db, size_t tableIdx,
+                      const std::vector<uint32_t> &columns) {
+    auto &info = db.getSchema().getTable(tableIdx);
+    for (uint32_t column : columns)
+      if (Catalog::fixedWidth(info.columns[column].type))
+        return true;
+    return false;
+  }
+
+  /// the next morsel in scan order once it is read, std::nullopt at the end
+  /// of the table; every morsel has to be released
+  std::optional<Morsel> acquire() {
+    std::unique_lock lock(m);
+    size_t idx = consumed++;
+    if (idx >= morsels.size())
+      return std::nullopt;
+    auto &slot = ring[idx % slots];
+    loaded.wait(lock, [&]() { return slot.ready == idx || error; });
+    if (error)
+      std::rethrow_exception(error);
+    auto &morsel = morsels[idx];
+    return Morsel{slot.table.data(), morsel.begin, morsel.end, idx};
+  }
+
+  /// hands the buffers of the morsel to the readers again
+  void release(const Morsel &morsel) {
+    {
+      std::lock_guard lock(m);
+      auto &slot = ring[morsel.index % slots];
+      slot.ready = none;
+      slot.round++;
+    }
+    freed.notify_all();
+  }
+
+  size_t size() const { return morsels.size(); }
+
+private:
+  /// layout of a ColumnMapping, see Catalog
+  struct ColumnEntry {
+    void *data;
+    uint64_t size;
+  };
+
+  struct StreamedColumn {
+    uint32_t idx;
+    size_t width;
+    /// size of its buffer in every slot
+    size_t bytes;
+  };
+
+  struct Range {
+    size_t segment;
+    uint64_t begin;
+    uint64_t end;
+  };
+
+  static constexpr size_t none = ~size_t(0);
+
+  struct Slot {
+    std::vector<void *> buffers;
+    std::vector<ColumnEntry> table;
+    /// morsel whose rows are in the buffers
+    size_t ready = none;
+    /// times the slot was released, morsel i is read in round i / slots
+    size_t round = 0;
+  };
+
+  static constexpr size_t page = 4096;
+
+  static size_t pageAligned(size_t bytes) {
+    return std::max<size_t>((bytes + page - 1) / page * page, page);
+  }
+
+  /// page aligned and locked in memory where the limits allow it
+  static void *allocate(size_t bytes) {
+    void *buffer = std::aligned_alloc(page, bytes);
+    if (!buffer)
+      throw std::bad_alloc();
+    ::mlock(buffer, bytes);
+    return buffer;
+  }
+
+  void read() {
+    while (true) {
+      size_t idx;
+      {
+        std::unique_lock lock(m);
+        idx = issued++;
+        if (idx >= morsels.size())
+          return;
+        auto &slot = ring[idx % slots];
+        freed.wait(lock, [&]() {
+          return stop || (slot.round == idx / slots && slot.ready == none);
+        });
+        if (stop)
+          return;
+      }
+      try {
+        fill(ring[idx % slots], morsels[idx]);
+      } catch (...) {
+        std::lock_guard lock(m);
+        error = std::current_exception();
+      }
+      {
+        std::lock_guard lock(m);
+        ring[idx % slots].ready = idx;
+      }
+      loaded.notify_all();
+    }
+  }
+
+  /// reads the rows of the morsel, the slot is owned by the calling reader
+  void fill(Slot &slot, const Range &morsel) {
+    slot.table = tables[morsel.segment];
+    for (size_t i = 0; i < streamed.size(); ++i) {
+      size_t width = streamed[i].width;
+      char *buffer = static_cast<char *>(slot.buffers[i]);
+      size_t bytes = (morsel.end - morsel.begin) * width;
+      off_t offset = morsel.begin * width;
+      for (size_t done = 0; done < bytes;) {
+        ssize_t n = ::pread(files[morsel.segment][i], buffer + done,
+                            bytes - done, offset + done);
+        if (n < 0 && errno == EINTR)
+          continue;
+        if (n <= 0)
+          throw std::runtime_error("Failed to read column " +
+                                   std::to_string(streamed[i].idx) + ": " +
+                                   (n < 0 ? std::strerror(errno) : "eof"));
+        done += n;
+      }
+      /// the pipeline indexes with the row numbers of the segment
+      slot.table[streamed[i].idx].data = reinterpret_cast<void *>(
+          reinterpret_cast<uintptr_t>(buffer) - offset);
+    }
+  }
+
+  size_t slots;
+  std::vector<StreamedColumn> streamed;
+  /// per segment
+  std::vector<std::vector<ColumnEntry>> tables;
+  std::vector<std::vector<int>> files;
+  std::vector<Range> morsels;
+  std::vector<Slot> ring;
+  std::vector<std::thread> readers;
+
+  std::mutex m;
+  std::condition_variable loaded, freed;
+  size_t issued = 0;
+  size_t consumed = 0;
+  std::exception_ptr error;
+  bool stop = false;
+};
+} // namespace p2cllvm
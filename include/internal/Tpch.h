@@ -16,6 +16,8 @@
 
 namespace p2cllvm {
 
+/// Typed mappings of all TPC-H columns, queries access tables through the
+/// Catalog
 struct InMemoryTPCH {
 
   std::string path;
@@ -153,162 +155,6 @@ struct InMemoryTPCH {
   } region{path + "/region"};
 
   InMemoryTPCH(const std::string_view path) : path(path) {}
-
-  static TypeRef<llvm::StructType>
-  createSingleTable(Query &query, llvm::LLVMContext &context, size_t idx) {
-    switch (idx) {
-    case 0:
-      return createTable<int32_t, StringView, StringView, StringView,
-                         StringView, int32_t, StringView, double, StringView>(
-          context, "part");
-    case 1:
-      return createTable<int32_t, StringView, StringView, int32_t, StringView,
-                         double, StringView>(context, "supplier");
-    case 2:
-      return createTable<int32_t, int32_t, int32_t, double, StringView>(
-          context, "partsupp");
-    case 3:
-      return createTable<int32_t, StringView, StringView, int32_t, StringView,
-                         double, StringView, StringView>(context, "customer");
-    case 4:
-      return createTable<int64_t, int32_t, char, double, Date, StringView,
-                         StringView, int32_t, StringView>(context, "orders");
-    case 5:
-      return createTable<int64_t, int32_t, int32_t, int32_t, double, double,
-                         double, double, char, char, Date, Date, Date,
-                         StringView, StringView, StringView>(context,
-                                                             "lineitem");
-    case 6:
-      return createTable<int32_t, StringView, int32_t, StringView>(context,
-                                                                   "nation");
-    case 7:
-      return createTable<int32_t, StringView, int32_t>(context, "region");
-    default:
-      throw std::runtime_error("Invalid table index");
-    }
-  }
-};
-
-struct TPCH {
-  using Info = std::pair<uint32_t, TypeEnum>;
-  InMemoryTPCH db;
-  TPCH(const std::string_view path) : db(path) {}
-  inline static std::unordered_map<
-      std::string_view,
-      std::pair<uint16_t, std::unordered_map<std::string_view, Info>>>
-      tables_indices{{"part",
-                      {0,
-                       {{"p_partkey", {0, TypeEnum::Integer}},
-                        {"p_name", {1, TypeEnum::String}},
-                        {"p_mfgr", {2, TypeEnum::String}},
-                        {"p_brand", {3, TypeEnum::String}},
-                        {"p_type", {4, TypeEnum::String}},
-                        {"p_size", {5, TypeEnum::Integer}},
-                        {"p_container", {6, TypeEnum::String}},
-                        {"p_retailprice", {7, TypeEnum::Double}},
-                        {"p_comment", {8, TypeEnum::String}}}}},
-                     {"supplier",
-                      {1,
-                       {{"s_suppkey", {0, TypeEnum::Integer}},
-                        {"s_name", {1, TypeEnum::String}},
-                        {"s_address", {2, TypeEnum::String}},
-                        {"s_nationkey", {3, TypeEnum::Integer}},
-                        {"s_phone", {4, TypeEnum::String}},
-                        {"s_acctbal", {5, TypeEnum::Double}},
-                        {"s_comment", {6, TypeEnum::String}}}}},
-                     {"partsupp",
-                      {2,
-                       {{"ps_partkey", {0, TypeEnum::Integer}},
-                        {"ps_suppkey", {1, TypeEnum::Integer}},
-                        {"ps_availqty", {2, TypeEnum::Integer}},
-                        {"ps_supplycost", {3, TypeEnum::Double}},
-                        {"ps_comment", {4, TypeEnum::String}}}}},
-                     {"customer",
-                      {3,
-                       {{"c_custkey", {0, TypeEnum::Integer}},
-                        {"c_name", {1, TypeEnum::String}},
-                        {"c_address", {2, TypeEnum::String}},
-                        {"c_nationkey", {3, TypeEnum::Integer}},
-                        {"c_phone", {4, TypeEnum::String}},
-                        {"c_acctbal", {5, TypeEnum::Double}},
-                        {"c_mktsegment", {6, TypeEnum::String}},
-                        {"c_comment", {7, TypeEnum::String}}}}},
-                     {"orders",
-                      {4,
-                       {{"o_orderkey", {0, TypeEnum::BigInt}},
-                        {"o_custkey", {1, TypeEnum::Integer}},
-                        {"o_orderstatus", {2, TypeEnum::String}},
-                        {"o_totalprice", {3, TypeEnum::Double}},
-                        {"o_orderdate", {4, TypeEnum::Date}},
-                        {"o_orderpriority", {5, TypeEnum::String}},
-                        {"o_clerk", {6, TypeEnum::String}},
-                        {"o_shippriority", {7, TypeEnum::Integer}},
-                        {"o_comment", {8, TypeEnum::String}}}}},
-                     {"lineitem",
-                      {5,
-                       {{"l_orderkey", {0, TypeEnum::BigInt}},
-                        {"l_partkey", {1, TypeEnum::Integer}},
-                        {"l_suppkey", {2, TypeEnum::Integer}},
-                        {"l_linenumber", {3, TypeEnum::Integer}},
-                        {"l_quantity", {4, TypeEnum::Double}},
-                        {"l_extendedprice", {5, TypeEnum::Double}},
-                        {"l_discount", {6, TypeEnum::Double}},
-                        {"l_tax", {7, TypeEnum::Double}},
-                        {"l_returnflag", {8, TypeEnum::Char}},
-                        {"l_linestatus", {9, TypeEnum::Char}},
-                        {"l_shipdate", {10, TypeEnum::Date}},
-                        {"l_commitdate", {11, TypeEnum::Date}},
-                        {"l_receiptdate", {12, TypeEnum::Date}},
-                        {"l_shipinstruct", {13, TypeEnum::String}},
-                        {"l_shipmode", {14, TypeEnum::String}},
-                        {"l_comment", {15, TypeEnum::String}}}}},
-                     {"nation",
-                      {6,
-                       {{"n_nationkey", {0, TypeEnum::Integer}},
-                        {"n_name", {1, TypeEnum::String}},
-                        {"n_regionkey", {2, TypeEnum::Integer}},
-                        {"n_comment", {3, TypeEnum::String}}}}},
-                     {"region",
-                      {7,
-                       {{"r_regionkey", {0, TypeEnum::Integer}},
-                        {"r_name", {1, TypeEnum::String}},
-                        {"r_comment", {2, TypeEnum::String}}}}}};
-
-  static ValueRef<> createColumnAccess(Builder &builder, llvm::Value *ptr,
-                                         std::string_view rel,
-                                         std::string_view col) {
-    auto &[idx, map] = tables_indices[rel];
-    auto &[idxt, type] = map[col];
-    auto &context = builder.getContext();
-    auto *structType =
-        InMemoryTPCH::createSingleTable(builder.query, context, idx);
-    return builder.builder.CreateStructGEP(structType, ptr, idxt);
-  }
-
-  int64_t estimate_scale_factor() {
-    return lround(static_cast<double>(db.lineitem.tuple_count) /
-                  (6e6 + 2e4)); // approx. scale factor
-  }
-
-  std::pair<void *, size_t> getTable(size_t idx) {
-#define CASE(idx, table)                                                       \
-  case idx:                                                                    \
-    return {&db.table, db.table.tuple_count};
-
-    switch (idx) {
-      CASE(0, part)
-      CASE(1, supplier)
-      CASE(2, partsupp)
-      CASE(3, customer)
-      CASE(4, orders)
-      CASE(5, lineitem)
-      CASE(6, nation)
-      CASE(7, region)
-    default:
-      throw std::runtime_error("Invalid table index");
-    }
-#undef CASE
-  }
 };
 
 }; // namespace p2cllvm
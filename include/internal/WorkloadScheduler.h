@@ -0,0 +1,472 @@
+#pragma once
+#include "IR/Pipeline.h"
+#include "internal/Catalog.h"
+#include "internal/Compiler.h"
+#include "runtime/Cancellation.h"
+#include "runtime/Spill.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <llvm/Support/Error.h>
+
+namespace p2cllvm {
+/// how the workers choose among the running queries
+enum class SchedulingPolicy {
+  /// the query that ran the least worker time, divided by its weight
+  FairShare,
+  /// the running query of the highest priority, fair among equal priorities
+  Priority,
+};
+
+inline std::optional<SchedulingPolicy> parseSchedulingPolicy(std::string_view s) {
+  if (s == "fair")
+    return SchedulingPolicy::FairShare;
+  if (s == "priority")
+    return SchedulingPolicy::Priority;
+  return std::nullopt;
+}
+
+inline const char *getName(SchedulingPolicy policy) {
+  return policy == SchedulingPolicy::FairShare ? "fair" : "priority";
+}
+
+/// Runs many queries at once on one pool of workers. The pipelines of a
+/// query still run one after another, but the workers interleave the
+/// morsels of all running queries: a worker picks the query to take its
+/// next morsel from after every morsel, so a short query finishes next to a
+/// long one instead of waiting for it. A query is admitted once the memory
+/// estimated for it fits next to the running queries; a query that does not
+/// fit lets at most maxBypass later queries pass. A cancelled query takes
+/// no further morsels, it ends once its morsels in flight finished.
+class WorkloadScheduler {
+public:
+  /// a pipeline of a query, split into units that run in any order on any
+  /// worker; the next step starts once all units ran
+  struct Step {
+    /// called when the step starts, returns the number of units
+    std::function<size_t()> start;
+    std::function<void(size_t unit)> run;
+  };
+
+  struct Options {
+    /// at most one worker per hardware thread, the thread local storage of
+    /// the operators has no more entries
+    size_t threads = std::thread::hardware_concurrency();
+    size_t chunkSize = 10000;
+    SchedulingPolicy policy = SchedulingPolicy::FairShare;
+    /// estimated bytes of all running queries
+    size_t memoryLimit = MemoryBudget::unlimited;
+    size_t maxBypass = 8;
+  };
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Job {
+    std::vector<Step> steps;
+    size_t memory;
+    int priority;
+    size_t step = 0;
+    /// units of the current step
+    size_t units = 0;
+    size_t next = 0;
+    size_t inflight = 0;
+    /// worker time in ns divided by the weight, the time of claimed units
+    /// is estimated until they finish
+    double vruntime = 0;
+    double unitCost = 0;
+    /// later queries admitted while this one did not fit
+    size_t bypassed = 0;
+    bool done = false;
+    /// position among the admitted queries and of its first and last unit
+    /// among the units the workers took, from 1; 0 until then
+    size_t admission = 0;
+    uint64_t firstDispatch = 0, lastDispatch = 0;
+    /// cancelled or past its deadline, the query ended early
+    bool stopped = false;
+    std::exception_ptr error;
+    Clock::time_point submitted, admitted, finished;
+    /// the token of the query, or its own
+    CancellationToken token;
+    CancellationToken *cancellation = &token;
+    /// frees the memory of a stopped query before it ends
+    std::function<void()> release;
+
+    double weight() const { return std::max(priority, 0) + 1; }
+  };
+
+public:
+  /// a submitted query
+  class Ticket {
+  public:
+    /// waits until the query ended, rethrows the first exception of its
+    /// steps; false if it was stopped
+    bool wait() {
+      {
+        std::unique_lock lock(scheduler->m);
+        scheduler->finished.wait(lock, [&]() { return job->done; });
+      }
+      if (job->error)
+        std::rethrow_exception(job->error);
+      return !job->stopped;
+    }
+
+    /// stops the query at the next morsel, a pending query is dropped
+    void cancel() {
+      job->cancellation->cancel();
+      {
+        std::lock_guard lock(scheduler->m);
+        scheduler->admit();
+      }
+      scheduler->cv.notify_all();
+    }
+
+    /// time from submission to admission and from admission to the end, of
+    /// a finished query
+    std::chrono::nanoseconds queueTime() const {
+      return job->admitted - job->submitted;
+    }
+    std::chrono::nanoseconds runTime() const {
+      return job->finished - job->admitted;
+    }
+
+    /// the order in which the scheduler admitted the query and took its
+    /// first and last unit, among all queries; 0 until then and for a
+    /// dropped query
+    size_t admission() const {
+      std::lock_guard lock(scheduler->m);
+      return job->admission;
+    }
+    std::pair<uint64_t, uint64_t> dispatches() const {
+      std::lock_guard lock(scheduler->m);
+      return {job->firstDispatch, job->lastDispatch};
+    }
+
+  private:
+    friend class WorkloadScheduler;
+    Ticket(WorkloadScheduler *scheduler, std::shared_ptr<Job> job)
+        : scheduler(scheduler), job(std::move(job)) {}
+
+    WorkloadScheduler *scheduler;
+    std::shared_ptr<Job> job;
+  };
+
+  WorkloadScheduler(Catalog &db, Options options)
+      : db(db), options(options) {
+    this->options.threads =
+        std::clamp<size_t>(options.threads, 1,
+                           std::max(std::thread::hardware_concurrency(), 1u));
+    workers.resize(this->options.threads);
+    for (auto &t : workers)
+      t = std::thread([this]() { work(); });
+  }
+
+  /// waits for the submitted queries
+  ~WorkloadScheduler() {
+    {
+      std::unique_lock lock(m);
+      finished.wait(lock, [&]() { return running.empty() && pending.empty(); });
+      stop = true;
+    }
+    cv.notify_all();
+    for (auto &t : workers)
+      t.join();
+  }
+
+  /// submits a query of the given steps, memory is its estimated peak
+  /// memory in bytes; a stopped cancellation token ends it early and calls
+  /// release first
+  Ticket submit(std::vector<Step> steps, size_t memory = 0, int priority = 0,
+                CancellationToken *cancellation = nullptr,
+                std::function<void()> release = {}) {
+    auto job = std::make_shared<Job>();
+    job->steps = std::move(steps);
+    job->memory = memory;
+    job->priority = priority;
+    if (cancellation)
+      job->cancellation = cancellation;
+    job->release = std::move(release);
+    job->submitted = Clock::now();
+    {
+      std::lock_guard lock(m);
+      auto pos = pending.end();
+      if (options.policy == SchedulingPolicy::Priority)
+        pos = std::find_if(pending.begin(), pending.end(), [&](auto &other) {
+          return other->priority < priority;
+        });
+      pending.insert(pos, job);
+      admit();
+    }
+    cv.notify_all();
+    return Ticket(this, std::move(job));
+  }
+
+  /// submits the pipelines of a compiled query, they must not be executed
+  /// by another scheduler; the query stops with its cancellation token and
+  /// then releases the memory of its operators
+  Ticket submit(Query &query, QueryCompiler &qc, size_t memory = 0,
+                int priority = 0) {
+    std::vector<Step> steps;
+    for (auto &pipeline : query.pipelines)
+      steps.push_back(makeStep(*pipeline, qc));
+    return submit(std::move(steps), memory, priority, &query.cancellation,
+                  [&query]() { query.operatorContext.clear(); });
+  }
+
+  size_t getThreads() const { return options.threads; }
+
+  /// estimated bytes of the running queries
+  size_t getReserved() {
+    std::lock_guard lock(m);
+    return reserved;
+  }
+
+private:
+  using ScanFn = void (*)(void *, uint64_t, uint64_t, uint64_t, void **);
+
+  struct Morsel {
+    void *table;
+    uint64_t begin;
+    uint64_t end;
+  };
+
+  Step makeStep(Pipeline &pipeline, QueryCompiler &qc) {
+    auto fn = qc.getPipelineFunction(pipeline.name);
+    if (!fn)
+      llvm::report_fatal_error(fn.takeError());
+    void **args = pipeline.args.data();
+    switch (pipeline.type) {
+    case PipelineType::Scan: {
+      auto *fptr = (*fn).toPtr<ScanFn>();
+      size_t tableIdx = static_cast<ScanPipeline &>(pipeline).tableIndex;
+      auto morsels = std::make_shared<std::vector<Morsel>>();
+      uint64_t nthreads = options.threads;
+      /// morsels never span segments, as with the MultiThreadedScheduler
+      return {[this, morsels, tableIdx]() {
+                for (auto [ptr, count] : db.getSegments(tableIdx))
+                  for (uint64_t begin = 0; begin < count;
+                       begin += options.chunkSize)
+                    morsels->push_back(
+                        {ptr, begin, std::min(begin + options.chunkSize, count)});
+                return morsels->size();
+              },
+              [fptr, morsels, nthreads, args](size_t unit) {
+                auto &morsel = (*morsels)[unit];
+                fptr(morsel.table, morsel.begin, morsel.end, nthreads, args);
+              }};
+    }
+    case PipelineType::Continuation: {
+      /// each call takes one thread local entry or spilled partition, once
+      /// per worker
+      auto *fptr = (*fn).toPtr<void (*)(void **)>();
+      size_t threads = options.threads;
+      return {[threads]() { return threads; },
+              [fptr, args](size_t) { fptr(args); }};
+    }
+    case PipelineType::Default:
+      break;
+    }
+    auto *fptr = (*fn).toPtr<void (*)(void **)>();
+    return {[]() -> size_t { return 1; }, [fptr, args](size_t) { fptr(args); }};
+  }
+
+  /// admits pending queries in order while their memory fits, a query that
+  /// does not fit blocks the queue once maxBypass queries passed it
+  void admit() {
+    std::vector<Job *> skipped;
+    for (auto it = pending.begin(); it != pending.end();) {
+      auto job = *it;
+      if (stopping(*job)) {
+        it = pending.erase(it);
+        job->admitted = Clock::now();
+        if (job->release)
+          job->release();
+        job->done = true;
+        job->finished = job->admitted;
+        finished.notify_all();
+        continue;
+      }
+      if (!running.empty() && reserved + job->memory > options.memoryLimit) {
+        if (job->bypassed >= options.maxBypass)
+          break;
+        skipped.push_back(job.get());
+        ++it;
+        continue;
+      }
+      for (auto *other : skipped)
+        ++other->bypassed;
+      it = pending.erase(it);
+      reserved += job->memory;
+      job->admission = ++admissions;
+      job->admitted = Clock::now();
+      /// starts at the least served running query, it neither catches up on
+      /// the time before it was admitted nor is starved by the others
+      if (!running.empty())
+        job->vruntime = (*std::min_element(running.begin(), running.end(),
+                                           [](auto &a, auto &b) {
+                                             return a->vruntime < b->vruntime;
+                                           }))->vruntime;
+      running.push_back(job);
+      if (!startStep(*job))
+        finish(*job);
+    }
+  }
+
+  /// starts the current step of the job, skipping steps without units;
+  /// false once the job has no step left or a step failed to start
+  bool startStep(Job &job) {
+    for (; job.step < job.steps.size(); ++job.step) {
+      job.next = 0;
+      job.units = 0;
+      try {
+        job.units = job.steps[job.step].start();
+      } catch (...) {
+        job.error = std::current_exception();
+        return false;
+      }
+      if (job.units)
+        return true;
+    }
+    return false;
+  }
+
+  /// the caller admits the queries that fit now
+  void finish(Job &job) {
+    job.done = true;
+    job.finished = Clock::now();
+    reserved -= job.memory;
+    running.erase(std::find_if(running.begin(), running.end(),
+                               [&](auto &other) { return other.get() == &job; }));
+    finished.notify_all();
+  }
+
+  /// the running query to take a unit from, nullptr if every running query
+  /// waits for units in flight
+  Job *pick() {
+    Job *best = nullptr;
+    for (auto &job : running) {
+      if (job->next >= job->units)
+        continue;
+      /// ends the query as soon as possible
+      if (stopping(*job))
+        return job.get();
+      if (!best) {
+        best = job.get();
+        continue;
+      }
+      if (options.policy == SchedulingPolicy::Priority &&
+          job->priority != best->priority) {
+        if (job->priority > best->priority)
+          best = job.get();
+        continue;
+      }
+      if (job->vruntime < best->vruntime)
+        best = job.get();
+    }
+    return best;
+  }
+
+  void work() {
+    std::unique_lock lock(m);
+    while (true) {
+      Job *job = nullptr;
+      cv.wait(lock, [&]() { return stop || (job = pick()); });
+      if (stop)
+        return;
+      /// keeps the job alive while its last unit finishes
+      auto owner = *std::find_if(running.begin(), running.end(),
+                                 [&](auto &other) { return other.get() == job; });
+      if (job->stopped) {
+        /// the units in flight finish, the last one ends the query
+        job->next = job->units;
+        if (!job->inflight)
+          end(lock, owner);
+        continue;
+      }
+      size_t unit = job->next++;
+      job->inflight++;
+      job->lastDispatch = ++dispatches;
+      if (!job->firstDispatch)
+        job->firstDispatch = job->lastDispatch;
+      double estimate = job->unitCost;
+      job->vruntime += estimate / job->weight();
+      auto &step = job->steps[job->step];
+      lock.unlock();
+      auto start = Clock::now();
+      std::exception_ptr error;
+      try {
+        step.run(unit);
+      } catch (...) {
+        error = std::current_exception();
+      }
+      double elapsed =
+          std::chrono::duration<double, std::nano>(Clock::now() - start)
+              .count();
+      lock.lock();
+      job->vruntime += (elapsed - estimate) / job->weight();
+      job->unitCost =
+          job->unitCost ? (job->unitCost * 7 + elapsed) / 8 : elapsed;
+      job->inflight--;
+      if (error) {
+        /// the remaining units are dropped
+        if (!job->error)
+          job->error = error;
+        job->next = job->units;
+      }
+      if (job->next < job->units || job->inflight)
+        continue;
+      job->step++;
+      if (!job->error && !stopping(*job) && startStep(*job)) {
+        cv.notify_all();
+        continue;
+      }
+      end(lock, owner);
+    }
+  }
+
+  /// true once the query was cancelled or passed its deadline
+  bool stopping(Job &job) {
+    if (!job.stopped && job.cancellation->stopped())
+      job.stopped = true;
+    return job.stopped;
+  }
+
+  /// ends a job without units in flight, a stopped query releases its
+  /// memory first
+  void end(std::unique_lock<std::mutex> &lock, const std::shared_ptr<Job> &job) {
+    if (job->stopped && job->release) {
+      lock.unlock();
+      job->release();
+      lock.lock();
+    }
+    finish(*job);
+    admit();
+    cv.notify_all();
+  }
+
+  Catalog &db;
+  Options options;
+  std::vector<std::thread> workers;
+  std::mutex m;
+  /// workers wait for units, tickets for finished queries
+  std::condition_variable cv, finished;
+  std::list<std::shared_ptr<Job>> pending;
+  std::vector<std::shared_ptr<Job>> running;
+  size_t reserved = 0;
+  size_t admissions = 0;
+  uint64_t dispatches = 0;
+  bool stop = false;
+};
+} // namespace p2cllvm
@@ -13,7 +13,9 @@
 #include "runtime/ThreadLocalContext.h"
 #include "runtime/TypeInfo.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cstddef>
 #include <memory>
 #include <string_view>
 #include <llvm/ADT/SmallVector.h>
@@ -28,6 +30,11 @@ namespace p2cllvm {
 struct Aggregate {
   IU *input;
   IU result;
+  /// thread local aggregation context of the current pipeline
+  ValueRef<> localContext = nullptr;
+  /// DistinctMerge of the merge pipeline, null where states are merged
+  /// right away
+  ValueRef<> distinctMerges = nullptr;
 
   Aggregate(std::string_view name, IU *input, TypeEnum type)
       : input(input), result(name, type) {}
@@ -36,6 +43,8 @@ struct Aggregate {
   virtual void createAggregation(Builder &builder) = 0;
   virtual void createReduceAggregation(Builder &builder,
                                        ValueRef<> other) = 0;
+  /// turn the stored aggregation state into the result value
+  virtual void finalize(Builder &builder) { (void)builder; }
   IU *getResult() { return &result; }
 };
 
@@ -150,6 +159,109 @@ void init(Builder &builder) override {
   }
 };
 
+/// Aggregates whose per group state lives outside of the tuple, the tuple
+/// only stores a pointer to it
+template <typename T> struct StateAggregate : public Aggregate {
+  StateAggregate(std::string_view name, IU *input)
+      : Aggregate(name, input, TypeEnum::BigInt) {}
+
+  ValueRef<> getState(Builder &builder, ValueRef<> val) {
+    return builder.builder.CreateIntToPtr(val, builder.getPtrTy());
+  }
+
+  void init(Builder &builder) override {
+    assert(localContext && "StateAggregate requires a thread local context");
+    auto &scope = builder.getCurrentScope();
+    ValueRef<> state = T::createAlloc(builder, localContext);
+    T::createAdd(builder, state,
+                 MurmurHasher::createHashSingle(input, builder));
+    scope.updateValue(&result, builder.builder.CreatePtrToInt(
+                                   state, builder.getInt64ty()));
+  }
+
+  void createAggregation(Builder &builder) override {
+    auto &scope = builder.getCurrentScope();
+    ValueRef<> state = getState(builder, scope.lookupValue(&result));
+    T::createAdd(builder, state,
+                 MurmurHasher::createHashSingle(input, builder));
+  }
+
+  void createReduceAggregation(Builder &builder, ValueRef<> other) override {
+    auto &scope = builder.getCurrentScope();
+    ValueRef<> state = getState(builder, scope.lookupValue(&result));
+    T::createMerge(builder, state, getState(builder, other), distinctMerges);
+  }
+
+  void finalize(Builder &builder) override {
+    auto &scope = builder.getCurrentScope();
+    ValueRef<> state = getState(builder, scope.lookupValue(&result));
+    scope.updateValue(&result, T::createCount(builder, state));
+    scope.updatePtr(&result, nullptr);
+  }
+};
+
+/// COUNT(DISTINCT) estimated with one HyperLogLog sketch per group
+struct ApproxCountDistinctAggregate
+    : public StateAggregate<ApproxCountDistinctAggregate> {
+  ApproxCountDistinctAggregate(std::string_view name, IU *input)
+      : StateAggregate(name, input) {}
+
+  static ValueRef<> createAlloc(Builder &builder, ValueRef<> lctx) {
+    return builder.createCall(
+        "aggAllocSketch", &aggAllocSketch, builder.getPtrTy(), lctx,
+        builder.addAndCreatePipelineArg(&builder.query.budget));
+  }
+
+  static void createAdd(Builder &builder, ValueRef<> state, ValueRef<> hash) {
+    builder.createSketchAdd(state, hash);
+  }
+
+  /// sketches are small, they are always merged right away
+  static void createMerge(Builder &builder, ValueRef<> state, ValueRef<> other,
+                          ValueRef<> merges) {
+    (void)merges;
+    builder.createCall("hll_merge", &hll_merge, builder.getVoidTy(), state,
+                       other);
+  }
+
+  static ValueRef<> createCount(Builder &builder, ValueRef<> state) {
+    return builder.createHLLEstimate(state);
+  }
+};
+
+/// COUNT(DISTINCT) with one hash set per group, distinct values are
+/// identified by their 64 bit hash
+struct CountDistinctAggregate : public StateAggregate<CountDistinctAggregate> {
+  CountDistinctAggregate(std::string_view name, IU *input)
+      : StateAggregate(name, input) {}
+
+  static ValueRef<> createAlloc(Builder &builder, ValueRef<> lctx) {
+    return builder.createCall(
+        "aggAllocDistinctSet", &aggAllocDistinctSet, builder.getPtrTy(), lctx,
+        builder.addAndCreatePipelineArg(&builder.query.budget));
+  }
+
+  static void createAdd(Builder &builder, ValueRef<> state, ValueRef<> hash) {
+    builder.createCall("distinct_insert", &distinct_insert,
+                       builder.getVoidTy(), state, hash);
+  }
+
+  static void createMerge(Builder &builder, ValueRef<> state, ValueRef<> other,
+                          ValueRef<> merges) {
+    if (merges)
+      builder.createCall("distinct_merge_deferred", &distinct_merge_deferred,
+                         builder.getVoidTy(), merges, state, other);
+    else
+      builder.createCall("distinct_merge", &distinct_merge,
+                         builder.getVoidTy(), state, other);
+  }
+
+  static ValueRef<> createCount(Builder &builder, ValueRef<> state) {
+    return builder.createCall("distinct_count", &distinct_count,
+                              builder.getInt64ty(), state);
+  }
+};
+
 class Aggregation : public Operator {
 public:
   Aggregation(std::unique_ptr<Operator> &&parent, IUSet &&groupByIUs)
@@ -158,9 +270,11 @@ public:
   void produce(IUSet &required, Builder &builder, ConsumerFn consumer,
                InitFn fn) override {
     Tuple elem;
-    AggregationContext *aContext;
+    AggregationContext *aContext = nullptr;
     IUSet requiredGb = required | groupByIUs;
     IUSet aggIUs;
+    /// with a memory budget the groups are partitioned and may spill
+    bool spilling = builder.query.budget.isLimited();
 
     /// inOrder for correct mapping between aggs and IUs
     /// might be reordered otherwise
@@ -174,10 +288,14 @@ public:
     elem = Tuple::get(builder.getContext(), required);
     size_t allocSize = calculateElemSize<>(elem);
     ValueRef<> tls = nullptr, tb = nullptr, ltls = nullptr,
-              localHt = nullptr;
+              localHt = nullptr, spill = nullptr, preAggregation = nullptr;
     auto init = [&](Builder &builder) {
-      aContext = builder.query.addOperatorContext(
-          std::make_unique<AggregationContext>());
+      /// the parent may run several pipelines that feed the same groups
+      if (!aContext)
+        aContext = builder.query.addOperatorContext(
+            std::make_unique<AggregationContext>(&builder.query.budget,
+                                                 allocSize,
+                                                 &builder.query.cancellation));
       tls = builder.addAndCreatePipelineArg(&aContext->tls);
       ltls = builder.createCall(
           "localAggregation", &local<ThreadAggregationContext>,
@@ -187,7 +305,14 @@ public:
                               ltls);
       localHt = builder.createCall(
           "getLocalHashTable", &getLocalHashTable,
-          builder.getPtrTy(), ltls);
+          builder.getPtrTy(), ltls, builder.getInt64Constant(allocSize));
+      preAggregation =
+          builder.createCall("getPreAggregation", &getPreAggregation,
+                             builder.getPtrTy(), ltls);
+      if (spilling)
+        spill = builder.addAndCreatePipelineArg(&aContext->spill);
+      for (auto &agg : aggs)
+        agg->localContext = ltls;
     };
     auto consumerFn = [&](Builder &builder) {
       assert(tb != nullptr);
@@ -197,6 +322,35 @@ public:
         groupby.push_back(scope.lookupValue(iu));
       }
       ValueRef<> hash = builder.createHashKeysHasher<MurmurHasher>(groupByIUs.v);
+      /// skip the local table if it does not reduce the number of groups,
+      /// the runtime is only called at the end of a sampling window
+      auto &ir = builder.builder;
+      ValueRef<> rowsPtr = ir.CreateConstInBoundsGEP1_64(
+          builder.getInt8ty(), preAggregation, offsetof(PreAggregation, rows));
+      ValueRef<> rows = ir.CreateAdd(
+          ir.CreateLoad(builder.getInt64ty(), rowsPtr),
+          builder.getInt64Constant(1));
+      ir.CreateStore(rows, rowsPtr);
+      BasicBlockRef adapt = builder.createBasicBlock("adapt");
+      BasicBlockRef decide = builder.createBasicBlock("decide");
+      ir.CreateCondBr(
+          ir.CreateICmpEQ(rows,
+                          builder.getInt64Constant(PreAggregation::sampleSize)),
+          adapt, decide);
+      builder.setInsertPoint(adapt);
+      builder.createCall("adaptPreAggregation", &adaptPreAggregation,
+                         builder.getVoidTy(), preAggregation);
+      ir.CreateBr(decide);
+      builder.setInsertPoint(decide);
+      ValueRef<> bypassing = ir.CreateLoad(
+          builder.getInt8ty(),
+          ir.CreateConstInBoundsGEP1_64(builder.getInt8ty(), preAggregation,
+                                        offsetof(PreAggregation, bypass)));
+      BasicBlockRef probe = builder.createBasicBlock("probe");
+      ValueRef<llvm::BranchInst> bypass = ir.CreateCondBr(
+          ir.CreateICmpEQ(bypassing, builder.getInt8Constant(0)), probe,
+          nullptr);
+      builder.setInsertPoint(probe);
       ValueRef<> bucket = builder.createHashTableLookUp(localHt, hash);
       ValueRef<> ptr= builder.createBeginForwardIter(bucket);
       ValueRef<> tuple = builder.createLoadData<>(ptr);
@@ -212,16 +366,21 @@ public:
       BasicBlockRef gcnt = builder.createEndCmpKeys(branches);
       if (gcnt)
         builder.setInsertPoint(gcnt);
-      builder.createEndForwardIter();
-      ValueRef<> entry = builder.createTupleBufferInsert(tb, allocSize);
+      bypass->setSuccessor(1, builder.createEndForwardIter());
+      /// the spilling insert also adds the entry to the local table
+      ValueRef<> entry =
+          spilling ? builder.createCall("insertAggEntrySpilling",
+                                        &insertAggEntrySpilling,
+                                        builder.getPtrTy(), spill, ltls, hash)
+                   : builder.createTupleBufferInsert(tb, allocSize);
       tuple = builder.createLoadData<>(entry);
       for (const auto &agg : aggs) {
         agg->init(builder);
       }
       builder.createPackTuple(elem, tuple, resultIUs.v);
-      builder.createCall("insertAggEntry", &insertAggEntry,
-                         builder.getPtrTy(), ltls,
-                         hash, entry);
+      if (!spilling)
+        builder.createCall("insertAggEntry", &insertAggEntry,
+                           builder.getPtrTy(), ltls, hash, entry);
       BasicBlockRef fbb = builder.createBasicBlock("final");
       builder.builder.CreateBr(fbb);
       builder.createBranch(body, fbb);
@@ -234,16 +393,30 @@ public:
 
     // create new pipeline
     ValueRef<> ht, tbP;
-    llvm::SmallVector<ValueRef<> , 8> groupby;
     builder.createPipeline();
-    fn(builder);
-    auto &scope = builder.getCurrentScope();
+    /// large distinct sets are merged by all workers in a pipeline of their
+    /// own, the groups are produced after it
+    bool mergeDistinct = hasCountDistinct();
+    if (mergeDistinct) {
+      ValueRef<> merges =
+          builder.addAndCreatePipelineArg(&aContext->distinctMerges);
+      for (auto &agg : aggs)
+        agg->distinctMerges = merges;
+    } else {
+      fn(builder);
+    }
     tls = builder.addAndCreatePipelineArg(&aContext->tls);
     ht = builder.addAndCreatePipelineArg(&aContext->ht);
     tbP = builder.addAndCreatePipelineArg(&aContext->tb8);
     ValueRef<> combinedSize = builder.createCall(
         "estimateCombinedAggSize", &combineSketches<ThreadAggregationContext>,
         builder.getInt64ty(), tls);
+    if (spilling) {
+      spill = builder.addAndCreatePipelineArg(&aContext->spill);
+      combinedSize = builder.createCall("finishAggBuild", &finishAggBuild,
+                                        builder.getInt64ty(), spill,
+                                        combinedSize);
+    }
     builder.createHashTableAlloc(ht, combinedSize);
     ValueRef<> threads = builder.createCall("getNumThreadContext",
     &getNumThreadContext<ThreadAggregationContext>,
@@ -254,53 +427,58 @@ public:
     ValueRef<> tctx = builder.createCall(
         "getAggContext", &getContext<ThreadAggregationContext>,
         builder.getPtrTy(), tls, titer);
-    tb = builder.createCall("getAggTB", &getLocalTB<ThreadAggregationContext>,
-                            builder.getPtrTy(),
-                            tctx);
-    ValueRef<> telem = builder.createBeginTupleBufferIter(tb);
-    ValueRef<> tuple = builder.createLoadData<>(telem);
-    builder.createUnpackTuple(elem, tuple, groupByIUs.v);
-    for (auto *iu : groupByIUs) {
-      groupby.push_back(scope.lookupValue(iu));
-    }
-    ValueRef<> hash = builder.createHashKeysHasher<MurmurHasher>(groupByIUs.v);
-    ValueRef<> bucket = builder.createHashTableLookUp(ht, hash);
-    ValueRef<> ptr = builder.createBeginForwardIter(bucket);
-    ValueRef<> nodeTuple = builder.createLoadData<>(ptr);
-    auto keyValArray = builder.createUnpackTuple<std::vector<ValueRef<> >>(
-        elem, nodeTuple, groupByIUs.v);
-    auto branches =
-        builder.createCmpKeys(keyValArray, groupby, groupByIUs.v);
-    auto aggValArray = builder.createUnpackTuple<std::vector<ValueRef<> >>(
-        elem, tuple, inOrder);
-    builder.createUnpackTuple<>(elem, nodeTuple, inOrder);
-    size_t i = 0;
-    for (const auto &agg : aggs) {
-      agg->createReduceAggregation(builder, aggValArray[i++]);
+    if (spilling) {
+      /// groups of spilled partitions were moved to disk by finishAggBuild
+      ValueRef<llvm::PHINode> piter = builder.createBeginIndexIter(
+          builder.getInt64Constant(0),
+          builder.getInt64Constant(AggregationSpill::numPartitions));
+      tb = builder.createCall("getAggPartitionTB", &getAggPartitionTB,
+                              builder.getPtrTy(), tctx, piter);
+    } else {
+      tb = builder.createCall("getAggTB", &getLocalTB<ThreadAggregationContext>,
+                              builder.getPtrTy(),
+                              tctx);
     }
-    BasicBlockRef body = builder.builder.GetInsertBlock();
-    BasicBlockRef gcnt = builder.createEndCmpKeys(branches);
-    builder.setInsertPoint(gcnt);
-    builder.createEndForwardIter();
-
-    ValueRef<> tbPelem = builder.createTupleBufferInsert(tbP, sizeof(void *));
-    builder.builder.CreateStore(telem, tbPelem);
-    builder.createHashTableInsert(ht, telem, hash);
-    BasicBlockRef fbb = builder.createBasicBlock("final");
-    builder.createBranch(fbb);
-    builder.createBranch(body, fbb);
-    builder.setInsertPoint(fbb);
+    ValueRef<> telem = builder.createBeginTupleBufferIter(tb);
+    mergeEntry(builder, ht, telem, elem, inOrder,
+               [&](ValueRef<> telem, ValueRef<> hash) {
+                 ValueRef<> tbPelem =
+                     builder.createTupleBufferInsert(tbP, sizeof(void *));
+                 builder.builder.CreateStore(telem, tbPelem);
+                 builder.createHashTableInsert(ht, telem, hash);
+               });
     builder.createEndTupleBufferIter(allocSize);
+    if (spilling)
+      builder.createEndIndexIter();
     builder.createEndIndexIter();
 
+    if (mergeDistinct) {
+      builder.finishPipeline();
+      builder.createContinuationPipeline();
+      builder.createCall(
+          "distinct_run_merges", &distinct_run_merges, builder.getVoidTy(),
+          builder.addAndCreatePipelineArg(&aContext->distinctMerges));
+      builder.finishPipeline();
+
+      builder.createPipeline();
+      fn(builder);
+      tbP = builder.addAndCreatePipelineArg(&aContext->tb8);
+      if (spilling)
+        spill = builder.addAndCreatePipelineArg(&aContext->spill);
+      /// the groups of spilled partitions are merged one partition at a time
+      for (auto &agg : aggs)
+        agg->distinctMerges = nullptr;
+    }
+
     /// iterate over aggregats
     ValueRef<> telemptr = builder.createBeginTupleBufferIter(tbP);
     telem = builder.builder.CreateLoad(
         builder.getPtrTy(), telemptr, false);
-    tuple = builder.createLoadData<>(telem);
-    builder.createUnpackTuple<>(elem, tuple, resultIUs.v);
-    consumer(builder);
+    produceGroup(builder, telem, elem, resultIUs, consumer);
     builder.createEndTupleBufferIter(sizeof(void *));
+    if (spilling)
+      produceSpilled(builder, spill, elem, inOrder, resultIUs, allocSize,
+                     consumer);
   }
 
   void addAggregate(std::unique_ptr<Aggregate> &&agg) {
@@ -315,6 +493,20 @@ public:
     return available;
   }
 
+  std::string getName() const override { return "Aggregation"; }
+
+  std::vector<std::unique_ptr<Operator> *> getInputs() override {
+    return {&parent};
+  }
+
+  const IUSet &getGroupBy() const { return groupByIUs; }
+
+  bool hasCountDistinct() const {
+    return std::any_of(aggs.begin(), aggs.end(), [](auto &agg) {
+      return dynamic_cast<CountDistinctAggregate *>(agg.get()) != nullptr;
+    });
+  }
+
   IUSet inputIUs() {
     IUSet input;
     for (auto &agg : aggs) {
@@ -338,6 +530,103 @@ public:
   }
 
 private:
+  /// merge the entry telem into ht, newGroup is called with the entry and
+  /// its hash if ht has no group with the same keys
+  template <typename F>
+  void mergeEntry(Builder &builder, ValueRef<> ht, ValueRef<> telem,
+                  Tuple &elem, std::vector<IU *> &inOrder, F &&newGroup) {
+    auto &scope = builder.getCurrentScope();
+    llvm::SmallVector<ValueRef<> , 8> groupby;
+    ValueRef<> tuple = builder.createLoadData<>(telem);
+    builder.createUnpackTuple(elem, tuple, groupByIUs.v);
+    for (auto *iu : groupByIUs) {
+      groupby.push_back(scope.lookupValue(iu));
+    }
+    ValueRef<> hash = builder.createHashKeysHasher<MurmurHasher>(groupByIUs.v);
+    ValueRef<> bucket = builder.createHashTableLookUp(ht, hash);
+    ValueRef<> ptr = builder.createBeginForwardIter(bucket);
+    ValueRef<> nodeTuple = builder.createLoadData<>(ptr);
+    auto keyValArray = builder.createUnpackTuple<std::vector<ValueRef<> >>(
+        elem, nodeTuple, groupByIUs.v);
+    auto branches =
+        builder.createCmpKeys(keyValArray, groupby, groupByIUs.v);
+    auto aggValArray = builder.createUnpackTuple<std::vector<ValueRef<> >>(
+        elem, tuple, inOrder);
+    builder.createUnpackTuple<>(elem, nodeTuple, inOrder);
+    size_t i = 0;
+    for (const auto &agg : aggs) {
+      agg->createReduceAggregation(builder, aggValArray[i++]);
+    }
+    BasicBlockRef body = builder.builder.GetInsertBlock();
+    BasicBlockRef gcnt = builder.createEndCmpKeys(branches);
+    builder.setInsertPoint(gcnt);
+    builder.createEndForwardIter();
+
+    newGroup(telem, hash);
+    BasicBlockRef fbb = builder.createBasicBlock("final");
+    builder.createBranch(fbb);
+    builder.createBranch(body, fbb);
+    builder.setInsertPoint(fbb);
+  }
+
+  /// finalize the group stored in telem and pass it to the consumer
+  void produceGroup(Builder &builder, ValueRef<> telem, Tuple &elem,
+                    IUSet &resultIUs, ConsumerFn &consumer) {
+    ValueRef<> tuple = builder.createLoadData<>(telem);
+    builder.createUnpackTuple<>(elem, tuple, resultIUs.v);
+    for (const auto &agg : aggs) {
+      agg->finalize(builder);
+    }
+    consumer(builder);
+  }
+
+  /// aggregate the spilled partitions one by one
+  void produceSpilled(Builder &builder, ValueRef<> spill, Tuple &elem,
+                      std::vector<IU *> &inOrder, IUSet &resultIUs,
+                      size_t allocSize, ConsumerFn &consumer) {
+    auto &irb = builder.getBuilder();
+    BasicBlockRef nextBB = builder.createBasicBlock("nextPartition");
+    builder.createBranch(nextBB);
+    builder.setInsertPoint(nextBB);
+    ValueRef<> partition = builder.createCall(
+        "aggNextPartition", &aggNextPartition, builder.getPtrTy(), spill);
+    BasicBlockRef partitionBB = builder.createBasicBlock("partition");
+    BasicBlockRef doneBB = builder.createBasicBlock("partitionsDone");
+    builder.createBranch(irb.CreateIsNotNull(partition), partitionBB, doneBB);
+    builder.setInsertPoint(partitionBB);
+    ValueRef<> ht = builder.createCall("aggPartitionTable", &aggPartitionTable,
+                                       builder.getPtrTy(), partition);
+    BasicBlockRef entryBB = builder.createBasicBlock("nextEntry");
+    builder.createBranch(entryBB);
+    builder.setInsertPoint(entryBB);
+    ValueRef<> entry = builder.createCall("aggNextEntry", &aggNextEntry,
+                                          builder.getPtrTy(), partition);
+    BasicBlockRef bodyBB = builder.createBasicBlock("spilledEntry");
+    BasicBlockRef endBB = builder.createBasicBlock("partitionEnd");
+    builder.createBranch(irb.CreateIsNotNull(entry), bodyBB, endBB);
+    builder.setInsertPoint(bodyBB);
+    mergeEntry(builder, ht, entry, elem, inOrder,
+               [&](ValueRef<> entry, ValueRef<> hash) {
+                 /// spilled entries only live until the next block is read
+                 ValueRef<> group = builder.createCall(
+                     "aggPartitionCopy", &aggPartitionCopy,
+                     builder.getPtrTy(), spill, partition, entry);
+                 builder.createHashTableInsert(ht, group, hash);
+               });
+    builder.createBranch(entryBB);
+    builder.setInsertPoint(endBB);
+    ValueRef<> groups = builder.createCall(
+        "aggPartitionGroups", &aggPartitionGroups, builder.getPtrTy(),
+        partition);
+    ValueRef<> telem = builder.createBeginTupleBufferIter(groups);
+    produceGroup(builder, telem, elem, resultIUs, consumer);
+    builder.createEndTupleBufferIter(allocSize);
+    builder.createCall("aggReleasePartition", &aggReleasePartition,
+                       builder.getVoidTy(), spill, partition);
+    builder.createBranch(nextBB);
+    builder.setInsertPoint(doneBB);
+  }
+
   std::unique_ptr<Operator> parent;
   IUSet groupByIUs;
   std::vector<std::unique_ptr<Aggregate>> aggs;
@@ -6,12 +6,15 @@
 #include "operators/OperatorContext.h"
 #include "runtime/Test.h"
 
+#include <atomic>
 #include <cassert>
 #include <cstdint>
 #include <memory>
+#include <span>
 #include <stdexcept>
 #include <string>
 #include <unordered_map>
+#include <vector>
 #include <llvm/Support/ErrorHandling.h>
 
 namespace p2cllvm {
@@ -39,6 +42,93 @@ public:
   }
 };
 
+/// Compares each output value with the next expected value, the values are
+/// given row by row as strings. After execution and before the query is
+/// destroyed, check the number of compared values with compareLength. The
+/// final pipeline must run on a single thread, like the output of a sort or
+/// a global aggregation; comparisons from a second thread fail.
+class AssertSink : public Sink {
+public:
+  explicit AssertSink(std::vector<std::string> expected)
+      : expected(std::move(expected)) {}
+  ~AssertSink() override = default;
+
+  void produce(std::unique_ptr<Operator> &parent, std::span<IU *> required,
+               std::span<std::string> names, Builder &builder) override {
+    ctx = builder.query.addOperatorContext(std::make_unique<AssertContext>());
+    ctx->iter = expected;
+    IUSet requiredAsSet(std::vector<IU *>{required.begin(), required.end()});
+    parent->produce(
+        requiredAsSet, builder,
+        [&](Builder &builder) {
+          ValueRef<> exp = builder.addAndCreatePipelineArg(ctx);
+          for (auto *iu : required)
+            createCompare(builder, iu, exp);
+        },
+        [&](Builder &builder) {});
+    builder.finishPipeline();
+  }
+
+  /// the context of the last produced query, owned by the query
+  AssertContext *getContext() { return ctx; }
+
+private:
+  void createCompare(Builder &builder, IU *iu, ValueRef<> exp) {
+#define COMPARE_FUNC(type)                                                     \
+  builder.createCall("compareFromString" #type,                               \
+                     &compareFromString<type##Ty>, builder.getVoidTy(),        \
+                     builder.getCurrentScope().lookupValue(iu), exp)
+    switch (iu->type.typeEnum) {
+    case TypeEnum::Integer:
+      COMPARE_FUNC(Integer);
+      break;
+    case TypeEnum::BigInt:
+      COMPARE_FUNC(BigInt);
+      break;
+    case TypeEnum::Double:
+      COMPARE_FUNC(Double);
+      break;
+    case TypeEnum::Char:
+      COMPARE_FUNC(Char);
+      break;
+    case TypeEnum::Date:
+      COMPARE_FUNC(Date);
+      break;
+    case TypeEnum::String:
+      COMPARE_FUNC(String);
+      break;
+    default:
+      throw std::runtime_error("Unsupported type");
+    }
+#undef COMPARE_FUNC
+  }
+
+  std::vector<std::string> expected;
+  AssertContext *ctx = nullptr;
+};
+
+/// Counts the output rows without materializing them
+class CountSink : public Sink {
+public:
+  ~CountSink() override = default;
+
+  void produce(std::unique_ptr<Operator> &parent, std::span<IU *> required,
+               std::span<std::string> names, Builder &builder) override {
+    rows = 0;
+    IUSet requiredAsSet(std::vector<IU *>{required.begin(), required.end()});
+    parent->produce(
+        requiredAsSet, builder,
+        [&](Builder &builder) { builder.createCounterIncrement(&rows); },
+        [&](Builder &builder) {});
+    builder.finishPipeline();
+  }
+
+  uint64_t getRows() const { return rows.load(); }
+
+private:
+  std::atomic<uint64_t> rows = 0;
+};
+
 void produce(std::unique_ptr<Operator> op, std::vector<IU *> outputs,
              std::vector<std::string> names, std::unique_ptr<Sink> sink);
 }; // namespace p2cllvm
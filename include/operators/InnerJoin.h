@@ -8,6 +8,7 @@
 #include "IR/Types.h"
 #include "Operator.h"
 #include "OperatorContext.h"
+#include "runtime/JoinSpill.h"
 #include "runtime/Runtime.h"
 #include "runtime/ThreadLocalContext.h"
 #include "runtime/TypeInfo.h"
@@ -31,9 +32,11 @@ class InnerJoin : public Operator {
 public:
   void produce(IUSet &required, Builder &builder, ConsumerFn fn,
                InitFn iit) override {
-        Tuple elem;
-    JoinContext *ijContext;
-    ValueRef<> tls, ltls, ht;  
+        Tuple elem, probeElem;
+    JoinContext *ijContext = nullptr;
+    ValueRef<> tls, ltls, ht, spill, spilled, ptls;
+    /// with a memory budget the build side is partitioned and may spill
+    bool spilling = builder.query.budget.isLimited();
     IUSet leftRequiredIUs =
         (required & left->availableIUs()) | IUSet(leftKeyIUs) |
         (condition ? left->availableIUs() & condition->getIUs() : IUSet());
@@ -43,26 +46,50 @@ public:
     IUSet leftPayloadIUs = leftRequiredIUs - IUSet(leftKeyIUs);
     elem = Tuple::get(builder.getContext(), leftRequiredIUs);
     size_t allocSize = calculateElemSize<>(elem);
+    probeElem = Tuple::get(builder.getContext(), rightRequiredIUs);
+    size_t probeSize = calculateElemSize<>(probeElem);
     auto initLeft = [&](Builder &builder) {
-      ijContext =
-          builder.query.addOperatorContext(std::make_unique<JoinContext>());
+      /// the left input may run several pipelines that feed the same table
+      if (!ijContext)
+        ijContext = builder.query.addOperatorContext(
+            std::make_unique<JoinContext>(&builder.query.budget, allocSize,
+                                          &builder.query.cancellation));
       tls = builder.addAndCreatePipelineArg(&ijContext->tls);
       ltls = builder.createCall("localJoin", local<ThreadJoinContext>,
                                 builder.getPtrTy(), tls);
+      if (spilling)
+        spill = builder.addAndCreatePipelineArg(&ijContext->spill);
     };
 
     auto initRight = [&](Builder &builder) {
       iit(builder);
       ht = builder.addAndCreatePipelineArg(&ijContext->ht);
+      if (spilling) {
+        spill = builder.addAndCreatePipelineArg(&ijContext->spill);
+        spilled = builder.createCall("joinSpilledPartitions",
+                                     &joinSpilledPartitions,
+                                     builder.getInt64ty(), spill);
+        ValueRef<> probeTls =
+            builder.addAndCreatePipelineArg(&ijContext->probeTls);
+        ptls = builder.createCall("localJoinProbe",
+                                  local<ThreadJoinProbeContext>,
+                                  builder.getPtrTy(), probeTls);
+      }
     };
     left->produce(
         leftRequiredIUs, builder,
         [&](Builder &builder) {
           ValueRef<> hash =
               builder.createHashKeysHasher<MurmurHasher>(leftKeyIUs);
-          ValueRef<> entry = builder.createCall(
-              "insertJoinEntry", &insertJoinEntry, builder.getPtrTy(), ltls,
-              hash, builder.getInt64Constant(allocSize));
+          ValueRef<> entry =
+              spilling ? builder.createCall("insertJoinEntrySpilling",
+                                            &insertJoinEntrySpilling,
+                                            builder.getPtrTy(), spill, ltls,
+                                            hash)
+                       : builder.createCall(
+                             "insertJoinEntry", &insertJoinEntry,
+                             builder.getPtrTy(), ltls, hash,
+                             builder.getInt64Constant(allocSize));
           builder.createStoreHash<>(entry, hash);
           ValueRef<> tuple = builder.createLoadData<>(entry);
           builder.createPackTuple(elem, tuple, leftRequiredIUs.v);
@@ -76,6 +103,11 @@ public:
     ValueRef<> htSize = builder.createCall("estimateCombinedJoinSize",
                                            &combineSketches<ThreadJoinContext>,
                                            builder.getInt64ty(), tls);
+    if (spilling) {
+      spill = builder.addAndCreatePipelineArg(&ijContext->spill);
+      htSize = builder.createCall("finishJoinBuild", &finishJoinBuild,
+                                  builder.getInt64ty(), spill, htSize);
+    }
     ht = builder.createHashTableAlloc(ht, htSize);
     builder.finishPipeline();
 
@@ -95,51 +127,70 @@ public:
     right->produce(
         rightRequiredIUs, builder,
         [&](Builder &builder) {
-          auto &scope = builder.getCurrentScope();
           ValueRef<> hash =
               builder.createHashKeysHasher<MurmurHasher>(rightKeyIUs);
-          ValueRef<> bucket = builder.createHashTableLookUp(ht, hash);
-          ValueRef<> ptr = builder.createBeginForwardIter(bucket);
-          ValueRef<> taggedPtr = ptr;
-          ptr = builder.createGetPtr<>(ptr);
-          BasicBlockRef cbb = builder.createCmpTag<>(taggedPtr, hash);
-          BasicBlockRef fbb = builder.getInsertBlock();
-          ValueRef<> tuple = builder.createLoadData<>(ptr);
-          builder.createUnpackTuple<>(elem, tuple, leftKeyIUs);
-          llvm::SmallVector<ValueRef<>, 8> leftV, rightV;
-          for (auto *iu : leftKeyIUs) {
-            leftV.push_back(scope.lookupValue(iu));
+          if (!spilling) {
+            probe(builder, ht, hash, elem, leftPayloadIUs, fn);
+            return;
           }
-          for (auto *iu : rightKeyIUs) {
-            rightV.push_back(scope.lookupValue(iu));
-          }
-          auto branches = builder.createCmpKeys(leftV, rightV, leftKeyIUs);
-          builder.createUnpackTuple(elem, tuple, leftPayloadIUs.v);
-          if (condition) {
-            ValueRef<> val = builder.createExpEval(condition);
-            BasicBlockRef trBB = builder.createBasicBlock("trueJoinCond");
-            BasicBlockRef cnt = builder.createBasicBlock("cntJoinCond");
-            builder.createBranch(val, trBB, cnt);
-            builder.setInsertPoint(trBB);
-            fn(builder);
-            builder.createBranch(cnt);
-            builder.setInsertPoint(cnt);
-          } else {
-            fn(builder);
-          }
-          BasicBlockRef bb = builder.createEndCmpKeys(branches);
-          builder.createBranch(bb);
-          builder.setInsertPoint(bb);
-          builder.createEndForwardIter<HashTableEntry, true>();
-          builder.createMissingBranch(cbb, builder.getInsertBlock(), fbb);
+          /// tuples of spilled partitions are joined after probing
+          auto &irb = builder.getBuilder();
+          ValueRef<> partition =
+              irb.CreateAnd(irb.CreateLShr(hash, JoinSpill::partitionShift),
+                            JoinSpill::numPartitions - 1);
+          ValueRef<> isSpilled = irb.CreateTrunc(
+              irb.CreateLShr(spilled, partition), builder.getInt1ty());
+          BasicBlockRef spillBB = builder.createBasicBlock("spillProbe");
+          BasicBlockRef probeBB = builder.createBasicBlock("probe");
+          BasicBlockRef cnt = builder.createBasicBlock("cntProbe");
+          builder.createBranch(isSpilled, spillBB, probeBB);
+          builder.setInsertPoint(spillBB);
+          ValueRef<> tuple = builder.createCall(
+              "joinSpillProbe", &joinSpillProbe, builder.getPtrTy(), spill,
+              ptls, hash, builder.getInt64Constant(probeSize));
+          builder.createPackTuple(probeElem, tuple, rightRequiredIUs.v);
+          builder.createBranch(cnt);
+          builder.setInsertPoint(probeBB);
+          probe(builder, ht, hash, elem, leftPayloadIUs, fn);
+          builder.createBranch(cnt);
+          builder.setInsertPoint(cnt);
         },
         initRight);
+    if (!spilling)
+      return;
+    builder.finishPipeline();
+
+    builder.createPipeline();
+    spill = builder.addAndCreatePipelineArg(&ijContext->spill);
+    builder.createCall("finishJoinProbe", &finishJoinProbe,
+                       builder.getVoidTy(), spill);
+    builder.finishPipeline();
+
+    /// Pipeline joining the spilled partitions one by one, it feeds the
+    /// same consumer as the probe pipeline
+    builder.createContinuationPipeline();
+    spill = builder.addAndCreatePipelineArg(&ijContext->spill);
+    iit(builder);
+    produceSpilled(builder, spill, probeElem, rightRequiredIUs, elem,
+                   leftPayloadIUs, fn);
   }
 
   IUSet availableIUs() override {
     return left->availableIUs() | right->availableIUs();
   }
 
+  std::string getName() const override { return "InnerJoin"; }
+
+  std::vector<std::unique_ptr<Operator> *> getInputs() override {
+    return {&left, &right};
+  }
+
+  /// keys of the left (build) and the right (probe) input, pairwise equal
+  const std::vector<IU *> &getLeftKeys() const { return leftKeyIUs; }
+  const std::vector<IU *> &getRightKeys() const { return rightKeyIUs; }
+  /// evaluated on key matches, may be null
+  Exp *getCondition() { return condition.get(); }
+
   InnerJoin(std::unique_ptr<Operator> &&left, std::unique_ptr<Operator> &&right,
             std::vector<IU *> &&leftKeyIUs, std::vector<IU *> &&rightKeyIUs,
             std::unique_ptr<Exp> &&condition)
@@ -148,6 +199,84 @@ public:
         rightKeyIUs(std::move(rightKeyIUs)) {}
 
 private:
+  /// probe the table with the right tuple in scope, calls fn for each match
+  void probe(Builder &builder, ValueRef<> ht, ValueRef<> hash, Tuple &elem,
+             IUSet &leftPayloadIUs, ConsumerFn &fn) {
+    auto &scope = builder.getCurrentScope();
+    ValueRef<> bucket = builder.createHashTableLookUp(ht, hash);
+    ValueRef<> ptr = builder.createBeginForwardIter(bucket);
+    ValueRef<> taggedPtr = ptr;
+    ptr = builder.createGetPtr<>(ptr);
+    BasicBlockRef cbb = builder.createCmpTag<>(taggedPtr, hash);
+    BasicBlockRef fbb = builder.getInsertBlock();
+    ValueRef<> tuple = builder.createLoadData<>(ptr);
+    builder.createUnpackTuple<>(elem, tuple, leftKeyIUs);
+    llvm::SmallVector<ValueRef<>, 8> leftV, rightV;
+    for (auto *iu : leftKeyIUs) {
+      leftV.push_back(scope.lookupValue(iu));
+    }
+    for (auto *iu : rightKeyIUs) {
+      rightV.push_back(scope.lookupValue(iu));
+    }
+    auto branches = builder.createCmpKeys(leftV, rightV, leftKeyIUs);
+    builder.createUnpackTuple(elem, tuple, leftPayloadIUs.v);
+    if (condition) {
+      ValueRef<> val = builder.createExpEval(condition);
+      BasicBlockRef trBB = builder.createBasicBlock("trueJoinCond");
+      BasicBlockRef cnt = builder.createBasicBlock("cntJoinCond");
+      builder.createBranch(val, trBB, cnt);
+      builder.setInsertPoint(trBB);
+      fn(builder);
+      builder.createBranch(cnt);
+      builder.setInsertPoint(cnt);
+    } else {
+      fn(builder);
+    }
+    BasicBlockRef bb = builder.createEndCmpKeys(branches);
+    builder.createBranch(bb);
+    builder.setInsertPoint(bb);
+    builder.createEndForwardIter<HashTableEntry, true>();
+    builder.createMissingBranch(cbb, builder.getInsertBlock(), fbb);
+  }
+
+  /// loop over the spilled partitions and their spilled probe tuples
+  void produceSpilled(Builder &builder, ValueRef<> spill, Tuple &probeElem,
+                      IUSet &rightRequiredIUs, Tuple &elem,
+                      IUSet &leftPayloadIUs, ConsumerFn &fn) {
+    auto &irb = builder.getBuilder();
+    BasicBlockRef nextBB = builder.createBasicBlock("nextPartition");
+    builder.createBranch(nextBB);
+    builder.setInsertPoint(nextBB);
+    ValueRef<> partition = builder.createCall(
+        "joinNextPartition", &joinNextPartition, builder.getPtrTy(), spill);
+    BasicBlockRef partitionBB = builder.createBasicBlock("partition");
+    BasicBlockRef doneBB = builder.createBasicBlock("partitionsDone");
+    builder.createBranch(irb.CreateIsNotNull(partition), partitionBB, doneBB);
+    builder.setInsertPoint(partitionBB);
+    ValueRef<> ht = builder.createCall("joinPartitionTable",
+                                       &joinPartitionTable,
+                                       builder.getPtrTy(), partition);
+    BasicBlockRef probeBB = builder.createBasicBlock("nextProbe");
+    builder.createBranch(probeBB);
+    builder.setInsertPoint(probeBB);
+    ValueRef<> entry = builder.createCall("joinNextProbe", &joinNextProbe,
+                                          builder.getPtrTy(), partition);
+    BasicBlockRef bodyBB = builder.createBasicBlock("spilledProbe");
+    BasicBlockRef endBB = builder.createBasicBlock("partitionEnd");
+    builder.createBranch(irb.CreateIsNotNull(entry), bodyBB, endBB);
+    builder.setInsertPoint(bodyBB);
+    ValueRef<> hash = builder.createLoadHash<>(entry);
+    builder.createUnpackTuple<>(probeElem, builder.createLoadData<>(entry),
+                                rightRequiredIUs.v);
+    probe(builder, ht, hash, elem, leftPayloadIUs, fn);
+    builder.createBranch(probeBB);
+    builder.setInsertPoint(endBB);
+    builder.createCall("joinReleasePartition", &joinReleasePartition,
+                       builder.getVoidTy(), spill, partition);
+    builder.createBranch(nextBB);
+    builder.setInsertPoint(doneBB);
+  }
+
   std::unique_ptr<Operator> left;
   std::unique_ptr<Operator> right;
   std::unique_ptr<Exp> condition;
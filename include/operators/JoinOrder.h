@@ -0,0 +1,359 @@
+#pragma once
+
+#include "IR/Binop.h"
+#include "IR/Expression.h"
+#include "IR/Unop.h"
+#include "internal/Statistics.h"
+#include "operators/InnerJoin.h"
+#include "operators/Iu.h"
+#include "operators/Operations.h"
+#include "operators/Operator.h"
+#include "operators/Scan.h"
+#include "operators/Selection.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace p2cllvm {
+/// Cardinality estimates of operators and predicates from Statistics,
+/// assuming independent predicates and uniformly distributed values
+class CardinalityEstimator {
+public:
+  static constexpr double defaultSelectivity = 1.0 / 3;
+  static constexpr double likeSelectivity = 0.1;
+
+  CardinalityEstimator(Statistics &stats, Operator &plan) : stats(stats) {
+    addScans(plan);
+  }
+
+  double estimate(Operator &op) {
+    if (auto *scan = dynamic_cast<Scan *>(&op))
+      return stats.getCardinality(scan->getTableName());
+    auto inputs = op.getInputs();
+    if (auto *selection = dynamic_cast<Selection *>(&op))
+      return estimate(**inputs[0]) * selectivity(selection->getPredicate());
+    if (auto *join = dynamic_cast<InnerJoin *>(&op)) {
+      double left = estimate(**inputs[0]);
+      double right = estimate(**inputs[1]);
+      double card = left * right;
+      auto &leftKeys = join->getLeftKeys();
+      auto &rightKeys = join->getRightKeys();
+      for (size_t i = 0; i < leftKeys.size(); ++i)
+        card /= std::max({distinct(leftKeys[i], left),
+                          distinct(rightKeys[i], right), 1.0});
+      if (auto *condition = join->getCondition())
+        card *= selectivity(*condition);
+      return card;
+    }
+    /// maps and sorts keep their input cardinality, aggregations are
+    /// overestimated
+    double card = 1;
+    for (auto *input : inputs)
+      card = std::max(card, estimate(**input));
+    return card;
+  }
+
+  double selectivity(Exp &exp) {
+    if (auto *binop = dynamic_cast<ShortCirCutBinOp *>(&exp)) {
+      double lhs = selectivity(*binop->lhs);
+      double rhs = selectivity(*binop->rhs);
+      return binop->op == BinOp::And ? lhs * rhs : lhs + rhs - lhs * rhs;
+    }
+    if (auto *unary = dynamic_cast<UnaryExp *>(&exp);
+        unary && unary->op == UnOp::NOT)
+      return 1 - selectivity(*unary->exp);
+    if (dynamic_cast<LikeExp *>(&exp))
+      return likeSelectivity;
+    if (auto *cmp = dynamic_cast<NonTypePreservingBinOp *>(&exp))
+      return comparison(cmp->op, *cmp->lhs, *cmp->rhs);
+    return defaultSelectivity;
+  }
+
+  /// distinct values of iu in an input with card tuples
+  double distinct(IU *iu, double card) {
+    auto *stats = column(iu);
+    if (!stats || stats->distinct == 0)
+      return card;
+    return std::min(static_cast<double>(stats->distinct), card);
+  }
+
+private:
+  void addScans(Operator &op) {
+    if (auto *scan = dynamic_cast<Scan *>(&op)) {
+      for (auto *iu : scan->availableIUs())
+        scans[iu] = scan->getTableName();
+    }
+    for (auto *input : op.getInputs())
+      addScans(**input);
+  }
+
+  const ColumnStatistics *column(IU *iu) {
+    auto it = scans.find(iu);
+    if (it == scans.end())
+      return nullptr;
+    return &stats.getColumn(it->second, iu->name);
+  }
+
+  static Exp *uncast(Exp &exp) {
+    if (auto *cast = dynamic_cast<CastExp *>(&exp))
+      return uncast(*cast->child);
+    return &exp;
+  }
+
+  static IU *getIU(Exp &exp) {
+    auto *iuExp = dynamic_cast<IUExp *>(uncast(exp));
+    return iuExp ? iuExp->iu : nullptr;
+  }
+
+  static std::optional<double> getConstant(Exp &exp) {
+    Exp *e = uncast(exp);
+    if (auto *c = dynamic_cast<ConstExp<int32_t> *>(e))
+      return c->value;
+    if (auto *c = dynamic_cast<ConstExp<int64_t> *>(e))
+      return c->value;
+    if (auto *c = dynamic_cast<ConstExp<double> *>(e))
+      return c->value;
+    if (auto *c = dynamic_cast<ConstExp<char> *>(e))
+      return c->value;
+    return std::nullopt;
+  }
+
+  static BinOp mirror(BinOp op) {
+    switch (op) {
+    case BinOp::CMPLT:
+      return BinOp::CMPGT;
+    case BinOp::CMPLE:
+      return BinOp::CMPGE;
+    case BinOp::CMPGT:
+      return BinOp::CMPLT;
+    case BinOp::CMPGE:
+      return BinOp::CMPLE;
+    default:
+      return op;
+    }
+  }
+
+  double comparison(BinOp op, Exp &lhs, Exp &rhs) {
+    IU *iu = getIU(lhs);
+    Exp *other = &rhs;
+    if (!iu) {
+      iu = getIU(rhs);
+      other = &lhs;
+      op = mirror(op);
+    }
+    auto *stats = iu ? column(iu) : nullptr;
+    if (!stats || stats->distinct == 0)
+      return defaultSelectivity;
+    if (IU *otherIU = getIU(*other)) {
+      auto *otherStats = column(otherIU);
+      if (op != BinOp::CMPEQ || !otherStats)
+        return defaultSelectivity;
+      return 1.0 / std::max({stats->distinct, otherStats->distinct,
+                             uint64_t{1}});
+    }
+    if (op == BinOp::CMPEQ)
+      return 1.0 / stats->distinct;
+    if (op == BinOp::CMPNE)
+      return 1.0 - 1.0 / stats->distinct;
+    auto value = getConstant(*other);
+    if (!value || !stats->numeric || stats->max <= stats->min)
+      return defaultSelectivity;
+    double below = stats->fractionBelow(*value);
+    return op == BinOp::CMPLT || op == BinOp::CMPLE ? below : 1.0 - below;
+  }
+
+  Statistics &stats;
+  /// table of every scanned IU
+  std::unordered_map<IU *, std::string_view> scans;
+};
+
+/// Reorders trees of InnerJoins without residual conditions by dynamic
+/// programming over the connected subsets of their inputs (DPsub). A plan
+/// costs the sum of its intermediate results and hash table sizes, so the
+/// smaller side of a join becomes the build side. Inputs of a join tree are
+/// kept as they are, join trees inside them are reordered separately.
+class JoinOrderOptimizer {
+public:
+  static constexpr size_t maxRelations = 16;
+
+  JoinOrderOptimizer(Statistics &stats, Operator &plan)
+      : estimator(stats, plan) {}
+
+  void optimize(std::unique_ptr<Operator> &op) {
+    if (!isReorderable(*op)) {
+      for (auto *input : op->getInputs())
+        optimize(*input);
+      return;
+    }
+    std::vector<std::unique_ptr<Operator> *> leaves;
+    std::vector<std::pair<IU *, IU *>> keys;
+    collect(op, leaves, keys);
+    for (auto *leaf : leaves)
+      optimize(*leaf);
+    if (leaves.size() > maxRelations)
+      return;
+    if (auto plan = reorder(leaves, keys))
+      op = std::move(plan);
+  }
+
+private:
+  struct Edge {
+    IU *left, *right;
+    uint32_t leftRelation, rightRelation;
+    /// distinct values of each side in its relation
+    double leftDistinct, rightDistinct;
+  };
+
+  struct Entry {
+    bool valid = false;
+    double cost = 0;
+    double card = 0;
+    /// relations of the build side
+    uint32_t build = 0;
+  };
+
+  static bool isReorderable(Operator &op) {
+    auto *join = dynamic_cast<InnerJoin *>(&op);
+    return join && !join->getCondition();
+  }
+
+  static void collect(std::unique_ptr<Operator> &op,
+                      std::vector<std::unique_ptr<Operator> *> &leaves,
+                      std::vector<std::pair<IU *, IU *>> &keys) {
+    if (!isReorderable(*op)) {
+      leaves.push_back(&op);
+      return;
+    }
+    auto &join = static_cast<InnerJoin &>(*op);
+    for (size_t i = 0; i < join.getLeftKeys().size(); ++i)
+      keys.emplace_back(join.getLeftKeys()[i], join.getRightKeys()[i]);
+    for (auto *input : join.getInputs())
+      collect(*input, leaves, keys);
+  }
+
+  /// the optimal join tree over leaves, null if the keys do not connect them
+  std::unique_ptr<Operator>
+  reorder(std::vector<std::unique_ptr<Operator> *> &leaves,
+          std::vector<std::pair<IU *, IU *>> &keys) {
+    size_t n = leaves.size();
+    std::vector<IUSet> available;
+    std::vector<double> cards;
+    for (auto *leaf : leaves) {
+      available.push_back((*leaf)->availableIUs());
+      cards.push_back(estimator.estimate(**leaf));
+    }
+    auto owner = [&](IU *iu) -> std::optional<uint32_t> {
+      for (uint32_t i = 0; i < n; ++i) {
+        if (available[i].contains(iu))
+          return i;
+      }
+      return std::nullopt;
+    };
+    std::vector<Edge> edges;
+    for (auto [left, right] : keys) {
+      auto l = owner(left), r = owner(right);
+      if (!l || !r || *l == *r)
+        return nullptr;
+      edges.push_back({left, right, *l, *r,
+                       estimator.distinct(left, cards[*l]),
+                       estimator.distinct(right, cards[*r])});
+    }
+
+    uint32_t full = (uint32_t{1} << n) - 1;
+    std::vector<Entry> best(full + 1);
+    for (uint32_t i = 0; i < n; ++i)
+      best[uint32_t{1} << i] = {true, 0, cards[i], 0};
+    for (uint32_t set = 1; set <= full; ++set) {
+      if (std::popcount(set) < 2)
+        continue;
+      for (uint32_t build = (set - 1) & set; build; build = (build - 1) & set) {
+        uint32_t probe = set ^ build;
+        if (!best[build].valid || !best[probe].valid)
+          continue;
+        double card = best[build].card * best[probe].card;
+        bool connected = false;
+        for (auto &edge : edges) {
+          if (!crosses(edge, build, probe))
+            continue;
+          connected = true;
+          card /= std::max({edge.leftDistinct, edge.rightDistinct, 1.0});
+        }
+        if (!connected)
+          continue;
+        double cost =
+            best[build].cost + best[probe].cost + card + best[build].card;
+        if (!best[set].valid || cost < best[set].cost)
+          best[set] = {true, cost, card, build};
+      }
+    }
+    if (!best[full].valid)
+      return nullptr;
+    return build(full, best, leaves, edges);
+  }
+
+  static bool crosses(const Edge &edge, uint32_t lhs, uint32_t rhs) {
+    uint32_t l = uint32_t{1} << edge.leftRelation;
+    uint32_t r = uint32_t{1} << edge.rightRelation;
+    return ((l & lhs) && (r & rhs)) || ((l & rhs) && (r & lhs));
+  }
+
+  std::unique_ptr<Operator>
+  build(uint32_t set, std::vector<Entry> &best,
+        std::vector<std::unique_ptr<Operator> *> &leaves,
+        std::vector<Edge> &edges) {
+    if (std::popcount(set) == 1)
+      return std::move(*leaves[std::countr_zero(set)]);
+    uint32_t buildSet = best[set].build;
+    uint32_t probeSet = set ^ buildSet;
+    auto left = build(buildSet, best, leaves, edges);
+    auto right = build(probeSet, best, leaves, edges);
+    std::vector<IU *> leftKeys, rightKeys;
+    std::unique_ptr<Exp> condition;
+    for (auto &edge : edges) {
+      if (!crosses(edge, buildSet, probeSet))
+        continue;
+      IU *l = edge.left, *r = edge.right;
+      if (buildSet & (uint32_t{1} << edge.rightRelation))
+        std::swap(l, r);
+      bool used = std::ranges::find(leftKeys, l) != leftKeys.end() ||
+                  std::ranges::find(rightKeys, r) != rightKeys.end();
+      if (!used) {
+        leftKeys.push_back(l);
+        rightKeys.push_back(r);
+        continue;
+      }
+      bool duplicate = false;
+      for (size_t i = 0; i < leftKeys.size(); ++i)
+        duplicate |= leftKeys[i] == l && rightKeys[i] == r;
+      if (duplicate)
+        continue;
+      /// a key may only appear once, further equalities on it are checked
+      /// on every match
+      auto eq = makeCallExp("std::equal_to()", std::make_unique<IUExp>(l),
+                            std::make_unique<IUExp>(r));
+      condition = condition ? makeCallExp("std::logical_and()",
+                                          std::move(condition), std::move(eq))
+                            : std::move(eq);
+    }
+    return std::make_unique<InnerJoin>(std::move(left), std::move(right),
+                                       std::move(leftKeys),
+                                       std::move(rightKeys),
+                                       std::move(condition));
+  }
+
+  CardinalityEstimator estimator;
+};
+
+/// chooses the join order and the build sides of all join trees in plan
+inline void optimizeJoinOrder(std::unique_ptr<Operator> &plan,
+                              Statistics &stats) {
+  JoinOrderOptimizer(stats, *plan).optimize(plan);
+}
+} // namespace p2cllvm
@@ -41,6 +41,12 @@ public:
     return nullptr;
   }
 
+  std::string getName() const override { return "Map " + iu.name; }
+
+  std::vector<std::unique_ptr<Operator> *> getInputs() override {
+    return {&parent};
+  }
+
   ~Map() override = default;
 
 private:
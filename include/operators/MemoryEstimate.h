@@ -0,0 +1,94 @@
+#pragma once
+
+#include "internal/BaseTypes.h"
+#include "internal/Catalog.h"
+#include "internal/Statistics.h"
+#include "operators/Aggregation.h"
+#include "operators/InnerJoin.h"
+#include "operators/Iu.h"
+#include "operators/JoinOrder.h"
+#include "operators/Operator.h"
+#include "operators/Sort.h"
+#include "runtime/Hashtables.h"
+#include "runtime/ThreadLocalContext.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+
+namespace p2cllvm {
+/// Estimated bytes a plan materializes: the tuples and hash table
+/// directories of join builds and aggregations, the pre-aggregation tables
+/// of the threads and the tuples of sorts, for the admission of queries by
+/// the WorkloadScheduler. Operators of a plan may release their memory
+/// before the query ends, the sum overestimates the peak.
+class MemoryEstimator {
+public:
+  MemoryEstimator(Statistics &stats, Operator &plan, size_t threads)
+      : estimator(stats, plan), threads(threads) {}
+
+  size_t estimate(Operator &op) {
+    double bytes = 0;
+    auto inputs = op.getInputs();
+    if (dynamic_cast<InnerJoin *>(&op)) {
+      /// the left input is built, with every IU it offers
+      auto &build = **inputs[0];
+      bytes = table(estimator.estimate(build), width(build.availableIUs()));
+    } else if (auto *agg = dynamic_cast<Aggregation *>(&op)) {
+      double card = estimator.estimate(**inputs[0]);
+      double groups = 1;
+      for (auto *iu : agg->getGroupBy())
+        groups *= estimator.distinct(iu, card);
+      size_t aggWidth = width(agg->availableIUs());
+      bytes = table(std::min(groups, card), aggWidth);
+      /// the local table of every thread, sized to its L2
+      size_t entrySize = sizeof(HashTableEntry) + aggWidth;
+      bytes += threads * ThreadAggregationContext::localHtSize(entrySize) *
+               sizeof(void *);
+      /// in bypass the threads keep one entry per input row
+      if (bypasses(groups, card))
+        bytes += card * entrySize;
+    } else if (dynamic_cast<Sort *>(&op)) {
+      auto &input = **inputs[0];
+      bytes = estimator.estimate(input) * width(input.availableIUs());
+    }
+    size_t total = static_cast<size_t>(bytes);
+    for (auto *input : inputs)
+      total += estimate(**input);
+    return total;
+  }
+
+private:
+  static size_t width(const IUSet &ius) {
+    size_t width = 0;
+    for (auto *iu : ius) {
+      size_t fixed = Catalog::fixedWidth(iu->type.typeEnum);
+      width += fixed ? fixed : sizeof(StringView);
+    }
+    return width;
+  }
+
+  /// a sampling window that creates more groups than maxGroupRatio of its
+  /// rows switches the threads to bypass
+  static bool bypasses(double groups, double card) {
+    double window =
+        std::min(card, static_cast<double>(PreAggregation::sampleSize));
+    return std::min(groups, card) > PreAggregation::maxGroupRatio * window;
+  }
+
+  /// tuples behind entry headers and a directory of one pointer per slot
+  static double table(double tuples, size_t width) {
+    auto slots = std::bit_ceil(static_cast<uint64_t>(std::max(tuples, 1.0)));
+    return tuples * (sizeof(HashTableEntry) + width) + slots * sizeof(void *);
+  }
+
+  CardinalityEstimator estimator;
+  size_t threads;
+};
+
+/// threads is the number of workers running the plan
+inline size_t estimateMemory(Operator &plan, Statistics &stats,
+                             size_t threads) {
+  return MemoryEstimator(stats, plan, threads).estimate(plan);
+}
+} // namespace p2cllvm
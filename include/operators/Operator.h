@@ -1,6 +1,9 @@
 #pragma once
 
 #include <functional>
+#include <memory>
+#include <string>
+#include <vector>
 
 #include "Iu.h"
 #include "IR/Builder.h"
@@ -13,6 +16,10 @@ class Operator {
     public:
         virtual void produce(IUSet &required, Builder &builder, ConsumerFn consumer, InitFn fn) = 0;
         virtual IUSet availableIUs() = 0;
+        /// name shown in query profiles
+        virtual std::string getName() const = 0;
+        /// inputs of the operator, used to instrument the plan
+        virtual std::vector<std::unique_ptr<Operator> *> getInputs() { return {}; }
         virtual ~Operator() = default;
 
 };
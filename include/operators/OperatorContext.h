@@ -1,39 +1,127 @@
 #pragma once
 
+#include "runtime/AggregationSpill.h"
+#include "runtime/ConjunctSampler.h"
+#include "runtime/JoinSpill.h"
 #include "runtime/Runtime.h"
+#include "runtime/SortSpill.h"
+#include "runtime/Spill.h"
 #include "runtime/ThreadLocal.h"
 #include "runtime/ThreadLocalContext.h"
 #include "runtime/Hashtables.h"
 #include "runtime/Tuplebuffer.h"
 
+#include <atomic>
+#include <bit>
 #include <cstdint>
 #include <string>
+#include <thread>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/raw_ostream.h>
 
 namespace p2cllvm {
 struct OperatorContext {
   virtual ~OperatorContext() = default;
+  /// runtime statistics for query profiles
+  virtual void explain(llvm::raw_ostream &os) { (void)os; }
 };
 
+/// size and chain lengths of a table and the sketch estimate it was sized by
+inline void explainHashTable(llvm::raw_ostream &os, const HashTable &ht,
+                             size_t estimate) {
+  auto stats = ht.getStats();
+  os << "hash table: " << ht.getSize() << " slots, " << stats.entries
+     << " entries, estimate " << estimate << ", longest chain "
+     << stats.longestChain << "\nchains:";
+  for (size_t i = 0; i < stats.chains.size(); ++i) {
+    os << " " << i << (i == HashTable::maxChainLength ? "+" : "") << ": "
+       << stats.chains[i];
+  }
+  os << "\n";
+}
+
+inline void explainSpill(llvm::raw_ostream &os, uint64_t spilled) {
+  if (spilled != 0)
+    os << "spilled partitions: " << std::popcount(spilled) << "\n";
+}
+
 struct JoinContext : public OperatorContext {
   ThreadLocalStorage<ThreadJoinContext> tls;
   HashTable ht;
   std::atomic<uint64_t> idx = 0;
+  ThreadLocalStorage<ThreadJoinProbeContext> probeTls;
+  JoinSpill spill;
+
+  JoinContext(MemoryBudget *budget, size_t elemSize,
+              const CancellationToken *cancellation = nullptr)
+      : spill(budget, &tls, &probeTls, elemSize, cancellation) {}
+
+  void explain(llvm::raw_ostream &os) override {
+    if (tls.getElems().second > 0)
+      explainHashTable(os, ht, combineSketches(&tls));
+    explainSpill(os, spill.getSpilled());
+  }
 };
 
 struct AggregationContext : public OperatorContext {
     ThreadLocalStorage<ThreadAggregationContext> tls;
     TupleBuffer tb8{sizeof(void*)};
     HashTable ht;
+    AggregationSpill spill;
+    DistinctMerge distinctMerges;
+
+    AggregationContext(MemoryBudget *budget, size_t elemSize,
+                       const CancellationToken *cancellation = nullptr)
+        : spill(budget, &tls, elemSize, cancellation) {}
+
+    void explain(llvm::raw_ostream &os) override {
+      if (tls.getElems().second > 0)
+        explainHashTable(os, ht, combineSketches(&tls));
+      explainSpill(os, spill.getSpilled());
+    }
 };
 
 struct SortContext : public OperatorContext{
     ThreadLocalStorage<ThreadSortContext> tls;
     SortBuffer sb;
+    SortSpill spill;
+
+    SortContext(MemoryBudget *budget, size_t elemSize,
+                const CancellationToken *cancellation = nullptr)
+        : spill(budget, &tls, elemSize, cancellation) {}
+
+    void explain(llvm::raw_ostream &os) override {
+      if (spill.getNumRuns() > 0)
+        os << "merged runs: " << spill.getNumRuns() << "\n";
+    }
+};
+
+struct SelectionContext : public OperatorContext {
+  ConjunctSampler sampler;
+
+  explicit SelectionContext(size_t conjuncts) : sampler(conjuncts) {}
+
+  void explain(llvm::raw_ostream &os) override {
+    os << "sampled " << sampler.getSamples() << " tuples";
+    if (!sampler.isSampling()) {
+      os << ", order:";
+      for (size_t i = 0; i < sampler.getConjuncts(); ++i)
+        os << " " << sampler.getOrder()[i];
+    }
+    os << "\n";
+    for (size_t i = 0; i < sampler.getConjuncts(); ++i)
+      os << "conjunct " << i << ": selectivity "
+         << llvm::format("%.3f", sampler.getSelectivity(i)) << ", "
+         << llvm::format("%.1f", sampler.getCycles(i)) << " cycles\n";
+  }
 };
 
+/// i is not atomic, the values must be compared by a single thread
 struct AssertContext : public OperatorContext{
     std::vector<std::string> iter;
     size_t i = 0;
+    /// the thread comparing the values, set by the first comparison
+    std::atomic<std::thread::id> owner;
 };
 
 struct AssertLengthContext : public OperatorContext{
@@ -0,0 +1,157 @@
+#pragma once
+
+#include "IR/Builder.h"
+#include "IR/Pipeline.h"
+#include "operators/Operator.h"
+#include "operators/OperatorContext.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/raw_ostream.h>
+
+namespace p2cllvm {
+/// Counts the tuples an operator produces and remembers the pipelines and
+/// operator contexts it created. Every operator of a plan is wrapped with
+/// instrument if the profile or jitdebug environment variable is set.
+class ProfiledOperator : public Operator {
+public:
+  ProfiledOperator(std::unique_ptr<Operator> &&op, bool countRows)
+      : op(std::move(op)), countRows(countRows) {}
+
+  static std::unique_ptr<Operator> instrument(std::unique_ptr<Operator> op,
+                                              bool countRows = true) {
+    for (auto *input : op->getInputs())
+      *input = instrument(std::move(*input), countRows);
+    return std::make_unique<ProfiledOperator>(std::move(op), countRows);
+  }
+
+  void produce(IUSet &required, Builder &builder, ConsumerFn consumer,
+               InitFn fn) override {
+    rows = 0;
+    pipelines.clear();
+    foreign.clear();
+    auto &contexts = builder.query.operatorContext;
+    firstContext = contexts.size();
+    op->produce(
+        required, builder,
+        [&](Builder &builder) {
+          if (countRows)
+            builder.createCounterIncrement(&rows);
+          size_t pipeline = builder.query.pipelines.size() - 1;
+          if (!llvm::is_contained(pipelines, pipeline))
+            pipelines.push_back(pipeline);
+          consumer(builder);
+        },
+        [&](Builder &builder) {
+          /// contexts created by the init of the consuming operator
+          size_t first = contexts.size();
+          fn(builder);
+          for (size_t i = first; i < contexts.size(); ++i)
+            foreign.push_back(i);
+        });
+    endContext = contexts.size();
+  }
+
+  IUSet availableIUs() override { return op->availableIUs(); }
+
+  std::string getName() const override { return op->getName(); }
+
+  std::vector<std::unique_ptr<Operator> *> getInputs() override {
+    return op->getInputs();
+  }
+
+  /// print the annotated operator tree of an executed query, followed by
+  /// the wall time of every pipeline
+  void explain(llvm::raw_ostream &os, Query &query, unsigned depth = 0) {
+    uint64_t rowsIn = 0;
+    for (auto *input : getInputs())
+      rowsIn += static_cast<ProfiledOperator &>(**input).rows;
+    os.indent(2 * depth) << getName() << "  rows in " << rowsIn << ", out "
+                         << rows.load();
+    /// the operators of a pipeline are fused and share its wall time, which
+    /// is printed once per pipeline below the tree
+    os << ", pipelines";
+    for (size_t pipeline : pipelines)
+      os << " " << query.pipelines[pipeline]->name;
+    os << "\n";
+    for (auto *context : ownContexts(query)) {
+      std::string details;
+      llvm::raw_string_ostream out(details);
+      context->explain(out);
+      for (auto line : llvm::split(llvm::StringRef(details).rtrim(), '\n'))
+        os.indent(2 * depth + 4) << line << "\n";
+    }
+    for (auto *input : getInputs())
+      static_cast<ProfiledOperator &>(**input).explain(os, query, depth + 1);
+    if (depth != 0)
+      return;
+    os << "pipeline wall times:\n";
+    for (const auto &pipeline : query.pipelines)
+      os.indent(2) << pipeline->name << ": "
+                   << llvm::format("%.3f", pipeline->time.count() / 1e6)
+                   << " ms\n";
+  }
+
+  /// append the names of the operators producing into a pipeline to its
+  /// function name, such that perf and gdb attribute generated code
+  void namePipelines(Query &query) {
+    for (auto *input : getInputs())
+      static_cast<ProfiledOperator &>(**input).namePipelines(query);
+    std::string suffix = getName();
+    for (auto &c : suffix) {
+      if (!llvm::isAlnum(c))
+        c = '_';
+    }
+    for (size_t idx : pipelines) {
+      auto &pipeline = *query.pipelines[idx];
+      auto *fn = query.getModule()->getFunction(pipeline.name);
+      fn->setName(pipeline.name + "." + suffix);
+      pipeline.name = fn->getName().str();
+    }
+  }
+
+private:
+  /// contexts created while producing this operator, minus the ones of its
+  /// inputs and the ones of the consuming operator
+  std::vector<OperatorContext *> ownContexts(Query &query) {
+    std::vector<bool> own(query.operatorContext.size(), false);
+    for (size_t i = firstContext; i < endContext; ++i)
+      own[i] = true;
+    for (auto *input : getInputs()) {
+      auto &profiled = static_cast<ProfiledOperator &>(**input);
+      for (size_t i = profiled.firstContext; i < profiled.endContext; ++i)
+        own[i] = false;
+    }
+    for (auto *input : getInputs()) {
+      for (size_t i : static_cast<ProfiledOperator &>(**input).foreign)
+        own[i] = true;
+    }
+    for (size_t i : foreign)
+      own[i] = false;
+    std::vector<OperatorContext *> contexts;
+    for (size_t i = 0; i < own.size(); ++i) {
+      if (own[i])
+        contexts.push_back(query.operatorContext[i].get());
+    }
+    return contexts;
+  }
+
+  std::unique_ptr<Operator> op;
+  /// tuples passed to the consumer
+  std::atomic<uint64_t> rows = 0;
+  bool countRows;
+  /// indices of the pipelines the operator produces into
+  std::vector<size_t> pipelines;
+  size_t firstContext = 0;
+  size_t endContext = 0;
+  std::vector<size_t> foreign;
+};
+}; // namespace p2cllvm
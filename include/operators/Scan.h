@@ -4,10 +4,11 @@
 #include "IR/ColTypes.h"
 #include "IR/Defs.h"
 #include "IR/Types.h"
-#include "internal/Tpch.h"
+#include "internal/Catalog.h"
 #include "Operator.h"
 
 #include <cassert>
+#include <stdexcept>
 #include <llvm/IR/BasicBlock.h>
 #include <llvm/IR/Constants.h>
 #include <llvm/IR/DerivedTypes.h>
@@ -21,11 +22,14 @@ class Scan : public Operator {
 public:
   void produce(IUSet &required, Builder &builder, ConsumerFn consumer,
                InitFn fn) override {
-    auto [table_idx, colmap] = TPCH::tables_indices[table_name];
+    /// the table is looked up in the catalog the query runs on
+    auto &db = builder.query.dbref;
+    size_t table_idx = db.getSchema().getTableIndex(table_name);
+    auto &info = db.getSchema().getTable(table_idx);
     auto &context = builder.getContext();
-    TypeRef<llvm::StructType> table = InMemoryTPCH::createSingleTable(
-        builder.query, builder.getContext(), table_idx);
-    builder.createScanPipeline(table_idx);
+    TypeRef<llvm::StructType> table = db.createTableType(context, table_idx);
+    auto &pipeline =
+        static_cast<ScanPipeline &>(builder.createScanPipeline(table_idx));
     auto &scope = builder.getCurrentScope();
     ValueRef<llvm::Function> fun = scope.pipeline;
     assert(builder.builder.GetInsertBlock());
@@ -33,10 +37,21 @@ public:
     ValueRef<> begin = fun->getArg(1);
     ValueRef<> end = fun->getArg(2);
     fn(builder);
+    /// only the columns the query reads are mapped
+    std::vector<uint32_t> indices;
+    for (auto &col : required) {
+      indices.push_back(info.getIndex(col->name));
+      if (info.columns[indices.back()].type != col->type.typeEnum)
+        throw std::runtime_error("Column " + col->name + " of table " +
+                                 info.name + " has a different type");
+    }
+    db.mapColumns(table_idx, indices);
+    pipeline.columns = indices;
     std::vector<ValueRef<>> cols;
     cols.reserve(attributes.size());
+    size_t colIdx = 0;
     for (auto &col : required) {
-      auto &[idx, type] = colmap[col->name];
+      uint32_t idx = indices[colIdx++];
       ValueRef<> colptr = builder.builder.CreateStructGEP(table, tableptr, idx);
       cols.push_back(builder.createColumnPtrLoad(
           colptr, createColumnType(context, col->type.typeEnum), col->type));
@@ -51,14 +66,21 @@ public:
     builder.createEndIndexIter();
   }
 
-  Scan(std::string_view table_name) : table_name(table_name) {
-    auto it = TPCH::tables_indices.find(table_name);
-    attributes.reserve(it->second.second.size());
-    for (auto &[name, type] : it->second.second) {
-      attributes.emplace_back(std::string(name), type.second);
+  /// the columns are taken from schema, the table of the same name in the
+  /// catalog of a query must have them as well
+  Scan(std::string_view table_name, const Schema &schema = Schema::tpch())
+      : table_name(table_name) {
+    auto &info = schema.getTable(table_name);
+    attributes.reserve(info.columns.size());
+    for (auto &column : info.columns) {
+      attributes.emplace_back(column.name, column.type);
     }
   }
 
+  std::string getName() const override {
+    return "Scan " + std::string(table_name);
+  }
+
   IU *getIU(std::string_view name) {
     for (auto &attr : attributes) {
       if (attr.name == name) {
@@ -68,6 +90,8 @@ public:
     return nullptr;
   }
 
+  std::string_view getTableName() const { return table_name; }
+
   IUSet availableIUs() override {
     IUSet iuSet;
     for (auto &attr : attributes) {
@@ -2,7 +2,14 @@
 #include "IR/Builder.h"
 #include "IR/Expression.h"
 #include "Operator.h"
+#include "OperatorContext.h"
+#include "runtime/ConjunctSampler.h"
+#include "runtime/Runtime.h"
+#include <algorithm>
 #include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Intrinsics.h>
+#include <vector>
 
 namespace p2cllvm {
 class Selection : public Operator {
@@ -12,7 +19,22 @@ public:
       : parent(std::move(parent)), predicate(std::move(predicate)) {}
   void produce(IUSet &required, Builder &builder, ConsumerFn consumer, InitFn fn) override {
       IUSet iuset = required | predicate->getIUs();
-    parent->produce(iuset, builder, [&](Builder &builder) {      
+      /// shared by all pipelines the parent produces
+      SelectionContext *context = nullptr;
+    parent->produce(iuset, builder, [&](Builder &builder) {
+      if (builder.query.adaptive) {
+        /// casts are inserted before the conjuncts are collected
+        predicate->checkSemantics();
+        std::vector<Exp *> conjuncts;
+        collectConjuncts(predicate.get(), conjuncts);
+        size_t n = reorderable(conjuncts);
+        if (n > 1 && n <= ConjunctSampler::maxConjuncts) {
+          std::vector<Exp *> guarded(conjuncts.begin() + n, conjuncts.end());
+          conjuncts.resize(n);
+          produceAdaptive(builder, conjuncts, guarded, context, consumer);
+          return;
+        }
+      }
       ValueRef<> res = builder.createExpEval(predicate);
       BasicBlockRef cnd = builder.builder.GetInsertBlock();
       BasicBlockRef body = builder.createBasicBlock("body");
@@ -28,7 +50,124 @@ public:
 
   IUSet availableIUs() override { return parent->availableIUs(); }
 
+  std::string getName() const override { return "Selection"; }
+
+  std::vector<std::unique_ptr<Operator> *> getInputs() override {
+    return {&parent};
+  }
+
+  Exp &getPredicate() { return *predicate; }
+
+  static void collectConjuncts(Exp *exp, std::vector<Exp *> &conjuncts) {
+    auto *binop = dynamic_cast<ShortCirCutBinOp *>(exp);
+    if (!binop || binop->op != BinOp::And) {
+      conjuncts.push_back(exp);
+      return;
+    }
+    collectConjuncts(binop->lhs.get(), conjuncts);
+    collectConjuncts(binop->rhs.get(), conjuncts);
+  }
+
+  /// The number of leading conjuncts that may be evaluated in any order. A
+  /// conjunct that may trap and the ones behind it keep the plan order and
+  /// run after the reordered ones passed, behind the conjuncts guarding it.
+  static size_t reorderable(const std::vector<Exp *> &conjuncts) {
+    auto trap = std::find_if(conjuncts.begin(), conjuncts.end(),
+                             [](Exp *exp) { return exp->canTrap(); });
+    return trap - conjuncts.begin();
+  }
+
 private:
+  /// While sampling, every conjunct is evaluated and timed and the results
+  /// are passed to the ConjunctSampler. Afterwards the conjuncts run in the
+  /// order chosen by the sampler: a loop over the order array switches to
+  /// the next conjunct and leaves on the first one that fails. The guarded
+  /// conjuncts follow in plan order once all others passed.
+  void produceAdaptive(Builder &builder, std::vector<Exp *> &conjuncts,
+                       std::vector<Exp *> &guarded, SelectionContext *&context,
+                       ConsumerFn &consumer) {
+    auto &ir = builder.builder;
+    size_t n = conjuncts.size();
+    if (!context)
+      context = builder.query.addOperatorContext(
+          std::make_unique<SelectionContext>(n));
+    ValueRef<> flag =
+        builder.addAndCreatePipelineArg(context->sampler.getSamplingFlag());
+    ValueRef<> order =
+        builder.addAndCreatePipelineArg(context->sampler.getOrder());
+    ValueRef<> sampler = builder.addAndCreatePipelineArg(&context->sampler);
+    TypeRef<llvm::ArrayType> cyclesType =
+        llvm::ArrayType::get(builder.getInt64ty(), n);
+    ValueRef<> cycles = builder.createAlloca(cyclesType, "cycles");
+
+    BasicBlockRef sampling = builder.createBasicBlock("sampling");
+    BasicBlockRef ordered = builder.createBasicBlock("ordered");
+    BasicBlockRef body = builder.createBasicBlock("body");
+    BasicBlockRef cnt = builder.createBasicBlock("cnt");
+    llvm::LoadInst *isSampling = ir.CreateLoad(builder.getInt8ty(), flag);
+    isSampling->setAtomic(llvm::AtomicOrdering::Acquire);
+    ir.CreateCondBr(ir.CreateICmpNE(isSampling, builder.getInt8Constant(0)),
+                    sampling, ordered);
+
+    ir.SetInsertPoint(sampling);
+    ValueRef<> mask = builder.getInt64Constant(0);
+    for (size_t i = 0; i < n; ++i) {
+      ValueRef<> start = ir.CreateIntrinsic(llvm::Intrinsic::readcyclecounter,
+                                            {}, {});
+      ValueRef<> res = conjuncts[i]->createEval(builder);
+      ValueRef<> end = ir.CreateIntrinsic(llvm::Intrinsic::readcyclecounter,
+                                          {}, {});
+      ir.CreateStore(ir.CreateSub(end, start),
+                     ir.CreateConstGEP2_64(cyclesType, cycles, 0, i));
+      ValueRef<> bit = ir.CreateShl(ir.CreateZExt(res, builder.getInt64ty()), i);
+      mask = ir.CreateOr(mask, bit);
+    }
+    ValueRef<> cyclesPtr = ir.CreateConstGEP2_64(cyclesType, cycles, 0, 0);
+    builder.createCall("selection_sample", &selection_sample,
+                       builder.getVoidTy(), sampler, cyclesPtr, mask);
+    uint64_t all = n == 64 ? ~uint64_t{0} : (uint64_t{1} << n) - 1;
+    ir.CreateCondBr(ir.CreateICmpEQ(mask, builder.getInt64Constant(all)), body,
+                    cnt);
+
+    ir.SetInsertPoint(ordered);
+    BasicBlockRef dispatch = builder.createBasicBlock("dispatch");
+    BasicBlockRef next = builder.createBasicBlock("next");
+    ir.CreateBr(dispatch);
+    ir.SetInsertPoint(dispatch);
+    llvm::PHINode *pos = ir.CreatePHI(builder.getInt64ty(), n + 1);
+    pos->addIncoming(builder.getInt64Constant(0), ordered);
+    ir.CreateCondBr(ir.CreateICmpEQ(pos, builder.getInt64Constant(n)), body,
+                    next);
+    ir.SetInsertPoint(next);
+    ValueRef<> idx = ir.CreateLoad(
+        builder.getInt32ty(), ir.CreateGEP(builder.getInt32ty(), order, pos));
+    ValueRef<> nextPos = ir.CreateAdd(pos, builder.getInt64Constant(1));
+    std::vector<BasicBlockRef> cases;
+    for (size_t i = 0; i < n; ++i)
+      cases.push_back(builder.createBasicBlock("conjunct"));
+    /// the order only contains valid indices
+    llvm::SwitchInst *sw = ir.CreateSwitch(idx, cases.front(), n - 1);
+    for (size_t i = 1; i < n; ++i)
+      sw->addCase(ir.getInt32(i), cases[i]);
+    for (size_t i = 0; i < n; ++i) {
+      ir.SetInsertPoint(cases[i]);
+      ValueRef<> res = conjuncts[i]->createEval(builder);
+      pos->addIncoming(nextPos, ir.GetInsertBlock());
+      ir.CreateCondBr(res, dispatch, cnt);
+    }
+
+    ir.SetInsertPoint(body);
+    for (auto *conjunct : guarded) {
+      ValueRef<> res = conjunct->createEval(builder);
+      BasicBlockRef passed = builder.createBasicBlock("guarded");
+      ir.CreateCondBr(res, passed, cnt);
+      ir.SetInsertPoint(passed);
+    }
+    consumer(builder);
+    ir.CreateBr(cnt);
+    ir.SetInsertPoint(cnt);
+  }
+
   std::unique_ptr<Operator> parent;
   std::unique_ptr<Exp> predicate;
 };
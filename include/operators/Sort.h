@@ -82,18 +82,28 @@ public:
   }
   void produce(IUSet &required, Builder &builder, ConsumerFn consumer,
                InitFn init) override {
+    /// the context of an earlier query is gone once that query is destroyed
+    sctx = nullptr;
     IUSet fromParent = required | IUSet(ius);
     t = Tuple::get(builder.getContext(), fromParent);
     ValueRef<llvm::Function> cmpFn = createCmpFn(builder);
     ValueRef<> tsize = builder.getInt64Constant(t.getSize());
-    ValueRef<> ltls;
+    ValueRef<> ltls, spill;
+    /// with a memory budget sorted runs are spilled and merged
+    spilling = builder.query.budget.isLimited();
     auto mInit = [&](Builder &builder) {
       static_cast<T &>(*this).init(builder, ltls);
+      if (spilling)
+        spill = builder.addAndCreatePipelineArg(&sctx->spill);
     };
 
     auto consumerFn = [&](Builder &builder) {
-      ValueRef<> tuple = builder.createCall("insertSortEntry", &insertSortEntry,
-                                            builder.getPtrTy(), ltls, tsize);
+      ValueRef<> tuple =
+          spilling ? builder.createCall("insertSortEntrySpilling",
+                                        &insertSortEntrySpilling,
+                                        builder.getPtrTy(), spill, ltls, cmpFn)
+                   : builder.createCall("insertSortEntry", &insertSortEntry,
+                                        builder.getPtrTy(), ltls, tsize);
       builder.createPackTuple(t, tuple, fromParent.v);
     };
     parent->produce(fromParent, builder, consumerFn, mInit);
@@ -104,6 +114,10 @@ public:
     static_cast<T&>(*this).continuation(builder, tsize, cmpFn, fromParent, consumer);
   }
 
+  std::vector<std::unique_ptr<Operator> *> getInputs() override {
+    return {&parent};
+  }
+
   IUSet availableIUs() override { return IUSet(ius) | parent->availableIUs(); }
 
 protected:
@@ -111,7 +125,9 @@ protected:
   std::vector<IU *> ius;
   std::vector<bool> cmp;
   Tuple t;
-  C *sctx;
+  /// owned by the query of the last produce
+  C *sctx = nullptr;
+  bool spilling = false;
 };
 
 class Sort : public SortOp<Sort, SortContext> {
@@ -120,8 +136,14 @@ public:
        std::vector<bool> &&cmp)
       : SortOp(std::move(parent), std::move(ius), std::move(cmp)) {}
 
+  std::string getName() const override { return "Sort"; }
+
   void init(Builder &builder, ValueRef<> &ltls) {
-    sctx = builder.query.addOperatorContext(std::make_unique<SortContext>());
+    /// the parent may run several pipelines that feed the same sort
+    if (!sctx)
+      sctx = builder.query.addOperatorContext(
+          std::make_unique<SortContext>(&builder.query.budget, t.getSize(),
+                                        &builder.query.cancellation));
     ValueRef<> tls = builder.addAndCreatePipelineArg(&sctx->tls);
     ltls = builder.createCall("localSort", &local<ThreadSortContext>,
                               builder.getPtrTy(), tls);
@@ -130,6 +152,10 @@ public:
   void continuation(Builder &builder, ValueRef<> tsize,
                     ValueRef<llvm::Function> cmpFn, IUSet &fromParent,
                     ConsumerFn consumer) {
+    if (spilling) {
+      merge(builder, cmpFn, fromParent, consumer);
+      return;
+    }
     ValueRef<> tls = builder.addAndCreatePipelineArg(&sctx->tls);
     ValueRef<> sb = builder.addAndCreatePipelineArg(&sctx->sb);
     ValueRef<> combinedSize = builder.createCall(
@@ -150,5 +176,28 @@ public:
     consumer(builder);
     builder.createEndIndexIter(t.getSize());
   }
+
+private:
+  /// merge the sorted runs and pass the tuples to the consumer one by one
+  void merge(Builder &builder, ValueRef<llvm::Function> cmpFn,
+             IUSet &fromParent, ConsumerFn &consumer) {
+    auto &irb = builder.getBuilder();
+    ValueRef<> spill = builder.addAndCreatePipelineArg(&sctx->spill);
+    builder.createCall("finishSort", &finishSort, builder.getVoidTy(), spill,
+                       cmpFn);
+    BasicBlockRef nextBB = builder.createBasicBlock("nextSorted");
+    builder.createBranch(nextBB);
+    builder.setInsertPoint(nextBB);
+    ValueRef<> tuple =
+        builder.createCall("sortNext", &sortNext, builder.getPtrTy(), spill);
+    BasicBlockRef bodyBB = builder.createBasicBlock("sorted");
+    BasicBlockRef doneBB = builder.createBasicBlock("sortDone");
+    builder.createBranch(irb.CreateIsNotNull(tuple), bodyBB, doneBB);
+    builder.setInsertPoint(bodyBB);
+    builder.createUnpackTuple<>(t, tuple, fromParent.v);
+    consumer(builder);
+    builder.createBranch(nextBB);
+    builder.setInsertPoint(doneBB);
+  }
 };
 }; // namespace p2cllvm
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "ThreadLocal.h"
+#include "ThreadLocalContext.h"
+#include "runtime/Hashtables.h"
+#include "runtime/Spill.h"
+#include "runtime/Tuplebuffer.h"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace p2cllvm {
+/// State of the external aggregation. Partial aggregates of partitions that
+/// do not fit into the budget are written to disk and aggregated partition
+/// by partition after the in-memory groups were produced.
+class AggregationSpill : public PartitionSpill {
+public:
+  /// a spilled partition while it is aggregated
+  struct Partition {
+    HashTable ht;
+    TupleBuffer groups;
+    SpillCursor entries;
+    size_t reserved = 0;
+  };
+
+  AggregationSpill(MemoryBudget *budget,
+                   ThreadLocalStorage<ThreadAggregationContext> *tls,
+                   size_t elemSize,
+                   const CancellationToken *cancellation = nullptr)
+      : PartitionSpill(budget, elemSize, cancellation), tls(tls) {}
+
+  /// allocate the entry of a new group, groups of in-memory partitions are
+  /// added to the thread local table
+  HashTableEntry *insert(ThreadAggregationContext &ctx, uint64_t hash);
+
+  /// spill the remaining in-memory groups of spilled partitions, returns the
+  /// estimate scaled to the groups that stay in memory
+  size_t finishBuild(size_t estimate);
+
+  /// load the next spilled partition, nullptr if none is left or the query
+  /// was stopped
+  Partition *nextPartition();
+
+  /// copy an entry into the groups of the partition
+  HashTableEntry *copy(Partition *partition, const HashTableEntry *entry);
+
+  void release(Partition *partition);
+
+private:
+  /// spill a partition, the thread local table may point into it
+  void spill(ThreadAggregationContext &ctx, size_t partition);
+
+  ThreadLocalStorage<ThreadAggregationContext> *tls;
+  std::atomic<size_t> next = 0;
+  std::array<Partition, numPartitions> partitions;
+};
+}; // namespace p2cllvm
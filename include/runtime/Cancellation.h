@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+
+namespace p2cllvm {
+/// Stops a query from another thread or once its deadline passed. The
+/// schedulers check the token between morsels, the spilling joins and
+/// aggregations between partitions and the external sort every few tuples;
+/// a running morsel is finished.
+class CancellationToken {
+public:
+  enum class Reason { None, Cancelled, Deadline };
+  using Clock = std::chrono::steady_clock;
+
+  void cancel() { stop(Reason::Cancelled); }
+
+  void setDeadline(Clock::time_point time) {
+    deadline.store(time.time_since_epoch().count(), std::memory_order_relaxed);
+  }
+
+  void setTimeout(std::chrono::nanoseconds timeout) {
+    setDeadline(Clock::now() + timeout);
+  }
+
+  /// true once the query was cancelled or its deadline passed
+  bool stopped() const {
+    if (reason.load(std::memory_order_relaxed) != Reason::None)
+      return true;
+    int64_t time = deadline.load(std::memory_order_relaxed);
+    if (time == none || Clock::now().time_since_epoch().count() < time)
+      return false;
+    stop(Reason::Deadline);
+    return true;
+  }
+
+  Reason getReason() const {
+    stopped();
+    return reason.load();
+  }
+
+private:
+  static constexpr int64_t none = std::numeric_limits<int64_t>::max();
+
+  /// the first reason is kept
+  void stop(Reason why) const {
+    Reason expected = Reason::None;
+    reason.compare_exchange_strong(expected, why);
+  }
+
+  mutable std::atomic<Reason> reason = Reason::None;
+  std::atomic<int64_t> deadline = none;
+};
+
+inline const char *getName(CancellationToken::Reason reason) {
+  switch (reason) {
+  case CancellationToken::Reason::Cancelled:
+    return "cancelled";
+  case CancellationToken::Reason::Deadline:
+    return "deadline exceeded";
+  default:
+    return "running";
+  }
+}
+} // namespace p2cllvm
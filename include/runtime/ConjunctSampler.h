@@ -0,0 +1,51 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace p2cllvm {
+/// Samples the selectivity and cost of the conjuncts of a selection over the
+/// first tuples of a query, then orders them by rank
+/// cost / (1 - selectivity) such that cheap and selective conjuncts run
+/// first. Shared by all workers.
+class ConjunctSampler {
+public:
+  /// one bit per conjunct in the masks passed to sample
+  static constexpr size_t maxConjuncts = 64;
+  /// about two morsels
+  static constexpr uint64_t defaultSampleSize = 1 << 14;
+
+  explicit ConjunctSampler(size_t conjuncts,
+                           uint64_t sampleSize = defaultSampleSize);
+
+  /// records one tuple with every conjunct evaluated, bit i of passed is the
+  /// result of conjunct i and cycles[i] its cost
+  void sample(const uint64_t *cycles, uint64_t passed);
+
+  /// loaded by generated code for every tuple, cleared once the order is set
+  std::atomic<uint8_t> *getSamplingFlag() { return &sampling; }
+  bool isSampling() const { return sampling.load(std::memory_order_acquire); }
+  /// conjunct indices in evaluation order, the plan order while sampling
+  uint32_t *getOrder() { return order.data(); }
+  const uint32_t *getOrder() const { return order.data(); }
+
+  size_t getConjuncts() const { return conjuncts; }
+  uint64_t getSamples() const { return samples.load(); }
+  double getSelectivity(size_t conjunct) const;
+  double getCycles(size_t conjunct) const;
+  double getRank(size_t conjunct) const;
+
+private:
+  void decide();
+
+  size_t conjuncts;
+  uint64_t sampleSize;
+  std::atomic<uint8_t> sampling = 1;
+  std::atomic<uint64_t> samples = 0;
+  std::array<std::atomic<uint64_t>, maxConjuncts> cycles{};
+  std::array<std::atomic<uint64_t>, maxConjuncts> passed{};
+  std::array<uint32_t, maxConjuncts> order{};
+};
+} // namespace p2cllvm
@@ -1,11 +1,17 @@
 #pragma once
 
+#include "runtime/Spill.h"
+
 #include <algorithm>
+#include <array>
 #include <atomic>
 #include <bit>
 #include <cassert>
 #include <cstddef>
 #include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 #include <llvm/IR/DerivedTypes.h>
 #include <llvm/IR/LLVMContext.h>
 
@@ -61,6 +67,7 @@ public:
     return ht[idx];
   }
   constexpr uint64_t getThreshold() const { return (size * 10) / 7; }
+  constexpr size_t getSize() const { return size; }
   void flush() { std::fill_n(ht, size, nullptr); }
   HashTable(size_t estimate) : size(std::bit_floor(estimate)) {
     ht = new HashTableEntry *[size];
@@ -70,6 +77,7 @@ public:
   HashTable() : ht(nullptr), size(0) {};
   HashTable &operator=(HashTable &&other) {
     if (this != &other) {
+      delete[] ht;
       ht = other.ht;
       size = other.size;
       other.ht = nullptr;
@@ -83,8 +91,88 @@ public:
       delete[] ht;
   }
 
+  /// longest chain length counted separately in the chain histogram
+  static constexpr size_t maxChainLength = 8;
+
+  struct Stats {
+    size_t entries = 0;
+    size_t longestChain = 0;
+    /// number of slots per chain length, the last element counts all chains
+    /// of at least maxChainLength entries
+    std::array<size_t, maxChainLength + 1> chains{};
+  };
+
+  /// walks all chains, only for profiling
+  Stats getStats() const;
+
 private:
   HashTableEntry **ht;
   size_t size;
 };
+
+/// Set of 64 bit hashes used for COUNT(DISTINCT), split into partitions by
+/// the upper hash bits such that large sets can be merged in parallel. The
+/// slots are charged to the budget of the query while the set lives.
+class DistinctSet {
+public:
+  static constexpr size_t partitionBits = 3;
+  static constexpr size_t numPartitions = 1ull << partitionBits;
+  /// merge partitions on the workers once the other set has this many
+  /// elements
+  static constexpr size_t parallelMergeThreshold = 1ull << 16;
+
+  explicit DistinctSet(MemoryBudget *budget = nullptr) : budget(budget) {}
+  DistinctSet(const DistinctSet &) = delete;
+  DistinctSet &operator=(const DistinctSet &) = delete;
+  ~DistinctSet();
+
+  void insert(uint64_t hash) {
+    partitions[hash >> (64 - partitionBits)].insert(hash, budget);
+  }
+
+  void merge(DistinctSet &other);
+
+  size_t size() const {
+    size_t count = 0;
+    for (auto &partition : partitions)
+      count += partition.count;
+    return count;
+  }
+
+private:
+  friend class DistinctMerge;
+
+  /// open addressing with linear probing, 0 marks an empty slot
+  struct Partition {
+    std::vector<uint64_t> slots;
+    uint32_t count = 0;
+    bool hasZero = false;
+
+    void insert(uint64_t hash, MemoryBudget *budget);
+    void merge(const Partition &other, MemoryBudget *budget);
+    /// grow until count elements stay below the load factor
+    void reserve(size_t count, MemoryBudget *budget);
+    void grow(MemoryBudget *budget);
+  };
+  std::array<Partition, numPartitions> partitions;
+  MemoryBudget *budget;
+};
+
+/// Merges of large distinct sets, collected while one thread merges the
+/// groups of all threads and run afterwards by every worker. A unit merges
+/// one partition of a set from all sets merged into it; partitions are
+/// disjoint, so the units of one set run on different workers.
+class DistinctMerge {
+public:
+  /// merges a small set right away
+  void add(DistinctSet &set, DistinctSet &other);
+  /// called by every worker, takes units until all ran
+  void run();
+
+private:
+  /// the sets merged into each set, in the order they were added
+  std::vector<std::pair<DistinctSet *, std::vector<DistinctSet *>>> merges;
+  std::unordered_map<DistinctSet *, size_t> index;
+  std::atomic<size_t> next = 0;
+};
 }; // namespace p2cllvm
@@ -4,55 +4,201 @@
 #include "IR/Types.h"
 #include "internal/BaseTypes.h"
 
+#include <algorithm>
+#include <bit>
 #include <cstdint>
 #include <cassert>
 #include <cstddef>
 #include <cmath>
+#include <limits>
+#include <numbers>
+#include <vector>
+#include <immintrin.h>
 #include <llvm/IR/DerivedTypes.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Type.h>
 
 namespace p2cllvm {
-struct Sketch {
-  static constexpr uint64_t REG_CNT = 128; // 1 << 7
-  static constexpr uint64_t REST_SHIFT = 7;
+/// HyperLogLog++ with 2^P registers. Small cardinalities are kept in a sparse
+/// list with precision SPARSE_P, the estimate uses the improved estimator from
+/// Ertl, "New cardinality estimation algorithms for HyperLogLog sketches",
+/// which corrects the bias of the raw estimator over the whole range.
+template <unsigned P = 14> struct BasicSketch {
+  static_assert(P >= 4 && P <= 18, "unsupported precision");
+  static constexpr unsigned PRECISION = P;
+  static constexpr uint64_t REG_CNT = 1ull << P;
+  static constexpr uint64_t REST_SHIFT = P;
   static constexpr uint64_t REG_SHIFT = 64 - REST_SHIFT;
-  uint8_t registers[REG_CNT] = {0};
+  /// largest possible register value
+  static constexpr uint8_t MAX_RANK = REG_SHIFT + 1;
+  static constexpr unsigned SPARSE_P = 25;
+  static constexpr uint64_t SPARSE_REG_CNT = 1ull << SPARSE_P;
+  static constexpr unsigned RANK_BITS = 6;
+  /// switch to the dense representation once the sparse list needs more
+  /// memory than the registers
+  static constexpr size_t MAX_SPARSE = REG_CNT / sizeof(uint32_t);
+
+  /// sparse entries: index with precision SPARSE_P << RANK_BITS | rank
+  std::vector<uint32_t> sparse;
+  /// number of sorted and deduplicated entries at the front of sparse
+  size_t compacted = 0;
+  std::vector<uint8_t> registers;
+
+  bool isSparse() const { return registers.empty(); }
 
   void add(uint64_t hash) {
-    auto &value = registers[hash >> REG_SHIFT];
-    uint64_t rest = hash << REST_SHIFT;
-    uint8_t rank = rest == 0 ? REG_SHIFT : (std::countl_zero(rest) + 1);
-    value = std::max(value, rank);
-    assert(value > 0);
+    if (!isSparse()) {
+      addDense(hash >> REG_SHIFT, rank(hash << REST_SHIFT, REG_SHIFT));
+      return;
+    }
+    uint64_t idx = hash >> (64 - SPARSE_P);
+    uint8_t r = rank(hash << SPARSE_P, 64 - SPARSE_P);
+    sparse.push_back(static_cast<uint32_t>(idx << RANK_BITS | r));
+    if (sparse.size() >= std::max<size_t>(2 * compacted, 64))
+      compact();
   }
 
-  void merge(const Sketch &o) {
-    for (size_t i = 0; i < REG_CNT; ++i) {
-      registers[i] = std::max(registers[i], o.registers[i]);
+  void merge(const BasicSketch &o) {
+    if (o.isSparse()) {
+      if (isSparse()) {
+        sparse.insert(sparse.end(), o.sparse.begin(), o.sparse.end());
+        compact();
+      } else {
+        for (auto entry : o.sparse)
+          addSparseEntry(entry);
+      }
+      return;
     }
+    if (isSparse())
+      toDense();
+    mergeRegisters(registers.data(), o.registers.data());
   }
 
   uint64_t estimate() {
-    double sum = 0;
-    unsigned zero_cnt = 0;
-    for (auto reg : registers) {
-      zero_cnt += reg == 0;
-      sum += 1.0 / (1ul << reg);
+    if (isSparse()) {
+      compact();
+      if (!isSparse())
+        return estimateDense();
+      /// linear counting on the sparse registers
+      double zeros = static_cast<double>(SPARSE_REG_CNT - sparse.size());
+      return std::llround(SPARSE_REG_CNT *
+                          std::log(static_cast<double>(SPARSE_REG_CNT) / zeros));
     }
-    double est = 0.709 * REG_CNT * REG_CNT / sum;
-    if (zero_cnt == 0) {
-        return static_cast<uint64_t>(est);
-      } else {
-          return REG_CNT * std::log(static_cast<double>(REG_CNT) / zero_cnt);
-    } 
+    return estimateDense();
   }
 
   static TypeRef<llvm::StructType> createType(llvm::LLVMContext& context) {
+      /// only passed by pointer to the runtime
       return getOrCreateType(context, "Sketch", [&]() {
-              return llvm::StructType::create(context, {llvm::ArrayType::get(CharTy::createType(context), REG_CNT)}, "Sketch");
+              return llvm::StructType::create(context, "Sketch");
               });
   }
+
+private:
+  static uint8_t rank(uint64_t rest, unsigned bits) {
+    return rest == 0 ? bits + 1 : std::countl_zero(rest) + 1;
+  }
+
+  void addDense(uint64_t idx, uint8_t value) {
+    auto &reg = registers[idx];
+    reg = std::max(reg, value);
+    assert(reg > 0 && reg <= MAX_RANK);
+  }
+
+  /// register index and value of a sparse entry with precision P
+  void addSparseEntry(uint32_t entry) {
+    constexpr unsigned extraBits = SPARSE_P - P;
+    uint64_t sidx = entry >> RANK_BITS;
+    uint64_t extra = sidx & ((1ull << extraBits) - 1);
+    uint8_t value = extra == 0
+                        ? extraBits + (entry & ((1u << RANK_BITS) - 1))
+                        : std::countl_zero(extra << (64 - extraBits)) + 1;
+    addDense(sidx >> extraBits, value);
+  }
+
+  /// sort, keep the maximum rank per index and convert if too large
+  void compact() {
+    std::sort(sparse.begin(), sparse.end());
+    auto out = sparse.begin();
+    for (auto it = sparse.begin(); it != sparse.end(); ++it) {
+      auto next = it + 1;
+      /// sorted by index and rank, so the last entry of an index has the max
+      if (next == sparse.end() || (*next >> RANK_BITS) != (*it >> RANK_BITS))
+        *out++ = *it;
+    }
+    sparse.erase(out, sparse.end());
+    compacted = sparse.size();
+    if (compacted > MAX_SPARSE)
+      toDense();
+  }
+
+  void toDense() {
+    registers.assign(REG_CNT, 0);
+    for (auto entry : sparse)
+      addSparseEntry(entry);
+    sparse.clear();
+    sparse.shrink_to_fit();
+    compacted = 0;
+  }
+
+  static void mergeRegisters(uint8_t *dst, const uint8_t *src) {
+    size_t i = 0;
+#ifdef __AVX2__
+    for (; i + 32 <= REG_CNT; i += 32) {
+      auto a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(dst + i));
+      auto b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i),
+                          _mm256_max_epu8(a, b));
+    }
+#endif
+    for (; i + 16 <= REG_CNT; i += 16) {
+      auto a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dst + i));
+      auto b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i),
+                       _mm_max_epu8(a, b));
+    }
+  }
+
+  static double sigma(double x) {
+    if (x == 1.0)
+      return std::numeric_limits<double>::infinity();
+    double y = 1.0, z = x, prev;
+    do {
+      x *= x;
+      prev = z;
+      z += x * y;
+      y += y;
+    } while (prev != z);
+    return z;
+  }
+
+  static double tau(double x) {
+    if (x == 0.0 || x == 1.0)
+      return 0.0;
+    double y = 1.0, z = 1.0 - x, prev;
+    do {
+      x = std::sqrt(x);
+      prev = z;
+      y *= 0.5;
+      z -= (1.0 - x) * (1.0 - x) * y;
+    } while (prev != z);
+    return z / 3.0;
+  }
+
+  uint64_t estimateDense() const {
+    uint32_t histogram[MAX_RANK + 1] = {0};
+    for (auto reg : registers)
+      ++histogram[reg];
+    constexpr double m = REG_CNT;
+    double z = m * tau(1.0 - histogram[MAX_RANK] / m);
+    for (int k = MAX_RANK - 1; k >= 1; --k)
+      z = 0.5 * (z + histogram[k]);
+    z += m * sigma(histogram[0] / m);
+    constexpr double alphaInf = 0.5 / std::numbers::ln2;
+    return std::llround(alphaInf * m * m / z);
+  }
 };
 
+using Sketch = BasicSketch<>;
+
 }; // namespace p2cllvm
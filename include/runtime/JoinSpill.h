@@ -0,0 +1,57 @@
+#pragma once
+
+#include "ThreadLocal.h"
+#include "ThreadLocalContext.h"
+#include "runtime/Hashtables.h"
+#include "runtime/Spill.h"
+#include "runtime/Tuplebuffer.h"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace p2cllvm {
+/// State of the grace hash join. Build partitions that do not fit into the
+/// budget are written to disk together with their probe tuples and joined
+/// one by one after probing.
+class JoinSpill : public PartitionSpill {
+public:
+  /// a spilled partition while it is joined
+  struct Partition {
+    Buffer build;
+    HashTable ht;
+    size_t reserved = 0;
+    SpillCursor probes;
+  };
+
+  JoinSpill(MemoryBudget *budget, ThreadLocalStorage<ThreadJoinContext> *build,
+            ThreadLocalStorage<ThreadJoinProbeContext> *probe, size_t elemSize,
+            const CancellationToken *cancellation = nullptr)
+      : PartitionSpill(budget, elemSize, cancellation), build(build),
+        probe(probe) {}
+
+  char *insert(ThreadJoinContext &ctx, uint64_t hash);
+
+  /// spill the remaining in-memory tuples of spilled partitions, returns the
+  /// estimate scaled to the tuples that stay in memory
+  size_t finishBuild(size_t estimate);
+
+  char *insertProbe(ThreadJoinProbeContext &ctx, uint64_t hash,
+                    size_t probeSize);
+
+  void finishProbe();
+
+  /// load the next spilled partition, nullptr if none is left or the query
+  /// was stopped
+  Partition *nextPartition();
+
+  void release(Partition *partition);
+
+private:
+  ThreadLocalStorage<ThreadJoinContext> *build;
+  ThreadLocalStorage<ThreadJoinProbeContext> *probe;
+  std::atomic<size_t> next = 0;
+  std::array<Partition, numPartitions> partitions;
+};
+}; // namespace p2cllvm
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace p2cllvm {
+/// Hardware event totals, scaled up if the kernel multiplexed the group
+struct PerfSample {
+  enum Event { Cycles, Instructions, LLCMisses, BranchMisses, DTLBMisses };
+  static constexpr size_t numEvents = 5;
+  static constexpr std::array<std::string_view, numEvents> names = {
+      "cycles", "instructions", "llc_misses", "branch_misses", "dtlb_misses"};
+
+  std::array<uint64_t, numEvents> values{};
+  /// events the kernel refused to count are missing from every sample
+  std::array<bool, numEvents> valid{};
+
+  PerfSample &operator+=(const PerfSample &other) {
+    for (size_t i = 0; i < numEvents; ++i) {
+      values[i] += other.values[i];
+      valid[i] |= other.valid[i];
+    }
+    return *this;
+  }
+};
+
+/// A perf_event_open group counting the calling thread. Opening fails
+/// silently if the kernel or the container does not permit counters, in
+/// which case samples are empty.
+class PerfCounters {
+public:
+  PerfCounters();
+  ~PerfCounters();
+  PerfCounters(const PerfCounters &) = delete;
+  PerfCounters &operator=(const PerfCounters &) = delete;
+
+  /// the group of the calling thread, opened on first use
+  static PerfCounters &local();
+
+  bool available() const { return fds[0] != -1; }
+  /// why the group could not be opened, empty if available
+  const std::string &error() const { return reason; }
+
+  void start();
+  PerfSample stop();
+
+private:
+  std::array<int, PerfSample::numEvents> fds;
+  /// position of each open event in a group read
+  std::array<int, PerfSample::numEvents> slots;
+  size_t open = 0;
+  std::string reason;
+};
+} // namespace p2cllvm
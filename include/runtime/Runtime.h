@@ -4,8 +4,12 @@
 #include "ThreadLocalContext.h"
 #include "internal/BaseTypes.h"
 #include "internal/File.h"
+#include "runtime/ConjunctSampler.h"
+#include "runtime/AggregationSpill.h"
 #include "runtime/Hashtables.h"
 #include "runtime/Hyperloglog.h"
+#include "runtime/JoinSpill.h"
+#include "runtime/SortSpill.h"
 #include "runtime/Tuplebuffer.h"
 
 #include <cstdint>
@@ -47,6 +51,8 @@ template ThreadAggregationContext *local<ThreadAggregationContext>(
     ThreadLocalStorage<ThreadAggregationContext> *ctx);
 template ThreadSortContext *
 local<ThreadSortContext>(ThreadLocalStorage<ThreadSortContext> *ctx);
+template ThreadJoinProbeContext *local<ThreadJoinProbeContext>(
+    ThreadLocalStorage<ThreadJoinProbeContext> *ctx);
 
 template TupleBuffer *getLocalTB<ThreadJoinContext>(ThreadJoinContext *lctx);
 template TupleBuffer *
@@ -97,6 +103,8 @@ void hll_add(Sketch *sketch, uint64_t hash);
 
 uint64_t hll_estimate(Sketch *sketch);
 
+void hll_merge(Sketch *sketch, Sketch *other);
+
 ///----------------------------------------------------
 /// TupleBuffer
 char *tb_insert(TupleBuffer *tb, size_t elem_size);
@@ -161,12 +169,82 @@ void insertAll(ThreadLocalStorage<ThreadJoinContext> *ctx, HashTable *ht,
                size_t elem_size);
 void insertMultithreaded(ThreadJoinContext* ctx, HashTable* ht, size_t elem_size);
 
+char *insertJoinEntrySpilling(JoinSpill *spill, ThreadJoinContext *ctx,
+                              uint64_t hash);
+
+size_t finishJoinBuild(JoinSpill *spill, size_t estimate);
+
+uint64_t joinSpilledPartitions(JoinSpill *spill);
+
+char *joinSpillProbe(JoinSpill *spill, ThreadJoinProbeContext *ctx,
+                     uint64_t hash, size_t elem_size);
+
+void finishJoinProbe(JoinSpill *spill);
+
+JoinSpill::Partition *joinNextPartition(JoinSpill *spill);
+
+HashTable *joinPartitionTable(JoinSpill::Partition *partition);
+
+HashTableEntry *joinNextProbe(JoinSpill::Partition *partition);
+
+void joinReleasePartition(JoinSpill *spill, JoinSpill::Partition *partition);
+
 ///----------------------------------------------------
 /// Aggregation
-HashTable *getLocalHashTable(ThreadAggregationContext *ctx);
+HashTable *getLocalHashTable(ThreadAggregationContext *ctx, size_t entrySize);
+
+PreAggregation *getPreAggregation(ThreadAggregationContext *ctx);
+
+void adaptPreAggregation(PreAggregation *preAggregation);
+
+Sketch *aggAllocSketch(ThreadAggregationContext *ctx, MemoryBudget *budget);
+
+DistinctSet *aggAllocDistinctSet(ThreadAggregationContext *ctx,
+                                 MemoryBudget *budget);
+
+void distinct_insert(DistinctSet *set, uint64_t hash);
+
+void distinct_merge(DistinctSet *set, DistinctSet *other);
+
+/// merges large sets later on all workers, see DistinctMerge
+void distinct_merge_deferred(DistinctMerge *merges, DistinctSet *set,
+                             DistinctSet *other);
+
+void distinct_run_merges(DistinctMerge *merges);
+
+uint64_t distinct_count(DistinctSet *set);
 
 void insertAggEntry(ThreadAggregationContext *ctx, uint64_t hash,
                     HashTableEntry *entry);
+
+HashTableEntry *insertAggEntrySpilling(AggregationSpill *spill,
+                                       ThreadAggregationContext *ctx,
+                                       uint64_t hash);
+
+size_t finishAggBuild(AggregationSpill *spill, size_t estimate);
+
+TupleBuffer *getAggPartitionTB(ThreadAggregationContext *ctx,
+                               size_t partition);
+
+AggregationSpill::Partition *aggNextPartition(AggregationSpill *spill);
+
+HashTable *aggPartitionTable(AggregationSpill::Partition *partition);
+
+HashTableEntry *aggNextEntry(AggregationSpill::Partition *partition);
+
+HashTableEntry *aggPartitionCopy(AggregationSpill *spill,
+                                 AggregationSpill::Partition *partition,
+                                 HashTableEntry *entry);
+
+TupleBuffer *aggPartitionGroups(AggregationSpill::Partition *partition);
+
+void aggReleasePartition(AggregationSpill *spill,
+                         AggregationSpill::Partition *partition);
+///-------------------------------------------------------
+/// Selection
+void selection_sample(ConjunctSampler *sampler, uint64_t *cycles,
+                      uint64_t passed);
+
 ///-------------------------------------------------------
 /// Sort
 using SortBuffer = Buffer;
@@ -181,3 +259,10 @@ char* insertSortEntry(ThreadSortContext* lctx, size_t size);
 
 char* getSorted(SortBuffer* sb);
 
+char *insertSortEntrySpilling(SortSpill *spill, ThreadSortContext *lctx,
+                              SortSpill::CmpFn cmp);
+
+void finishSort(SortSpill *spill, SortSpill::CmpFn cmp);
+
+char *sortNext(SortSpill *spill);
+
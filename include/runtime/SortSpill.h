@@ -0,0 +1,83 @@
+#pragma once
+
+#include "ThreadLocal.h"
+#include "ThreadLocalContext.h"
+#include "runtime/Cancellation.h"
+#include "runtime/Spill.h"
+
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <vector>
+
+namespace p2cllvm {
+/// External merge sort. Threads sort and spill their tuples as a run once
+/// the budget is exhausted, the runs of all threads are merged with a k-way
+/// merge that returns one tuple at a time. Once the cancellation token
+/// stopped, runs are no longer written and the merge ends early.
+class SortSpill {
+public:
+  using CmpFn = int (*)(const void *, const void *);
+  static constexpr size_t reserveChunk = PartitionSpill::reserveChunk;
+  /// tuples written or merged between checks of the cancellation token
+  static constexpr size_t checkInterval = 1024;
+
+  SortSpill(MemoryBudget *budget, ThreadLocalStorage<ThreadSortContext> *tls,
+            size_t elemSize, const CancellationToken *cancellation = nullptr)
+      : budget(budget), tls(tls), elemSize(elemSize),
+        cancellation(cancellation) {}
+
+  char *insert(ThreadSortContext &ctx, CmpFn cmp);
+
+  /// sort the in-memory tuples of every thread and start the merge
+  void finish(CmpFn cmp);
+
+  /// next tuple in sort order, valid until the next call, nullptr at the end
+  /// or once the query stopped
+  char *next();
+
+  /// number of runs merged by the last finish
+  size_t getNumRuns() const { return numRuns; }
+
+private:
+  /// a sorted run, either spilled or tuple pointers into a thread buffer
+  struct Run {
+    std::unique_ptr<SpillReader> reader;
+    std::span<char> block;
+    size_t pos = 0;
+    std::vector<char *> sorted;
+    char *current = nullptr;
+
+    /// move to the next tuple, false at the end of the run
+    bool advance(size_t elemSize);
+  };
+
+  static std::vector<char *> sortedTuples(ThreadSortContext &ctx,
+                                          size_t elemSize, CmpFn cmp);
+
+  void spillRun(ThreadSortContext &ctx, CmpFn cmp);
+
+  /// drops the runs and returns the reservations of all threads
+  void release();
+
+  bool stopped() const { return cancellation && cancellation->stopped(); }
+
+  /// heap order of the runs, the smallest current tuple is on top
+  bool greater(size_t a, size_t b) const {
+    return cmp(runs[a].current, runs[b].current) > 0;
+  }
+
+  MemoryBudget *budget;
+  ThreadLocalStorage<ThreadSortContext> *tls;
+  size_t elemSize;
+  const CancellationToken *cancellation;
+  CmpFn cmp = nullptr;
+  std::vector<Run> runs;
+  std::vector<size_t> heap;
+  size_t numRuns = 0;
+  /// run of the tuple returned last, it is advanced on the next call
+  size_t last = 0;
+  size_t merged = 0;
+  bool started = false;
+};
+}; // namespace p2cllvm
@@ -0,0 +1,257 @@
+#pragma once
+
+#include "runtime/Cancellation.h"
+#include "runtime/Tuplebuffer.h"
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace p2cllvm {
+/// Memory the materializing operators of one query may use. Operators that
+/// cannot reserve memory spill to disk.
+class MemoryBudget {
+public:
+  static constexpr size_t unlimited = std::numeric_limits<size_t>::max();
+
+  explicit MemoryBudget(size_t limit = unlimited) : limit(limit) {}
+
+  bool isLimited() const { return limit != unlimited; }
+
+  bool tryReserve(size_t bytes) {
+    if (used.fetch_add(bytes) + bytes <= limit)
+      return true;
+    used.fetch_sub(bytes);
+    return false;
+  }
+
+  /// reserve even if the budget is exceeded
+  void reserve(size_t bytes) { used.fetch_add(bytes); }
+
+  void release(size_t bytes) { used.fetch_sub(bytes); }
+
+  size_t getUsed() const { return used.load(); }
+  size_t getLimit() const { return limit; }
+
+  /// budget from the memorybudget environment variable, in bytes with an
+  /// optional K, M or G suffix
+  static size_t fromEnv();
+  /// bytes with an optional K, M or G suffix
+  static size_t parse(const char *bytes);
+
+private:
+  std::atomic<size_t> used = 0;
+  size_t limit;
+};
+
+/// Background threads for spill I/O such that writing and reading spill
+/// files overlaps with query processing
+class SpillIO {
+public:
+  static SpillIO &get();
+
+  template <typename F> auto submit(F &&fn) {
+    using R = std::invoke_result_t<F>;
+    auto task = std::make_shared<std::packaged_task<R()>>(std::forward<F>(fn));
+    auto future = task->get_future();
+    {
+      std::lock_guard lock(m);
+      jobs.emplace_back([task]() { (*task)(); });
+    }
+    cv.notify_one();
+    return future;
+  }
+
+  ~SpillIO();
+
+private:
+  SpillIO();
+  void work();
+
+  std::mutex m;
+  std::condition_variable cv;
+  std::deque<std::function<void()>> jobs;
+  std::vector<std::thread> workers;
+  bool stop = false;
+};
+
+/// Unlinked temporary file of fixed size records. Records are collected in
+/// one buffer while the other one is written in the background.
+class SpillWriter {
+public:
+  static constexpr size_t blockSize = 1ull << 16;
+
+  explicit SpillWriter(size_t recordSize);
+  ~SpillWriter();
+  SpillWriter(const SpillWriter &) = delete;
+  SpillWriter &operator=(const SpillWriter &) = delete;
+
+  char *alloc() {
+    if (used == capacity)
+      flush();
+    char *record = buffers[active].get() + used;
+    used += recordSize;
+    return record;
+  }
+
+  /// append len bytes of complete records
+  void append(const char *data, size_t len);
+
+  /// write the remaining records and wait for all writes
+  void finish();
+
+  size_t getSize() const { return written + used; }
+  size_t getRecordSize() const { return recordSize; }
+  size_t getBlockCapacity() const { return capacity; }
+  int getFd() const { return fd; }
+
+private:
+  void flush();
+
+  int fd;
+  size_t recordSize;
+  size_t capacity;
+  size_t used = 0;
+  size_t written = 0;
+  unsigned active = 0;
+  std::unique_ptr<char[]> buffers[2];
+  std::future<void> pending;
+};
+
+/// Reads the records of a finished SpillWriter block by block, the next
+/// block is read ahead in the background
+class SpillReader {
+public:
+  explicit SpillReader(const SpillWriter &writer);
+  /// the pending read writes into a buffer of this reader
+  ~SpillReader() {
+    if (pending.valid())
+      pending.wait();
+  }
+  SpillReader(SpillReader &&) = default;
+
+  /// next block of complete records, empty at the end of the file
+  std::span<char> next();
+
+  /// read the whole file into dst
+  static void readAll(const SpillWriter &writer, char *dst);
+
+private:
+  void prefetch();
+
+  int fd;
+  size_t size;
+  size_t capacity;
+  size_t offset = 0;
+  unsigned active = 1;
+  std::unique_ptr<char[]> buffers[2];
+  std::future<size_t> pending;
+};
+
+/// Iterates the records of several spill files one after another
+class SpillCursor {
+public:
+  void add(const SpillWriter &writer);
+
+  /// next record, nullptr at the end of the last file
+  char *next();
+
+  void clear();
+
+private:
+  std::vector<SpillReader> readers;
+  size_t reader = 0;
+  size_t recordSize = 0;
+  std::span<char> block;
+  size_t pos = 0;
+};
+
+/// Per thread hash partitions of materialized tuples that can be spilled
+struct PartitionedBuffer {
+  static constexpr size_t numPartitions = 32;
+  std::array<TupleBuffer, numPartitions> partitions;
+  std::array<size_t, numPartitions> sizes{};
+  std::array<std::unique_ptr<SpillWriter>, numPartitions> spills;
+  /// bytes reserved from the budget and used by the in-memory partitions
+  size_t reserved = 0;
+  size_t used = 0;
+};
+
+/// Partitioning and budget accounting shared by the spilling operators.
+/// Partitions are selected by the hash bits below the pointer tag, so the
+/// table index bits stay uniform within a partition.
+class PartitionSpill {
+public:
+  static constexpr unsigned partitionShift = 43;
+  static constexpr size_t numPartitions = PartitionedBuffer::numPartitions;
+  /// threads reserve memory from the budget in chunks of this size
+  static constexpr size_t reserveChunk = 1ull << 20;
+  static_assert(numPartitions <= 64, "spilled partitions are a 64 bit mask");
+
+  static size_t partitionOf(uint64_t hash) {
+    return (hash >> partitionShift) & (numPartitions - 1);
+  }
+
+  /// spilled partitions are no longer handed out once cancellation stopped
+  PartitionSpill(MemoryBudget *budget, size_t elemSize,
+                 const CancellationToken *cancellation = nullptr)
+      : budget(budget), elemSize(elemSize), cancellation(cancellation) {}
+
+  bool isSpilled(size_t partition) const {
+    return (spilled.load(std::memory_order_relaxed) >> partition) & 1;
+  }
+
+  uint64_t getSpilled() const { return spilled.load(); }
+
+protected:
+  /// make room for one element in buf. If the budget is exhausted the
+  /// largest partition of buf is spilled and false is returned. A buffer
+  /// without in-memory elements may exceed the budget by one chunk.
+  bool reserve(PartitionedBuffer &buf);
+
+  /// move the in-memory elements of a partition to its spill file
+  void spillPartition(PartitionedBuffer &buf, size_t partition);
+
+  char *allocInMemory(PartitionedBuffer &buf, size_t partition) {
+    buf.used += elemSize;
+    buf.sizes[partition] += elemSize;
+    return buf.partitions[partition].alloc(elemSize);
+  }
+
+  /// spill the in-memory elements of spilled partitions and finish all
+  /// writes, adds the bytes kept in memory and written to disk
+  void finish(PartitionedBuffer &buf, size_t &inMemory, size_t &onDisk);
+
+  bool stopped() const { return cancellation && cancellation->stopped(); }
+
+  /// reserve the bytes of a spilled partition before loading it, waits while
+  /// the budget is exhausted and other partitions are loaded. A partition
+  /// larger than the budget is loaded once it is the only one.
+  void reservePartition(size_t bytes);
+  void releasePartition(size_t bytes);
+
+  MemoryBudget *budget;
+  size_t elemSize;
+  const CancellationToken *cancellation;
+  /// bitmask of spilled partitions
+  std::atomic<uint64_t> spilled = 0;
+
+private:
+  std::mutex loadMutex;
+  std::condition_variable unloaded;
+  /// partitions currently loaded
+  size_t loaded = 0;
+};
+}; // namespace p2cllvm
@@ -9,6 +9,7 @@
 #include <cstdlib>
 #include <source_location>
 #include <string>
+#include <thread>
 #include <type_traits>
 #include <vector>
 namespace p2cllvm { 
@@ -44,9 +45,18 @@ constexpr void compareLength(size_t exp, AssertContext *ctx) {
   assertCond(ctx->i == exp);
 }
 
+/// the values are compared in order, which a parallel pipeline does not keep
+inline void assertSingleThread(AssertContext *ctx) {
+  std::thread::id none, self = std::this_thread::get_id();
+  ctx->owner.compare_exchange_strong(none, self);
+  assertCond(ctx->owner.load() == self);
+}
+
 template <typename T>
   requires std::is_arithmetic_v<typename T::value_type>
 void compareFromString(const typename T::arg_type lhs, AssertContext *expIter) {
+  assertSingleThread(expIter);
+  assertCond(expIter->i < expIter->iter.size());
   typename T::value_type rhs;
   auto &exp = expIter->iter[expIter->i];
   if constexpr (!std::is_same_v<char, typename T::value_type>) {
@@ -62,6 +72,8 @@ void compareFromString(const typename T::arg_type lhs, AssertContext *expIter) {
 template <typename T>
   requires std::is_same_v<typename T::value_type, StringView>
 void compareFromString(const typename T::arg_type lhs, AssertContext *expIter) {
+  assertSingleThread(expIter);
+  assertCond(expIter->i < expIter->iter.size());
   assertCond(*lhs == expIter->iter[expIter->i++]);
 }
 template void compareFromString<BigIntTy>(const BigIntTy::arg_type lhs,
@@ -2,20 +2,87 @@
 
 #include "Hashtables.h"
 #include "Hyperloglog.h"
+#include "Spill.h"
 #include "Tuplebuffer.h"
 
+#include <algorithm>
+#include <array>
+#include <bit>
 #include <cstdint>
+#include <deque>
+#include <memory>
 #include <queue>
+#include <unistd.h>
+#include <vector>
 
 namespace p2cllvm {
+/// Adaptive pre-aggregation of a thread: rows are counted in windows of
+/// sampleSize and a window that creates too many groups switches to bypass,
+/// where rows skip the local table and every row becomes a group of its own
+/// in the thread's TupleBuffer, or its hash partition under a memory budget.
+/// The merge phase reads them like every other group. The generated
+/// consumer counts the rows and loads bypass itself; only the end of a
+/// window calls adapt.
+struct PreAggregation {
+  /// rows per sampling window
+  static constexpr uint64_t sampleSize = 1ull << 14;
+  /// windows spent in bypass mode before sampling again
+  static constexpr size_t bypassWindows = 16;
+  /// pre-aggregation is ineffective if more groups than this fraction of the
+  /// rows are created
+  static constexpr double maxGroupRatio = 0.5;
+  uint64_t rows = 0;
+  uint64_t groups = 0;
+  uint64_t windows = 0;
+  uint8_t bypass = false;
+
+  void adapt() {
+    if (bypass) {
+      bypass = ++windows < bypassWindows;
+    } else {
+      bypass = groups > maxGroupRatio * rows;
+      windows = 0;
+    }
+    rows = 0;
+    groups = 0;
+  }
+};
+
 struct ThreadAggregationContext {
-  static constexpr size_t localHtSize = 1024;  
+  static constexpr size_t minLocalHtSize = 256;
+  static constexpr size_t maxLocalHtSize = 1ull << 16;
+  /// the states of distinct aggregates are charged in chunks of this size
+  static constexpr size_t stateChunk = 1ull << 16;
   TupleBuffer tupleBuffer;
-  HashTable ht{localHtSize};
+  HashTable ht;
   Sketch sketch;
-  size_t inserted = 0; 
+  size_t inserted = 0;
+  PreAggregation preAggregation;
+  /// per group state of distinct aggregates, deques keep the pointers stable
+  std::deque<Sketch> sketches;
+  std::deque<DistinctSet> distinctSets;
+  /// bytes of the states reserved from the budget in chunks, the slots of
+  /// the distinct sets are charged by the sets
+  MemoryBudget *stateBudget = nullptr;
+  size_t stateReserved = 0;
+  size_t stateUsed = 0;
+  /// partial aggregates if the query has a memory budget
+  PartitionedBuffer partitioned;
+
+  /// size the local table such that slots and entries fit into L2
+  static size_t localHtSize(size_t entrySize) {
+    static const size_t l2 = [] {
+      long size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+      return size > 0 ? static_cast<size_t>(size) : 1ull << 20;
+    }();
+    size_t slots = l2 / (sizeof(HashTableEntry *) + entrySize);
+    return std::clamp(std::bit_floor(slots), minLocalHtSize, maxLocalHtSize);
+  }
 
   void insertAgg(uint64_t hash, HashTableEntry* entry){
+      ++preAggregation.groups;
+      if(preAggregation.bypass)
+          return;
       if(inserted >= ht.getThreshold()){
           ht.flush();
           inserted = 0;
@@ -24,18 +91,56 @@ struct ThreadAggregationContext {
       ++inserted;
   }
 
+  ThreadAggregationContext() = default;
+  ThreadAggregationContext(const ThreadAggregationContext &) = delete;
+  ThreadAggregationContext &operator=(const ThreadAggregationContext &) =
+      delete;
+
+  /// the sets release their slots first
+  ~ThreadAggregationContext() {
+    distinctSets.clear();
+    if (stateBudget)
+      stateBudget->release(stateReserved);
+  }
+
+  /// charge a new state to the budget, one chunk at a time
+  void chargeState(MemoryBudget *budget, size_t bytes) {
+    stateBudget = budget;
+    stateUsed += bytes;
+    while (stateUsed > stateReserved) {
+      budget->reserve(stateChunk);
+      stateReserved += stateChunk;
+    }
+  }
+
+  Sketch *allocSketch(MemoryBudget *budget) {
+    chargeState(budget, sizeof(Sketch));
+    return &sketches.emplace_back();
+  }
+
+  DistinctSet *allocDistinctSet(MemoryBudget *budget) {
+    chargeState(budget, sizeof(DistinctSet));
+    return &distinctSets.emplace_back(budget);
+  }
+
   void allocTupleBuffer(size_t tupleSize) {
     tupleBuffer = TupleBuffer(tupleSize);
   }
 
   TupleBuffer *getTupleBuffer() { return &tupleBuffer; }
 
-  HashTable *getHashTable() { return &ht; }
+  HashTable *getHashTable(size_t entrySize) {
+    if (ht.getSize() == 0)
+      ht = HashTable(localHtSize(entrySize));
+    return &ht;
+  }
 };
 
 struct ThreadJoinContext {
   TupleBuffer tupleBuffer;
   Sketch sketch;
+  /// build side if the query has a memory budget
+  PartitionedBuffer partitioned;
 
   void allocTupleBuffer(size_t tupleSize) {
     tupleBuffer = TupleBuffer(tupleSize);
@@ -46,9 +151,18 @@ struct ThreadJoinContext {
   Sketch *getSketch() { return &sketch; }
 };
 
+struct ThreadJoinProbeContext {
+  /// probe tuples of spilled partitions
+  std::array<std::unique_ptr<SpillWriter>, PartitionedBuffer::numPartitions>
+      spills;
+};
+
 struct ThreadSortContext {
     TupleBuffer tb;
     size_t elems;
+    /// sorted runs spilled if the query has a memory budget
+    std::vector<std::unique_ptr<SpillWriter>> runs;
+    size_t reserved = 0;
 
     TupleBuffer* getTupleBuffer() {return &tb;}
 };
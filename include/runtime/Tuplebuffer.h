@@ -39,6 +39,10 @@ struct Buffer {
     }
 
     Buffer &operator=(Buffer &&other) {
+      if (this == &other)
+        return *this;
+      if (mem != nullptr)
+        ::munmap(mem, size);
       ptr = other.ptr;
       size = other.size;
       mem = other.mem;
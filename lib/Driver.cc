@@ -1,18 +1,26 @@
 #include "IR/Builder.h"
 #include "IR/Pipeline.h"
+#include "internal/Catalog.h"
 #include "internal/Compiler.h"
 #include "internal/QueryScheduler.h"
-#include "internal/Tpch.h"
 #include "operators/Driver.h"
+#include "internal/Statistics.h"
 #include "operators/Iu.h"
+#include "operators/JoinOrder.h"
 #include "operators/Operator.h"
+#include "operators/Profile.h"
+#include "runtime/PerfCounters.h"
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cstdint>
 #include <cstdlib>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/Verifier.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/JSON.h>
 #include <llvm/Support/TargetSelect.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Target/TargetMachine.h>
@@ -21,36 +29,151 @@
 
 namespace p2cllvm {
 
-static void produce_impl(TPCH &db, std::unique_ptr<Operator> &op,
+/// diagnostics requested through environment variables
+struct DriverOptions {
+  bool profile;
+  bool jitdebug;
+  bool perfcounters;
+  bool compilereport;
+  bool adaptive;
+  OptLevel optlevel;
+  TargetOptions target;
+  /// buffered morsels per worker of streaming scans, 0 scans the mappings
+  size_t streaming = 0;
+  /// time a run may take before it is stopped, 0 for no deadline
+  std::chrono::milliseconds timeout{0};
+};
+
+/// one object per pipeline with its wall time and hardware events
+static void emitCounters(llvm::raw_ostream &os, Query &query) {
+  llvm::json::OStream json(os);
+  json.array([&]() {
+    for (const auto &pipeline : query.pipelines) {
+      json.object([&]() {
+        json.attribute("pipeline", pipeline->name);
+        json.attribute("ms", pipeline->time.count() / 1e6);
+        auto &counters = pipeline->counters;
+        for (size_t i = 0; i < PerfSample::numEvents; ++i) {
+          if (counters.valid[i])
+            json.attribute(PerfSample::names[i],
+                           static_cast<int64_t>(counters.values[i]));
+        }
+      });
+    }
+  });
+  os << "\n";
+}
+
+static void produce_impl(Catalog &db, std::unique_ptr<Operator> &op,
                          std::vector<IU *> &outputs,
                          std::vector<std::string> &names,
-                         std::unique_ptr<Sink> &sink) {
+                         std::unique_ptr<Sink> &sink,
+                         const DriverOptions &options) {
   Query query(db);
+  query.adaptive = options.adaptive;
   auto builder = Builder(query);
   sink->produce(op, outputs, names, builder);
+  /// name pipeline functions after their operators for perf, gdb and the
+  /// compilation report
+  if (options.jitdebug || options.compilereport)
+    static_cast<ProfiledOperator &>(*op).namePipelines(builder.query);
   QueryCompiler compiler;
-  compiler.createJIT();
+  compiler.createJIT(options.target, options.jitdebug);
+  compiler.setReporting(options.compilereport);
+  compiler.setOptLevel(options.optlevel);
   compiler.addQuery(std::move(builder.query), builder.query.context);
   compiler.addSymbols(builder.query.symbolManager);
+  if (options.compilereport) {
+    compiler.materialize(builder.query);
+    llvm::json::OStream json(llvm::errs());
+    compiler.getReport().toJSON(json);
+    llvm::errs() << "\n";
+  }
   MultiThreadedScheduler scheduler{10000, db};
-  for (const auto &pipeline : builder.query.pipelines) {
-    scheduler.execPipeline(*pipeline, compiler);
-#ifndef NDEBUG
-    llvm::errs() << "executed: " << pipeline->name << "\n";
-#endif
+  scheduler.setTiming(options.profile || options.perfcounters);
+  scheduler.setCounting(options.perfcounters);
+  scheduler.setStreaming(options.streaming);
+  if (options.timeout.count())
+    builder.query.cancellation.setTimeout(options.timeout);
+  if (!scheduler.execQuery(builder.query, compiler)) {
+    llvm::errs() << "query stopped: "
+                 << getName(builder.query.cancellation.getReason()) << "\n";
+    return;
   }
+  if (options.perfcounters)
+    emitCounters(llvm::errs(), query);
+  if (options.profile)
+    static_cast<ProfiledOperator &>(*op).explain(llvm::errs(), query);
 }
 
 void produce(std::unique_ptr<Operator> op, std::vector<IU *> outputs,
              std::vector<std::string> names, std::unique_ptr<Sink> sink) {
   llvm::InitializeNativeTarget();
   llvm::InitializeNativeTargetAsmPrinter();
-  std::string path = std::getenv("tpchpath") ? std::getenv("tpchpath")
-                                             : "../data-generator/output";
-  TPCH db(path);
+  Catalog db(Catalog::defaultPath());
   uint32_t runs = std::getenv("runs") ? std::atoi(std::getenv("runs")) : 3;
+  /// count tuples per operator and time pipelines, printed after every run
+  DriverOptions options;
+  options.profile = std::getenv("profile") != nullptr;
+  /// register the JIT'd code with perf and gdb
+  options.jitdebug = std::getenv("jitdebug") != nullptr;
+  /// hardware events per pipeline as JSON, printed after every run
+  options.perfcounters = std::getenv("perfcounters") != nullptr;
+  /// pass times, codegen time and code size as JSON, printed after every run
+  options.compilereport = std::getenv("compilereport") != nullptr;
+  /// reorder the conjuncts of selections by sampled selectivity and cost
+  options.adaptive = std::getenv("adaptive") != nullptr;
+  /// fast, default or aggressive
+  options.optlevel = OptLevel::Fast;
+  if (const char *level = std::getenv("optlevel")) {
+    auto parsed = parseOptLevel(level);
+    if (!parsed) {
+      llvm::errs() << "unknown optlevel " << level
+                   << ", expected fast, default or aggressive\n";
+      std::exit(EXIT_FAILURE);
+    }
+    options.optlevel = *parsed;
+  }
+  /// generate code for another CPU than the host, e.g. x86-64-v3, and add
+  /// or remove features, e.g. -avx512f
+  if (const char *cpu = std::getenv("targetcpu"))
+    options.target.cpu = cpu;
+  if (const char *features = std::getenv("targetfeatures"))
+    options.target.features = features;
+  if (options.perfcounters && !PerfCounters::local().available())
+    llvm::errs() << "hardware counters unavailable ("
+                 << PerfCounters::local().error()
+                 << "), check /proc/sys/kernel/perf_event_paranoid\n";
+  /// load the pages of the columns a query reads when they are mapped:
+  /// none, populate or willneed
+  if (const char *mode = std::getenv("prefault")) {
+    auto parsed = parsePrefault(mode);
+    if (!parsed) {
+      llvm::errs() << "unknown prefault " << mode
+                   << ", expected none, populate or willneed\n";
+      std::exit(EXIT_FAILURE);
+    }
+    db.setPrefault(*parsed);
+  }
+  /// read fixed size columns through buffers filled ahead of the scan
+  /// instead of faulting in the mappings, for data larger than memory; the
+  /// value is the number of buffered morsels per worker
+  if (const char *slots = std::getenv("streaming"))
+    options.streaming = std::max(std::atoi(slots), 1);
+  /// stop a run that takes longer than the given milliseconds, the workers
+  /// finish their morsels and the memory of the operators is released
+  if (const char *timeout = std::getenv("timeout"))
+    options.timeout = std::chrono::milliseconds(std::atoll(timeout));
+  /// choose join order and build sides by estimated cardinalities instead
+  /// of taking them from the plan
+  if (std::getenv("joinorder")) {
+    Statistics stats(db);
+    optimizeJoinOrder(op, stats);
+  }
+  if (options.profile || options.jitdebug || options.compilereport)
+    op = ProfiledOperator::instrument(std::move(op), options.profile);
    for (uint32_t run = 0; run < runs; ++run) {
-    produce_impl(db, op, outputs, names, sink);
+    produce_impl(db, op, outputs, names, sink, options);
   }
 }
 } // namespace p2cllvm
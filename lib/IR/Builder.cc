@@ -12,6 +12,7 @@
 #include "runtime/Hyperloglog.h"
 #include "runtime/Tuplebuffer.h"
 
+#include <algorithm>
 #include <cassert>
 #include <llvm/IR/BasicBlock.h>
 #include <llvm/IR/Constants.h>
@@ -48,9 +49,34 @@ Pipeline& Builder::createContinuationPipeline() {
 }
 
 void Builder::finishPipeline() {
+   for (auto& [local, shared] : scope->counters) {
+      ValueRef<> count = builder.CreateLoad(getInt64ty(), local);
+      builder.CreateAtomicRMW(llvm::AtomicRMWInst::Add, shared, count,
+                              llvm::MaybeAlign(8),
+                              llvm::AtomicOrdering::Monotonic);
+   }
    builder.CreateRetVoid();
 }
 
+void Builder::createCounterIncrement(std::atomic<uint64_t>* counter) {
+   auto it = std::find(scope->counterTargets.begin(),
+                       scope->counterTargets.end(), counter);
+   size_t idx = it - scope->counterTargets.begin();
+   if (it == scope->counterTargets.end()) {
+      ValueRef<> shared = addAndCreatePipelineArg(counter);
+      ValueRef<llvm::AllocaInst> local = createAlloca(getInt64ty(), "counter");
+      auto* cbb = builder.GetInsertBlock();
+      builder.SetInsertPoint(local->getParent(), ++local->getIterator());
+      builder.CreateStore(getInt64Constant(0), local);
+      builder.SetInsertPoint(cbb);
+      scope->counters.emplace_back(local, shared);
+      scope->counterTargets.push_back(counter);
+   }
+   ValueRef<llvm::AllocaInst> local = scope->counters[idx].first;
+   ValueRef<> count = builder.CreateLoad(getInt64ty(), local);
+   builder.CreateStore(builder.CreateAdd(count, getInt64Constant(1)), local);
+}
+
 llvm::Function* Builder::createCmpFunction() {
    static unsigned fi = 0;
    auto& context = builder.getContext();
@@ -1,8 +0,0 @@
-#include "IR/Pipeline.h"
-#include "internal/Tpch.h"
-#include <cstdint>
-namespace p2cllvm {
-    uint64_t Query::getLineItemCount() const{
-        return dbref.db.lineitem.tuple_count;
-    }
-}
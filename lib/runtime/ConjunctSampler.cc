@@ -0,0 +1,52 @@
+#include "runtime/ConjunctSampler.h"
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+#include <numeric>
+
+namespace p2cllvm {
+ConjunctSampler::ConjunctSampler(size_t conjuncts, uint64_t sampleSize)
+    : conjuncts(conjuncts), sampleSize(sampleSize) {
+  assert(conjuncts <= maxConjuncts);
+  std::iota(order.begin(), order.begin() + conjuncts, 0);
+}
+
+void ConjunctSampler::sample(const uint64_t *tupleCycles, uint64_t mask) {
+  for (size_t i = 0; i < conjuncts; ++i) {
+    cycles[i].fetch_add(tupleCycles[i], std::memory_order_relaxed);
+    if (mask & (uint64_t{1} << i))
+      passed[i].fetch_add(1, std::memory_order_relaxed);
+  }
+  /// other workers may still be sampling, their tuples are not needed
+  if (samples.fetch_add(1, std::memory_order_acq_rel) + 1 == sampleSize)
+    decide();
+}
+
+double ConjunctSampler::getSelectivity(size_t conjunct) const {
+  uint64_t n = samples.load();
+  return n ? static_cast<double>(passed[conjunct].load()) / n : 1.0;
+}
+
+double ConjunctSampler::getCycles(size_t conjunct) const {
+  uint64_t n = samples.load();
+  return n ? static_cast<double>(cycles[conjunct].load()) / n : 0.0;
+}
+
+double ConjunctSampler::getRank(size_t conjunct) const {
+  double selectivity = getSelectivity(conjunct);
+  if (selectivity >= 1.0)
+    return std::numeric_limits<double>::infinity();
+  return getCycles(conjunct) / (1.0 - selectivity);
+}
+
+void ConjunctSampler::decide() {
+  std::array<double, maxConjuncts> ranks;
+  for (size_t i = 0; i < conjuncts; ++i)
+    ranks[i] = getRank(i);
+  /// ties keep the plan order
+  std::stable_sort(order.begin(), order.begin() + conjuncts,
+                   [&](uint32_t l, uint32_t r) { return ranks[l] < ranks[r]; });
+  sampling.store(0, std::memory_order_release);
+}
+} // namespace p2cllvm
@@ -2,6 +2,9 @@
 #include "IR/Types.h"
 #include "internal/BaseTypes.h"
 #include "runtime/Hashtables.h"
+
+#include <algorithm>
+#include <cstdint>
 #include <llvm/IR/DerivedTypes.h>
 
 namespace p2cllvm {
@@ -20,4 +23,109 @@ TypeRef<llvm::StructType> HashTableEntry::createType(llvm::LLVMContext &context)
         "HashTableEntry");
   });
 }
+
+HashTable::Stats HashTable::getStats() const {
+  Stats stats;
+  auto untag = [](HashTableEntry *entry) {
+    return reinterpret_cast<HashTableEntry *>(
+        (reinterpret_cast<intptr_t>(entry) << 16) >> 16);
+  };
+  for (size_t i = 0; i < size; ++i) {
+    size_t length = 0;
+    for (auto *entry = untag(ht[i]); entry; entry = untag(entry->next))
+      ++length;
+    stats.entries += length;
+    stats.longestChain = std::max(stats.longestChain, length);
+    ++stats.chains[std::min(length, maxChainLength)];
+  }
+  return stats;
+}
+
+DistinctSet::~DistinctSet() {
+  if (!budget)
+    return;
+  for (auto &partition : partitions)
+    budget->release(partition.slots.size() * sizeof(uint64_t));
+}
+
+void DistinctSet::Partition::insert(uint64_t hash, MemoryBudget *budget) {
+  if (hash == 0) {
+    count += !hasZero;
+    hasZero = true;
+    return;
+  }
+  reserve(count + 1, budget);
+  auto mask = slots.size() - 1;
+  for (auto idx = hash & mask;; idx = (idx + 1) & mask) {
+    if (slots[idx] == hash)
+      return;
+    if (slots[idx] == 0) {
+      slots[idx] = hash;
+      ++count;
+      return;
+    }
+  }
+}
+
+void DistinctSet::Partition::reserve(size_t count, MemoryBudget *budget) {
+  while (count * 10 >= slots.size() * 7)
+    grow(budget);
+}
+
+void DistinctSet::Partition::grow(MemoryBudget *budget) {
+  std::vector<uint64_t> old(std::max<size_t>(16, slots.size() * 2), 0);
+  /// only the partition grows, workers merging other partitions of the set
+  /// charge the budget concurrently
+  if (budget)
+    budget->reserve((old.size() - slots.size()) * sizeof(uint64_t));
+  std::swap(old, slots);
+  auto mask = slots.size() - 1;
+  for (auto hash : old) {
+    if (hash == 0)
+      continue;
+    auto idx = hash & mask;
+    while (slots[idx] != 0)
+      idx = (idx + 1) & mask;
+    slots[idx] = hash;
+  }
+}
+
+void DistinctSet::Partition::merge(const Partition &other,
+                                   MemoryBudget *budget) {
+  /// grow once up front instead of repeatedly while inserting
+  reserve(count + other.count + 1, budget);
+  if (other.hasZero)
+    insert(0, budget);
+  for (auto hash : other.slots) {
+    if (hash != 0)
+      insert(hash, budget);
+  }
+}
+
+void DistinctSet::merge(DistinctSet &other) {
+  for (size_t i = 0; i < numPartitions; ++i)
+    partitions[i].merge(other.partitions[i], budget);
+}
+
+void DistinctMerge::add(DistinctSet &set, DistinctSet &other) {
+  if (other.size() < DistinctSet::parallelMergeThreshold) {
+    set.merge(other);
+    return;
+  }
+  auto [it, inserted] = index.try_emplace(&set, merges.size());
+  if (inserted)
+    merges.emplace_back(&set, std::vector<DistinctSet *>{});
+  merges[it->second].second.push_back(&other);
+}
+
+void DistinctMerge::run() {
+  size_t unit;
+  while ((unit = next.fetch_add(1)) <
+         merges.size() * DistinctSet::numPartitions) {
+    auto &[set, others] = merges[unit / DistinctSet::numPartitions];
+    size_t i = unit % DistinctSet::numPartitions;
+    for (auto *other : others)
+      set->partitions[i].merge(other->partitions[i], set->budget);
+  }
+}
 }; // namespace p2cllvm
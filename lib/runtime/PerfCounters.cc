@@ -0,0 +1,102 @@
+#include "runtime/PerfCounters.h"
+
+#include <cerrno>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <utility>
+
+namespace p2cllvm {
+namespace {
+constexpr uint64_t cacheEvent(uint64_t cache) {
+  return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+         (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+}
+
+/// type and config of each event, in the order of PerfSample::Event
+constexpr std::array<std::pair<uint32_t, uint64_t>, PerfSample::numEvents>
+    events = {{
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+        {PERF_TYPE_HW_CACHE, cacheEvent(PERF_COUNT_HW_CACHE_DTLB)},
+    }};
+
+int openEvent(uint32_t type, uint64_t config, int group) {
+  perf_event_attr attr;
+  std::memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.disabled = group == -1;
+  /// user space only, also permitted with perf_event_paranoid = 2
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                     PERF_FORMAT_TOTAL_TIME_RUNNING;
+  return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, group, 0));
+}
+} // namespace
+
+PerfCounters::PerfCounters() {
+  fds.fill(-1);
+  slots.fill(-1);
+  for (size_t i = 0; i < events.size(); ++i) {
+    auto [type, config] = events[i];
+    fds[i] = openEvent(type, config, fds[0]);
+    if (fds[i] != -1) {
+      slots[i] = static_cast<int>(open++);
+    } else if (i == 0) {
+      reason = std::string("perf_event_open: ") + std::strerror(errno);
+      return;
+    }
+  }
+}
+
+PerfCounters::~PerfCounters() {
+  for (int fd : fds) {
+    if (fd != -1)
+      close(fd);
+  }
+}
+
+PerfCounters &PerfCounters::local() {
+  thread_local PerfCounters counters;
+  return counters;
+}
+
+void PerfCounters::start() {
+  if (!available())
+    return;
+  ioctl(fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+  ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+PerfSample PerfCounters::stop() {
+  PerfSample sample;
+  if (!available())
+    return sample;
+  ioctl(fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+  /// nr, time enabled, time running, one value per open event
+  std::array<uint64_t, 3 + PerfSample::numEvents> buffer{};
+  if (read(fds[0], buffer.data(), sizeof(buffer)) <
+      static_cast<ssize_t>((3 + open) * sizeof(uint64_t)))
+    return sample;
+  auto enabled = buffer[1];
+  auto running = buffer[2];
+  if (running == 0)
+    return sample;
+  for (size_t i = 0; i < PerfSample::numEvents; ++i) {
+    if (slots[i] == -1)
+      continue;
+    auto value = buffer[3 + slots[i]];
+    sample.values[i] = static_cast<uint64_t>(
+        static_cast<double>(value) * enabled / running);
+    sample.valid[i] = true;
+  }
+  return sample;
+}
+} // namespace p2cllvm
@@ -39,6 +39,8 @@ void hll_add(Sketch *sketch, uint64_t hash) { sketch->add(hash); }
 
 uint64_t hll_estimate(Sketch *sketch) { return sketch->estimate(); }
 
+void hll_merge(Sketch *sketch, Sketch *other) { sketch->merge(*other); }
+
 char *tb_insert(TupleBuffer *tb, size_t elem_size) {
   return reinterpret_cast<char *>(tb->alloc(elem_size));
 }
@@ -130,10 +132,9 @@ char *insertJoinEntry(ThreadJoinContext *ctx, uint64_t hash, size_t elem_size) {
 }
 
 template <typename F>
-static inline void insert(ThreadJoinContext &ctx, HashTable *ht,
-                          size_t elem_size, F &&fn) {
-  size_t num = ctx.tupleBuffer.getNumBuffers();
-  auto *buffers = ctx.tupleBuffer.getBuffers();
+static inline void insert(TupleBuffer &tb, size_t elem_size, F &&fn) {
+  size_t num = tb.getNumBuffers();
+  auto *buffers = tb.getBuffers();
   for (auto i = 0ull; i < num; ++i) {
     auto &[ptr, size, mem] = buffers[i];
     for (auto j = 0ull; j < ptr; j += elem_size) {
@@ -143,11 +144,20 @@ static inline void insert(ThreadJoinContext &ctx, HashTable *ht,
   }
 }
 
+/// the build side is either in one buffer or, with a memory budget, in the
+/// in-memory partitions
+template <typename F>
+static inline void insert(ThreadJoinContext &ctx, size_t elem_size, F &&fn) {
+  insert(ctx.tupleBuffer, elem_size, fn);
+  for (auto &partition : ctx.partitioned.partitions)
+    insert(partition, elem_size, fn);
+}
+
 void insertAll(ThreadLocalStorage<ThreadJoinContext> *ctx, HashTable *ht,
                size_t elem_size) {
   auto [ref, size] = ctx->getElems();
   for (auto i = 0u; i < size; ++i) {
-    insert(static_cast<ThreadJoinContext &>(ref[i]), ht, elem_size,
+    insert(static_cast<ThreadJoinContext &>(ref[i]), elem_size,
            [&](HashTableEntry *htEntry, uint64_t hash) {
              ht->insertWithTag(htEntry, hash);
            });
@@ -155,27 +165,133 @@ void insertAll(ThreadLocalStorage<ThreadJoinContext> *ctx, HashTable *ht,
 }
 
 void insertMultithreaded(ThreadJoinContext *ctx, HashTable *ht, size_t elem_size) {
-  size_t num = ctx->tupleBuffer.getNumBuffers();
-  auto *buffers = ctx->tupleBuffer.getBuffers();
-  for (auto i = 0ull; i < num; ++i) {
-    auto &[ptr, size, mem] = buffers[i];
-    for (auto j = 0ull; j < ptr; j += elem_size) {
-      auto *htEntry = reinterpret_cast<HashTableEntry *>(mem + j);
-      ht->insertWithTagThreaded(htEntry, htEntry->hash);
-    }
-  }    
+  insert(*ctx, elem_size, [&](HashTableEntry *htEntry, uint64_t hash) {
+    ht->insertWithTagThreaded(htEntry, hash);
+  });
+}
+
+char *insertJoinEntrySpilling(JoinSpill *spill, ThreadJoinContext *ctx,
+                              uint64_t hash) {
+  return spill->insert(*ctx, hash);
+}
+
+size_t finishJoinBuild(JoinSpill *spill, size_t estimate) {
+  return spill->finishBuild(estimate);
+}
+
+uint64_t joinSpilledPartitions(JoinSpill *spill) { return spill->getSpilled(); }
+
+char *joinSpillProbe(JoinSpill *spill, ThreadJoinProbeContext *ctx,
+                     uint64_t hash, size_t elem_size) {
+  return spill->insertProbe(*ctx, hash, elem_size);
+}
+
+void finishJoinProbe(JoinSpill *spill) { spill->finishProbe(); }
+
+JoinSpill::Partition *joinNextPartition(JoinSpill *spill) {
+  return spill->nextPartition();
+}
+
+HashTable *joinPartitionTable(JoinSpill::Partition *partition) {
+  return &partition->ht;
+}
+
+HashTableEntry *joinNextProbe(JoinSpill::Partition *partition) {
+  return reinterpret_cast<HashTableEntry *>(partition->probes.next());
+}
+
+void joinReleasePartition(JoinSpill *spill, JoinSpill::Partition *partition) {
+  spill->release(partition);
+}
+
+/// Selection
+void selection_sample(ConjunctSampler *sampler, uint64_t *cycles,
+                      uint64_t passed) {
+  sampler->sample(cycles, passed);
 }
 
 /// Aggregation
 void insertAggEntry(ThreadAggregationContext *ctx, uint64_t hash,
                     HashTableEntry *entry) {
-  assert(ctx->ht.getThreshold() ==
-         (ThreadAggregationContext::localHtSize * 10) / 7);
   ctx->sketch.add(hash);
-  ctx->ht.insert(entry, hash);
+  ctx->insertAgg(hash, entry);
+}
+
+HashTable *getLocalHashTable(ThreadAggregationContext *ctx, size_t entrySize) {
+  return ctx->getHashTable(entrySize);
+}
+
+PreAggregation *getPreAggregation(ThreadAggregationContext *ctx) {
+  return &ctx->preAggregation;
 }
 
-HashTable *getLocalHashTable(ThreadAggregationContext *ctx) { return &ctx->ht; }
+void adaptPreAggregation(PreAggregation *preAggregation) {
+  preAggregation->adapt();
+}
+
+Sketch *aggAllocSketch(ThreadAggregationContext *ctx, MemoryBudget *budget) {
+  return ctx->allocSketch(budget);
+}
+
+DistinctSet *aggAllocDistinctSet(ThreadAggregationContext *ctx,
+                                 MemoryBudget *budget) {
+  return ctx->allocDistinctSet(budget);
+}
+
+void distinct_insert(DistinctSet *set, uint64_t hash) { set->insert(hash); }
+
+void distinct_merge(DistinctSet *set, DistinctSet *other) { set->merge(*other); }
+
+void distinct_merge_deferred(DistinctMerge *merges, DistinctSet *set,
+                             DistinctSet *other) {
+  merges->add(*set, *other);
+}
+
+void distinct_run_merges(DistinctMerge *merges) { merges->run(); }
+
+uint64_t distinct_count(DistinctSet *set) { return set->size(); }
+
+HashTableEntry *insertAggEntrySpilling(AggregationSpill *spill,
+                                       ThreadAggregationContext *ctx,
+                                       uint64_t hash) {
+  return spill->insert(*ctx, hash);
+}
+
+size_t finishAggBuild(AggregationSpill *spill, size_t estimate) {
+  return spill->finishBuild(estimate);
+}
+
+TupleBuffer *getAggPartitionTB(ThreadAggregationContext *ctx,
+                               size_t partition) {
+  return &ctx->partitioned.partitions[partition];
+}
+
+AggregationSpill::Partition *aggNextPartition(AggregationSpill *spill) {
+  return spill->nextPartition();
+}
+
+HashTable *aggPartitionTable(AggregationSpill::Partition *partition) {
+  return &partition->ht;
+}
+
+HashTableEntry *aggNextEntry(AggregationSpill::Partition *partition) {
+  return reinterpret_cast<HashTableEntry *>(partition->entries.next());
+}
+
+HashTableEntry *aggPartitionCopy(AggregationSpill *spill,
+                                 AggregationSpill::Partition *partition,
+                                 HashTableEntry *entry) {
+  return spill->copy(partition, entry);
+}
+
+TupleBuffer *aggPartitionGroups(AggregationSpill::Partition *partition) {
+  return &partition->groups;
+}
+
+void aggReleasePartition(AggregationSpill *spill,
+                         AggregationSpill::Partition *partition) {
+  spill->release(partition);
+}
 
 /// Sort
 void allocSortBuffer(SortBuffer *sb, size_t size) {
@@ -220,6 +336,15 @@ void sortBuffer(SortBuffer *buf, size_t size,
 
 char *getSorted(SortBuffer *sb) { return sb->mem; }
 
+char *insertSortEntrySpilling(SortSpill *spill, ThreadSortContext *lctx,
+                              SortSpill::CmpFn cmp) {
+  return spill->insert(*lctx, cmp);
+}
+
+void finishSort(SortSpill *spill, SortSpill::CmpFn cmp) { spill->finish(cmp); }
+
+char *sortNext(SortSpill *spill) { return spill->next(); }
+
 void *signExtend(void *ptr) {
   /// adapted from https://graphics.stanford.edu/~seander/bithacks.html#VariableSignExtend  
   constexpr unsigned signOff = 48;
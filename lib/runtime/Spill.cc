@@ -0,0 +1,594 @@
+#include "runtime/AggregationSpill.h"
+#include "runtime/JoinSpill.h"
+#include "runtime/SortSpill.h"
+#include "runtime/Spill.h"
+#include "runtime/ThreadLocalContext.h"
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <system_error>
+#include <unistd.h>
+
+namespace p2cllvm {
+size_t MemoryBudget::fromEnv() {
+  const char *env = std::getenv("memorybudget");
+  if (!env || !*env)
+    return unlimited;
+  return parse(env);
+}
+
+size_t MemoryBudget::parse(const char *bytes) {
+  char *end;
+  size_t value = std::strtoull(bytes, &end, 10);
+  switch (*end) {
+  case 'G':
+  case 'g':
+    value <<= 10;
+    [[fallthrough]];
+  case 'M':
+  case 'm':
+    value <<= 10;
+    [[fallthrough]];
+  case 'K':
+  case 'k':
+    value <<= 10;
+  }
+  return value;
+}
+
+SpillIO &SpillIO::get() {
+  static SpillIO io;
+  return io;
+}
+
+SpillIO::SpillIO()
+    : workers(std::clamp<size_t>(std::thread::hardware_concurrency() / 4, 1, 4)) {
+  for (auto &t : workers)
+    t = std::thread([this]() { work(); });
+}
+
+SpillIO::~SpillIO() {
+  {
+    std::lock_guard lock(m);
+    stop = true;
+  }
+  cv.notify_all();
+  for (auto &t : workers)
+    t.join();
+}
+
+void SpillIO::work() {
+  std::unique_lock lock(m);
+  while (true) {
+    cv.wait(lock, [&]() { return stop || !jobs.empty(); });
+    if (jobs.empty())
+      return;
+    auto job = std::move(jobs.front());
+    jobs.pop_front();
+    lock.unlock();
+    job();
+    lock.lock();
+  }
+}
+
+static int createSpillFile() {
+  const char *dir = std::getenv("spilldir");
+  std::string path = std::string(dir ? dir : "/tmp") + "/p2c-spill-XXXXXX";
+  int fd = ::mkstemp(path.data());
+  if (fd < 0)
+    throw std::system_error(errno, std::generic_category(), path);
+  /// the file is removed once it is closed
+  ::unlink(path.c_str());
+  return fd;
+}
+
+SpillWriter::SpillWriter(size_t recordSize)
+    : fd(createSpillFile()), recordSize(recordSize),
+      capacity(std::max<size_t>(1, blockSize / recordSize) * recordSize) {
+  buffers[0] = std::make_unique<char[]>(capacity);
+  buffers[1] = std::make_unique<char[]>(capacity);
+}
+
+SpillWriter::~SpillWriter() {
+  if (pending.valid())
+    pending.wait();
+  ::close(fd);
+}
+
+void SpillWriter::flush() {
+  if (pending.valid())
+    pending.get();
+  if (used == 0)
+    return;
+  pending = SpillIO::get().submit(
+      [fd = fd, data = buffers[active].get(), len = used, off = written]() {
+        for (size_t done = 0; done < len;) {
+          auto res = ::pwrite(fd, data + done, len - done, off + done);
+          if (res < 0 && errno != EINTR)
+            throw std::system_error(errno, std::generic_category(),
+                                    "spill write");
+          done += std::max<ssize_t>(res, 0);
+        }
+      });
+  written += used;
+  used = 0;
+  active ^= 1;
+}
+
+void SpillWriter::append(const char *data, size_t len) {
+  assert(len % recordSize == 0);
+  while (len > 0) {
+    if (used == capacity)
+      flush();
+    size_t n = std::min(len, capacity - used);
+    std::memcpy(buffers[active].get() + used, data, n);
+    used += n;
+    data += n;
+    len -= n;
+  }
+}
+
+void SpillWriter::finish() {
+  flush();
+  if (pending.valid())
+    pending.get();
+}
+
+static size_t readAt(int fd, char *dst, size_t len, size_t off) {
+  for (size_t done = 0; done < len;) {
+    auto res = ::pread(fd, dst + done, len - done, off + done);
+    if (res < 0 && errno != EINTR)
+      throw std::system_error(errno, std::generic_category(), "spill read");
+    if (res == 0)
+      return done;
+    done += std::max<ssize_t>(res, 0);
+  }
+  return len;
+}
+
+SpillReader::SpillReader(const SpillWriter &writer)
+    : fd(writer.getFd()), size(writer.getSize()),
+      capacity(writer.getBlockCapacity()) {
+  buffers[0] = std::make_unique<char[]>(capacity);
+  buffers[1] = std::make_unique<char[]>(capacity);
+  prefetch();
+}
+
+void SpillReader::prefetch() {
+  if (offset == size)
+    return;
+  size_t len = std::min(capacity, size - offset);
+  pending = SpillIO::get().submit(
+      [fd = fd, dst = buffers[active ^ 1].get(), len, off = offset]() {
+        return readAt(fd, dst, len, off);
+      });
+  offset += len;
+}
+
+std::span<char> SpillReader::next() {
+  if (!pending.valid())
+    return {};
+  size_t len = pending.get();
+  active ^= 1;
+  prefetch();
+  return {buffers[active].get(), len};
+}
+
+void SpillReader::readAll(const SpillWriter &writer, char *dst) {
+  readAt(writer.getFd(), dst, writer.getSize(), 0);
+}
+
+void SpillCursor::add(const SpillWriter &writer) {
+  if (writer.getSize() == 0)
+    return;
+  recordSize = writer.getRecordSize();
+  readers.emplace_back(writer);
+}
+
+char *SpillCursor::next() {
+  while (pos == block.size()) {
+    if (reader == readers.size())
+      return nullptr;
+    block = readers[reader].next();
+    pos = 0;
+    if (block.empty())
+      ++reader;
+  }
+  char *record = block.data() + pos;
+  pos += recordSize;
+  return record;
+}
+
+void SpillCursor::clear() {
+  readers.clear();
+  reader = 0;
+  block = {};
+  pos = 0;
+}
+
+///----------------------------------------------------
+/// Partitioned spilling
+bool PartitionSpill::reserve(PartitionedBuffer &buf) {
+  if (buf.used + elemSize <= buf.reserved)
+    return true;
+  if (budget->tryReserve(reserveChunk)) {
+    buf.reserved += reserveChunk;
+    return true;
+  }
+  /// out of memory, spill the largest partition of this thread
+  size_t victim = numPartitions;
+  for (size_t i = 0; i < numPartitions; ++i) {
+    if (!isSpilled(i) &&
+        (victim == numPartitions || buf.sizes[i] > buf.sizes[victim]))
+      victim = i;
+  }
+  if (victim == numPartitions || buf.sizes[victim] == 0) {
+    /// nothing of this thread to spill, progress beyond the budget
+    budget->reserve(reserveChunk);
+    buf.reserved += reserveChunk;
+    return true;
+  }
+  spilled.fetch_or(1ull << victim);
+  spillPartition(buf, victim);
+  return false;
+}
+
+void PartitionSpill::spillPartition(PartitionedBuffer &buf, size_t partition) {
+  auto &writer = buf.spills[partition];
+  if (!writer)
+    writer = std::make_unique<SpillWriter>(elemSize);
+  auto &size = buf.sizes[partition];
+  if (size == 0)
+    return;
+  auto &tb = buf.partitions[partition];
+  auto *buffers = tb.getBuffers();
+  for (size_t i = 0; i < tb.getNumBuffers(); ++i)
+    writer->append(buffers[i].mem, buffers[i].ptr);
+  tb = TupleBuffer();
+  buf.used -= size;
+  size = 0;
+  /// keep one chunk for the next inserts, the rest goes back to the budget
+  if (buf.reserved - buf.used > reserveChunk) {
+    size_t surplus = buf.reserved - buf.used - reserveChunk;
+    budget->release(surplus);
+    buf.reserved -= surplus;
+  }
+}
+
+void PartitionSpill::finish(PartitionedBuffer &buf, size_t &inMemory,
+                            size_t &onDisk) {
+  for (size_t i = 0; i < numPartitions; ++i) {
+    if (isSpilled(i) && buf.sizes[i] > 0)
+      spillPartition(buf, i);
+    inMemory += buf.sizes[i];
+    if (buf.spills[i]) {
+      buf.spills[i]->finish();
+      onDisk += buf.spills[i]->getSize();
+    }
+  }
+}
+
+///----------------------------------------------------
+/// Grace hash join
+char *JoinSpill::insert(ThreadJoinContext &ctx, uint64_t hash) {
+  ctx.sketch.add(hash);
+  auto &buf = ctx.partitioned;
+  size_t partition = partitionOf(hash);
+  while (!isSpilled(partition)) {
+    if (reserve(buf))
+      return allocInMemory(buf, partition);
+  }
+  /// another thread may have spilled the partition after we inserted into it
+  if (!buf.spills[partition] || buf.sizes[partition] > 0)
+    spillPartition(buf, partition);
+  return buf.spills[partition]->alloc();
+}
+
+void PartitionSpill::reservePartition(size_t bytes) {
+  std::unique_lock lock(loadMutex);
+  while (!budget->tryReserve(bytes)) {
+    if (loaded == 0) {
+      budget->reserve(bytes);
+      break;
+    }
+    unloaded.wait(lock);
+  }
+  ++loaded;
+}
+
+void PartitionSpill::releasePartition(size_t bytes) {
+  {
+    std::lock_guard lock(loadMutex);
+    budget->release(bytes);
+    --loaded;
+  }
+  unloaded.notify_all();
+}
+
+size_t JoinSpill::finishBuild(size_t estimate) {
+  if (getSpilled() == 0)
+    return estimate;
+  size_t inMemory = 0, onDisk = 0;
+  for (auto &ctx : *build)
+    finish(ctx.partitioned, inMemory, onDisk);
+  return std::max<size_t>(1, estimate * inMemory / (inMemory + onDisk));
+}
+
+char *JoinSpill::insertProbe(ThreadJoinProbeContext &ctx, uint64_t hash,
+                             size_t probeSize) {
+  auto &writer = ctx.spills[partitionOf(hash)];
+  if (!writer)
+    writer = std::make_unique<SpillWriter>(probeSize);
+  auto *entry = reinterpret_cast<HashTableEntry *>(writer->alloc());
+  entry->hash = hash;
+  return entry->data;
+}
+
+void JoinSpill::finishProbe() {
+  for (auto &ctx : *probe) {
+    for (auto &writer : ctx.spills) {
+      if (writer)
+        writer->finish();
+    }
+  }
+}
+
+JoinSpill::Partition *JoinSpill::nextPartition() {
+  size_t i;
+  while (!stopped() && (i = next.fetch_add(1)) < numPartitions) {
+    if (!isSpilled(i))
+      continue;
+    size_t bytes = 0;
+    for (auto &ctx : *build) {
+      auto &writer = ctx.partitioned.spills[i];
+      bytes += writer ? writer->getSize() : 0;
+    }
+    /// without build tuples no probe tuple can find a join partner
+    if (bytes == 0)
+      continue;
+    /// partitions are not split again, a partition may exceed the budget
+    auto &partition = partitions[i];
+    reservePartition(bytes);
+    partition.reserved = bytes;
+    partition.build = Buffer(bytes);
+    char *dst = partition.build.mem;
+    for (auto &ctx : *build) {
+      auto &writer = ctx.partitioned.spills[i];
+      if (!writer)
+        continue;
+      SpillReader::readAll(*writer, dst);
+      dst += writer->getSize();
+      writer.reset();
+    }
+    partition.ht = HashTable(bytes / elemSize);
+    for (size_t off = 0; off < bytes; off += elemSize) {
+      auto *entry = reinterpret_cast<HashTableEntry *>(partition.build.mem + off);
+      partition.ht.insertWithTag(entry, entry->hash);
+    }
+    for (auto &ctx : *probe) {
+      if (ctx.spills[i])
+        partition.probes.add(*ctx.spills[i]);
+    }
+    return &partition;
+  }
+  return nullptr;
+}
+
+void JoinSpill::release(Partition *partition) {
+  size_t i = partition - partitions.data();
+  partition->probes.clear();
+  partition->build = Buffer();
+  partition->ht = HashTable();
+  releasePartition(partition->reserved);
+  for (auto &ctx : *probe)
+    ctx.spills[i].reset();
+}
+
+///----------------------------------------------------
+/// External aggregation
+void AggregationSpill::spill(ThreadAggregationContext &ctx, size_t partition) {
+  ctx.ht.flush();
+  ctx.inserted = 0;
+  spillPartition(ctx.partitioned, partition);
+}
+
+HashTableEntry *AggregationSpill::insert(ThreadAggregationContext &ctx,
+                                         uint64_t hash) {
+  ctx.sketch.add(hash);
+  auto &buf = ctx.partitioned;
+  size_t partition = partitionOf(hash);
+  while (!isSpilled(partition)) {
+    if (reserve(buf)) {
+      auto *entry =
+          reinterpret_cast<HashTableEntry *>(allocInMemory(buf, partition));
+      ctx.insertAgg(hash, entry);
+      return entry;
+    }
+    /// reserve spilled a partition the local table may point into
+    ctx.ht.flush();
+    ctx.inserted = 0;
+  }
+  /// another thread may have spilled the partition after we inserted into it
+  if (!buf.spills[partition] || buf.sizes[partition] > 0)
+    spill(ctx, partition);
+  ++ctx.preAggregation.groups;
+  return reinterpret_cast<HashTableEntry *>(buf.spills[partition]->alloc());
+}
+
+size_t AggregationSpill::finishBuild(size_t estimate) {
+  if (getSpilled() == 0)
+    return estimate;
+  size_t inMemory = 0, onDisk = 0;
+  for (auto &ctx : *tls)
+    finish(ctx.partitioned, inMemory, onDisk);
+  return std::max<size_t>(1, estimate * inMemory / (inMemory + onDisk));
+}
+
+AggregationSpill::Partition *AggregationSpill::nextPartition() {
+  size_t i;
+  while (!stopped() && (i = next.fetch_add(1)) < numPartitions) {
+    if (!isSpilled(i))
+      continue;
+    auto &partition = partitions[i];
+    size_t entries = 0;
+    for (auto &ctx : *tls) {
+      if (auto &writer = ctx.partitioned.spills[i]) {
+        entries += writer->getSize() / elemSize;
+        partition.entries.add(*writer);
+      }
+    }
+    if (entries == 0)
+      continue;
+    /// every entry may be a group of its own, partitions are not split again
+    size_t slots = std::bit_floor(std::max<size_t>(entries, 2));
+    partition.reserved = entries * elemSize + slots * sizeof(HashTableEntry *);
+    reservePartition(partition.reserved);
+    partition.ht = HashTable(slots);
+    partition.groups = TupleBuffer();
+    return &partition;
+  }
+  return nullptr;
+}
+
+HashTableEntry *AggregationSpill::copy(Partition *partition,
+                                       const HashTableEntry *entry) {
+  char *group = partition->groups.alloc(elemSize);
+  std::memcpy(group, entry, elemSize);
+  return reinterpret_cast<HashTableEntry *>(group);
+}
+
+void AggregationSpill::release(Partition *partition) {
+  size_t i = partition - partitions.data();
+  partition->entries.clear();
+  partition->groups = TupleBuffer();
+  partition->ht = HashTable();
+  releasePartition(partition->reserved);
+  for (auto &ctx : *tls)
+    ctx.partitioned.spills[i].reset();
+}
+
+///----------------------------------------------------
+/// External merge sort
+std::vector<char *> SortSpill::sortedTuples(ThreadSortContext &ctx,
+                                            size_t elemSize, CmpFn cmp) {
+  std::vector<char *> tuples;
+  tuples.reserve(ctx.elems);
+  auto *buffers = ctx.tb.getBuffers();
+  for (size_t i = 0; i < ctx.tb.getNumBuffers(); ++i) {
+    for (size_t off = 0; off < buffers[i].ptr; off += elemSize)
+      tuples.push_back(buffers[i].mem + off);
+  }
+  std::sort(tuples.begin(), tuples.end(),
+            [cmp](char *a, char *b) { return cmp(a, b) < 0; });
+  return tuples;
+}
+
+void SortSpill::spillRun(ThreadSortContext &ctx, CmpFn cmp) {
+  auto &writer = ctx.runs.emplace_back(std::make_unique<SpillWriter>(elemSize));
+  auto tuples = sortedTuples(ctx, elemSize, cmp);
+  /// a stopped query never merges the run, its rest is not written
+  for (size_t i = 0; i < tuples.size(); ++i) {
+    if (i % checkInterval == 0 && stopped())
+      break;
+    writer->append(tuples[i], elemSize);
+  }
+  writer->finish();
+  ctx.tb = TupleBuffer();
+  ctx.elems = 0;
+  /// keep one chunk for the next run, the rest goes back to the budget
+  if (ctx.reserved > reserveChunk) {
+    budget->release(ctx.reserved - reserveChunk);
+    ctx.reserved = reserveChunk;
+  }
+}
+
+char *SortSpill::insert(ThreadSortContext &ctx, CmpFn cmp) {
+  if ((ctx.elems + 1) * elemSize > ctx.reserved) {
+    if (budget->tryReserve(reserveChunk)) {
+      ctx.reserved += reserveChunk;
+    } else if (ctx.elems > 0) {
+      spillRun(ctx, cmp);
+    } else {
+      /// nothing of this thread to spill, progress beyond the budget
+      budget->reserve(reserveChunk);
+      ctx.reserved += reserveChunk;
+    }
+  }
+  ++ctx.elems;
+  return ctx.tb.alloc(elemSize);
+}
+
+bool SortSpill::Run::advance(size_t elemSize) {
+  if (!reader) {
+    if (pos == sorted.size())
+      return false;
+    current = sorted[pos++];
+    return true;
+  }
+  if (pos == block.size()) {
+    block = reader->next();
+    pos = 0;
+    if (block.empty())
+      return false;
+  }
+  current = block.data() + pos;
+  pos += elemSize;
+  return true;
+}
+
+void SortSpill::finish(CmpFn cmpFn) {
+  cmp = cmpFn;
+  /// next ends the merge right away
+  if (stopped())
+    return;
+  for (auto &ctx : *tls) {
+    for (auto &writer : ctx.runs)
+      runs.emplace_back().reader = std::make_unique<SpillReader>(*writer);
+    /// the remaining tuples are merged from memory without a copy
+    if (ctx.elems > 0)
+      runs.emplace_back().sorted = sortedTuples(ctx, elemSize, cmp);
+  }
+  numRuns = runs.size();
+  for (size_t i = 0; i < runs.size(); ++i) {
+    if (runs[i].advance(elemSize))
+      heap.push_back(i);
+  }
+  auto order = [this](size_t a, size_t b) { return greater(a, b); };
+  std::make_heap(heap.begin(), heap.end(), order);
+}
+
+void SortSpill::release() {
+  heap.clear();
+  runs.clear();
+  for (auto &ctx : *tls) {
+    ctx.runs.clear();
+    budget->release(ctx.reserved);
+    ctx.reserved = 0;
+  }
+}
+
+char *SortSpill::next() {
+  auto order = [this](size_t a, size_t b) { return greater(a, b); };
+  if (started && last < runs.size()) {
+    /// the previous tuple stays valid until now, replace it by its successor
+    if (runs[last].advance(elemSize)) {
+      heap.push_back(last);
+      std::push_heap(heap.begin(), heap.end(), order);
+    }
+  }
+  started = true;
+  if (heap.empty() || (++merged % checkInterval == 0 && stopped())) {
+    release();
+    return nullptr;
+  }
+  std::pop_heap(heap.begin(), heap.end(), order);
+  last = heap.back();
+  heap.pop_back();
+  return runs[last].current;
+}
+}; // namespace p2cllvm
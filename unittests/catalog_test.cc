@@ -0,0 +1,212 @@
+#include "internal/Catalog.h"
+
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <llvm/IR/LLVMContext.h>
+#include <sstream>
+#include <string>
+#include <sys/file.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace p2cllvm;
+namespace fs = std::filesystem;
+
+namespace {
+void writeFile(const fs::path &path, const void *data, size_t size) {
+  std::ofstream out(path, std::ios::binary);
+  out.write(static_cast<const char *>(data), size);
+}
+
+/// slotted layout of the data generator: count, slots, then the strings
+void writeStrings(const fs::path &path, const std::vector<std::string> &strs) {
+  size_t header = sizeof(uint64_t) + strs.size() * sizeof(String::StringData);
+  std::vector<char> data(header);
+  uint64_t count = strs.size();
+  std::memcpy(data.data(), &count, sizeof(count));
+  for (size_t i = 0; i < strs.size(); ++i) {
+    String::StringData slot{strs[i].size(), data.size()};
+    std::memcpy(data.data() + sizeof(uint64_t) + i * sizeof(slot), &slot,
+                sizeof(slot));
+    data.insert(data.end(), strs[i].begin(), strs[i].end());
+  }
+  writeFile(path, data.data(), data.size());
+}
+
+/// sensors(s_name String, s_id Integer, s_value Double) with three rows
+fs::path writeSensors() {
+  fs::path dir = fs::path(testing::TempDir()) / "catalog_test";
+  fs::create_directories(dir / "sensors");
+  {
+    std::ofstream schema(dir / "schema");
+    schema << "sensors s_name:String s_id:Integer s_value:Double\n";
+  }
+  std::vector<int32_t> ids{7, 8, 9};
+  std::vector<double> values{0.5, 1.5, 2.5};
+  writeStrings(dir / "sensors" / "s_name.bin", {"a", "bc", "def"});
+  writeFile(dir / "sensors" / "s_id.bin", ids.data(),
+            ids.size() * sizeof(int32_t));
+  writeFile(dir / "sensors" / "s_value.bin", values.data(),
+            values.size() * sizeof(double));
+  return dir;
+}
+} // namespace
+
+TEST(CatalogTest, ParsesManifest) {
+  std::istringstream in("# comment\n"
+                        "events e_id:BigInt e_name:String e_day:Date\n"
+                        "\n"
+                        "tags t_id:Integer t_flag:Char\n");
+  auto schema = Schema::parse(in, "test");
+  ASSERT_EQ(schema.size(), 2);
+  auto &events = schema.getTable("events");
+  ASSERT_EQ(events.columns.size(), 3);
+  EXPECT_EQ(events.columns[0].type, TypeEnum::BigInt);
+  EXPECT_EQ(events.columns[2].type, TypeEnum::Date);
+  EXPECT_EQ(events.getIndex("e_name"), 1);
+  EXPECT_EQ(schema.getTableIndex("tags"), 1);
+  EXPECT_FALSE(schema.find("missing"));
+  EXPECT_THROW(events.getIndex("missing"), std::runtime_error);
+}
+
+TEST(CatalogTest, RejectsMalformedManifest) {
+  std::istringstream untyped("t a:Integer b\n");
+  EXPECT_THROW(Schema::parse(untyped, "test"), std::runtime_error);
+  std::istringstream unknown("t a:Float\n");
+  EXPECT_THROW(Schema::parse(unknown, "test"), std::runtime_error);
+}
+
+TEST(CatalogTest, DefaultsToTPCH) {
+  auto schema = Schema::load(testing::TempDir() + "no-such-directory");
+  EXPECT_EQ(schema.size(), 8);
+  EXPECT_EQ(schema.getTable("lineitem").columns.size(), 16);
+  auto &orders = schema.getTable("orders");
+  EXPECT_EQ(orders.columns[orders.getIndex("o_orderstatus")].type,
+            TypeEnum::Char);
+}
+
+TEST(CatalogTest, MapsTablesFromManifest) {
+  fs::path dir = writeSensors();
+  {
+    Catalog catalog(dir.string());
+    auto &schema = catalog.getSchema();
+    size_t idx = schema.getTableIndex("sensors");
+    catalog.mapColumns(idx, {0, 1, 2});
+    auto segments = catalog.getSegments(idx);
+    ASSERT_EQ(segments.size(), 1);
+    auto [ptr, count] = segments.front();
+    EXPECT_EQ(count, 3);
+    auto *columns = static_cast<ColumnMapping<int32_t> *>(ptr);
+    EXPECT_EQ(columns[1].data[2], 9);
+    EXPECT_EQ(reinterpret_cast<double *>(columns[2].data)[0], 0.5);
+    auto *names = reinterpret_cast<String *>(columns[0].data);
+    EXPECT_EQ(names->slot[1].length, 2);
+    /// mapped once
+    EXPECT_EQ(catalog.getSegments(idx).front().first, ptr);
+
+    llvm::LLVMContext context;
+    auto *type = catalog.createTableType(context, idx);
+    EXPECT_EQ(type->getNumElements(), 3);
+    EXPECT_EQ(type->getName(), "sensors");
+  }
+  fs::remove_all(dir);
+}
+
+TEST(CatalogTest, KeepsSchemaPerCatalog) {
+  fs::path dir = writeSensors();
+  {
+    Catalog sensors(dir.string());
+    Catalog tpch(testing::TempDir() + "no-such-directory");
+    EXPECT_EQ(sensors.getSchema().size(), 1);
+    EXPECT_EQ(tpch.getSchema().size(), 8);
+    EXPECT_FALSE(tpch.getSchema().find("sensors"));
+    size_t idx = sensors.getSchema().getTableIndex("sensors");
+    EXPECT_EQ(sensors.getTupleCount(idx), 3);
+  }
+  fs::remove_all(dir);
+}
+
+TEST(CatalogTest, MapsColumnsOnDemand) {
+  fs::path dir = writeSensors();
+  for (auto prefault :
+       {Prefault::None, Prefault::Populate, Prefault::WillNeed}) {
+    Catalog catalog(dir.string());
+    catalog.setPrefault(prefault);
+    size_t idx = catalog.getSchema().getTableIndex("sensors");
+    EXPECT_EQ(catalog.getMappedColumns(), 0);
+    /// counted from the size of the first fixed size column
+    auto [ptr, count] = catalog.getSegments(idx).front();
+    EXPECT_EQ(count, 3);
+    EXPECT_EQ(catalog.getMappedColumns(), 0);
+    catalog.mapColumns(idx, {2, 1, 2});
+    EXPECT_EQ(catalog.getMappedColumns(), 2);
+    auto *columns = static_cast<ColumnMapping<int32_t> *>(ptr);
+    EXPECT_EQ(columns[0].data, nullptr);
+    EXPECT_EQ(columns[1].data[0], 7);
+    EXPECT_EQ(reinterpret_cast<double *>(columns[2].data)[2], 2.5);
+  }
+  fs::remove_all(dir);
+}
+
+TEST(CatalogTest, OpensColumnFilesOnFirstUse) {
+  fs::path dir = writeSensors();
+  fs::remove(dir / "sensors" / "s_name.bin");
+  {
+    Catalog catalog(dir.string());
+    size_t idx = catalog.getSchema().getTableIndex("sensors");
+    EXPECT_EQ(catalog.getTupleCount(idx), 3);
+    catalog.mapColumns(idx, {1, 2});
+    EXPECT_EQ(catalog.getMappedColumns(), 2);
+    EXPECT_THROW(catalog.mapColumns(idx, {0}), std::runtime_error);
+  }
+  fs::remove_all(dir);
+}
+
+TEST(CatalogTest, ReadsDeltaSegments) {
+  fs::path dir = writeSensors();
+  fs::path delta = dir / "sensors" / "delta.1";
+  fs::create_directories(delta);
+  std::vector<int32_t> ids{10, 11};
+  std::vector<double> values{3.5, 4.5};
+  writeStrings(delta / "s_name.bin", {"gh", "i"});
+  writeFile(delta / "s_id.bin", ids.data(), ids.size() * sizeof(int32_t));
+  writeFile(delta / "s_value.bin", values.data(),
+            values.size() * sizeof(double));
+  {
+    std::ofstream segments(dir / "sensors" / "segments");
+    segments << ".\ndelta.1\n";
+  }
+  {
+    Catalog catalog(dir.string());
+    size_t idx = catalog.getSchema().getTableIndex("sensors");
+    EXPECT_EQ(catalog.getTupleCount(idx), 5);
+    EXPECT_EQ(catalog.getMainPath(idx), (dir / "sensors").string());
+    /// a merge deletes a replaced segment only once no catalog locks it
+    int merge = ::open(delta.c_str(), O_RDONLY | O_DIRECTORY);
+    EXPECT_NE(::flock(merge, LOCK_EX | LOCK_NB), 0);
+    ::close(merge);
+    catalog.mapColumns(idx, {1});
+    EXPECT_EQ(catalog.getMappedColumns(), 2);
+    auto segments = catalog.getSegments(idx);
+    ASSERT_EQ(segments.size(), 2);
+    EXPECT_EQ(segments[0].second, 3);
+    EXPECT_EQ(segments[1].second, 2);
+    auto *columns = static_cast<ColumnMapping<int32_t> *>(segments[1].first);
+    EXPECT_EQ(columns[1].data[1], 11);
+  }
+  int merge = ::open(delta.c_str(), O_RDONLY | O_DIRECTORY);
+  EXPECT_EQ(::flock(merge, LOCK_EX | LOCK_NB), 0);
+  ::close(merge);
+  fs::remove_all(dir);
+}
+
+TEST(CatalogTest, ParsesPrefault) {
+  EXPECT_EQ(parsePrefault("populate"), Prefault::Populate);
+  EXPECT_EQ(parsePrefault("willneed"), Prefault::WillNeed);
+  EXPECT_EQ(parsePrefault("none"), Prefault::None);
+  EXPECT_FALSE(parsePrefault("eager"));
+}
@@ -0,0 +1,105 @@
+#include "IR/Expression.h"
+#include "operators/Iu.h"
+#include "operators/Selection.h"
+#include "runtime/ConjunctSampler.h"
+
+#include <array>
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace p2cllvm;
+
+TEST(ConjunctSamplerTest, KeepsPlanOrderWhileSampling) {
+  ConjunctSampler sampler(3, 10);
+  std::array<uint64_t, 3> cycles{100, 1, 1};
+  for (int i = 0; i < 9; ++i)
+    sampler.sample(cycles.data(), 0b111);
+  EXPECT_TRUE(sampler.isSampling());
+  EXPECT_EQ(sampler.getOrder()[0], 0);
+  EXPECT_EQ(sampler.getOrder()[1], 1);
+  EXPECT_EQ(sampler.getOrder()[2], 2);
+}
+
+TEST(ConjunctSamplerTest, OrdersByRank) {
+  ConjunctSampler sampler(3, 100);
+  /// conjunct 0 is expensive, 1 cheap and unselective, 2 cheap and selective
+  std::array<uint64_t, 3> cycles{200, 2, 2};
+  for (int i = 0; i < 100; ++i) {
+    uint64_t mask = 0b001 | (i % 10 ? 0b010 : 0) | (i % 10 ? 0 : 0b100);
+    sampler.sample(cycles.data(), mask);
+  }
+  EXPECT_FALSE(sampler.isSampling());
+  EXPECT_DOUBLE_EQ(sampler.getSelectivity(1), 0.9);
+  EXPECT_DOUBLE_EQ(sampler.getSelectivity(2), 0.1);
+  EXPECT_DOUBLE_EQ(sampler.getCycles(0), 200);
+  EXPECT_EQ(sampler.getOrder()[0], 2);
+  EXPECT_EQ(sampler.getOrder()[1], 1);
+  /// always true, its rank is infinite
+  EXPECT_EQ(sampler.getOrder()[2], 0);
+}
+
+TEST(ConjunctSamplerTest, Threaded) {
+  ConjunctSampler sampler(2, 1000);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&]() {
+      std::array<uint64_t, 2> cycles{50, 5};
+      for (int i = 0; i < 1000; ++i)
+        sampler.sample(cycles.data(), 0b01);
+    });
+  }
+  for (auto &thread : threads)
+    thread.join();
+  EXPECT_FALSE(sampler.isSampling());
+  EXPECT_EQ(sampler.getSamples(), 4000);
+  EXPECT_EQ(sampler.getOrder()[0], 1);
+  EXPECT_EQ(sampler.getOrder()[1], 0);
+}
+
+namespace {
+std::unique_ptr<Exp> cmp(BinOp op, std::unique_ptr<Exp> lhs,
+                         std::unique_ptr<Exp> rhs) {
+  return std::make_unique<NonTypePreservingBinOp>(op, std::move(lhs),
+                                                  std::move(rhs));
+}
+
+std::unique_ptr<Exp> conj(std::unique_ptr<Exp> lhs, std::unique_ptr<Exp> rhs) {
+  return std::make_unique<ShortCirCutBinOp>(BinOp::And, std::move(lhs),
+                                            std::move(rhs));
+}
+
+std::unique_ptr<Exp> div(IU *lhs, std::unique_ptr<Exp> rhs) {
+  return std::make_unique<TypePreservingBinOp>(
+      BinOp::Div, std::make_unique<IUExp>(lhs), std::move(rhs));
+}
+} // namespace
+
+TEST(SelectionTest, KeepsGuardedDivisionBehindItsGuard) {
+  IU a("a", TypeEnum::Integer), b("b", TypeEnum::Integer),
+      c("c", TypeEnum::Integer), d("d", TypeEnum::Double);
+  /// c < 5 AND a <> 0 AND b / a > 1 AND d / 2.0 > 1
+  auto predicate = conj(
+      conj(conj(cmp(BinOp::CMPLT, std::make_unique<IUExp>(&c),
+                    std::make_unique<ConstExp<int32_t>>(5)),
+                cmp(BinOp::CMPNE, std::make_unique<IUExp>(&a),
+                    std::make_unique<ConstExp<int32_t>>(0))),
+           cmp(BinOp::CMPGT, div(&b, std::make_unique<IUExp>(&a)),
+               std::make_unique<ConstExp<int32_t>>(1))),
+      cmp(BinOp::CMPGT, div(&d, std::make_unique<ConstExp<double>>(2.0)),
+          std::make_unique<ConstExp<double>>(1.0)));
+  predicate->checkSemantics();
+  std::vector<Exp *> conjuncts;
+  Selection::collectConjuncts(predicate.get(), conjuncts);
+  ASSERT_EQ(conjuncts.size(), 4);
+  EXPECT_FALSE(conjuncts[1]->canTrap());
+  EXPECT_TRUE(conjuncts[2]->canTrap());
+  /// a floating point division does not trap
+  EXPECT_FALSE(conjuncts[3]->canTrap());
+  /// only the conjuncts ahead of the integer division are reordered
+  EXPECT_EQ(Selection::reorderable(conjuncts), 2);
+  conjuncts.erase(conjuncts.begin());
+  EXPECT_EQ(Selection::reorderable(conjuncts), 1);
+}
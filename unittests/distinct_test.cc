@@ -0,0 +1,81 @@
+#include "runtime/Hashtables.h"
+#include "runtime/Murmur.h"
+#include "runtime/Runtime.h"
+#include "runtime/ThreadLocalContext.h"
+
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+
+using namespace p2cllvm;
+
+TEST(DISTINCT_TEST, DUPLICATES) {
+  DistinctSet set;
+  for (uint64_t i = 0; i < 10000; ++i) {
+    distinct_insert(&set, hash64bit(i % 1000));
+  }
+  distinct_insert(&set, 0);
+  distinct_insert(&set, 0);
+  EXPECT_EQ(distinct_count(&set), 1001);
+}
+
+TEST(DISTINCT_TEST, MERGE) {
+  DistinctSet s1, s2;
+  for (uint64_t i = 0; i < 1000; ++i) {
+    distinct_insert(&s1, hash64bit(i));
+    distinct_insert(&s2, hash64bit(i + 500));
+  }
+  distinct_merge(&s1, &s2);
+  EXPECT_EQ(distinct_count(&s1), 1500);
+}
+
+TEST(DISTINCT_TEST, LARGE_MERGE) {
+  DistinctSet s1, s2;
+  constexpr uint64_t n = 1ull << 17;
+  for (uint64_t i = 0; i < n; ++i) {
+    distinct_insert(&s1, hash64bit(i));
+    distinct_insert(&s2, hash64bit(i + n / 2));
+  }
+  distinct_merge(&s1, &s2);
+  EXPECT_EQ(distinct_count(&s1), n + n / 2);
+}
+
+TEST(DISTINCT_TEST, MERGE_ON_WORKERS) {
+  constexpr uint64_t n = DistinctSet::parallelMergeThreshold * 2;
+  DistinctSet s1, s2, s3, small;
+  for (uint64_t i = 0; i < n; ++i) {
+    distinct_insert(&s1, hash64bit(i));
+    distinct_insert(&s2, hash64bit(i + n / 2));
+    distinct_insert(&s3, hash64bit(i + n));
+  }
+  distinct_insert(&small, hash64bit(3 * n));
+  DistinctMerge merges;
+  distinct_merge_deferred(&merges, &s1, &s2);
+  distinct_merge_deferred(&merges, &s1, &s3);
+  /// a small set is merged right away
+  distinct_merge_deferred(&merges, &s1, &small);
+  EXPECT_EQ(distinct_count(&s1), n + 1);
+  std::vector<std::thread> workers(4);
+  for (auto &t : workers)
+    t = std::thread([&]() { distinct_run_merges(&merges); });
+  for (auto &t : workers)
+    t.join();
+  EXPECT_EQ(distinct_count(&s1), 2 * n + 1);
+}
+
+TEST(DISTINCT_TEST, CHARGES_BUDGET) {
+  MemoryBudget budget;
+  {
+    ThreadAggregationContext ctx;
+    DistinctSet *set = aggAllocDistinctSet(&ctx, &budget);
+    aggAllocSketch(&ctx, &budget);
+    size_t states = budget.getUsed();
+    EXPECT_GE(states, sizeof(DistinctSet) + sizeof(Sketch));
+    for (uint64_t i = 0; i < 10000; ++i)
+      distinct_insert(set, hash64bit(i));
+    /// the slots of the set, at least one per element
+    EXPECT_GE(budget.getUsed(), states + 10000 * sizeof(uint64_t));
+  }
+  EXPECT_EQ(budget.getUsed(), 0);
+}
@@ -1,7 +1,11 @@
 #include "internal/Tpch.h"
+#include "runtime/Hyperloglog.h"
 #include "runtime/Murmur.h"
 
+#include <cmath>
+#include <cstdint>
 #include <gtest/gtest.h>
+#include <random>
 #include <string>
 
 TEST(HLLTEST, HLL_VAL) {
@@ -15,3 +19,47 @@ TEST(HLLTEST, HLL_VAL) {
   }
   EXPECT_GE(sketch.estimate(), db.part.tuple_count * 0.8);
 }
+
+template <typename S> static double relativeError(size_t n, uint64_t seed) {
+  std::mt19937_64 gen(seed);
+  S sketch;
+  for (size_t i = 0; i < n; ++i)
+    sketch.add(gen());
+  return std::abs(static_cast<double>(sketch.estimate()) - n) / n;
+}
+
+TEST(HLLTEST, HLL_SPARSE) {
+  Sketch sketch;
+  std::mt19937_64 gen(7);
+  for (size_t i = 0; i < 1000; ++i) {
+    auto hash = gen();
+    sketch.add(hash);
+    sketch.add(hash);
+  }
+  EXPECT_TRUE(sketch.isSparse());
+  EXPECT_NEAR(sketch.estimate(), 1000, 5);
+}
+
+TEST(HLLTEST, HLL_ERROR) {
+  for (size_t n : {100ul, 10'000ul, 100'000ul, 1'000'000ul}) {
+    EXPECT_LT(relativeError<Sketch>(n, n), 0.03) << n;
+    EXPECT_LT(relativeError<BasicSketch<10>>(n, n), 0.12) << n;
+  }
+}
+
+TEST(HLLTEST, HLL_MERGE) {
+  for (size_t n : {500ul, 200'000ul}) {
+    std::mt19937_64 gen(n);
+    Sketch single;
+    Sketch parts[4];
+    for (size_t i = 0; i < n; ++i) {
+      auto hash = gen();
+      single.add(hash);
+      parts[i % (i < n / 2 ? 4 : 2)].add(hash);
+    }
+    for (size_t i = 1; i < 4; ++i)
+      parts[0].merge(parts[i]);
+    EXPECT_EQ(parts[0].isSparse(), single.isSparse());
+    EXPECT_EQ(parts[0].estimate(), single.estimate());
+  }
+}
@@ -42,3 +42,17 @@ TEST(MaterializationTest, Basic) {
     }
   }
 }
+
+TEST(MaterializationTest, HashTableStats) {
+  HashTable ht(16);
+  std::vector<HashTableEntry> entries(20);
+  /// ten entries in slot 0, one in each of the slots 1 to 10
+  for (uint64_t i = 0; i < entries.size(); ++i)
+    ht.insertWithTag(&entries[i], i < 10 ? 16 * i : i - 9);
+  auto stats = ht.getStats();
+  EXPECT_EQ(stats.entries, 20);
+  EXPECT_EQ(stats.longestChain, 10);
+  EXPECT_EQ(stats.chains[0], 5);
+  EXPECT_EQ(stats.chains[1], 10);
+  EXPECT_EQ(stats.chains[HashTable::maxChainLength], 1);
+}
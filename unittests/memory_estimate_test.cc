@@ -0,0 +1,104 @@
+#include "operators/Aggregation.h"
+#include "operators/InnerJoin.h"
+#include "operators/MemoryEstimate.h"
+#include "operators/Sort.h"
+#include "synthetic_catalog.h"
+
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <memory>
+#include <utility>
+#include <vector>
+
+using namespace p2cllvm;
+
+namespace {
+/// big: 1000 rows, small: 10 rows, both of two Integer columns
+class MemoryEstimateTest : public SyntheticCatalogTest {
+protected:
+  void SetUp() override {
+    open({{"big", 1000, {{"big_k", 1000}, {"big_g", 50}}},
+          {"small", 10, {{"small_k", 10}, {"small_v", 10}}}});
+  }
+};
+
+constexpr size_t threads = 4;
+
+/// entry header and tuple per group, one directory pointer per slot
+constexpr size_t table(size_t tuples, size_t width, size_t slots) {
+  return tuples * (sizeof(HashTableEntry) + width) + slots * sizeof(void *);
+}
+
+/// the directories of the local tables of all threads
+size_t localTables(size_t width) {
+  return threads *
+         ThreadAggregationContext::localHtSize(sizeof(HashTableEntry) + width) *
+         sizeof(void *);
+}
+} // namespace
+
+TEST_F(MemoryEstimateTest, CountsScansAsFree) {
+  auto plan = scan("big");
+  EXPECT_EQ(estimateMemory(*plan, *stats, threads), 0);
+}
+
+TEST_F(MemoryEstimateTest, SizesJoinBuildTable) {
+  auto small = scan("small");
+  auto big = scan("big");
+  IU *smallKey = small->getIU("small_k"), *bigKey = big->getIU("big_k");
+  InnerJoin join(std::move(small), std::move(big), {smallKey}, {bigKey},
+                 nullptr);
+  /// both columns of small are built, the probe side is not materialized
+  EXPECT_EQ(estimateMemory(join, *stats, threads),
+            table(10, 2 * sizeof(int32_t), 16));
+}
+
+TEST_F(MemoryEstimateTest, SizesAggregationByGroups) {
+  auto big = scan("big");
+  IU *group = big->getIU("big_g");
+  Aggregation agg(std::move(big), IUSet({group}));
+  agg.addAggregate(std::make_unique<CountAggregate>("cnt"));
+  /// 50 groups of the key and a BigInt count, the local tables reduce
+  /// the rows
+  size_t width = sizeof(int32_t) + sizeof(int64_t);
+  EXPECT_EQ(estimateMemory(agg, *stats, threads),
+            table(50, width, 64) + localTables(width));
+}
+
+TEST_F(MemoryEstimateTest, CapsGroupsAtInputCardinality) {
+  auto big = scan("big");
+  IU *key = big->getIU("big_k"), *group = big->getIU("big_g");
+  /// 1000 * 50 combinations, but only 1000 rows; every row is a group, so
+  /// the threads bypass their local tables and keep every row
+  Aggregation agg(std::move(big), IUSet({key, group}));
+  size_t width = 2 * sizeof(int32_t);
+  EXPECT_EQ(estimateMemory(agg, *stats, threads),
+            table(1000, width, 1024) + localTables(width) +
+                1000 * (sizeof(HashTableEntry) + width));
+}
+
+TEST_F(MemoryEstimateTest, SizesSortByInput) {
+  auto big = scan("big");
+  IU *key = big->getIU("big_k");
+  Sort sort(std::move(big), {key}, {true});
+  /// every row with both columns, without a directory
+  EXPECT_EQ(estimateMemory(sort, *stats, threads),
+            1000 * 2 * sizeof(int32_t));
+}
+
+TEST_F(MemoryEstimateTest, SumsOperatorsOfThePlan) {
+  auto small = scan("small");
+  auto big = scan("big");
+  IU *smallKey = small->getIU("small_k"), *bigKey = big->getIU("big_k");
+  IU *value = small->getIU("small_v");
+  auto join = std::make_unique<InnerJoin>(
+      std::move(small), std::move(big), std::vector<IU *>{smallKey},
+      std::vector<IU *>{bigKey}, nullptr);
+  /// the join keeps 10 rows of 10 values, which bypass the local tables
+  Aggregation agg(std::move(join), IUSet({value}));
+  size_t width = sizeof(int32_t);
+  EXPECT_EQ(estimateMemory(agg, *stats, threads),
+            table(10, width, 16) + localTables(width) +
+                10 * (sizeof(HashTableEntry) + width) +
+                table(10, 2 * sizeof(int32_t), 16));
+}
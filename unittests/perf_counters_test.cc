@@ -0,0 +1,41 @@
+#include "runtime/PerfCounters.h"
+
+#include <cstdint>
+#include <gtest/gtest.h>
+
+using namespace p2cllvm;
+
+TEST(PerfCountersTest, Accumulate) {
+  PerfSample a, b;
+  a.values[PerfSample::Cycles] = 10;
+  a.valid[PerfSample::Cycles] = true;
+  b.values[PerfSample::Cycles] = 5;
+  b.values[PerfSample::Instructions] = 7;
+  b.valid[PerfSample::Instructions] = true;
+  a += b;
+  EXPECT_EQ(a.values[PerfSample::Cycles], 15);
+  EXPECT_EQ(a.values[PerfSample::Instructions], 7);
+  EXPECT_TRUE(a.valid[PerfSample::Cycles]);
+  EXPECT_TRUE(a.valid[PerfSample::Instructions]);
+  EXPECT_FALSE(a.valid[PerfSample::DTLBMisses]);
+}
+
+TEST(PerfCountersTest, Count) {
+  auto &counters = PerfCounters::local();
+  if (!counters.available()) {
+    /// containers commonly forbid perf_event_open, samples stay empty
+    EXPECT_FALSE(counters.error().empty());
+    counters.start();
+    auto sample = counters.stop();
+    for (bool valid : sample.valid)
+      EXPECT_FALSE(valid);
+    GTEST_SKIP() << counters.error();
+  }
+  counters.start();
+  volatile uint64_t sum = 0;
+  for (uint64_t i = 0; i < 1'000'000; ++i)
+    sum = sum + i;
+  auto sample = counters.stop();
+  ASSERT_TRUE(sample.valid[PerfSample::Instructions]);
+  EXPECT_GT(sample.values[PerfSample::Instructions], 1'000'000);
+}
@@ -0,0 +1,93 @@
+#include "internal/SharedScan.h"
+
+#include <atomic>
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <set>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace p2cllvm;
+
+namespace {
+/// two segments of 1000 and 250 rows, the structs are only compared
+int mainSegment, deltaSegment;
+const std::vector<std::pair<void *, size_t>> segments = {
+    {&mainSegment, 1000}, {&deltaSegment, 250}};
+
+std::pair<void *, uint64_t> key(const SharedScans::Morsel &morsel) {
+  return {morsel.table, morsel.begin};
+}
+} // namespace
+
+TEST(SharedScanTest, ScansAloneInOrder) {
+  SharedScans scans;
+  auto cursor = scans.attach(0, segments, 100);
+  std::vector<SharedScans::Morsel> morsels;
+  while (auto morsel = cursor->next())
+    morsels.push_back(*morsel);
+  ASSERT_EQ(morsels.size(), 13);
+  EXPECT_EQ(morsels[0].table, &mainSegment);
+  EXPECT_EQ(morsels[9].end, 1000);
+  EXPECT_EQ(morsels[10].table, &deltaSegment);
+  EXPECT_EQ(morsels[12].begin, 200);
+  EXPECT_EQ(morsels[12].end, 250);
+  EXPECT_EQ(scans.getSharedMorsels(), 0);
+}
+
+TEST(SharedScanTest, AttachesToRunningScan) {
+  SharedScans scans(4);
+  auto first = scans.attach(0, segments, 100);
+  for (int i = 0; i < 5; ++i)
+    ASSERT_TRUE(first->next());
+  /// starts where the running scan is and wraps around
+  auto second = scans.attach(0, segments, 100);
+  EXPECT_EQ(scans.getAttachedToRunning(), 1);
+  auto morsel = second->next();
+  ASSERT_TRUE(morsel);
+  EXPECT_EQ(morsel->begin, 500);
+  std::set<std::pair<void *, uint64_t>> seen{key(*morsel)};
+  /// the second scan is 1 ahead, the first must keep up
+  for (int i = 0; i < 8; ++i) {
+    ASSERT_TRUE(first->next());
+    auto morsel = second->next();
+    ASSERT_TRUE(morsel);
+    seen.insert(key(*morsel));
+  }
+  /// the first scan is done and no longer holds the second back
+  EXPECT_FALSE(first->next());
+  while (auto morsel = second->next())
+    seen.insert(key(*morsel));
+  EXPECT_EQ(seen.size(), 13);
+  EXPECT_GT(scans.getSharedMorsels(), 0);
+}
+
+TEST(SharedScanTest, ConcurrentScansStayWithinWindow) {
+  constexpr uint64_t window = 2;
+  SharedScans scans(window);
+  auto fast = scans.attach(1, segments, 10);
+  auto slow = scans.attach(1, segments, 10);
+  std::atomic<int64_t> fastClaimed = 0, slowClaimed = 0, maxLead = 0;
+  std::thread leader([&]() {
+    while (fast->next()) {
+      int64_t lead = ++fastClaimed - slowClaimed;
+      int64_t seen = maxLead;
+      while (lead > seen && !maxLead.compare_exchange_weak(seen, lead))
+        ;
+    }
+  });
+  std::thread follower([&]() {
+    while (slow->next()) {
+      std::this_thread::yield();
+      ++slowClaimed;
+    }
+  });
+  leader.join();
+  follower.join();
+  EXPECT_EQ(fastClaimed, 125);
+  EXPECT_EQ(slowClaimed, 125);
+  /// the leader waits for the follower, allow for the follower's counter
+  /// trailing its claims
+  EXPECT_LE(maxLead, static_cast<int64_t>(window) + 1);
+}
@@ -0,0 +1,314 @@
+#include "runtime/AggregationSpill.h"
+#include "runtime/Cancellation.h"
+#include "runtime/JoinSpill.h"
+#include "runtime/Murmur.h"
+#include "runtime/Runtime.h"
+#include "runtime/SortSpill.h"
+#include "runtime/Spill.h"
+#include "runtime/ThreadLocal.h"
+#include "runtime/ThreadLocalContext.h"
+
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <gtest/gtest.h>
+#include <thread>
+#include <unordered_map>
+
+using namespace p2cllvm;
+
+TEST(SpillTest, WriteRead) {
+  constexpr size_t n = 100'000;
+  SpillWriter writer(3 * sizeof(uint64_t));
+  for (uint64_t i = 0; i < n; ++i) {
+    auto *record = reinterpret_cast<uint64_t *>(writer.alloc());
+    record[0] = i;
+    record[2] = ~i;
+  }
+  writer.finish();
+  EXPECT_EQ(writer.getSize(), n * 3 * sizeof(uint64_t));
+
+  SpillReader reader(writer);
+  uint64_t expected = 0;
+  for (auto block = reader.next(); !block.empty(); block = reader.next()) {
+    for (size_t off = 0; off < block.size(); off += 3 * sizeof(uint64_t)) {
+      auto *record = reinterpret_cast<uint64_t *>(block.data() + off);
+      EXPECT_EQ(record[0], expected);
+      EXPECT_EQ(record[2], ~expected);
+      ++expected;
+    }
+  }
+  EXPECT_EQ(expected, n);
+}
+
+TEST(SpillTest, Budget) {
+  MemoryBudget budget(100);
+  EXPECT_TRUE(budget.isLimited());
+  EXPECT_TRUE(budget.tryReserve(60));
+  EXPECT_FALSE(budget.tryReserve(60));
+  EXPECT_EQ(budget.getUsed(), 60);
+  budget.release(60);
+  EXPECT_TRUE(budget.tryReserve(100));
+  EXPECT_FALSE(MemoryBudget().isLimited());
+}
+
+static size_t countMatches(HashTable &ht, uint64_t hash, uint64_t key) {
+  size_t matches = 0;
+  for (auto *entry = ht.lookup(hash); entry;) {
+    entry = reinterpret_cast<HashTableEntry *>(signExtend(entry));
+    uint64_t other;
+    std::memcpy(&other, entry->data, sizeof(other));
+    matches += other == key;
+    entry = entry->next;
+  }
+  return matches;
+}
+
+TEST(SpillTest, GraceJoin) {
+  constexpr size_t n = 1ull << 18;
+  constexpr size_t elemSize = sizeof(HashTableEntry) + sizeof(uint64_t);
+  MemoryBudget budget(2 * JoinSpill::reserveChunk);
+  ThreadLocalStorage<ThreadJoinContext> build;
+  ThreadLocalStorage<ThreadJoinProbeContext> probe;
+  JoinSpill spill(&budget, &build, &probe, elemSize);
+
+  auto *ctx = local(&build);
+  for (uint64_t key = 0; key < n; ++key) {
+    auto hash = murmurHash(reinterpret_cast<const char *>(&key), sizeof(key));
+    auto *entry = reinterpret_cast<HashTableEntry *>(
+        insertJoinEntrySpilling(&spill, ctx, hash));
+    entry->hash = hash;
+    std::memcpy(entry->data, &key, sizeof(key));
+  }
+  EXPECT_NE(spill.getSpilled(), 0);
+  EXPECT_LE(budget.getUsed(), budget.getLimit());
+
+  HashTable ht(finishJoinBuild(&spill, n));
+  insertAll(&build, &ht, elemSize);
+
+  auto *pctx = local(&probe);
+  size_t matches = 0;
+  for (uint64_t key = 0; key < n; ++key) {
+    auto hash = murmurHash(reinterpret_cast<const char *>(&key), sizeof(key));
+    if ((joinSpilledPartitions(&spill) >> JoinSpill::partitionOf(hash)) & 1)
+      std::memcpy(joinSpillProbe(&spill, pctx, hash, elemSize), &key,
+                  sizeof(key));
+    else
+      matches += countMatches(ht, hash, key);
+  }
+  finishJoinProbe(&spill);
+
+  while (auto *partition = joinNextPartition(&spill)) {
+    while (auto *entry = joinNextProbe(partition)) {
+      uint64_t key;
+      std::memcpy(&key, entry->data, sizeof(key));
+      matches += countMatches(*joinPartitionTable(partition), entry->hash, key);
+    }
+    joinReleasePartition(&spill, partition);
+  }
+  EXPECT_EQ(matches, n);
+}
+
+TEST(SpillTest, LoadsPartitionsWithinBudget) {
+  constexpr size_t n = 1ull << 18;
+  constexpr size_t elemSize = sizeof(HashTableEntry) + sizeof(uint64_t);
+  MemoryBudget budget(2 * JoinSpill::reserveChunk);
+  ThreadLocalStorage<ThreadJoinContext> build;
+  ThreadLocalStorage<ThreadJoinProbeContext> probe;
+  JoinSpill spill(&budget, &build, &probe, elemSize);
+
+  auto *ctx = local(&build);
+  for (uint64_t key = 0; key < n; ++key) {
+    auto hash = murmurHash(reinterpret_cast<const char *>(&key), sizeof(key));
+    auto *entry = reinterpret_cast<HashTableEntry *>(
+        insertJoinEntrySpilling(&spill, ctx, hash));
+    entry->hash = hash;
+    std::memcpy(entry->data, &key, sizeof(key));
+  }
+  ASSERT_GT(std::popcount(spill.getSpilled()), 1);
+  finishJoinBuild(&spill, n);
+  finishJoinProbe(&spill);
+
+  auto *first = joinNextPartition(&spill);
+  ASSERT_NE(first, nullptr);
+  /// no room for a second partition while the first one is loaded
+  budget.reserve(budget.getLimit());
+  std::atomic<JoinSpill::Partition *> second = nullptr;
+  std::thread worker([&]() { second = joinNextPartition(&spill); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  EXPECT_EQ(second.load(), nullptr);
+  /// alone, the second partition is loaded even beyond the budget
+  joinReleasePartition(&spill, first);
+  worker.join();
+  ASSERT_NE(second.load(), nullptr);
+  joinReleasePartition(&spill, second);
+  budget.release(budget.getLimit());
+}
+
+TEST(SpillTest, CancelledJoinStopsBetweenPartitions) {
+  constexpr size_t n = 1ull << 18;
+  constexpr size_t elemSize = sizeof(HashTableEntry) + sizeof(uint64_t);
+  MemoryBudget budget(2 * JoinSpill::reserveChunk);
+  ThreadLocalStorage<ThreadJoinContext> build;
+  ThreadLocalStorage<ThreadJoinProbeContext> probe;
+  CancellationToken cancellation;
+  JoinSpill spill(&budget, &build, &probe, elemSize, &cancellation);
+
+  auto *ctx = local(&build);
+  for (uint64_t key = 0; key < n; ++key) {
+    auto hash = murmurHash(reinterpret_cast<const char *>(&key), sizeof(key));
+    auto *entry = reinterpret_cast<HashTableEntry *>(
+        insertJoinEntrySpilling(&spill, ctx, hash));
+    entry->hash = hash;
+    std::memcpy(entry->data, &key, sizeof(key));
+  }
+  ASSERT_GT(std::popcount(spill.getSpilled()), 1);
+  finishJoinBuild(&spill, n);
+  finishJoinProbe(&spill);
+
+  auto *partition = joinNextPartition(&spill);
+  ASSERT_NE(partition, nullptr);
+  size_t reserved = budget.getUsed();
+  cancellation.cancel();
+  /// the loaded partition is released, no further one is loaded
+  joinReleasePartition(&spill, partition);
+  EXPECT_EQ(joinNextPartition(&spill), nullptr);
+  EXPECT_LT(budget.getUsed(), reserved);
+}
+
+/// adds the {key, count} entries of tb to counts, returns the number of entries
+static size_t collectGroups(TupleBuffer *tb, size_t elemSize,
+                            std::unordered_map<uint64_t, uint64_t> &counts) {
+  size_t entries = 0;
+  for (size_t i = 0; i < tb->getNumBuffers(); ++i) {
+    auto &buffer = tb->getBuffers()[i];
+    for (size_t off = 0; off < buffer.ptr; off += elemSize, ++entries) {
+      uint64_t data[2];
+      std::memcpy(data, buffer.mem + off + sizeof(HashTableEntry),
+                  sizeof(data));
+      counts[data[0]] += data[1];
+    }
+  }
+  return entries;
+}
+
+TEST(SpillTest, ExternalAggregation) {
+  constexpr size_t groups = 1ull << 17;
+  constexpr size_t elemSize = sizeof(HashTableEntry) + 2 * sizeof(uint64_t);
+  MemoryBudget budget(2 * AggregationSpill::reserveChunk);
+  ThreadLocalStorage<ThreadAggregationContext> tls;
+  AggregationSpill spill(&budget, &tls, elemSize);
+
+  /// every group is inserted twice as a partial aggregate
+  auto *ctx = local(&tls);
+  getLocalHashTable(ctx, elemSize);
+  for (uint64_t i = 0; i < 2 * groups; ++i) {
+    uint64_t data[2] = {i % groups, 1};
+    auto hash = murmurHash(reinterpret_cast<const char *>(data), sizeof(uint64_t));
+    auto *entry = insertAggEntrySpilling(&spill, ctx, hash);
+    std::memcpy(entry->data, data, sizeof(data));
+  }
+  EXPECT_NE(spill.getSpilled(), 0);
+  EXPECT_LE(budget.getUsed(), budget.getLimit());
+  EXPECT_LT(finishAggBuild(&spill, groups), groups);
+
+  std::unordered_map<uint64_t, uint64_t> counts;
+  for (size_t p = 0; p < AggregationSpill::numPartitions; ++p)
+    collectGroups(getAggPartitionTB(ctx, p), elemSize, counts);
+  size_t inMemory = counts.size();
+
+  size_t produced = 0;
+  while (auto *partition = aggNextPartition(&spill)) {
+    std::unordered_map<uint64_t, HashTableEntry *> merged;
+    while (auto *entry = aggNextEntry(partition)) {
+      uint64_t data[2];
+      std::memcpy(data, entry->data, sizeof(data));
+      auto [it, inserted] = merged.try_emplace(data[0], nullptr);
+      if (inserted) {
+        it->second = aggPartitionCopy(&spill, partition, entry);
+        continue;
+      }
+      uint64_t count;
+      std::memcpy(&count, it->second->data + sizeof(uint64_t), sizeof(count));
+      count += data[1];
+      std::memcpy(it->second->data + sizeof(uint64_t), &count, sizeof(count));
+    }
+    produced += collectGroups(aggPartitionGroups(partition), elemSize, counts);
+    aggReleasePartition(&spill, partition);
+  }
+  EXPECT_EQ(inMemory + produced, groups);
+  EXPECT_EQ(counts.size(), groups);
+  for (auto &[key, count] : counts)
+    EXPECT_EQ(count, 2) << key;
+}
+
+static int cmpKeys(const void *a, const void *b) {
+  uint64_t x, y;
+  std::memcpy(&x, a, sizeof(x));
+  std::memcpy(&y, b, sizeof(y));
+  return (x > y) - (x < y);
+}
+
+TEST(SpillTest, ExternalSort) {
+  constexpr size_t n = 1ull << 18;
+  constexpr size_t elemSize = 2 * sizeof(uint64_t);
+  MemoryBudget budget(2 * SortSpill::reserveChunk);
+  ThreadLocalStorage<ThreadSortContext> tls;
+  SortSpill spill(&budget, &tls, elemSize);
+
+  auto *ctx = local(&tls);
+  for (uint64_t i = 0; i < n; ++i) {
+    uint64_t tuple[2] = {murmurHash(reinterpret_cast<const char *>(&i),
+                                    sizeof(i)),
+                         i};
+    std::memcpy(insertSortEntrySpilling(&spill, ctx, &cmpKeys), tuple,
+                sizeof(tuple));
+  }
+  EXPECT_LE(budget.getUsed(), budget.getLimit());
+
+  finishSort(&spill, &cmpKeys);
+  EXPECT_GT(spill.getNumRuns(), 1);
+  size_t count = 0;
+  uint64_t prev = 0;
+  for (char *tuple = sortNext(&spill); tuple; tuple = sortNext(&spill)) {
+    uint64_t key;
+    std::memcpy(&key, tuple, sizeof(key));
+    EXPECT_LE(prev, key);
+    prev = key;
+    ++count;
+  }
+  EXPECT_EQ(count, n);
+  EXPECT_EQ(budget.getUsed(), 0);
+}
+
+TEST(SpillTest, CancelledSortStopsMerging) {
+  constexpr size_t n = 1ull << 18;
+  constexpr size_t elemSize = 2 * sizeof(uint64_t);
+  MemoryBudget budget(2 * SortSpill::reserveChunk);
+  ThreadLocalStorage<ThreadSortContext> tls;
+  CancellationToken cancellation;
+  SortSpill spill(&budget, &tls, elemSize, &cancellation);
+
+  auto *ctx = local(&tls);
+  for (uint64_t i = 0; i < n; ++i) {
+    uint64_t tuple[2] = {murmurHash(reinterpret_cast<const char *>(&i),
+                                    sizeof(i)),
+                         i};
+    std::memcpy(insertSortEntrySpilling(&spill, ctx, &cmpKeys), tuple,
+                sizeof(tuple));
+  }
+  finishSort(&spill, &cmpKeys);
+  ASSERT_GT(spill.getNumRuns(), 1);
+  for (size_t i = 0; i < 10; ++i)
+    ASSERT_NE(sortNext(&spill), nullptr);
+  cancellation.cancel();
+  /// the merge ends at the next check, the runs and reservations are dropped
+  size_t after = 0;
+  while (sortNext(&spill))
+    ++after;
+  EXPECT_LT(after, SortSpill::checkInterval);
+  EXPECT_TRUE(ctx->runs.empty());
+  EXPECT_EQ(budget.getUsed(), 0);
+}
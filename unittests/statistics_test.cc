@@ -0,0 +1,98 @@
+#include "internal/Statistics.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <numeric>
+#include <string>
+#include <vector>
+
+using namespace p2cllvm;
+namespace fs = std::filesystem;
+
+TEST(StatisticsTest, LoadsGeneratedFile) {
+  std::string path = testing::TempDir() + "c_custkey.stats";
+  {
+    std::ofstream out(path);
+    out << "rows 100\nnulls 0\ndistinct 98\nsorted 1\nclustering 1\n"
+        << "min 1\nmax 100\nhistogram 5 1 25 50 75 100\n";
+  }
+  auto stats = ColumnStatistics::load(path);
+  std::remove(path.c_str());
+  ASSERT_TRUE(stats.has_value());
+  EXPECT_EQ(stats->rows, 100);
+  EXPECT_EQ(stats->nulls, 0);
+  EXPECT_EQ(stats->distinct, 98);
+  EXPECT_TRUE(stats->sorted);
+  EXPECT_TRUE(stats->numeric);
+  EXPECT_DOUBLE_EQ(stats->min, 1);
+  EXPECT_DOUBLE_EQ(stats->max, 100);
+  ASSERT_EQ(stats->histogram.size(), 5);
+  EXPECT_DOUBLE_EQ(stats->histogram[2], 50);
+}
+
+TEST(StatisticsTest, StringsAreNotNumeric) {
+  std::string path = testing::TempDir() + "c_name.stats";
+  {
+    std::ofstream out(path);
+    out << "rows 10\nnulls 0\ndistinct 10\nsorted 0\nclustering 0.5\n";
+  }
+  auto stats = ColumnStatistics::load(path);
+  std::remove(path.c_str());
+  ASSERT_TRUE(stats.has_value());
+  EXPECT_FALSE(stats->numeric);
+  EXPECT_FALSE(stats->sorted);
+  EXPECT_DOUBLE_EQ(stats->clustering, 0.5);
+  EXPECT_DOUBLE_EQ(stats->fractionBelow(5), 0.0);
+}
+
+TEST(StatisticsTest, MissingFile) {
+  EXPECT_FALSE(ColumnStatistics::load(testing::TempDir() + "missing.stats"));
+}
+
+TEST(StatisticsTest, FractionBelowUsesHistogram) {
+  ColumnStatistics stats;
+  stats.numeric = true;
+  stats.min = 0;
+  stats.max = 1000;
+  /// skewed: half of the values are below 10
+  stats.histogram = {0, 5, 10, 500, 1000};
+  EXPECT_DOUBLE_EQ(stats.fractionBelow(0), 0.0);
+  EXPECT_DOUBLE_EQ(stats.fractionBelow(10), 0.5);
+  EXPECT_DOUBLE_EQ(stats.fractionBelow(7.5), 0.375);
+  EXPECT_DOUBLE_EQ(stats.fractionBelow(750), 0.875);
+  EXPECT_DOUBLE_EQ(stats.fractionBelow(2000), 1.0);
+  stats.histogram.clear();
+  EXPECT_DOUBLE_EQ(stats.fractionBelow(250), 0.25);
+}
+
+TEST(StatisticsTest, ComputesMissingStatisticsInOnePass) {
+  /// more values than the histogram samples, without a .stats file
+  constexpr int32_t n = 100000;
+  fs::path dir = fs::path(testing::TempDir()) / "statistics_compute";
+  fs::remove_all(dir);
+  fs::create_directories(dir / "t");
+  std::ofstream(dir / "schema") << "t t_v:Integer\n";
+  std::vector<int32_t> values(n);
+  std::iota(values.begin(), values.end(), 0);
+  std::ofstream(dir / "t" / "t_v.bin", std::ios::binary)
+      .write(reinterpret_cast<const char *>(values.data()),
+             values.size() * sizeof(int32_t));
+  {
+    Catalog db(dir.string());
+    Statistics statistics(db);
+    auto &stats = statistics.getColumn("t", "t_v");
+    EXPECT_EQ(stats.rows, n);
+    EXPECT_TRUE(stats.sorted);
+    EXPECT_DOUBLE_EQ(stats.min, 0);
+    EXPECT_DOUBLE_EQ(stats.max, n - 1);
+    EXPECT_NEAR(stats.distinct, n, n / 20);
+    ASSERT_EQ(stats.histogram.size(), ColumnStatistics::histogramBuckets + 1);
+    EXPECT_DOUBLE_EQ(stats.histogram.front(), 0);
+    EXPECT_DOUBLE_EQ(stats.histogram.back(), n - 1);
+    EXPECT_NEAR(stats.fractionBelow(n / 2), 0.5, 0.05);
+  }
+  fs::remove_all(dir);
+}
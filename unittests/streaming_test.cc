@@ -0,0 +1,116 @@
+#include "internal/Catalog.h"
+#include "internal/StreamingScan.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace p2cllvm;
+namespace fs = std::filesystem;
+
+namespace {
+template <typename T>
+void writeColumn(const fs::path &path, const std::vector<T> &values) {
+  std::ofstream out(path, std::ios::binary);
+  out.write(reinterpret_cast<const char *>(values.data()),
+            values.size() * sizeof(T));
+}
+
+/// readings(r_id Integer, r_value Double, r_tag String) with ids counting up
+/// from first and an empty tag per row
+void writeSegment(const fs::path &dir, int32_t first, size_t rows) {
+  fs::create_directories(dir);
+  std::vector<int32_t> ids(rows);
+  std::vector<double> values(rows);
+  for (size_t i = 0; i < rows; ++i) {
+    ids[i] = first + i;
+    values[i] = (first + i) * 0.5;
+  }
+  writeColumn(dir / "r_id.bin", ids);
+  writeColumn(dir / "r_value.bin", values);
+  std::vector<char> tags(sizeof(uint64_t) + rows * sizeof(String::StringData));
+  uint64_t count = rows;
+  std::memcpy(tags.data(), &count, sizeof(count));
+  writeColumn(dir / "r_tag.bin", tags);
+}
+
+fs::path writeReadings() {
+  fs::path dir = fs::path(testing::TempDir()) / "streaming_test";
+  fs::remove_all(dir);
+  writeSegment(dir / "readings", 0, 10000);
+  writeSegment(dir / "readings" / "delta.1", 10000, 2500);
+  std::ofstream(dir / "schema")
+      << "readings r_id:Integer r_value:Double r_tag:String\n";
+  std::ofstream(dir / "readings" / "segments") << ".\ndelta.1\n";
+  return dir;
+}
+} // namespace
+
+TEST(StreamingTest, StreamsMorselsOfAllSegments) {
+  fs::path dir = writeReadings();
+  {
+    Catalog catalog(dir.string());
+    size_t idx = catalog.getSchema().getTableIndex("readings");
+    catalog.mapColumns(idx, {0, 1, 2});
+    EXPECT_TRUE(MorselStream::streams(catalog, idx, {2, 0}));
+    EXPECT_FALSE(MorselStream::streams(catalog, idx, {2}));
+    auto mappedTags = catalog.getSegments(idx);
+
+    MorselStream stream(catalog, idx, {0, 1, 2}, 1000, 3, 2);
+    /// the last morsel of each segment is cut at its end
+    EXPECT_EQ(stream.size(), 13);
+    std::atomic<uint64_t> rows = 0, sum = 0;
+    std::atomic<bool> valid = true;
+    std::vector<std::thread> workers;
+    for (int t = 0; t < 4; ++t)
+      workers.emplace_back([&]() {
+        while (auto morsel = stream.acquire()) {
+          auto *columns = static_cast<ColumnMapping<int32_t> *>(morsel->table);
+          auto *ids = columns[0].data;
+          auto *values = reinterpret_cast<double *>(columns[1].data);
+          for (uint64_t i = morsel->begin; i < morsel->end; ++i) {
+            sum += ids[i];
+            valid = valid && values[i] == ids[i] * 0.5;
+          }
+          /// strings are read from the mapping
+          bool mapped = false;
+          for (auto [ptr, count] : mappedTags)
+            mapped |= static_cast<ColumnMapping<int32_t> *>(ptr)[2].data ==
+                      columns[2].data;
+          valid = valid && mapped;
+          rows += morsel->end - morsel->begin;
+          stream.release(*morsel);
+        }
+      });
+    for (auto &worker : workers)
+      worker.join();
+    EXPECT_TRUE(valid);
+    EXPECT_EQ(rows, 12500);
+    EXPECT_EQ(sum, 12500ull * 12499 / 2);
+  }
+  fs::remove_all(dir);
+}
+
+TEST(StreamingTest, StopsUnfinishedScans) {
+  fs::path dir = writeReadings();
+  {
+    Catalog catalog(dir.string());
+    size_t idx = catalog.getSchema().getTableIndex("readings");
+    catalog.mapColumns(idx, {0});
+    MorselStream stream(catalog, idx, {0}, 100, 2, 4);
+    auto morsel = stream.acquire();
+    ASSERT_TRUE(morsel);
+    EXPECT_EQ(morsel->begin, 0);
+    EXPECT_EQ(static_cast<ColumnMapping<int32_t> *>(morsel->table)[0].data[99],
+              99);
+    stream.release(*morsel);
+    /// the readers wait for free slots and are stopped by the destructor
+  }
+  fs::remove_all(dir);
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "internal/Catalog.h"
+#include "internal/Statistics.h"
+#include "operators/Scan.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace p2cllvm {
+/// Fixture of the planner tests: a catalog of Integer tables in a temporary
+/// directory, removed after the test. The values are never read, the
+/// statistics come from the .stats files.
+class SyntheticCatalogTest : public testing::Test {
+protected:
+  /// columns with their number of distinct values
+  struct TableSpec {
+    std::string name;
+    uint64_t rows;
+    std::vector<std::pair<std::string, uint64_t>> columns;
+  };
+
+  /// writes the tables and opens the catalog and its statistics
+  void open(const std::vector<TableSpec> &tables) {
+    auto *test = testing::UnitTest::GetInstance()->current_test_info();
+    dir = std::filesystem::path(testing::TempDir()) /
+          (std::string(test->test_suite_name()) + "_" + test->name());
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    {
+      std::ofstream schema(dir / "schema");
+      for (auto &table : tables) {
+        std::filesystem::create_directories(dir / table.name);
+        schema << table.name;
+        for (auto &[column, distinct] : table.columns) {
+          schema << " " << column << ":Integer";
+          std::vector<int32_t> values(table.rows);
+          std::ofstream(dir / table.name / (column + ".bin"), std::ios::binary)
+              .write(reinterpret_cast<const char *>(values.data()),
+                     values.size() * sizeof(int32_t));
+          std::ofstream(dir / table.name / (column + ".stats"))
+              << "rows " << table.rows << "\ndistinct " << distinct << "\n";
+        }
+        schema << "\n";
+      }
+    }
+    db.emplace(dir.string());
+    stats.emplace(*db);
+  }
+
+  std::unique_ptr<Scan> scan(std::string_view table) {
+    return std::make_unique<Scan>(table, db->getSchema());
+  }
+
+  void TearDown() override {
+    stats.reset();
+    db.reset();
+    if (!dir.empty())
+      std::filesystem::remove_all(dir);
+  }
+
+  std::filesystem::path dir;
+  std::optional<Catalog> db;
+  std::optional<Statistics> stats;
+};
+} // namespace p2cllvm
@@ -108,3 +108,48 @@ TEST(ThreadLocalTest, MultiThreadedAggregation) {
   for (auto &thread : threads)
     thread.join();
 }
+
+namespace {
+/// the row counting the aggregation consumer generates: the runtime is only
+/// called at the end of a window, false if the row skips the local table
+bool countRow(ThreadAggregationContext &ctx) {
+  PreAggregation *preAggregation = getPreAggregation(&ctx);
+  if (++preAggregation->rows == PreAggregation::sampleSize)
+    adaptPreAggregation(preAggregation);
+  return !preAggregation->bypass;
+}
+} // namespace
+
+TEST(ThreadLocalTest, PreAggregationBypass) {
+  ThreadAggregationContext ctx;
+  auto *ht = ctx.getHashTable(32);
+  EXPECT_GE(ht->getSize(), ThreadAggregationContext::minLocalHtSize);
+  EXPECT_LE(ht->getSize(), ThreadAggregationContext::maxLocalHtSize);
+  /// every row creates a new group
+  for (size_t i = 0; i < PreAggregation::sampleSize; ++i) {
+    countRow(ctx);
+    auto *entry = reinterpret_cast<HashTableEntry *>(ctx.tupleBuffer.alloc(32));
+    ctx.insertAgg(i, entry);
+  }
+  EXPECT_TRUE(ctx.preAggregation.bypass);
+  EXPECT_FALSE(countRow(ctx));
+  /// sampling resumes after bypassWindows windows
+  for (size_t i = 1;
+       i < PreAggregation::bypassWindows * PreAggregation::sampleSize; ++i)
+    countRow(ctx);
+  EXPECT_FALSE(ctx.preAggregation.bypass);
+}
+
+TEST(ThreadLocalTest, PreAggregationReduces) {
+  ThreadAggregationContext ctx;
+  ctx.getHashTable(32);
+  /// only a few groups, the local table is effective
+  for (size_t i = 0; i < PreAggregation::sampleSize; ++i) {
+    EXPECT_TRUE(countRow(ctx));
+    if (i % 64 == 0) {
+      auto *entry = reinterpret_cast<HashTableEntry *>(ctx.tupleBuffer.alloc(32));
+      ctx.insertAgg(i, entry);
+    }
+  }
+  EXPECT_FALSE(ctx.preAggregation.bypass);
+}
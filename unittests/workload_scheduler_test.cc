@@ -0,0 +1,243 @@
+#include "internal/Catalog.h"
+#include "internal/WorkloadScheduler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <cstddef>
+#include <gtest/gtest.h>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace p2cllvm;
+using namespace std::chrono_literals;
+
+namespace {
+using Step = WorkloadScheduler::Step;
+
+/// a step of units that each call fn
+Step units(size_t count, std::function<void(size_t)> fn) {
+  return {[count]() { return count; }, std::move(fn)};
+}
+
+/// holds the workers in the units of a query until the test opened it
+class Gate {
+public:
+  Step units(size_t count, std::function<void(size_t)> fn = {}) {
+    return ::units(count, [this, fn](size_t unit) {
+      opened.wait();
+      if (fn)
+        fn(unit);
+    });
+  }
+
+  void open() { promise.set_value(); }
+
+private:
+  std::promise<void> promise;
+  std::shared_future<void> opened = promise.get_future().share();
+};
+
+WorkloadScheduler::Options options(size_t memoryLimit = MemoryBudget::unlimited,
+                                   size_t maxBypass = 8) {
+  WorkloadScheduler::Options options;
+  options.threads = 2;
+  options.memoryLimit = memoryLimit;
+  options.maxBypass = maxBypass;
+  return options;
+}
+} // namespace
+
+TEST(WorkloadSchedulerTest, RunsStepsInOrder) {
+  Catalog db(testing::TempDir() + "no-such-directory");
+  WorkloadScheduler scheduler(db, options());
+  std::mutex m;
+  std::vector<size_t> steps;
+  std::vector<Step> query;
+  for (size_t step = 0; step < 3; ++step)
+    query.push_back(units(20, [&, step](size_t) {
+      std::lock_guard lock(m);
+      steps.push_back(step);
+    }));
+  /// a step without units is skipped
+  query.insert(query.begin() + 1, units(0, [](size_t) { FAIL(); }));
+  auto ticket = scheduler.submit(std::move(query));
+  ticket.wait();
+  ASSERT_EQ(steps.size(), 60);
+  EXPECT_TRUE(std::is_sorted(steps.begin(), steps.end()));
+}
+
+TEST(WorkloadSchedulerTest, ShortQueryPassesLongQuery) {
+  Catalog db(testing::TempDir() + "no-such-directory");
+  WorkloadScheduler scheduler(db, options());
+  /// the long query has units left when the short one is admitted; its
+  /// units cost worker time, the fair share of the short query is larger
+  Gate gate;
+  auto longQuery = scheduler.submit({gate.units(
+      400, [](size_t) { std::this_thread::sleep_for(100us); })});
+  std::vector<Step> shortQuery;
+  for (int i = 0; i < 3; ++i)
+    shortQuery.push_back(units(4, [](size_t) {}));
+  auto ticket = scheduler.submit(std::move(shortQuery));
+  gate.open();
+  ticket.wait();
+  longQuery.wait();
+  /// the workers alternate between both queries instead of finishing the
+  /// long one first
+  EXPECT_LT(ticket.dispatches().second, longQuery.dispatches().second);
+  EXPECT_LT(longQuery.dispatches().first, ticket.dispatches().first);
+}
+
+TEST(WorkloadSchedulerTest, PriorityQueryRunsFirst) {
+  Catalog db(testing::TempDir() + "no-such-directory");
+  auto config = options();
+  config.policy = SchedulingPolicy::Priority;
+  WorkloadScheduler scheduler(db, config);
+  Gate gate;
+  auto low = scheduler.submit({gate.units(20)}, 0, 0);
+  auto high = scheduler.submit({units(20, [](size_t) {})}, 0, 1);
+  gate.open();
+  high.wait();
+  low.wait();
+  /// the low priority query only finishes the units in flight, the workers
+  /// take every unit of the high priority query before its next one
+  auto [first, last] = high.dispatches();
+  EXPECT_EQ(last - first + 1, 20);
+  EXPECT_LT(last, low.dispatches().second);
+}
+
+TEST(WorkloadSchedulerTest, AdmitsByEstimatedMemory) {
+  Catalog db(testing::TempDir() + "no-such-directory");
+  WorkloadScheduler scheduler(db, options(100));
+  Gate gate;
+  auto big = scheduler.submit({gate.units(200)}, 80);
+  std::atomic<bool> mediumRan = false, smallRan = false;
+  auto medium = scheduler.submit(
+      {units(1, [&](size_t) { mediumRan = true; })}, 50);
+  auto small = scheduler.submit(
+      {units(1, [&](size_t) { smallRan = true; })}, 10);
+  /// the small query fits next to the big one and passes the medium one
+  EXPECT_EQ(small.admission(), 2);
+  EXPECT_EQ(medium.admission(), 0);
+  EXPECT_EQ(scheduler.getReserved(), 90);
+  gate.open();
+  small.wait();
+  medium.wait();
+  big.wait();
+  EXPECT_TRUE(smallRan);
+  EXPECT_TRUE(mediumRan);
+  EXPECT_EQ(big.admission(), 1);
+  EXPECT_EQ(medium.admission(), 3);
+  EXPECT_EQ(scheduler.getReserved(), 0);
+}
+
+TEST(WorkloadSchedulerTest, LimitsBypassing) {
+  Catalog db(testing::TempDir() + "no-such-directory");
+  WorkloadScheduler scheduler(db, options(100, 1));
+  Gate gate;
+  auto big = scheduler.submit({gate.units(200)}, 80);
+  std::atomic<int> ran = 0;
+  auto medium = scheduler.submit({units(1, [&](size_t) { ++ran; })}, 50);
+  auto first = scheduler.submit({units(1, [&](size_t) { ++ran; })}, 10);
+  EXPECT_EQ(first.admission(), 2);
+  /// the medium query was passed once and blocks the queue
+  auto second = scheduler.submit({units(1, [&](size_t) { ++ran; })}, 10);
+  EXPECT_EQ(second.admission(), 0);
+  gate.open();
+  first.wait();
+  second.wait();
+  medium.wait();
+  EXPECT_EQ(ran.load(), 3);
+  EXPECT_EQ(medium.admission(), 3);
+  EXPECT_EQ(second.admission(), 4);
+}
+
+TEST(WorkloadSchedulerTest, RethrowsErrorsOfSteps) {
+  Catalog db(testing::TempDir() + "no-such-directory");
+  WorkloadScheduler scheduler(db, options());
+  std::atomic<bool> later = false;
+  auto ticket = scheduler.submit(
+      {units(10,
+             [](size_t unit) {
+               if (unit == 3)
+                 throw std::runtime_error("failed");
+             }),
+       units(1, [&](size_t) { later = true; })});
+  EXPECT_THROW(ticket.wait(), std::runtime_error);
+  EXPECT_FALSE(later);
+  /// the workers keep running other queries
+  auto next = scheduler.submit({units(2, [](size_t) {})});
+  next.wait();
+}
+
+TEST(CancellationTest, StopsAtDeadline) {
+  CancellationToken token;
+  EXPECT_FALSE(token.stopped());
+  token.setTimeout(1h);
+  EXPECT_FALSE(token.stopped());
+  token.setTimeout(0ns);
+  EXPECT_TRUE(token.stopped());
+  /// the first reason is kept
+  token.cancel();
+  EXPECT_EQ(token.getReason(), CancellationToken::Reason::Deadline);
+}
+
+TEST(WorkloadSchedulerTest, StopsCancelledQueryBetweenUnits) {
+  Catalog db(testing::TempDir() + "no-such-directory");
+  WorkloadScheduler scheduler(db, options());
+  CancellationToken token;
+  std::atomic<size_t> ran = 0;
+  std::atomic<bool> released = false, later = false;
+  auto ticket = scheduler.submit(
+      {units(1000,
+             [&](size_t) {
+               if (++ran == 10)
+                 token.cancel();
+             }),
+       units(1, [&](size_t) { later = true; })},
+      0, 0, &token, [&]() { released = true; });
+  EXPECT_FALSE(ticket.wait());
+  /// only the units in flight finish after the token stopped
+  EXPECT_LE(ran.load(), 10 + scheduler.getThreads());
+  EXPECT_FALSE(later);
+  EXPECT_TRUE(released);
+}
+
+TEST(WorkloadSchedulerTest, DropsQueriesPastTheirDeadline) {
+  Catalog db(testing::TempDir() + "no-such-directory");
+  WorkloadScheduler scheduler(db, options(100));
+  Gate gate;
+  auto big = scheduler.submit({gate.units(50)}, 80);
+  CancellationToken token;
+  token.setTimeout(5ms);
+  std::atomic<bool> ran = false;
+  /// waits for the big query and is dropped once admission is tried again
+  auto late = scheduler.submit({units(1, [&](size_t) { ran = true; })}, 50, 0,
+                               &token);
+  while (!token.stopped())
+    std::this_thread::yield();
+  gate.open();
+  EXPECT_FALSE(late.wait());
+  EXPECT_FALSE(ran);
+  EXPECT_EQ(late.runTime(), 0ns);
+  EXPECT_TRUE(big.wait());
+  /// a pending query is dropped as soon as it is cancelled
+  Gate second;
+  std::atomic<size_t> started = 0;
+  auto running = scheduler.submit(
+      {second.units(200, [&](size_t) { ++started; })}, 80);
+  auto pending = scheduler.submit({units(1, [](size_t) {})}, 50);
+  pending.cancel();
+  EXPECT_FALSE(pending.wait());
+  EXPECT_EQ(pending.admission(), 0);
+  /// only the units the workers hold finish
+  running.cancel();
+  second.open();
+  EXPECT_FALSE(running.wait());
+  EXPECT_LE(started.load(), scheduler.getThreads());
+}